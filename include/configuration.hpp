@@ -25,6 +25,7 @@
 #include <distance_t.hpp>
 
 #include <array>
+#include <cmath>
 #include <hardware_dof_conf.hpp>
 #include <string>
 #include <vector>
@@ -95,12 +96,24 @@ public:
     }
 };
 
+/**
+ * how the velocity at the junction of two segments is calculated
+ */
+enum cornering_model_e {
+    CORNERING_ANGLE,              // "angle" - the velocity is interpolated from the turn angle
+    CORNERING_JUNCTION_DEVIATION  // "junction_deviation" - the velocity comes from the centripetal acceleration on the arc that deviates at most junction_deviation_mm from the corner
+};
+
 class limits
 {
 public:
     distance_t max_accelerations_mm_s2;    ///<maximal acceleration on given axis (x, y, z, a) in mm/s2
     distance_t max_velocity_mm_s;          ///<maximal velocity on axis in mm/s
     distance_t max_no_accel_velocity_mm_s; ///<maximal velocity on axis in mm/s
+    distance_t max_jerk_mm_s3;             ///<maximal jerk on axis in mm/s3. 0 means that the acceleration can change instantly (trapezoidal profile)
+    cornering_model_e cornering_model;     ///<the method of calculation of the velocity on the turns
+    double junction_deviation_mm;          ///<maximal distance between the corner and the path that the machine follows (junction_deviation model only)
+    bool time_optimal_planning;            ///<plan the fastest velocity profile along the whole path with forward and backward passes instead of iterative feedrate reduction
 
     /**
     * calculates maximal linear acceleration with respect to the cureant direction and limits
@@ -114,6 +127,10 @@ public:
     * calculates maximal linear velocity that can be reached instantenousli with respect to the cureant direction and limits
      */
     virtual double proportional_max_no_accel_velocity_mm_s(const distance_t& norm_vect) const;
+    /**
+    * calculates maximal jerk with respect to the cureant direction and limits. 0 means no jerk limit
+     */
+    virtual double proportional_max_jerk_mm_s3(const distance_t& norm_vect) const;
 
     /**
     * constructs limits configuration element
@@ -121,13 +138,106 @@ public:
     limits(
         distance_t _max_accelerations_mm_s2,
         distance_t _max_velocity_mm_s,
-        distance_t _max_no_accel_velocity_mm_s) : max_accelerations_mm_s2(_max_accelerations_mm_s2),
+        distance_t _max_no_accel_velocity_mm_s,
+        distance_t _max_jerk_mm_s3 = {0,0,0,0}) : max_accelerations_mm_s2(_max_accelerations_mm_s2),
                                                                                  max_velocity_mm_s(_max_velocity_mm_s),
-                                                                                 max_no_accel_velocity_mm_s(_max_no_accel_velocity_mm_s) {}
+                                                                                 max_no_accel_velocity_mm_s(_max_no_accel_velocity_mm_s),
+                                                                                 max_jerk_mm_s3(_max_jerk_mm_s3),
+                                                                                 cornering_model(CORNERING_ANGLE),
+                                                                                 junction_deviation_mm(0.01),
+                                                                                 time_optimal_planning(false) {}
     limits() {
         max_accelerations_mm_s2 = {0,0,0};
         max_velocity_mm_s = {0,0,0};
         max_no_accel_velocity_mm_s = {0,0,0};
+        max_jerk_mm_s3 = {0,0,0,0};
+        cornering_model = CORNERING_ANGLE;
+        junction_deviation_mm = 0.01;
+        time_optimal_planning = false;
+    }
+};
+
+/**
+ * limits prepared for the motion planner. It gives the same values as limits::proportional_*
+ * but the evaluation is inline, without virtual calls. The direction does not have to be
+ * normalized - the result is the average of axis limits weighted by the absolute value of
+ * the direction components, so it depends only on the direction. For zero vector the result is nan.
+ */
+class proportional_limits
+{
+public:
+    struct values_t {
+        double max_accelerations_mm_s2;
+        double max_velocity_mm_s;
+        double max_no_accel_velocity_mm_s;
+        double max_jerk_mm_s3;
+    };
+
+    proportional_limits(const limits& limits_)
+    {
+        for (std::size_t i = 0; i < _acc.size(); i++) {
+            _acc[i] = limits_.max_accelerations_mm_s2[i];
+            _v[i] = limits_.max_velocity_mm_s[i];
+            _v0[i] = limits_.max_no_accel_velocity_mm_s[i];
+            _j[i] = limits_.max_jerk_mm_s3[i];
+        }
+    }
+
+    inline double max_accelerations_mm_s2(const distance_t& direction) const { return weighted(_acc, direction); }
+    inline double max_velocity_mm_s(const distance_t& direction) const { return weighted(_v, direction); }
+    inline double max_no_accel_velocity_mm_s(const distance_t& direction) const { return weighted(_v0, direction); }
+    inline double max_jerk_mm_s3(const distance_t& direction) const { return weighted(_j, direction); }
+
+    /**
+     * all three limits in one pass
+     */
+    inline values_t all(const distance_t& direction) const
+    {
+        double a = 0, v = 0, v0 = 0, j = 0, w = 0;
+        for (std::size_t i = 0; i < _acc.size(); i++) {
+            double d = std::abs(direction[i]);
+            a += _acc[i] * d;
+            v += _v[i] * d;
+            v0 += _v0[i] * d;
+            j += _j[i] * d;
+            w += d;
+        }
+        if (w == 0) return {0, 0, 0, 0};
+        return {a / w, v / w, v0 / w, j / w};
+    }
+
+    /**
+     * batch form - calculates limits for every direction from the table
+     */
+    void all(const distance_t* directions_, std::size_t n_, values_t* result_) const
+    {
+        for (std::size_t i = 0; i < n_; i++)
+            result_[i] = all(directions_[i]);
+    }
+
+    std::vector<values_t> all(const std::vector<distance_t>& directions_) const
+    {
+        std::vector<values_t> ret(directions_.size());
+        all(directions_.data(), directions_.size(), ret.data());
+        return ret;
+    }
+
+private:
+    std::array<double, 4> _acc;
+    std::array<double, 4> _v;
+    std::array<double, 4> _v0;
+    std::array<double, 4> _j;
+
+    static inline double weighted(const std::array<double, 4>& l, const distance_t& direction)
+    {
+        double s = 0, w = 0;
+        for (std::size_t i = 0; i < l.size(); i++) {
+            double d = std::abs(direction[i]);
+            s += l[i] * d;
+            w += d;
+        }
+        if (w == 0) return 0;
+        return s / w;
     }
 };
 
@@ -162,10 +272,24 @@ public:
 };
 
 
+/**
+ * possible buttons drivers
+ */
+enum low_buttons_e {
+    BUTTONS_POLLING,    // "polling" - the raspberry_pi_3 reads the inputs periodically
+    BUTTONS_GPIO_EVENTS // "gpio_events" - edge events from the GPIO character device
+};
+
 enum steps_generator_e {
 PROGRAM_TO_STEPS,// "program_to_steps"
 BEZIER_SPLINE,// "bezier_spline"
-LINEAR_INTERPOLATION// "linear_interpolation"
+LINEAR_INTERPOLATION,// "linear_interpolation"
+VARIABLE_INTERVAL// "variable_interval" - every step has its own time, see multistep_command::delay_ns
+};
+
+enum path_simplifier_e {
+    DOUGLAS_PEUCKER,   // "douglas_peucker"
+    VISVALINGAM_WHYATT // "visvalingam_whyatt" - O(n log n), removes the points with the smallest area first
 };
 
 /**
@@ -183,8 +307,17 @@ public:
     steps_generator_e steps_generator; // selected steps generator - the method that transforms path to steps
     bool simulate_execution;      // should I use simulator by default
     bool sequential_gcode_execution;      ///< gcode execution should follow: generate_steps->execute_steps->generate_steps->execute_steps...
-    double douglas_peucker_marigin;
+    double douglas_peucker_marigin;       ///< the maximal distance between the original and the simplified path
+    path_simplifier_e path_simplifier;    ///< the algorithm that removes the redundant points of the path
+    bool cross_group_blending;            ///< plan junction velocities across consecutive G0 and G1 parts, so the machine does not stop between them
+    bool reorder_travel_moves;            ///< reorder the cut sequences to shorten the G0 travel between them (see gcd/reorder_travel_moves.hpp)
+    int planning_threads;                 ///< number of threads that plan the parts of the program, 0 means the number of the hardware threads
     low_timers_e lowleveltimer;
+    low_buttons_e buttons_driver;         ///< how the buttons and endstops are read
+    int button_debounce_us;               ///< the time when the button ignores edges after the accepted one (gpio_events only)
+    std::string telemetry_shm;            ///< name of POSIX shared memory object for telemetry (see doc/TELEMETRY.md). Empty means disabled
+    int telemetry_interval_us;            ///< minimal time between telemetry updates
+    double feed_override_rate;            ///< maximal change of the feed override per second of execution, 0.5 means 50% per second
 
     std::vector<spindle_pwm> spindles;
     std::vector<button> buttons;
@@ -0,0 +1,99 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __CONVERTERS_GCD_PROGRAM_TO_PNG_HPP___
+#define __CONVERTERS_GCD_PROGRAM_TO_PNG_HPP___
+
+#include <gcd/gcode_interpreter.hpp>
+#include <hardware/motor_layout.hpp>
+#include <hardware/stepping_commands.hpp>
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace raspigcd {
+namespace converters {
+
+/**
+ * @brief one straight piece of the toolpath prepared for drawing
+ */
+struct preview_segment_t {
+    distance_t a;  ///< start position in milimeters
+    distance_t b;  ///< end position in milimeters
+    double power;  ///< spindle (laser) power during the move, 0 to 1
+    bool travel;   ///< G0 or move with the laser off
+};
+
+struct preview_options_t {
+    int width = 1024;                          ///< maximal width of the picture in pixels
+    int height = 1024;                         ///< maximal height of the picture in pixels
+    int threads = 0;                           ///< number of rasterizer threads, 0 means hardware concurrency
+    double resolution_mm = 0.05;               ///< steps stream is merged into segments of at least this length
+    std::array<unsigned char, 3> background = {255, 255, 255};
+    std::array<unsigned char, 3> travel = {160, 200, 255};
+    std::array<unsigned char, 3> work = {0, 0, 0}; ///< color of the moves with full power
+};
+
+/**
+ * @brief RGBA picture, rows from top to bottom
+ */
+struct preview_image_t {
+    int width;
+    int height;
+    double pixels_per_mm;
+    std::vector<unsigned char> rgba;
+};
+
+/**
+ * @brief converts the program into segments. G0 is travel, other moves are work.
+ * Arcs (G2, G3) are drawn as short lines. The power is taken from M3 (on) and M5 (off).
+ */
+std::vector<preview_segment_t> program_to_preview_segments(const gcd::partitioned_program_t& program_,
+    const gcd::block_t& initial_state_ = {{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}});
+
+/**
+ * @brief converts the steps stream into segments. The power comes from the
+ * synchronized spindle flag (flags.bits.g). Moves with the spindle off are travel.
+ * If the stream does not contain any spindle flags, every move is drawn as work.
+ */
+std::vector<preview_segment_t> steps_to_preview_segments(const hardware::multistep_commands_t& commands_,
+    hardware::motor_layout& motor_layout_,
+    const steps_t& start_steps_ = {0, 0, 0, 0},
+    const preview_options_t& options_ = {});
+
+/**
+ * @brief draws the top view (X, Y) of the segments. The picture is fitted to the
+ * width and height from options keeping the proportions. The picture is divided
+ * into horizontal bands that are rasterized in parallel. Work moves are drawn over
+ * travel moves, darker for higher power.
+ */
+preview_image_t render_preview(const std::vector<preview_segment_t>& segments_, const preview_options_t& options_ = {});
+
+/**
+ * @brief saves the picture as PNG. Throws std::runtime_error on failure.
+ */
+void save_preview_png(const preview_image_t& image_, const std::string& filename_);
+
+} // namespace converters
+} // namespace raspigcd
+
+#endif
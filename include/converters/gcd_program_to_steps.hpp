@@ -50,6 +50,13 @@ using program_to_steps_f_t = std::function<hardware::multistep_commands_t (
 
 program_to_steps_f_t program_to_steps_factory( const configuration::steps_generator_e f_name );
 
+/**
+ * @brief returns the steps generator selected in the configuration. If the configuration sets
+ * max_jerk_mm_s3, then the program_to_steps generator uses jerk limited (S-curve) velocity changes.
+ * The spline and interpolation generators follow their own velocity profiles.
+ */
+program_to_steps_f_t program_to_steps_factory( const configuration::global& cfg_ );
+
 
 } // namespace converters
 } // namespace raspigcd
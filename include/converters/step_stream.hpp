@@ -0,0 +1,170 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __RASPIGCD_CONVERTERS_STEP_STREAM_HPP__
+#define __RASPIGCD_CONVERTERS_STEP_STREAM_HPP__
+
+#include <configuration.hpp>
+#include <gcd/gcode_interpreter.hpp>
+#include <hardware/stepping_commands.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace raspigcd {
+namespace converters {
+
+/**
+ * The step stream is the binary file with the steps that were calculated ahead of the
+ * execution (see raspigcd --compile). It starts with step_stream_header_t, then there are
+ * records (step_stream_record_t). The STEPS record is followed by its multistep commands.
+ * The last record is STEP_STREAM_END. Numbers are stored in the byte order of the
+ * machine that created the file.
+ */
+
+static const char STEP_STREAM_MAGIC[8] = {'R', 'G', 'C', 'D', 'S', 'T', 'E', 'P'};
+static const std::uint32_t STEP_STREAM_VERSION = 1;
+static const std::uint32_t STEP_STREAM_BYTE_ORDER = 0x01020304;
+
+enum step_stream_record_e : std::uint32_t {
+    STEP_STREAM_END = 0,   ///< the end of the stream
+    STEP_STREAM_STEPS = 1, ///< count multistep commands, code is 1 if the next record continues the motion
+    STEP_STREAM_M = 2,     ///< M code (M3, M5, M17, M18), values[0] is P (wait in milliseconds) or -1 for the default
+    STEP_STREAM_G92 = 3    ///< set the position, code is the mask of axes (1 - X, 2 - Y, 4 - Z), values are X, Y, Z
+};
+
+/**
+ * @brief the header of the stream. It describes the machine the steps were calculated for.
+ */
+struct step_stream_header_t {
+    char magic[8];              ///< STEP_STREAM_MAGIC
+    std::uint32_t version;      ///< STEP_STREAM_VERSION
+    std::uint32_t byte_order;   ///< STEP_STREAM_BYTE_ORDER
+    std::uint32_t command_size; ///< sizeof(hardware::multistep_command)
+    std::int32_t tick_duration_us;
+    std::int32_t motion_layout;
+    std::int32_t laser;         ///< 1 if the spindle 0 is the laser, so the stream carries the laser state
+    std::int32_t steppers;      ///< number of steppers
+    std::int32_t reserved;
+    double steps_per_mm[4];
+    double scale[4];
+};
+
+struct step_stream_record_t {
+    std::uint32_t type; ///< step_stream_record_e
+    std::int32_t code;  ///< meaning depends on the type
+    std::int64_t count; ///< number of multistep commands that follow the record
+    double values[3];   ///< meaning depends on the type
+};
+
+/**
+ * @brief the header that describes the given configuration
+ */
+step_stream_header_t step_stream_header(const configuration::global& cfg_);
+
+/**
+ * @brief throws std::invalid_argument when the stream was calculated for different
+ * machine than described by the configuration. The message lists differences.
+ */
+void step_stream_validate(const step_stream_header_t& header_, const configuration::global& cfg_);
+
+/**
+ * @brief writes the step stream file. The stream is complete after finish().
+ * Throws std::runtime_error when the file cannot be written.
+ */
+class step_stream_writer
+{
+    std::ofstream _out;
+    std::string _filename;
+
+    void write_record(const step_stream_record_t& record_);
+
+public:
+    step_stream_writer(const std::string& filename_, const configuration::global& cfg_);
+
+    /**
+     * @brief appends the multistep commands that are executed at once
+     *
+     * @param continues_motion the next record continues the motion, so the laser is not switched off
+     */
+    void steps(const hardware::multistep_commands_t& commands_, const bool continues_motion_);
+    /**
+     * @brief appends M3, M5, M17 or M18 block. Other M codes are skipped.
+     */
+    void m_code(const gcd::block_t& m_);
+    /**
+     * @brief appends one block of G92
+     */
+    void set_position(const gcd::block_t& g92_);
+    /**
+     * @brief writes the end of the stream and closes the file
+     */
+    void finish();
+};
+
+/**
+ * @brief one record of the memory mapped stream
+ */
+struct step_stream_event_t {
+    const step_stream_record_t* record;
+    const hardware::multistep_command* commands; ///< commands of the STEPS record, or nullptr
+};
+
+/**
+ * @brief memory maps the step stream file and checks its structure. Throws
+ * std::invalid_argument if it is not the complete step stream of this version.
+ * The events point to the mapped memory, so they are valid as long as the reader.
+ */
+class step_stream_reader
+{
+    int _fd;
+    void* _data;
+    std::size_t _size;
+    std::vector<step_stream_event_t> _events;
+
+public:
+    const step_stream_header_t& header() const { return *(const step_stream_header_t*)_data; }
+    const std::vector<step_stream_event_t>& events() const { return _events; }
+
+    step_stream_reader(const std::string& filename_);
+    virtual ~step_stream_reader();
+
+    step_stream_reader(step_stream_reader const&) = delete;
+    void operator=(step_stream_reader const& x) = delete;
+};
+
+/**
+ * @brief converts the M record back to the block
+ */
+gcd::block_t step_stream_record_to_m_block(const step_stream_record_t& record_);
+
+/**
+ * @brief converts the G92 record back to the block
+ */
+gcd::block_t step_stream_record_to_g92_block(const step_stream_record_t& record_);
+
+} // namespace converters
+} // namespace raspigcd
+
+#endif
@@ -11,6 +11,7 @@
 #include <hardware/driver/raspberry_pi.hpp>
 #include <hardware/motor_layout.hpp>
 #include <hardware/stepping.hpp>
+#include <metrics.hpp>
 
 
 #include <map>
@@ -28,6 +29,7 @@ struct execution_objects_t {
     std::shared_ptr<raspigcd::hardware::low_buttons> buttons_drv;
     std::shared_ptr<raspigcd::hardware::motor_layout> motor_layout_;
     std::shared_ptr<raspigcd::hardware::stepping_simple_timer> stepping;
+    std::shared_ptr<raspigcd::metrics_registry> metrics; ///< performance signals of the pipeline, can be empty
 };
 
 // std::tuple<
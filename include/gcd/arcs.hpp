@@ -0,0 +1,115 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_GCD_ARCS_HPP__
+#define __RASPIGCD_GCD_ARCS_HPP__
+
+#include <configuration.hpp>
+#include <gcd/gcode_interpreter.hpp>
+
+#include <vector>
+
+namespace raspigcd {
+namespace gcd {
+
+/**
+ * @brief circular arc in the XY plane described by G2 or G3 block. The Z coordinate
+ * changes linearly with the angle (helix).
+ */
+struct arc_t {
+    distance_t start;
+    distance_t end;
+    distance_t center;   ///< center of the arc, X and Y only
+    double start_radius; ///< distance from the center to the start point
+    double end_radius;   ///< distance from the center to the end point, almost the same as start_radius
+    double start_angle;  ///< angle of the start point in radians
+    double sweep;        ///< angular travel in radians. Positive for G3 (counterclockwise), negative for G2
+
+    /**
+     * @brief length of the path along the arc in milimeters
+     */
+    double length() const;
+    /**
+     * @brief position after traveling s milimeters along the arc. The result for s >= length() is exactly end
+     */
+    distance_t point_at(double s) const;
+    /**
+     * @brief direction of the movement after traveling s milimeters along the arc (unit vector)
+     */
+    distance_t tangent_at(double s) const;
+};
+
+/**
+ * @brief true if the block is G2 or G3
+ */
+inline bool is_arc_block(const block_t& block)
+{
+    return block.count('G') && (((int)block.at('G') == 2) || ((int)block.at('G') == 3));
+}
+
+/**
+ * @brief calculates the arc geometry. The state is the machine state before the
+ * block. The block must be G2 or G3 (or the state must be) and it must contain
+ * I and J (center relative to the start point) or R (radius, negative for the
+ * arc longer than half of the circle). Throws std::invalid_argument if the arc
+ * cannot be constructed.
+ */
+arc_t block_to_arc(const block_t& state, const block_t& block);
+
+/**
+ * @brief splits the arc into points, so the distance between the line segments and
+ * the arc is at most max_error_mm. The start point is not included, the last
+ * point is the end of the arc.
+ */
+std::vector<distance_t> arc_to_points(const arc_t& arc, double max_error_mm);
+
+/**
+ * @brief maximal feedrate on the arc. It is limited by the centripetal acceleration
+ * (v^2/r must not exceed proportional_max_accelerations_mm_s2 along the arc) and by
+ * proportional_max_velocity_mm_s along the arc.
+ */
+double arc_max_velocity(const arc_t& arc, const configuration::limits& machine_limits);
+
+/**
+ * @brief maximal tangential acceleration on the arc - the minimum of proportional_max_accelerations_mm_s2 along the arc
+ */
+double arc_max_acceleration(const arc_t& arc, const configuration::limits& machine_limits);
+
+/**
+ * @brief maximal jerk on the arc - the minimum of proportional_max_jerk_mm_s3 along the arc. 0 means no jerk limit
+ */
+double arc_max_jerk(const arc_t& arc, const configuration::limits& machine_limits);
+
+/**
+ * @brief splits the arc block into two arc blocks. The first ends after s milimeters along the arc.
+ * Both blocks use I and J form.
+ */
+std::pair<block_t, block_t> split_arc_block(const block_t& state, const block_t& block, double s);
+
+/**
+ * @brief replaces G2 and G3 moves with G1 segments that are at most max_error_mm from the arc
+ */
+program_t linearize_arcs(const program_t& program_, double max_error_mm, const block_t& initial_state = {});
+
+} // namespace gcd
+} // namespace raspigcd
+
+#endif
@@ -34,6 +34,7 @@
 #include <list>
 #include <map>
 #include <string>
+#include <vector>
 
 
 namespace raspigcd {
@@ -48,18 +49,32 @@ using partitioned_program_t = std::vector<program_t>; // represents program part
  * @brief Adds F to every element in program. This allows for easier interpretation of path
  */
 program_t enrich_gcode_with_feedrate_commands(const program_t& program_, const configuration::global& cfg);
+/**
+ * @brief Adds F to every element in program. The blocks are changed in place
+ */
+program_t enrich_gcode_with_feedrate_commands(program_t&& program_, const configuration::global& cfg);
 
 /**
  * @brief Add nodes that will allow for acceleration and break control before and after turns
  * 
  * The function gets every path segment and checks if it can add another nodes in the segment so the path would be executed like: start-accelerate-constantspeed-break-end
+ * The parts are processed on separate threads, the state before every part is found first. The threads count 0 means
+ * the number of the hardware threads.
+ */
+partitioned_program_t insert_additional_nodes_inbetween(partitioned_program_t &partitioned_program_, const block_t &initial_state, const configuration::limits &machine_limits, const int threads = 0);
+/**
+ * @brief the same as insert_additional_nodes_inbetween, but every part of the source is moved or released as soon as it is processed
  */
-partitioned_program_t insert_additional_nodes_inbetween(partitioned_program_t &partitioned_program_, const block_t &initial_state, const configuration::limits &machine_limits);
+partitioned_program_t insert_additional_nodes_inbetween_consume(partitioned_program_t &&partitioned_program_, const block_t &initial_state, const configuration::limits &machine_limits, const int threads = 0);
 
 /**
  * @brief removed duplicate blocks. If the feedrate is different, then it interprets it as rapid velocity shift and does not remove
  */
 program_t remove_duplicate_blocks(const program_t& program_states, const block_t &initial_state);
+/**
+ * @brief removed duplicate blocks. The program is compacted in place
+ */
+program_t remove_duplicate_blocks(program_t&& program_states, const block_t &initial_state);
 
 /**
  * @brief calculates last state after execution of the program.
@@ -119,16 +134,65 @@ std::string back_to_gcode(const partitioned_program_t &btg);
  * maximal feedrate based on turn angle and limits.
  * 
  * The first and last G1 command is interpreted that it is on the 90deg turn.
+ * 
+ * The velocity on the turn is calculated according to machine_limits.cornering_model.
  */
 program_t apply_limits_for_turns (const program_t& program_states,
                 const configuration::limits &machine_limits);
 
+/**
+ * @brief maximal velocity in the point B on the path A -> B -> C for the junction deviation model.
+ *
+ * The turn is treated as the arc that is tangent to both segments and that is not further than
+ * junction_deviation_mm from the corner. The velocity is sqrt(a*r), where a is the acceleration limit
+ * in the direction of the change of velocity. The result is not lower than the half of no accel velocity
+ * and not higher than the maximal velocity of both segments.
+ */
+double junction_deviation_velocity(const distance_t& A, const distance_t& B, const distance_t& C,
+    const configuration::proportional_limits& plimits, const double junction_deviation_mm);
 
 
+
+/**
+ * @brief the fastest velocity profile along the path (the phase plane method for the path made of lines).
+ *
+ * The F in every block is the maximal velocity in this node, for example from apply_limits_for_turns.
+ * segment_feedrates[i] is the maximal velocity on the segment that ends in the block i, it can be empty,
+ * then only the machine limits are used. The backward pass lowers the velocities so the machine can always brake
+ * before the next node, the forward pass lowers them so they can be reached from the previous node. Then
+ * every segment gets the nodes where the acceleration ends and the braking starts, so the velocity
+ * between nodes changes with the maximal allowed acceleration (or the jerk limited acceleration).
+ * The time and memory are linear with the program size.
+ */
+program_t time_optimal_feedrates(const program_t& program_states,
+    const configuration::limits& machine_limits,
+    const std::vector<double>& segment_feedrates = {});
+
+/**
+ * @brief Limits the feedrates of G0 or G1 moves so the turns and accelerations are within machine limits.
+ *
+ * The entry_from is the state the machine arrives from to the current_state, and exit_to is the
+ * state the machine goes to after the program. These are used only to calculate the velocity on the
+ * first and the last junction. If empty, the machine is assumed to stop there (90deg turn).
+ */
 program_t g1_move_to_g1_with_machine_limits(const program_t& program_states,
     const configuration::limits& machine_limits,
     block_t current_state = {{'X',0},{'Y',0},{'Z',0},{'A',0}},
-    bool do_the_accel_limit = true);
+    bool do_the_accel_limit = true,
+    const block_t& entry_from = {},
+    const block_t& exit_to = {});
+
+/**
+ * @brief Plans junction velocities across the boundaries of G0 and G1 parts.
+ * 
+ * G0 parts are limited by g1_move_to_g1_with_machine_limits, but when the neighbour part is
+ * a G0 or G1 part (no M code, G4, G28 or G92 between), the velocity on the boundary is
+ * calculated from the real turn angle instead of the 90deg turn, so the machine does not
+ * stop between the travel and the cut. G1 parts and other parts are copied unchanged.
+ */
+partitioned_program_t blend_motion_parts(const partitioned_program_t& program_parts,
+    const configuration::limits& machine_limits,
+    block_t current_state = {{'X',0},{'Y',0},{'Z',0},{'A',0}});
 
 /**
  * @brief converts G0 into sequences of G1 moves that accelerates to maximal
@@ -147,6 +211,10 @@ program_t g0_move_to_g1_sequence (const program_t& program_states,
  * 
  */
 partitioned_program_t group_gcode_commands(const program_t& program_states, const block_t & initial_state = {{'F',1}} );
+/**
+ * @brief Gropus gcode commands. The blocks are moved to the groups and the source program is cleared
+ */
+partitioned_program_t group_gcode_commands(program_t&& program_states, const block_t & initial_state = {{'F',1}} );
 
 /**
  * @brief updates values in destination block from source block.
@@ -181,15 +249,75 @@ block_t command_to_map_of_arguments(const std::string& command_);
 
 /**
  * @brief UNTESTED: optimizes program using douglas + puecker algorithm
- * 
+ *
+ * Independent G0 and G1 groups are simplified on separate threads. The threads count 0 means
+ * the number of the hardware threads.
  */
 program_t optimize_path_douglas_peucker(const program_t &program_, 
     const double epsilon = 0.0125, 
-    const block_t &initial_state = {{'X',0},{'Y',0},{'Z', 0},{'F',0.1}});
+    const block_t &initial_state = {{'X',0},{'Y',0},{'Z', 0},{'F',0.1}},
+    const int threads = 0);
+/**
+ * @brief optimizes program using douglas + puecker algorithm. The removed blocks are compacted in place
+ */
+program_t optimize_path_douglas_peucker(program_t &&program_,
+    const double epsilon = 0.0125,
+    const block_t &initial_state = {{'X',0},{'Y',0},{'Z', 0},{'F',0.1}},
+    const int threads = 0);
+
+/**
+ * @brief the path stored as separate arrays of coordinates
+ */
+struct path_coordinates_t {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+    std::size_t size() const { return x.size(); }
+};
+
+/**
+ * @brief Douglas-Peucker simplification without recursion. It uses the explicit stack of
+ * ranges, and the long ranges are searched and simplified on many threads.
+ *
+ * @param path the points of the path
+ * @param epsilon the maximal distance of the removed point from the simplified path
+ * @param threads number of threads, 0 means the number of the hardware threads
+ * @return the mask with 1 for every point that can be removed. It is the same as the one from optimize_generic_path_dp
+ */
+std::vector<char> douglas_peucker_mask(const path_coordinates_t& path, const double epsilon, const int threads = 1);
+
+/**
+ * @brief optimizes program using Visvalingam-Whyatt algorithm. The points with the smallest
+ * effective area are removed first, and no point of the original path is further than epsilon
+ * from the result. The same points as in optimize_path_douglas_peucker are kept.
+ */
+program_t optimize_path_visvalingam_whyatt(const program_t &program_,
+    const double epsilon = 0.0125,
+    const block_t &initial_state = {{'X',0},{'Y',0},{'Z', 0},{'F',0.1}},
+    const int threads = 0);
+/**
+ * @brief optimizes program using Visvalingam-Whyatt algorithm. The removed blocks are compacted in place
+ */
+program_t optimize_path_visvalingam_whyatt(program_t &&program_,
+    const double epsilon = 0.0125,
+    const block_t &initial_state = {{'X',0},{'Y',0},{'Z', 0},{'F',0.1}},
+    const int threads = 0);
+
+/**
+ * @brief Visvalingam-Whyatt simplification with the indexed min-heap, O(n log n). The point
+ * is removed only if the upper bound of the distance between the removed points and the
+ * simplified path stays below epsilon.
+ *
+ * @param path the points of the path
+ * @param epsilon the maximal distance of the removed point from the simplified path
+ * @param fixed the points marked with 1 are never removed
+ * @return the mask with 1 for every point that can be removed
+ */
+std::vector<char> visvalingam_whyatt_mask(const path_coordinates_t& path, const double epsilon, const std::vector<char>& fixed = {});
 
 
 
-auto linear_interpolation = [](auto x, auto x0, auto y0, auto x1, auto y1) {
+inline auto linear_interpolation = [](auto x, auto x0, auto y0, auto x1, auto y1) {
     return y0 * (1 - (x - x0) / (x1 - x0)) + y1 * ((x - x0) / (x1 - x0)); // percentage of the max_no_accel_speed
 };
 
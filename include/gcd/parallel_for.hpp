@@ -0,0 +1,53 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_GCD_PARALLEL_FOR_HPP__
+#define __RASPIGCD_GCD_PARALLEL_FOR_HPP__
+
+#include <cstddef>
+#include <functional>
+
+namespace raspigcd {
+namespace gcd {
+
+/**
+ * @brief the number of threads that should be used
+ *
+ * @param threads requested number of threads, 0 or less means the number of the hardware threads
+ */
+int threads_to_use(const int threads);
+
+/**
+ * @brief calls f(i) for every i from 0 to n-1. The indexes are taken one by one by the threads,
+ * so f must be safe to call concurrently for different indexes. With one thread, f is called in
+ * order on the calling thread. If f throws, the threads stop taking new indexes and the first
+ * exception is rethrown on the calling thread after all threads finish.
+ *
+ * @param n the number of indexes
+ * @param threads the number of threads, 0 means the number of the hardware threads
+ * @param f the function to call
+ */
+void parallel_for(const std::size_t n, const int threads, const std::function<void(std::size_t)>& f);
+
+} // namespace gcd
+} // namespace raspigcd
+
+#endif
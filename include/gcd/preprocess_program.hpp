@@ -0,0 +1,70 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __RASPIGCD_GCD_PREPROCESS_PROGRAM_HPP__
+#define __RASPIGCD_GCD_PREPROCESS_PROGRAM_HPP__
+
+#include <configuration.hpp>
+#include <gcd/gcode_interpreter.hpp>
+#include <metrics.hpp>
+
+#include <memory>
+
+namespace raspigcd {
+namespace gcd {
+
+/**
+ * @brief prepares the parsed program for the steps generator.
+ *
+ * The passes are: enrich_gcode_with_feedrate_commands, reorder_travel_moves (if enabled),
+ * path simplification, group_gcode_commands, insert_additional_nodes_inbetween and
+ * preprocess_program_parts. The program is moved from one pass to the next and the passes
+ * work in place where it is possible, so there is about one copy of the program in memory.
+ * The result is the same as the result of the separate passes.
+ *
+ * @param program_ the parsed program
+ * @param cfg the configuration of the machine
+ * @param initial_state the state of the machine before the program
+ * @param raw_gcode if true, then only the feedrate is added and the program is grouped
+ * @param metrics the durations of passes are stored here as stages, can be empty
+ */
+partitioned_program_t preprocess_program(program_t program_,
+    const configuration::global& cfg,
+    const block_t& initial_state = {{'F', 0.5}},
+    const bool raw_gcode = false,
+    const std::shared_ptr<metrics_registry>& metrics = nullptr);
+
+/**
+ * @brief applies the machine limits to the grouped program - G0 moves are planned, the feedrate
+ * on arcs is limited and only the M codes that the machine knows are left. Then the program is
+ * simplified and grouped again.
+ *
+ * @param program_parts the grouped program with the additional nodes
+ * @param cfg the configuration of the machine
+ * @param machine_state the state of the machine before the program
+ */
+partitioned_program_t preprocess_program_parts(partitioned_program_t program_parts, const configuration::global& cfg, block_t machine_state);
+
+} // namespace gcd
+} // namespace raspigcd
+
+#endif
@@ -0,0 +1,64 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#ifndef __RASPIGCD_GCD_REORDER_TRAVEL_MOVES_HPP__
+#define __RASPIGCD_GCD_REORDER_TRAVEL_MOVES_HPP__
+
+#include <gcd/gcode_interpreter.hpp>
+
+namespace raspigcd {
+namespace gcd {
+
+/**
+ * @brief the summary of the travel optimization
+ */
+struct travel_statistics_t {
+    double travel_before_mm; ///< length of G0 moves in the reordered fragments before the optimization
+    double travel_after_mm;  ///< length of G0 moves in the reordered fragments after the optimization
+    int cuts;                ///< number of cut sequences that could be moved
+};
+
+/**
+ * @brief reorders the cut sequences so the G0 travel between them is as short as possible.
+ *
+ * The cut sequence is the run of G1, G2, G3, G4, M3 and M5 blocks between G0 moves. Other
+ * blocks (G92, M17, M18, and so on) are barriers - the sequences are reordered only between
+ * them. A sequence can be moved only if the spindle is in the same state at its start and at
+ * its end, so the M codes keep their meaning. It can be executed backwards only if it contains
+ * G1 moves on one height (M3 and M5 can be at the beginning and the end).
+ *
+ * The order is found by the nearest neighbour search (on the grid of the cut ends) and then
+ * improved by 2-opt. The travel moves are generated again - the machine goes up to the
+ * highest Z of the original travel moves, moves over the next cut and goes down. The fragment
+ * is changed only if the travel gets shorter. The moves in reordered fragments have all the coordinates.
+ */
+program_t reorder_travel_moves(const program_t& program_, const block_t& initial_state, travel_statistics_t& statistics);
+
+/**
+ * @brief reorders the cut sequences, see reorder_travel_moves
+ */
+program_t reorder_travel_moves(const program_t& program_, const block_t& initial_state = {});
+
+} // namespace gcd
+} // namespace raspigcd
+
+#endif
@@ -0,0 +1,84 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_HARDWARE_BUTTON_EVENTS_FAKE_T_HPP__
+#define __RASPIGCD_HARDWARE_BUTTON_EVENTS_FAKE_T_HPP__
+
+#include <hardware/driver/low_buttons_gpio_events.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace raspigcd {
+namespace hardware {
+namespace driver {
+
+/**
+ * @brief button events source that allows for triggering edges from the code. Useful for tests
+ */
+class button_events_fake : public button_events_source
+{
+private:
+    std::mutex _m;
+    std::condition_variable _cv;
+    std::deque<button_event_t> _events;
+    std::vector<int> _values;
+
+public:
+    int buttons_count() const { return _values.size(); }
+
+    bool wait_for_event(button_event_t& event, const std::chrono::microseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(_m);
+        if (!_cv.wait_for(lock, timeout, [this]() { return _events.size() > 0; })) return false;
+        event = _events.front();
+        _events.pop_front();
+        return true;
+    }
+
+    int read_value(const int btn)
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        return _values.at(btn);
+    }
+
+    /**
+     * @brief simulates the edge on the button input
+     */
+    void push_event(int btn, int value, std::chrono::steady_clock::time_point timestamp = std::chrono::steady_clock::now())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_m);
+            _values.at(btn) = value;
+            _events.push_back({btn, value, timestamp});
+        }
+        _cv.notify_all();
+    }
+
+    button_events_fake(int max_supported_keys) : _values(max_supported_keys, 0) {}
+};
+
+} // namespace driver
+} // namespace hardware
+} // namespace raspigcd
+
+#endif
@@ -0,0 +1,69 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_HARDWARE_BUTTON_EVENTS_GPIO_CHARDEV_T_HPP__
+#define __RASPIGCD_HARDWARE_BUTTON_EVENTS_GPIO_CHARDEV_T_HPP__
+
+#include <configuration.hpp>
+#include <hardware/driver/low_buttons_gpio_events.hpp>
+
+#include <string>
+#include <vector>
+
+namespace raspigcd {
+namespace hardware {
+namespace driver {
+
+/**
+ * @brief button edges from the Linux GPIO character device (/dev/gpiochipN).
+ *        The kernel timestamps the edges, so the latency of the handler can be measured
+ */
+class button_events_gpio_chardev : public button_events_source
+{
+private:
+    std::vector<configuration::button> _buttons;
+    std::vector<int> _fds;
+
+    int to_button_value(const int btn, const int level) const;
+
+public:
+    int buttons_count() const;
+    bool wait_for_event(button_event_t& event, const std::chrono::microseconds timeout);
+    int read_value(const int btn);
+
+    /**
+     * @brief requests edge events for every button. Throws std::runtime_error if the device is not available
+     *
+     * @param buttons the buttons configuration
+     * @param chip_name the GPIO character device
+     */
+    button_events_gpio_chardev(const std::vector<configuration::button>& buttons, const std::string& chip_name = "/dev/gpiochip0");
+    virtual ~button_events_gpio_chardev();
+
+    button_events_gpio_chardev(button_events_gpio_chardev const&) = delete;
+    void operator=(button_events_gpio_chardev const& x) = delete;
+};
+
+} // namespace driver
+} // namespace hardware
+} // namespace raspigcd
+
+#endif
@@ -0,0 +1,158 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_HARDWARE_LOW_LEVEL_BUTTONS_GPIO_EVENTS_T_HPP__
+#define __RASPIGCD_HARDWARE_LOW_LEVEL_BUTTONS_GPIO_EVENTS_T_HPP__
+
+#include <hardware/low_buttons.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raspigcd {
+namespace hardware {
+namespace driver {
+
+/**
+ * @brief single edge detected on the button input
+ */
+struct button_event_t {
+    int button;                                      ///< index of the button
+    int value;                                       ///< new state of the button (0 off, 1 on)
+    std::chrono::steady_clock::time_point timestamp; ///< when the edge happened
+};
+
+/**
+ * @brief the source of button edges. It can be the Linux GPIO character device or fake source for tests
+ */
+class button_events_source
+{
+public:
+    /**
+     * @brief the number of buttons this source observes
+     */
+    virtual int buttons_count() const = 0;
+
+    /**
+     * @brief waits for the next edge on any button
+     *
+     * @param event the event that was received
+     * @param timeout how long to wait for the event
+     * @return true if the event was received, false on timeout
+     */
+    virtual bool wait_for_event(button_event_t& event, const std::chrono::microseconds timeout) = 0;
+
+    /**
+     * @brief reads the current state of the button (0 off, 1 on)
+     */
+    virtual int read_value(const int btn) = 0;
+
+    virtual ~button_events_source(){};
+};
+
+/**
+ * @brief buttons driver that reacts on edge events instead of polling the inputs.
+ *
+ * The debounce is time based. The first edge is accepted immediately, then the
+ * button is locked for the debounce time. After the lockout the input is read
+ * again, so the release that happened during the bouncing is not lost.
+ */
+class low_buttons_gpio_events : public low_buttons
+{
+public:
+    /**
+     * @brief the latency between the edge and the call of the handler
+     */
+    struct latency_statistics_t {
+        long events;    ///< number of accepted events
+        double mean_us; ///< mean latency in microseconds
+        double max_us;  ///< maximal latency in microseconds
+    };
+
+private:
+    std::shared_ptr<button_events_source> _source;
+    std::chrono::microseconds _debounce;
+
+    std::mutex _m;
+    std::vector<std::function<void(int, int)>> _callbacks;
+    std::vector<int> _state;
+    std::vector<button_event_t> _last_events;
+    std::vector<std::chrono::steady_clock::time_point> _lockout_until;
+    std::vector<bool> _recheck;
+    latency_statistics_t _latency;
+
+    std::atomic<bool> _alive;
+    std::thread _worker;
+
+    void accept_event(const button_event_t& e);
+    void worker_loop();
+
+public:
+    /**
+     * @brief attach callback to button down. It will throw exception for not supported button
+     * @param callback_ the callback function that will receive button number and new status
+     */
+    void on_key(int btn, std::function<void(int, int)> callback_);
+
+    /**
+     * @brief returns current handler for key down
+     */
+    std::function<void(int, int)> on_key(int btn);
+
+    /**
+     * @brief returns the key state
+     */
+    virtual std::vector<int> keys_state();
+
+    /**
+     * @brief returns the last accepted event for the button
+     */
+    button_event_t last_event(int btn);
+
+    /**
+     * @brief returns the latency of accepted events measured from the edge timestamp
+     */
+    latency_statistics_t latency_statistics();
+
+    /**
+     * @brief Construct the buttons driver and start the thread that waits for events
+     *
+     * @param source the source of button edges
+     * @param debounce the time when the button ignores edges after the accepted one
+     */
+    low_buttons_gpio_events(std::shared_ptr<button_events_source> source, const std::chrono::microseconds debounce);
+
+    virtual ~low_buttons_gpio_events();
+
+    low_buttons_gpio_events(low_buttons_gpio_events const&) = delete;
+    void operator=(low_buttons_gpio_events const& x) = delete;
+};
+
+} // namespace driver
+} // namespace hardware
+} // namespace raspigcd
+
+#endif
@@ -49,6 +49,13 @@ public:
         const std::chrono::high_resolution_clock::time_point &,
         const int64_t t);
 
+    /**
+     * @brief wait for the tick to end. The time is in nanoseconds
+     */
+    std::chrono::high_resolution_clock::time_point wait_for_tick_ns(
+        const std::chrono::high_resolution_clock::time_point &,
+        const int64_t t);
+
     std::function<void(const double)> on_wait_s;
     low_timers_fake(std::function<void(const double)> callback = [](const double){}){on_wait_s = callback;}
 };
@@ -46,6 +46,13 @@ public:
     std::chrono::high_resolution_clock::time_point wait_for_tick_us(
         const std::chrono::high_resolution_clock::time_point &prev_timer,
         const int64_t t);
+
+    /**
+     * @brief wait for the tick to end. The time is in nanoseconds
+     */
+    std::chrono::high_resolution_clock::time_point wait_for_tick_ns(
+        const std::chrono::high_resolution_clock::time_point &prev_timer,
+        const int64_t t);
 };
 
 }
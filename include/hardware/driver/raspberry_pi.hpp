@@ -28,6 +28,7 @@
 #include <hardware/low_steppers.hpp>
 #include <hardware/stepping_commands.hpp>
 #include <hardware/low_timers.hpp>
+#include <hardware/pwm_scheduler.hpp>
 #include <steps_t.hpp>
 
 #include <functional>
@@ -62,6 +63,16 @@ struct bcm2835_peripheral {
     volatile uint32_t* addr;
 };
 
+/**
+ * @brief the pwm duty time of the spindle for the given power. The power 0 gives duty_min,
+ * so the ESC spindles get their idle pulse also when they are stopped.
+ *
+ * @param spindle the spindle configuration
+ * @param power value between 0 (stop) and 1 (maximal speed)
+ * @return double the duty time in seconds
+ */
+double spindle_pwm_duty(const configuration::spindle_pwm& spindle, const double power);
+
 class raspberry_pi_3 : public low_buttons, public low_steppers, public low_spindles_pwm// , public low_timers
 {
 private:
@@ -72,9 +83,7 @@ private:
     std::vector<std::function<void(int,int)> > buttons_callbacks;
 
     std::atomic<bool> _threads_alive;
-    //std::vector<std::future<void>> _spindle_threads;
-    std::vector<std::thread> _spindle_threads;
-    std::vector< double > _spindle_duties;
+    std::unique_ptr<pwm_scheduler> _spindles_pwm;
 
     std::vector<bool> _enabled_steppers;
 
@@ -58,6 +58,17 @@ public:
     virtual std::chrono::high_resolution_clock::time_point wait_for_tick_us(
         const std::chrono::high_resolution_clock::time_point &prev_timer,
         const int64_t t) = 0;
+
+    /**
+     * @brief the same as wait_for_tick_us, but the time is in nanoseconds (1/1000000000 s).
+     * It is used by the timed commands (see multistep_command::delay_ns)
+     * 
+     * @param prev_timer
+     * @param t next tick time is prev_timer + t. It tells us when to stop waiting
+     */
+    virtual std::chrono::high_resolution_clock::time_point wait_for_tick_ns(
+        const std::chrono::high_resolution_clock::time_point &prev_timer,
+        const int64_t t) = 0;
 };
 
 } // namespace hardware
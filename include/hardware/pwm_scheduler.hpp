@@ -0,0 +1,105 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_HARDWARE_PWM_SCHEDULER_HPP__
+#define __RASPIGCD_HARDWARE_PWM_SCHEDULER_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raspigcd {
+namespace hardware {
+
+/**
+ * @brief software PWM generator for multiple outputs served by one thread.
+ *
+ * The edges of every channel are kept in the deadline queue sorted by time. The
+ * thread sleeps until the earliest deadline and the next cycle is always
+ * calculated from the previous deadline, not from the wakeup time, so the
+ * period does not drift when the thread is woken up late.
+ */
+class pwm_scheduler
+{
+public:
+    /**
+     * @brief the function that sets the output of the channel to high (true) or low (false)
+     */
+    using set_output_f = std::function<void(int, bool)>;
+
+private:
+    struct edge_t {
+        std::chrono::steady_clock::time_point deadline;
+        int channel;
+        bool rising;
+    };
+
+    std::vector<double> _cycle_times;
+    std::unique_ptr<std::atomic<double>[]> _duties;
+    set_output_f _set_output;
+
+    std::mutex _m;
+    std::condition_variable _cv;
+    bool _alive;
+    std::thread _worker;
+
+    void worker_loop();
+
+public:
+    /**
+     * @brief Construct the scheduler and start the timing thread. All the outputs start with duty 0
+     *
+     * @param cycle_times_seconds the PWM period for each channel
+     * @param set_output the function that changes the state of the output
+     */
+    pwm_scheduler(const std::vector<double>& cycle_times_seconds, set_output_f set_output);
+
+    /**
+     * @brief Set the duty time. The change is applied at the beginning of the next cycle
+     *
+     * @param channel the output number
+     * @param duty_seconds how long the output is high during one cycle. It is limited to the cycle time
+     */
+    void set_duty(const int channel, const double duty_seconds);
+
+    /**
+     * @brief returns the current duty time of the channel
+     */
+    double get_duty(const int channel) const;
+
+    /**
+     * @brief Stops the timing thread. The outputs are left in low state
+     */
+    virtual ~pwm_scheduler();
+
+    pwm_scheduler(pwm_scheduler const&) = delete;
+    void operator=(pwm_scheduler const& x) = delete;
+};
+
+} // namespace hardware
+} // namespace raspigcd
+
+#endif
@@ -25,9 +25,11 @@
 #include <configuration.hpp>
 #include <distance_t.hpp>
 #include <functional>
+#include <hardware/low_spindles_pwm.hpp>
 #include <hardware/low_steppers.hpp>
 #include <hardware/low_timers.hpp>
 #include <hardware/stepping_commands.hpp>
+#include <hardware/telemetry.hpp>
 #include <memory>
 #include <steps_t.hpp>
 #include <list>
@@ -114,15 +116,37 @@ public:
     }
 };
 
+/**
+ * @brief the longest wait for the commands without steps (see stepping_simple_timer::exec) after
+ * which the termination request is checked
+ */
+static const int64_t idle_wait_slice_ns = 10000000;
+
+/**
+ * @brief the tick index and the steps counter of stepping_simple_timer are updated every
+ * executor_counters_interval ticks during exec, and always on break and at the end of exec
+ */
+static const int executor_counters_interval = 64;
+
+/**
+ * @brief the range of the feed override (see stepping_simple_timer::set_feed_override)
+ */
+static const double feed_override_min = 0.5;
+static const double feed_override_max = 2.0;
+
 class stepping_simple_timer : public stepping
 {
     std::atomic<int> _steps_counter; 
     std::atomic<int> _tick_index; 
     std::atomic<int> _terminate_execution;
+    std::atomic<double> _feed_override{1.0};         ///< requested feed override
+    std::atomic<double> _current_feed_override{1.0}; ///< executed feed override, it follows the requested one
+    std::atomic<double> _feed_override_rate{0.5};    ///< maximal change of the feed override per second
 
 public:
 /**
- * @brief returns the counter that is incremented whenever stepper motor performs step
+ * @brief returns the counter that is incremented whenever stepper motor performs step.
+ * During exec it is updated every executor_counters_interval ticks
  * 
  */
     virtual std::atomic<int> *get_step_counter() {
@@ -137,6 +161,12 @@ public:
     std::shared_ptr<low_timers> _low_timer_shr;
     low_timers *_low_timer;
 
+    std::shared_ptr<low_spindles_pwm> _spindles_driver_shr;
+    low_spindles_pwm *_spindles_driver = nullptr;
+
+    std::shared_ptr<telemetry_writer> _telemetry_shr;
+    telemetry_writer *_telemetry = nullptr;
+
     /**
      * @brief Set the delay in microseconds
      * 
@@ -144,6 +174,29 @@ public:
      */
     void set_delay_microseconds(int delay_us);
 
+    /**
+     * @brief Set the feed override. The tick period and the delay of timed commands are divided
+     * by the factor, so 2.0 is twice as fast. It can be changed during exec; the executed factor
+     * follows it not faster than the feed override rate. Remember that the accelerations of the
+     * planned moves are multiplied by the square of the factor.
+     * Throws std::invalid_argument if the factor is not between feed_override_min and feed_override_max
+     *
+     * @param factor the feed override, 1.0 means the speed from the program
+     */
+    void set_feed_override(const double factor);
+    /**
+     * @brief returns the requested feed override
+     */
+    double get_feed_override() const { return _feed_override; }
+    /**
+     * @brief returns the feed override that is executed now. It reaches the requested one gradually
+     */
+    double get_current_feed_override() const { return _current_feed_override; }
+    /**
+     * @brief Set the maximal change of the feed override per second of the execution
+     */
+    void set_feed_override_rate(const double rate_per_s);
+
     /**
      * @brief Set the low level steppers driver
      * 
@@ -153,9 +206,34 @@ public:
 
     void set_low_level_timers(std::shared_ptr<low_timers> timer_drv_);
 
+    /**
+     * @brief Set the spindles driver that is switched according to the flags.bits.g
+     * field of executed commands (see spindle_sync_e). If it is not set, then
+     * the spindle synchronization flags are ignored.
+     * 
+     * @param spindles_driver the spindles driver. This can be faked or true
+     */
+    void set_low_level_spindles_pwm(std::shared_ptr<low_spindles_pwm> spindles_driver);
+
+    /**
+     * @brief Set the telemetry writer. During exec the position, tick index and
+     * command index are published every telemetry_writer::interval_us() microseconds
+     * of the machine time. If it is not set, nothing is published.
+     * 
+     * @param telemetry the telemetry writer
+     */
+    void set_telemetry(std::shared_ptr<telemetry_writer> telemetry);
+
     void exec(const multistep_commands_t& commands_to_do,
     std::function<int (const steps_t steps_from_start, const int command_index) > on_execution_break = [](auto,auto){return 0;});
 
+    /**
+     * @brief Executes commands_count commands that are stored in the memory not owned by the vector,
+     * for example the memory mapped step stream file. It works the same way as exec above.
+     */
+    void exec(const multistep_command* commands_to_do, const std::size_t commands_count,
+    std::function<int (const steps_t steps_from_start, const int command_index) > on_execution_break = [](auto,auto){return 0;});
+
     void terminate(const int n = 0) {
         if (_terminate_execution == 0) _terminate_execution = 1+n;
     }
@@ -172,6 +250,7 @@ public:
     stepping_simple_timer(const configuration::global& conf, std::shared_ptr<low_steppers> steppers_driver, std::shared_ptr<low_timers> timer_drv_)
     {
         set_delay_microseconds(conf.tick_duration_us);
+        set_feed_override_rate(conf.feed_override_rate);
         set_low_level_steppers_driver(steppers_driver);
         set_low_level_timers(timer_drv_);
     }
@@ -188,6 +267,14 @@ std::list<steps_t> hardware_commands_to_steps(const multistep_commands_t& comman
  * @param last_step_ the break after given number of steps. If 0, then no steps are performed.
  */
 steps_t hardware_commands_to_last_position_after_given_steps(const std::vector<multistep_command>& commands_to_do, int last_step_ = -1);
+/**
+ * @brief the time of the execution of the commands in seconds. The timed commands take their
+ * delay (see multistep_command::delay_ns), the others take one tick
+ *
+ * @param commands_to_do list of commands to execute
+ * @param tick_duration_s the duration of the tick in seconds
+ */
+double hardware_commands_duration(const std::vector<multistep_command>& commands_to_do, const double tick_duration_s);
 // untested:
 int hardware_commands_to_steps_count(const std::vector<multistep_command>& commands_to_do, int last_step_ = -1);
 
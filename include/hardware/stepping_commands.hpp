@@ -22,6 +22,7 @@
 #define __RASPIGCD_HARDWARE_STEPPING_COMMANDS_T_HPP__
 
 #include <cstdint>
+#include <algorithm>
 #include <vector>
 #include <array>
 
@@ -35,18 +36,73 @@ struct single_step_command {
     unsigned char dir : 1;//, sync_laser_en: 1, sync_laser: 1;
 };
 
+/**
+ * @brief values of the flags.bits.g field of multistep_command. This is the state
+ * of the synchronized spindle (the laser, spindle 0) that must be set before the
+ * command is executed. It is switched exactly on the tick of the first command that
+ * carries the new state.
+ */
+enum spindle_sync_e {
+    SPINDLE_SYNC_NONE = 0, ///< do not touch the spindle
+    SPINDLE_SYNC_OFF = 1,  ///< spindle 0 must be off during this command
+    SPINDLE_SYNC_ON = 2    ///< spindle 0 must be on during this command
+};
+
+/**
+ * @brief the longest delay of the timed command in nanoseconds. The longer waits are
+ * split into many commands
+ */
+static const int multistep_command_max_delay_ns = 0x7fffffff;
+
+/**
+ * @brief the longest pattern of commands that can be repeated by one pattern header
+ */
+static const int multistep_command_max_pattern_length = 63;
+
 struct multistep_command {
     std::array<single_step_command,4> b; // command that have to be executed synchronously
     union {
         unsigned char all;
         struct {
-            unsigned char g:2;
+            unsigned char g:2; // synchronized spindle state - see spindle_sync_e
+            unsigned char p:6; // pattern header - the next p commands are repeated count times, see multistep_command_pattern_length
         } bits;
-    } flags;
+    } flags = {0};
     int count;                                    // number of times to repeat the command, it means that the command will be executed repeat n.
+    int delay_ns = 0;                             // timed command: nanoseconds from this execution to the next one, 0 means one tick (tick_duration_us)
 };
 using multistep_commands_t = std::vector<multistep_command>;
 
+/**
+ * @brief the number of commands repeated by the pattern header, 0 if the command is not the header.
+ * The header does not perform steps, the next multistep_command_pattern_length(c) commands
+ * are executed c.count times. The periodic steps of constant velocity moves are stored this way
+ * (see simple_steps::compress_periodic_patterns). The patterns are not nested.
+ */
+inline int multistep_command_pattern_length(const multistep_command &c) {
+    return c.flags.bits.p;
+}
+
+/**
+ * @brief calls f for every command in the order of execution. The pattern headers are not
+ * passed to f, the commands of the pattern are passed as many times as the pattern is repeated.
+ */
+template <class F>
+inline void multistep_commands_for_each(const multistep_commands_t &commands, F f) {
+    for (std::size_t i = 0; i < commands.size(); i++) {
+        const int pattern_length = multistep_command_pattern_length(commands[i]);
+        if (pattern_length == 0) {
+            f(commands[i]);
+            continue;
+        }
+        const std::size_t end = std::min(commands.size(), i + 1 + pattern_length);
+        for (int r = 0; r < commands[i].count; r++)
+            for (std::size_t k = i + 1; k < end; k++)
+                f(commands[k]);
+        i = end - 1;
+    }
+}
+
 inline bool operator==(const single_step_command &a, const single_step_command &b) {
     return (a.step == b.step) && (a.dir == b.dir);
     //return *(char*)&a == *(char*)&b;
@@ -58,6 +114,7 @@ inline bool operator==(const single_step_command &a, const single_step_command &
 inline bool multistep_command_same_command(const multistep_command &a, const multistep_command &b) {
     for (unsigned i = 0; i < a.b.size(); i++) if (!(a.b[i] == b.b[i])) return false;
     if (a.flags.all != b.flags.all) return false;
+    if (a.delay_ns != b.delay_ns) return false;
     return true;
 }
 
@@ -0,0 +1,152 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_HARDWARE_TELEMETRY_HPP__
+#define __RASPIGCD_HARDWARE_TELEMETRY_HPP__
+
+#include <steps_t.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace raspigcd {
+namespace hardware {
+
+/**
+ * @brief the telemetry block as it is placed in the shared memory. The layout is
+ * fixed, see doc/TELEMETRY.md. The fields are written with seqlock semantics - the
+ * sequence is odd while the writer updates the block.
+ */
+struct telemetry_block_t {
+    std::uint32_t magic;                              ///< offset 0: TELEMETRY_MAGIC
+    std::uint32_t version;                            ///< offset 4: TELEMETRY_VERSION
+    std::atomic<std::uint32_t> sequence;              ///< offset 8: seqlock counter
+    std::atomic<std::int32_t> command_index;          ///< offset 12: index of the executed command, -1 when idle
+    std::atomic<std::int64_t> tick_index;             ///< offset 16: ticks since the start of the current exec
+    std::array<std::atomic<std::int32_t>, 4> steps;   ///< offset 24: position of motors in steps
+    std::array<std::atomic<double>, 4> velocity;      ///< offset 40: commanded velocity of each motor in steps per second
+    std::array<std::atomic<double>, 4> spindle_power; ///< offset 72: power of spindles from 0 to 1
+    std::atomic<std::int64_t> timestamp_ns;           ///< offset 104: CLOCK_MONOTONIC time of the last update
+};
+
+static const std::uint32_t TELEMETRY_MAGIC = 0x54434752; // "RGCT"
+static const std::uint32_t TELEMETRY_VERSION = 1;
+
+/**
+ * @brief consistent copy of the telemetry block
+ */
+struct telemetry_snapshot_t {
+    std::uint32_t sequence;
+    int command_index;
+    std::int64_t tick_index;
+    steps_t steps;
+    std::array<double, 4> velocity;
+    std::array<double, 4> spindle_power;
+    std::int64_t timestamp_ns;
+};
+
+/**
+ * @brief publishes the machine state in the POSIX shared memory
+ */
+class telemetry_writer
+{
+    std::string _name;
+    int _fd;
+    telemetry_block_t* _block;
+    std::atomic_flag _writer_lock = ATOMIC_FLAG_INIT;
+    int _interval_us;
+    // the spindle power waiting for the publication, it is written by the one who holds the lock
+    std::array<std::atomic<double>, 4> _spindle_power;
+    std::atomic<bool> _spindle_changed;
+
+    bool try_write_begin();
+    void write_end();
+    void copy_spindle_power();
+    void flush_spindle_power();
+
+public:
+    /**
+     * @brief the minimal time between updates from the executor in microseconds
+     */
+    int interval_us() const { return _interval_us; }
+
+    /**
+     * @brief publishes the motion state. It never waits, so it can be called from the executor. If the
+     * block is being written by another thread (the spindle power), nothing is published.
+     *
+     * @param tick_index current tick index
+     * @param steps current position of motors
+     * @param command_index index of the executed command, -1 when idle
+     * @param velocity commanded velocity of each motor in steps per second
+     * @return true if the state was published, false if it should be published again later
+     */
+    bool publish(const std::int64_t tick_index, const steps_t& steps, const int command_index, const std::array<double, 4>& velocity);
+
+    /**
+     * @brief publishes the spindle power. It does not wait for the other writer - if the block is
+     * being written, the power is published by that writer when it finishes.
+     */
+    void publish_spindle(const int i, const double power);
+
+    /**
+     * @brief creates (or reuses) the shared memory object. Throws std::runtime_error if it is not possible
+     *
+     * @param name the name of shared memory object, for example "/raspigcd"
+     * @param interval_us the minimal time between updates from the executor
+     */
+    telemetry_writer(const std::string& name, const int interval_us = 10000);
+    virtual ~telemetry_writer();
+
+    telemetry_writer(telemetry_writer const&) = delete;
+    void operator=(telemetry_writer const& x) = delete;
+};
+
+/**
+ * @brief reads the telemetry published by another thread or process
+ */
+class telemetry_reader
+{
+    int _fd;
+    const telemetry_block_t* _block;
+
+public:
+    /**
+     * @brief returns the consistent copy of the telemetry block. It does not block the writer
+     */
+    telemetry_snapshot_t read() const;
+
+    /**
+     * @brief opens the existing shared memory object. Throws std::runtime_error if it is not
+     *        available or it is not the telemetry block
+     */
+    telemetry_reader(const std::string& name);
+    virtual ~telemetry_reader();
+
+    telemetry_reader(telemetry_reader const&) = delete;
+    void operator=(telemetry_reader const& x) = delete;
+};
+
+} // namespace hardware
+} // namespace raspigcd
+
+#endif
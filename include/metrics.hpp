@@ -0,0 +1,142 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_METRICS_HPP__
+#define __RASPIGCD_METRICS_HPP__
+
+#include <json/json.hpp>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace raspigcd {
+
+/**
+ * @brief collects the performance signals of the whole pipeline - the durations of
+ * preprocessing stages, the depth of the queue between steps generator and executor,
+ * the time when executor waited for commands and the memory usage.
+ *
+ * All methods are thread safe.
+ */
+class metrics_registry
+{
+public:
+    struct stage_t {
+        long count;
+        double total_ms;
+        double max_ms;
+        double last_ms;
+    };
+
+private:
+    mutable std::mutex _m;
+    std::map<std::string, stage_t> _stages;
+    long _queue_samples;
+    double _queue_depth_sum;
+    int _queue_depth_max;
+    long _underruns;
+    double _underrun_ms;
+    double _startup_wait_ms;
+    long _generated_commands;
+    double _generation_seconds;
+    long _executed_commands;
+    double _execution_seconds;
+    std::string _dump_file;
+
+public:
+    /**
+     * @brief measures the duration of the stage from construction to destruction of this object
+     */
+    class stage_timer
+    {
+        metrics_registry* _metrics;
+        std::string _stage;
+        std::chrono::steady_clock::time_point _start;
+
+    public:
+        stage_timer(const std::shared_ptr<metrics_registry>& metrics, const std::string& stage);
+        ~stage_timer();
+    };
+
+    /**
+     * @brief adds the duration of one execution of the stage (parse, enrich, douglas_peucker, ...)
+     */
+    void add_stage_time(const std::string& stage, const double ms);
+
+    /**
+     * @brief registers the current number of elements waiting in the queue for execution
+     */
+    void queue_depth(const int depth);
+
+    /**
+     * @brief registers the time when the executor waited on the empty queue
+     *
+     * @param ms the waiting time in milliseconds
+     * @param in_motion true if the executor has already started the job - this is the underrun
+     */
+    void executor_wait(const double ms, const bool in_motion);
+
+    /**
+     * @brief registers the number of generated multistep commands and the time of generation
+     */
+    void generated_commands(const long n, const double seconds);
+
+    /**
+     * @brief registers the number of executed multistep commands and the time of execution
+     */
+    void executed_commands(const long n, const double seconds);
+
+    /**
+     * @brief peak resident memory of the process in kilobytes
+     */
+    static long peak_memory_kb();
+
+    /**
+     * @brief clears all the collected values. It should be called at the beginning of the job
+     */
+    void reset();
+
+    /**
+     * @brief returns the collected values as json object
+     */
+    nlohmann::json to_json() const;
+
+    /**
+     * @brief Set the file where the metrics are appended by job_finished. Empty name disables saving
+     */
+    void set_dump_file(const std::string& filename);
+
+    /**
+     * @brief appends metrics of the job as one line of json to the dump file, if it is set
+     *
+     * @param job the name of the job, for example the gcode file name
+     */
+    void job_finished(const std::string& job) const;
+
+    metrics_registry() { reset(); }
+};
+
+} // namespace raspigcd
+
+#endif
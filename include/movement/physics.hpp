@@ -94,6 +94,62 @@ double acceleration_between(const path_node_t &a, const path_node_t &b);
  * */
 path_node_t calculate_transition_point(const path_node_t &a, const path_node_t &b, const double acceleration);
 
+/**
+ * the same as calculate_transition_point, but the velocity change follows the jerk limited
+ * profile (see s_curve_t), so the average acceleration is given by jerk_limited_acceleration.
+ * For max_jerk equal 0 it is the same as calculate_transition_point.
+ * */
+path_node_t calculate_transition_point(const path_node_t &a, const path_node_t &b, const double max_acceleration, const double max_jerk);
+
+/**
+ * @brief the shortest distance needed to change the velocity from v0 to v1 with the given limits.
+ * For max_jerk equal 0 it is (v1^2-v0^2)/(2*max_acceleration).
+ */
+double velocity_change_distance(const double v0, const double v1, const double max_acceleration, const double max_jerk);
+
+/**
+ * @brief average acceleration of the fastest jerk limited change of the velocity by dv.
+ *
+ * The acceleration cannot exceed max_acceleration and it cannot change faster than max_jerk,
+ * so small changes of velocity are slower than with the constant acceleration. This is the
+ * acceleration that should be used by the planner when the S-curve profile is used.
+ * For max_jerk equal 0 (no jerk limit) it returns max_acceleration.
+ */
+double jerk_limited_acceleration(const double dv, const double max_acceleration, const double max_jerk);
+
+/**
+ * @brief jerk limited (S-curve) change of the velocity from v0 to v1 in the time T.
+ *
+ * The acceleration grows with the constant jerk, stays constant and then drops to zero
+ * with the same jerk. Together with the constant velocity part and the same three phases
+ * for the braking it gives the 7 segment velocity profile. The profile is symmetric, so the
+ * distance after the time T is (v0+v1)*T/2 - the same as for the constant acceleration,
+ * and the planner nodes can stay as they are.
+ */
+struct s_curve_t {
+    double v0; ///< initial velocity
+    double T;  ///< duration of the velocity change
+    double j;  ///< jerk in the first phase (negative for braking)
+    double tj; ///< duration of the first and the last phase
+    double a;  ///< acceleration in the middle phase (negative for braking)
+    double v1; ///< final velocity, it is returned exactly at the end of the curve
+
+    /**
+     * distance from the start after time t
+     */
+    double distance(double t) const;
+    /**
+     * velocity after time t
+     */
+    double velocity(double t) const;
+};
+
+/**
+ * @brief prepares the S-curve from v0 to v1 that takes time T. The jerk is max_jerk if it is
+ * possible. If the time is too short for such jerk, the acceleration has the triangle shape
+ * with the jerk that is needed. For max_jerk equal 0 it is the constant acceleration.
+ */
+s_curve_t s_curve_between(const double v0, const double v1, const double T, const double max_jerk);
 
 bool operator==(const path_node_t &lhs,const path_node_t &rhs);
 
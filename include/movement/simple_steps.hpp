@@ -46,6 +46,23 @@ int steps_remaining( const steps_t& steps_, const steps_t& destination_steps_ );
  * */
 hardware::multistep_commands_t collapse_repeated_steps(const std::list<hardware::multistep_command>& ret);
 
+/**
+ * @brief stores the periodic sequences of commands (like step, empty, empty, step, empty, empty, ...
+ * at constant velocity) once, with the pattern header that repeats them (see multistep_command_pattern_length).
+ * The commands that are already in patterns are copied. The execution of the result is the same as
+ * the execution of the commands.
+ *
+ * @param commands the commands after collapse_repeated_steps
+ * @param max_pattern_length the longest pattern to look for, at most multistep_command_max_pattern_length
+ */
+hardware::multistep_commands_t compress_periodic_patterns(const hardware::multistep_commands_t& commands,
+    const int max_pattern_length = hardware::multistep_command_max_pattern_length);
+
+/**
+ * @brief the reverse of compress_periodic_patterns - the commands without the pattern headers
+ */
+hardware::multistep_commands_t expand_periodic_patterns(const hardware::multistep_commands_t& commands);
+
 
 
 /**
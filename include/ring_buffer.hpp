@@ -0,0 +1,125 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#ifndef __RASPIGCD_RING_BUFFER_HPP__
+#define __RASPIGCD_RING_BUFFER_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace raspigcd {
+
+/**
+ * @brief lock-free ring buffer for exactly one producer thread and one consumer thread.
+ *
+ * The producer never blocks - when the buffer is full, try_push returns false and the
+ * element is counted as dropped. This is meant for feeding data from the stepping
+ * loop to observers (like visualization) that must not slow down the execution.
+ */
+template <class T>
+class spsc_ring_c
+{
+    std::vector<T> _data;
+    std::size_t _mask;
+    alignas(64) std::atomic<std::size_t> _head; ///< next write position, owned by producer
+    alignas(64) std::atomic<std::size_t> _tail; ///< next read position, owned by consumer
+    alignas(64) std::atomic<std::size_t> _dropped;
+
+public:
+    /**
+     * @brief creates buffer that can hold at least capacity_ elements. The capacity is rounded up to the power of 2.
+     */
+    spsc_ring_c(std::size_t capacity_)
+    {
+        if (capacity_ == 0) throw std::invalid_argument("spsc_ring_c: capacity must be positive");
+        std::size_t c = 1;
+        while (c < capacity_)
+            c <<= 1;
+        _data.resize(c);
+        _mask = c - 1;
+        _head = 0;
+        _tail = 0;
+        _dropped = 0;
+    }
+
+    std::size_t capacity() const { return _data.size(); }
+
+    /**
+     * @brief number of elements that are waiting for the consumer (approximate when called from third thread)
+     */
+    std::size_t size() const
+    {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief number of elements rejected because the buffer was full
+     */
+    std::size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief producer side. Returns false (and does not wait) if the buffer is full
+     */
+    bool try_push(const T& v)
+    {
+        const std::size_t h = _head.load(std::memory_order_relaxed);
+        if (h - _tail.load(std::memory_order_acquire) >= _data.size()) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        _data[h & _mask] = v;
+        _head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief consumer side. Returns false if there is nothing to read
+     */
+    bool try_pop(T& v)
+    {
+        const std::size_t t = _tail.load(std::memory_order_relaxed);
+        if (t == _head.load(std::memory_order_acquire)) return false;
+        v = _data[t & _mask];
+        _tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief consumer side. Calls f on every element available at the moment of the call
+     * and releases them at once. Returns the number of consumed elements.
+     */
+    template <class F>
+    std::size_t consume_all(F f)
+    {
+        const std::size_t t = _tail.load(std::memory_order_relaxed);
+        const std::size_t h = _head.load(std::memory_order_acquire);
+        for (std::size_t i = t; i != h; i++)
+            f(_data[i & _mask]);
+        _tail.store(h, std::memory_order_release);
+        return h - t;
+    }
+};
+
+} // namespace raspigcd
+
+#endif
@@ -30,25 +30,47 @@ namespace raspigcd {
 namespace configuration {
 
 
-static const std::array<std::string, 3> steps_generator_strings = {"program_to_steps", "bezier_spline", "linear_interpolation"};
+static const std::array<std::string, 4> steps_generator_strings = {"program_to_steps", "bezier_spline", "linear_interpolation", "variable_interval"};
 static const std::map<std::string, steps_generator_e> steps_generator_values = {
     {"", PROGRAM_TO_STEPS}, // default
     {"program_to_steps", PROGRAM_TO_STEPS},
     {"bezier_spline", BEZIER_SPLINE},
-    {"linear_interpolation", LINEAR_INTERPOLATION}};
-
+    {"linear_interpolation", LINEAR_INTERPOLATION},
+    {"variable_interval", VARIABLE_INTERVAL}};
+
+static const std::array<std::string, 2> path_simplifier_strings = {"douglas_peucker", "visvalingam_whyatt"};
+static const std::map<std::string, path_simplifier_e> path_simplifier_values = {
+    {"", DOUGLAS_PEUCKER}, // default
+    {"douglas_peucker", DOUGLAS_PEUCKER},
+    {"visvalingam_whyatt", VISVALINGAM_WHYATT}};
+
+static const std::array<std::string, 2> buttons_driver_strings = {"polling", "gpio_events"};
+static const std::map<std::string, low_buttons_e> buttons_driver_values = {
+    {"", BUTTONS_POLLING}, // default
+    {"polling", BUTTONS_POLLING},
+    {"gpio_events", BUTTONS_GPIO_EVENTS}};
+
+static const std::array<std::string, 2> cornering_model_strings = {"angle", "junction_deviation"};
+static const std::map<std::string, cornering_model_e> cornering_model_values = {
+    {"", CORNERING_ANGLE}, // default
+    {"angle", CORNERING_ANGLE},
+    {"junction_deviation", CORNERING_JUNCTION_DEVIATION}};
 
 double limits::proportional_max_accelerations_mm_s2(const distance_t& norm_vect) const
 {
-    return calculate_linear_coefficient_from_limits(max_accelerations_mm_s2, norm_vect);
+    return proportional_limits(*this).max_accelerations_mm_s2(norm_vect);
 }
 double limits::proportional_max_velocity_mm_s(const distance_t& norm_vect) const
 {
-    return calculate_linear_coefficient_from_limits(max_velocity_mm_s, norm_vect);
+    return proportional_limits(*this).max_velocity_mm_s(norm_vect);
 }
 double limits::proportional_max_no_accel_velocity_mm_s(const distance_t& norm_vect) const
 {
-    return calculate_linear_coefficient_from_limits(max_no_accel_velocity_mm_s, norm_vect);
+    return proportional_limits(*this).max_no_accel_velocity_mm_s(norm_vect);
+}
+double limits::proportional_max_jerk_mm_s3(const distance_t& norm_vect) const
+{
+    return proportional_limits(*this).max_jerk_mm_s3(norm_vect);
 }
 
 
@@ -65,13 +87,26 @@ global& global::load_defaults()
     steps_generator = steps_generator_e::PROGRAM_TO_STEPS;
 
     douglas_peucker_marigin = 1.0 / 64.0;
+    path_simplifier = path_simplifier_e::DOUGLAS_PEUCKER;
+    cross_group_blending = false;
+    reorder_travel_moves = false;
+    planning_threads = 0;
 
     motion_layout = COREXY; //"corexy";
     lowleveltimer = BUSY_WAIT;
+    buttons_driver = BUTTONS_POLLING;
+    button_debounce_us = 2000;
+    telemetry_shm = "";
+    telemetry_interval_us = 10000;
+    feed_override_rate = 0.5;
     scale = {1.0, 1.0, 1.0};
     max_accelerations_mm_s2 = {200.0, 200.0, 200.0};
     max_velocity_mm_s = {220.0, 220.0, 110.0};    ///<maximal velocity on axis in mm/s
     max_no_accel_velocity_mm_s = {2.0, 2.0, 2.0}; ///<maximal velocity on axis in mm/s
+    max_jerk_mm_s3 = {0.0, 0.0, 0.0};             ///<no jerk limit - trapezoidal velocity profile
+    cornering_model = CORNERING_ANGLE;
+    junction_deviation_mm = 0.01;
+    time_optimal_planning = false;
 
     steppers = {
         stepper(27, 10, 22, 100.0),
@@ -217,12 +252,25 @@ void to_json(nlohmann::json& j, const global& p)
         {"sequential_gcode_execution", p.sequential_gcode_execution},
         {"steps_generator", steps_generator_strings.at(p.steps_generator)},
         {"douglas_peucker_marigin", p.douglas_peucker_marigin},
+        {"path_simplifier", path_simplifier_strings.at(p.path_simplifier)},
+        {"cross_group_blending", p.cross_group_blending},
+        {"reorder_travel_moves", p.reorder_travel_moves},
+        {"planning_threads", p.planning_threads},
         {"lowleveltimer", lowleveltimertostring(p.lowleveltimer)},
+        {"buttons_driver", buttons_driver_strings.at(p.buttons_driver)},
+        {"button_debounce_us", p.button_debounce_us},
+        {"telemetry_shm", p.telemetry_shm},
+        {"telemetry_interval_us", p.telemetry_interval_us},
+        {"feed_override_rate", p.feed_override_rate},
         {"motion_layout", (p.motion_layout == COREXY) ? "corexy" : "cartesian"},
         {"scale", p.scale},
         {"max_accelerations_mm_s2", p.max_accelerations_mm_s2},
         {"max_velocity_mm_s", p.max_velocity_mm_s},
         {"max_no_accel_velocity_mm_s", p.max_no_accel_velocity_mm_s},
+        {"max_jerk_mm_s3", p.max_jerk_mm_s3},
+        {"cornering_model", cornering_model_strings.at(p.cornering_model)},
+        {"junction_deviation_mm", p.junction_deviation_mm},
+        {"time_optimal_planning", p.time_optimal_planning},
         {"spindles", p.spindles},
         {"steppers", p.steppers},
         {"buttons", p.buttons}};
@@ -233,8 +281,18 @@ void from_json(const nlohmann::json& j, global& p)
     p.simulate_execution = j.value("simulate_execution", p.simulate_execution);
     p.sequential_gcode_execution = j.value("sequential_gcode_execution", p.sequential_gcode_execution);
     p.douglas_peucker_marigin = j.value("douglas_peucker_marigin", p.douglas_peucker_marigin);
+    p.path_simplifier = path_simplifier_values.at(j.value("path_simplifier", path_simplifier_strings.at(p.path_simplifier)));
+    p.cross_group_blending = j.value("cross_group_blending", p.cross_group_blending);
+    p.reorder_travel_moves = j.value("reorder_travel_moves", p.reorder_travel_moves);
+    p.planning_threads = j.value("planning_threads", p.planning_threads);
     p.steps_generator = steps_generator_values.at(j.value("steps_generator", steps_generator_strings.at(p.steps_generator)));
     p.tick_duration_us = j.value("tick_duration_us", p.tick_duration_us);
+    p.buttons_driver = buttons_driver_values.at(j.value("buttons_driver", buttons_driver_strings.at(p.buttons_driver)));
+    p.button_debounce_us = j.value("button_debounce_us", p.button_debounce_us);
+    p.telemetry_shm = j.value("telemetry_shm", p.telemetry_shm);
+    p.telemetry_interval_us = j.value("telemetry_interval_us", p.telemetry_interval_us);
+    p.feed_override_rate = j.value("feed_override_rate", p.feed_override_rate);
+    if (p.feed_override_rate <= 0) throw std::invalid_argument("feed_override_rate must be greater than 0");
 
     {
         //p.lowleveltimer = j.value("lowleveltimer", p.lowleveltimer);
@@ -266,6 +324,12 @@ void from_json(const nlohmann::json& j, global& p)
     p.max_velocity_mm_s = tmp;
     tmp = j.value("max_no_accel_velocity_mm_s", std::vector<double>(p.max_no_accel_velocity_mm_s.begin(), p.max_no_accel_velocity_mm_s.end()));
     p.max_no_accel_velocity_mm_s = tmp;
+    tmp = j.value("max_jerk_mm_s3", std::vector<double>(p.max_jerk_mm_s3.begin(), p.max_jerk_mm_s3.end()));
+    p.max_jerk_mm_s3 = tmp;
+    p.cornering_model = cornering_model_values.at(j.value("cornering_model", cornering_model_strings.at(p.cornering_model)));
+    p.junction_deviation_mm = j.value("junction_deviation_mm", p.junction_deviation_mm);
+    if (p.junction_deviation_mm <= 0) throw std::invalid_argument("junction_deviation_mm must be greater than 0");
+    p.time_optimal_planning = j.value("time_optimal_planning", p.time_optimal_planning);
 
     p.spindles = j.value("spindles", p.spindles);
     p.steppers = j.value("steppers", p.steppers);
@@ -288,6 +352,10 @@ bool operator==(const global& l, const global& r)
            (l.max_accelerations_mm_s2 == r.max_accelerations_mm_s2) &&
            (l.max_velocity_mm_s == r.max_velocity_mm_s) &&
            (l.max_no_accel_velocity_mm_s == r.max_no_accel_velocity_mm_s) &&
+           (l.max_jerk_mm_s3 == r.max_jerk_mm_s3) &&
+           (l.cornering_model == r.cornering_model) &&
+           (l.junction_deviation_mm == r.junction_deviation_mm) &&
+           (l.time_optimal_planning == r.time_optimal_planning) &&
            (l.scale == r.scale) &&
            (l.motion_layout == r.motion_layout) &&
            (l.spindles == r.spindles) &&
@@ -295,6 +363,15 @@ bool operator==(const global& l, const global& r)
            (l.buttons == r.buttons) &&
            (l.simulate_execution == r.simulate_execution) &&
            (l.douglas_peucker_marigin == r.douglas_peucker_marigin) &&
+           (l.path_simplifier == r.path_simplifier) &&
+           (l.cross_group_blending == r.cross_group_blending) &&
+           (l.reorder_travel_moves == r.reorder_travel_moves) &&
+           (l.planning_threads == r.planning_threads) &&
+           (l.buttons_driver == r.buttons_driver) &&
+           (l.button_debounce_us == r.button_debounce_us) &&
+           (l.telemetry_shm == r.telemetry_shm) &&
+           (l.telemetry_interval_us == r.telemetry_interval_us) &&
+           (l.feed_override_rate == r.feed_override_rate) &&
            (l.lowleveltimer == r.lowleveltimer);
 }
 
@@ -0,0 +1,227 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <converters/gcd_program_to_png.hpp>
+#include <gcd/arcs.hpp>
+#include <lodepng/lodepng.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace raspigcd {
+namespace converters {
+
+std::vector<preview_segment_t> program_to_preview_segments(const gcd::partitioned_program_t& program_,
+    const gcd::block_t& initial_state_)
+{
+    using namespace gcd;
+    std::vector<preview_segment_t> ret;
+    block_t state = merge_blocks({{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}}, initial_state_);
+    double power = 0.0;
+    for (const auto& ppart : program_) {
+        if (ppart.size() == 0) continue;
+        if (ppart[0].count('M')) {
+            for (const auto& m : ppart) {
+                switch ((int)(m.at('M'))) {
+                case 3:
+                    power = 1.0;
+                    break;
+                case 5:
+                    power = 0.0;
+                    break;
+                }
+            }
+            continue;
+        }
+        for (const auto& block : ppart) {
+            block_t new_state = merge_blocks(state, block);
+            int g = (int)(new_state.count('G') ? new_state['G'] : 0);
+            if ((g == 0) || (g == 1)) {
+                distance_t a = block_to_distance_t(state);
+                distance_t b = block_to_distance_t(new_state);
+                if (!(a == b)) ret.push_back({a, b, power, g == 0});
+            } else if ((g == 2) || (g == 3)) {
+                distance_t a = block_to_distance_t(state);
+                for (const auto& b : arc_to_points(block_to_arc(state, block), 0.01)) {
+                    ret.push_back({a, b, power, false});
+                    a = b;
+                }
+            }
+            // G28 returns to the origin of given axes, G92 only changes the coordinates
+            if ((g == 28) && (block.count('G'))) {
+                for (char axis : {'X', 'Y', 'Z'})
+                    if (block.count(axis)) new_state[axis] = 0.0;
+            }
+            state = new_state;
+        }
+    }
+    return ret;
+}
+
+std::vector<preview_segment_t> steps_to_preview_segments(const hardware::multistep_commands_t& commands_,
+    hardware::motor_layout& motor_layout_,
+    const steps_t& start_steps_,
+    const preview_options_t& options_)
+{
+    using namespace hardware;
+    std::vector<preview_segment_t> ret;
+    bool has_spindle_flags = std::any_of(commands_.begin(), commands_.end(), [](const multistep_command& c) {
+        return c.flags.bits.g != SPINDLE_SYNC_NONE;
+    });
+    const double resolution2 = options_.resolution_mm * options_.resolution_mm;
+
+    steps_t position = start_steps_;
+    distance_t segment_start = motor_layout_.steps_to_cartesian(position);
+    distance_t current = segment_start;
+    double power = has_spindle_flags ? 0.0 : 1.0;
+    auto emit = [&]() {
+        if (!(segment_start == current))
+            ret.push_back({segment_start, current, power, has_spindle_flags && (power == 0.0)});
+        segment_start = current;
+    };
+    multistep_commands_for_each(commands_, [&](const multistep_command& c) {
+        if (c.flags.bits.g != SPINDLE_SYNC_NONE) {
+            double new_power = (c.flags.bits.g == SPINDLE_SYNC_ON) ? 1.0 : 0.0;
+            if (new_power != power) {
+                emit();
+                power = new_power;
+            }
+        }
+        bool moved = false;
+        for (std::size_t j = 0; j < position.size(); j++) {
+            if (c.b[j].step) {
+                position[j] += c.count * ((int)c.b[j].dir * 2 - 1);
+                moved = true;
+            }
+        }
+        if (!moved) return;
+        current = motor_layout_.steps_to_cartesian(position);
+        if ((current - segment_start).length2() >= resolution2) emit();
+    });
+    emit();
+    return ret;
+}
+
+preview_image_t render_preview(const std::vector<preview_segment_t>& segments_, const preview_options_t& options_)
+{
+    if ((options_.width < 3) || (options_.height < 3)) throw std::invalid_argument("render_preview: the picture must be at least 3x3 pixels");
+    double min_x = 0, max_x = 0, min_y = 0, max_y = 0;
+    if (segments_.size()) {
+        min_x = max_x = segments_[0].a[0];
+        min_y = max_y = segments_[0].a[1];
+    }
+    for (const auto& s : segments_) {
+        for (const auto& p : {s.a, s.b}) {
+            min_x = std::min(min_x, p[0]);
+            max_x = std::max(max_x, p[0]);
+            min_y = std::min(min_y, p[1]);
+            max_y = std::max(max_y, p[1]);
+        }
+    }
+    // one pixel margin on every side
+    double scale = 1.0;
+    if ((max_x > min_x) || (max_y > min_y)) {
+        scale = std::min(((max_x > min_x) ? (options_.width - 3) / (max_x - min_x) : 1e100),
+            ((max_y > min_y) ? (options_.height - 3) / (max_y - min_y) : 1e100));
+    }
+    preview_image_t image;
+    image.pixels_per_mm = scale;
+    image.width = std::min(options_.width, (int)std::ceil((max_x - min_x) * scale) + 3);
+    image.height = std::min(options_.height, (int)std::ceil((max_y - min_y) * scale) + 3);
+    image.rgba.resize((std::size_t)image.width * image.height * 4);
+
+    auto px = [&](const distance_t& p) { return (p[0] - min_x) * scale + 1.0; };
+    auto py = [&](const distance_t& p) { return (max_y - p[1]) * scale + 1.0; };
+
+    int threads = (options_.threads > 0) ? options_.threads : (int)std::thread::hardware_concurrency();
+    threads = std::max(1, std::min(threads, image.height));
+
+    // every thread owns a band of rows, so the bands can be written without locks
+    auto rasterize_band = [&](const int row_0, const int row_1) {
+        const int w = image.width;
+        std::vector<unsigned char> work((std::size_t)w * (row_1 - row_0), 0);
+        std::vector<unsigned char> travel((std::size_t)w * (row_1 - row_0), 0);
+        for (const auto& s : segments_) {
+            double x0 = px(s.a), y0 = py(s.a), x1 = px(s.b), y1 = py(s.b);
+            if ((std::max(y0, y1) < row_0 - 0.5) || (std::min(y0, y1) >= row_1 - 0.5)) continue;
+            double dx = x1 - x0, dy = y1 - y0;
+            long n = std::max(1L, (long)std::ceil(std::max(std::abs(dx), std::abs(dy))));
+            long i_0 = 0, i_1 = n;
+            if (dy != 0.0) {
+                double t_0 = (row_0 - 0.5 - y0) / dy;
+                double t_1 = (row_1 - 0.5 - y0) / dy;
+                if (t_0 > t_1) std::swap(t_0, t_1);
+                i_0 = std::max(0L, (long)std::floor(t_0 * n));
+                i_1 = std::min(n, (long)std::ceil(t_1 * n));
+            }
+            unsigned char v = (unsigned char)(64 + std::max(0.0, std::min(1.0, s.power)) * 191);
+            for (long i = i_0; i <= i_1; i++) {
+                int x = (int)std::lround(x0 + dx * i / n);
+                int y = (int)std::lround(y0 + dy * i / n);
+                if ((y < row_0) || (y >= row_1) || (x < 0) || (x >= w)) continue;
+                std::size_t idx = (std::size_t)(y - row_0) * w + x;
+                if (s.travel) {
+                    travel[idx] = 1;
+                } else {
+                    work[idx] = std::max(work[idx], v);
+                }
+            }
+        }
+        for (int y = row_0; y < row_1; y++) {
+            for (int x = 0; x < w; x++) {
+                std::size_t idx = (std::size_t)(y - row_0) * w + x;
+                unsigned char* out = &image.rgba[((std::size_t)y * w + x) * 4];
+                for (int c = 0; c < 3; c++) {
+                    if (work[idx]) {
+                        out[c] = (unsigned char)(options_.background[c] + ((int)options_.work[c] - (int)options_.background[c]) * work[idx] / 255);
+                    } else if (travel[idx]) {
+                        out[c] = options_.travel[c];
+                    } else {
+                        out[c] = options_.background[c];
+                    }
+                }
+                out[3] = 255;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        int row_0 = image.height * t / threads;
+        int row_1 = image.height * (t + 1) / threads;
+        workers.emplace_back(rasterize_band, row_0, row_1);
+    }
+    for (auto& w : workers)
+        w.join();
+    return image;
+}
+
+void save_preview_png(const preview_image_t& image_, const std::string& filename_)
+{
+    unsigned error = lodepng::encode(filename_, image_.rgba, image_.width, image_.height);
+    if (error) throw std::runtime_error(std::string("save_preview_png: ") + lodepng_error_text(error));
+}
+
+} // namespace converters
+} // namespace raspigcd
@@ -87,7 +87,8 @@ gcd::program_t program_to_raw_program(
         for (auto kv : ee) {
             if (machine_state.count(kv.first)) {
                 if (kv.second == machine_state.at(kv.first)) {
-                    if ((kv.first != 'G') && (kv.first != 'M')) e.erase(kv.first);
+                    // I, J and R describe the arc and are not modal
+                    if ((kv.first != 'G') && (kv.first != 'M') && (kv.first != 'I') && (kv.first != 'J') && (kv.first != 'R')) e.erase(kv.first);
                 }
             }
         }
@@ -19,9 +19,11 @@
 
 
 #include <converters/gcd_program_to_steps.hpp>
+#include <gcd/arcs.hpp>
 #include <movement/physics.hpp>
 #include <movement/simple_steps.hpp>
 
+#include <cmath>
 #include <functional>
 
 namespace raspigcd {
@@ -67,11 +69,20 @@ auto smart_append = [](auto& fragment, const raspigcd::hardware::multistep_comma
 };
 
 
+/// maximal distance between the arc and the lines that replace it in spline and interpolation generators
+static const double arc_linearization_error_mm = 0.01;
+
+/**
+ * generates steps for the line. The velocity changes from the velocity of the state to the velocity of
+ * the next state. If max_jerk is 0, then the acceleration is constant, otherwise the velocity follows
+ * the jerk limited S-curve that takes the same time.
+ */
 raspigcd::hardware::multistep_commands_t __generate_g1_steps(
     const raspigcd::gcd::block_t& state,
     const raspigcd::gcd::block_t& next_state,
     double dt,
-    hardware::motor_layout& ml_)
+    hardware::motor_layout& ml_,
+    double max_jerk = 0.0)
 {
     using namespace raspigcd::hardware;
     using namespace raspigcd::gcd;
@@ -105,6 +116,18 @@ raspigcd::hardware::multistep_commands_t __generate_g1_steps(
                 pos_from_steps = pos_to_steps;
             }
             final_steps = pos_from_steps;
+        } else if (max_jerk > 0) {
+            auto direction = (pos_to - pos_from) / l;
+            const s_curve_t curve = s_curve_between(v0, v1, 2.0 * l / (v0 + v1), max_jerk);
+            auto p_steps = ml_.cartesian_to_steps(pos_from);
+            for (int i = 1; (dt * i) < curve.T; ++i) {
+                auto pos = ml_.cartesian_to_steps(pos_from + direction * curve.distance(dt * i));
+                chase_steps(steps_todo, p_steps, pos);
+                smart_append(fragment, steps_todo);
+                steps_todo.clear();
+                p_steps = pos;
+            }
+            final_steps = p_steps;
         } else if ((v1 != v0)) {
             auto direction = (pos_to - pos_from) / l;
             const path_node_t pn_a{.p = pos_from, .v = v0};
@@ -115,7 +138,8 @@ raspigcd::hardware::multistep_commands_t __generate_g1_steps(
             auto l = [&]() { return v0 * t + 0.5 * a * t * t; }; ///< current distance from p0
             double s = (pos_to - pos_from).length();             // distance to travel
             auto p_steps = ml_.cartesian_to_steps(pos_from);
-            for (int i = 1; l() < s; ++i, t = dt * i) {
+            // the velocity cannot drop below 0, the missing steps are fixed below
+            for (int i = 1; (l() < s) && ((v0 + a * t) > 0); ++i, t = dt * i) {
                 auto pos = ml_.cartesian_to_steps(pos_from + direction * l());
                 chase_steps(steps_todo, p_steps, pos);
                 smart_append(fragment, steps_todo);
@@ -137,12 +161,62 @@ raspigcd::hardware::multistep_commands_t __generate_g1_steps(
     return {};
 }
 
-hardware::multistep_commands_t program_to_steps(
+/**
+ * walks the arc in time. Every tick the position on the arc is converted to steps, so
+ * the curve is followed directly in the steps space, without linear segments.
+ * The velocity changes from the velocity of the state to the velocity of the next state,
+ * the same way as in __generate_g1_steps.
+ */
+raspigcd::hardware::multistep_commands_t __generate_arc_steps(
+    const raspigcd::gcd::block_t& state,
+    const raspigcd::gcd::block_t& block,
+    const raspigcd::gcd::block_t& next_state,
+    double dt,
+    hardware::motor_layout& ml_,
+    double max_jerk = 0.0)
+{
+    using namespace raspigcd::hardware;
+    using namespace raspigcd::movement::simple_steps;
+    const gcd::arc_t arc = gcd::block_to_arc(state, block);
+    const double l = arc.length();
+    if (l <= 0) return {};
+    double v0 = state.at('F');
+    double v1 = next_state.at('F');
+    if ((v0 == 0) && (v1 == 0)) throw std::invalid_argument("the feedrate should not be 0 for non zero distance");
+    const movement::physics::s_curve_t curve = movement::physics::s_curve_between(v0, v1, 2.0 * l / (v0 + v1), max_jerk);
+
+    std::list<multistep_command> fragment;
+    multistep_commands_t steps_todo;
+    auto p_steps = ml_.cartesian_to_steps(arc.start);
+    for (int i = 1; (dt * i) < curve.T; ++i) {
+        double s = curve.distance(dt * i);
+        if (s >= l) break;
+        auto pos = ml_.cartesian_to_steps(arc.point_at(s));
+        chase_steps(steps_todo, p_steps, pos);
+        smart_append(fragment, steps_todo);
+        steps_todo.clear();
+        p_steps = pos;
+    }
+    auto pos_to_steps = ml_.cartesian_to_steps(arc.end);
+    if (!(p_steps == pos_to_steps)) { // fix missing steps
+        chase_steps(steps_todo, p_steps, pos_to_steps);
+        smart_append(fragment, steps_todo);
+        steps_todo.clear();
+    }
+    return collapse_repeated_steps(fragment);
+}
+
+/**
+ * the steps generator that follows the program exactly. If the jerk limits are given, then the
+ * velocity changes follow the S-curve
+ */
+hardware::multistep_commands_t program_to_steps_with_jerk(
     const gcd::program_t& prog_,
     const configuration::actuators_organization& conf_,
     hardware::motor_layout& ml_,
     const gcd::block_t initial_state_, // = {{'F',0}},
-    std::function<void(const gcd::block_t)> finish_callback_f_)
+    std::function<void(const gcd::block_t)> finish_callback_f_,
+    const configuration::limits* jerk_limits_)
 {
     using namespace raspigcd::hardware;
     using namespace raspigcd::gcd;
@@ -172,7 +246,16 @@ hardware::multistep_commands_t program_to_steps(
             result.push_back(executor_command);
             next_state = state;
         } else if ((next_state.at('G') == 1) || (next_state.at('G') == 0)) {
-            auto collapsed = __generate_g1_steps(state, next_state, dt, ml_);
+            double max_jerk = 0.0;
+            if (jerk_limits_ != nullptr) {
+                auto move_vec = blocks_to_vector_move(state, next_state);
+                if (move_vec.length() > 0) max_jerk = jerk_limits_->proportional_max_jerk_mm_s3(move_vec);
+            }
+            auto collapsed = __generate_g1_steps(state, next_state, dt, ml_, max_jerk);
+            result.insert(result.end(), collapsed.begin(), collapsed.end());
+        } else if (gcd::is_arc_block(next_state)) {
+            double max_jerk = (jerk_limits_ != nullptr) ? arc_max_jerk(block_to_arc(state, block), *jerk_limits_) : 0.0;
+            auto collapsed = __generate_arc_steps(state, block, next_state, dt, ml_, max_jerk);
             result.insert(result.end(), collapsed.begin(), collapsed.end());
         }
         state = next_state;
@@ -181,6 +264,246 @@ hardware::multistep_commands_t program_to_steps(
     return collapse_repeated_steps(result);
 }
 
+hardware::multistep_commands_t program_to_steps(
+    const gcd::program_t& prog_,
+    const configuration::actuators_organization& conf_,
+    hardware::motor_layout& ml_,
+    const gcd::block_t initial_state_, // = {{'F',0}},
+    std::function<void(const gcd::block_t)> finish_callback_f_)
+{
+    return program_to_steps_with_jerk(prog_, conf_, ml_, initial_state_, finish_callback_f_, nullptr);
+}
+
+
+namespace {
+/**
+ * the steps stream of the variable_interval generator. Every step is the timed command that
+ * waits until the time of the next step, so the step is executed at the exact moment and not
+ * on the nearest tick.
+ */
+struct timed_steps_t {
+    hardware::multistep_commands_t result;
+    hardware::multistep_command last = {}; ///< the last step, its delay is known when the next step comes
+    bool has_last = false;
+    double last_time = 0.0; ///< the time of the last step in seconds
+    double time = 0.0;      ///< the time of the start of the current move in seconds
+
+    /// appends the timed command. The long delays are split and the same consecutive commands are merged
+    void append(hardware::multistep_command c, int64_t delay_ns)
+    {
+        using namespace raspigcd::hardware;
+        auto push = [this](multistep_command c, int delay, int count) {
+            c.delay_ns = delay;
+            c.count = count;
+            if (result.size() && multistep_command_same_command(c, result.back()) && (result.back().count <= 0x0fffffff - count))
+                result.back().count += count;
+            else
+                result.push_back(c);
+        };
+        delay_ns = std::max((int64_t)1, delay_ns);
+        if (delay_ns <= multistep_command_max_delay_ns) {
+            push(c, delay_ns, 1);
+            return;
+        }
+        push(c, multistep_command_max_delay_ns, 1);
+        delay_ns -= multistep_command_max_delay_ns;
+        multistep_command wait = {};
+        if (delay_ns / multistep_command_max_delay_ns) push(wait, multistep_command_max_delay_ns, delay_ns / multistep_command_max_delay_ns);
+        if (delay_ns % multistep_command_max_delay_ns) push(wait, delay_ns % multistep_command_max_delay_ns, 1);
+    }
+
+    /// the step at the time t seconds from the start of the stream
+    void step(const hardware::multistep_command& c, const double t)
+    {
+        if (has_last) {
+            // the times are rounded before the subtraction, so the equal intervals give equal delays
+            append(last, std::llround(t * 1000000000.0) - std::llround(last_time * 1000000000.0));
+        } else if (std::llround(t * 1000000000.0) > 0) {
+            append({}, std::llround(t * 1000000000.0));
+        }
+        last = c;
+        has_last = true;
+        last_time = t;
+    }
+
+    /// the last step waits till the end of the stream
+    hardware::multistep_commands_t finish()
+    {
+        if (has_last) {
+            append(last, std::llround(time * 1000000000.0) - std::llround(last_time * 1000000000.0));
+        } else if (std::llround(time * 1000000000.0) > 0) {
+            append({}, std::llround(time * 1000000000.0));
+        }
+        has_last = false;
+        return result;
+    }
+
+    /**
+     * generates the steps of the move of the length l. The position(s) is the point after s milimeters
+     * and time_at(s) is the time when this point is reached. The path is divided into n parts, so
+     * every motor moves at most one step in every part. The position is checked in the middle of
+     * the part, so the rounding on the step boundaries does not move the step to the next part.
+     */
+    void move(hardware::motor_layout& ml_, const double l, const int n, const double duration,
+        const std::function<distance_t(double)>& position, const std::function<double(double)>& time_at)
+    {
+        hardware::multistep_commands_t steps_todo;
+        auto p_steps = ml_.cartesian_to_steps(position(0.0));
+        double p_t = time;
+        for (int i = 1; i <= n; i++) {
+            auto pos = ml_.cartesian_to_steps(position((i < n) ? (l * (i + 0.5) / n) : l));
+            if (pos == p_steps) continue;
+            movement::simple_steps::chase_steps(steps_todo, p_steps, pos);
+            double t = time + time_at((i < n) ? (l * i / n) : l);
+            // more than one step in the part is spread over the part
+            int k = 0;
+            for (const auto& c : steps_todo)
+                k += c.count;
+            int j = 0;
+            for (auto c : steps_todo) {
+                int count = c.count;
+                c.count = 1;
+                for (int m = 0; m < count; m++, j++)
+                    step(c, p_t + (t - p_t) * (j + 1) / k);
+            }
+            steps_todo.clear();
+            p_steps = pos;
+            p_t = t;
+        }
+        time += duration;
+    }
+};
+
+/// the time when the distance s is reached on the S-curve. The curve distance grows with time, so the bisection is used
+double s_curve_time_at(const movement::physics::s_curve_t& curve, const double s)
+{
+    double t0 = 0.0;
+    double t1 = curve.T;
+    if (curve.distance(t1) <= s) return t1;
+    for (int i = 0; i < 48; i++) {
+        double t = (t0 + t1) * 0.5;
+        if (curve.distance(t) < s)
+            t0 = t;
+        else
+            t1 = t;
+    }
+    return (t0 + t1) * 0.5;
+}
+
+/// the maximal number of steps of any motor for the move of 1mm in any direction
+double max_steps_per_mm(hardware::motor_layout& ml_)
+{
+    const auto zero = ml_.cartesian_to_steps(distance_t{0.0, 0.0, 0.0, 0.0});
+    std::array<double, 4> squares = {0.0, 0.0, 0.0, 0.0};
+    for (unsigned axis = 0; axis < 4; axis++) {
+        distance_t d{0.0, 0.0, 0.0, 0.0};
+        d[axis] = 1000.0;
+        auto st = ml_.cartesian_to_steps(d);
+        for (unsigned m = 0; m < 4; m++)
+            squares[m] += std::pow((st[m] - zero[m]) / 1000.0, 2);
+    }
+    return std::sqrt(*std::max_element(squares.begin(), squares.end()));
+}
+} // namespace
+
+/**
+ * the steps generator that gives every step its own time (see multistep_command::delay_ns). The
+ * velocity profiles are the same as in program_to_steps, but the steps are not quantized to ticks,
+ * so the velocity is smoother, the steps can be faster than one per tick and the slow moves
+ * do not produce the empty ticks.
+ */
+hardware::multistep_commands_t variable_interval_program_to_steps_with_jerk(
+    const gcd::program_t& prog_,
+    const configuration::actuators_organization&,
+    hardware::motor_layout& ml_,
+    const gcd::block_t initial_state_,
+    std::function<void(const gcd::block_t)> finish_callback_f_,
+    const configuration::limits* jerk_limits_)
+{
+    using namespace raspigcd::gcd;
+    using namespace movement::physics;
+    auto state = initial_state_;
+    timed_steps_t timed_steps;
+    const double steps_per_mm = max_steps_per_mm(ml_);
+    auto max_steps_between = [&ml_](const distance_t& a, const distance_t& b) {
+        auto sa = ml_.cartesian_to_steps(a);
+        auto sb = ml_.cartesian_to_steps(b);
+        int n = 0;
+        for (unsigned m = 0; m < sa.size(); m++)
+            n = std::max(n, std::abs(sb[m] - sa[m]));
+        return n;
+    };
+    for (const auto& block : prog_) {
+        finish_callback_f_(state);
+        auto next_state = gcd::merge_blocks(state, block);
+
+        if (next_state.at('G') == 92) {
+            // change position, but not generate steps
+        } else if (next_state.at('G') == 4) {
+            if (block.count('X')) { // seconds
+                timed_steps.time += block.at('X');
+            } else if (block.count('P')) {
+                timed_steps.time += block.at('P') / 1000.0;
+            }
+            next_state = state;
+        } else if ((next_state.at('G') == 1) || (next_state.at('G') == 0)) {
+            auto pos_from = gcd::block_to_distance_t(state);
+            auto pos_to = gcd::block_to_distance_t(next_state);
+            double l = (pos_to - pos_from).length();
+            double v0 = state.at('F');
+            double v1 = next_state.at('F');
+            if (l > 0) {
+                if ((v0 == 0) && (v1 == 0)) throw std::invalid_argument("the feedrate should not be 0 for non zero distance");
+                double max_jerk = 0.0;
+                if (jerk_limits_ != nullptr) max_jerk = jerk_limits_->proportional_max_jerk_mm_s3(pos_to - pos_from);
+                auto direction = (pos_to - pos_from) / l;
+                auto position = [&](double s) { return (s < l) ? (pos_from + direction * s) : pos_to; };
+                const int n = max_steps_between(pos_from, pos_to);
+                if (v0 == v1) {
+                    timed_steps.move(ml_, l, n, l / v1, position, [v1](double s) { return s / v1; });
+                } else if (max_jerk > 0) {
+                    const s_curve_t curve = s_curve_between(v0, v1, 2.0 * l / (v0 + v1), max_jerk);
+                    timed_steps.move(ml_, l, n, curve.T, position, [&curve](double s) { return s_curve_time_at(curve, s); });
+                } else {
+                    // constant acceleration, v0*t + a*t*t/2 = s
+                    const double a = (v1 * v1 - v0 * v0) / (2.0 * l);
+                    timed_steps.move(ml_, l, n, 2.0 * l / (v0 + v1), position, [v0, a](double s) {
+                        double d = std::sqrt(std::max(0.0, v0 * v0 + 2.0 * a * s));
+                        return ((v0 + d) > 0) ? (2.0 * s / (v0 + d)) : 0.0;
+                    });
+                }
+            }
+        } else if (gcd::is_arc_block(next_state)) {
+            const gcd::arc_t arc = gcd::block_to_arc(state, block);
+            const double l = arc.length();
+            double v0 = state.at('F');
+            double v1 = next_state.at('F');
+            if (l > 0) {
+                if ((v0 == 0) && (v1 == 0)) throw std::invalid_argument("the feedrate should not be 0 for non zero distance");
+                double max_jerk = (jerk_limits_ != nullptr) ? arc_max_jerk(arc, *jerk_limits_) : 0.0;
+                const s_curve_t curve = s_curve_between(v0, v1, 2.0 * l / (v0 + v1), max_jerk);
+                // the arc is not straight in the steps space, so the number of points comes from its length
+                const int n = std::max(max_steps_between(arc.start, arc.end), (int)std::ceil(l * steps_per_mm));
+                timed_steps.move(ml_, l, n, curve.T, [&arc, l](double s) { return (s < l) ? arc.point_at(s) : arc.end; },
+                    [&curve](double s) { return s_curve_time_at(curve, s); });
+            }
+        }
+        state = next_state;
+    }
+    finish_callback_f_(state);
+    return timed_steps.finish();
+}
+
+hardware::multistep_commands_t variable_interval_program_to_steps(
+    const gcd::program_t& prog_,
+    const configuration::actuators_organization& conf_,
+    hardware::motor_layout& ml_,
+    const gcd::block_t initial_state_,
+    std::function<void(const gcd::block_t)> finish_callback_f_)
+{
+    return variable_interval_program_to_steps_with_jerk(prog_, conf_, ml_, initial_state_, finish_callback_f_, nullptr);
+}
+
 
 hardware::multistep_commands_t bezier_spline_program_to_steps(
     const gcd::program_t& prog_,
@@ -205,7 +528,8 @@ hardware::multistep_commands_t bezier_spline_program_to_steps(
     std::vector<distance_with_velocity_t> distances;
 
     distances.push_back(block_to_distance_with_v_t(state));
-    for (const auto& block : prog_) {
+    // the spline and interpolation work on points, so arcs are replaced by short lines
+    for (const auto& block : linearize_arcs(prog_, arc_linearization_error_mm, state)) {
         finish_callback_f_(state);
         auto next_state = gcd::merge_blocks(state, block);
 
@@ -292,7 +616,8 @@ hardware::multistep_commands_t linear_interpolation_to_steps(
     distances.reserve(1000000);
 
     distances.push_back(block_to_distance_with_v_t(state));
-    for (const auto& block : prog_) {
+    // the spline and interpolation work on points, so arcs are replaced by short lines
+    for (const auto& block : linearize_arcs(prog_, arc_linearization_error_mm, state)) {
         finish_callback_f_(state);
         auto next_state = gcd::merge_blocks(state, block);
 
@@ -391,8 +716,37 @@ switch(f_name) {
 case configuration::steps_generator_e::PROGRAM_TO_STEPS:return program_to_steps; break;
 case configuration::steps_generator_e::BEZIER_SPLINE:return bezier_spline_program_to_steps; break;
 case configuration::steps_generator_e::LINEAR_INTERPOLATION: return linear_interpolation_to_steps; break;
-default:     throw std::invalid_argument("bad function name - available are program_to_steps bezier_spline linear_interpolation");
+case configuration::steps_generator_e::VARIABLE_INTERVAL: return variable_interval_program_to_steps; break;
+default:     throw std::invalid_argument("bad function name - available are program_to_steps bezier_spline linear_interpolation variable_interval");
+}
 }
+
+program_to_steps_f_t program_to_steps_factory(const configuration::global& cfg_)
+{
+    bool jerk_limited = false;
+    for (auto j : cfg_.max_jerk_mm_s3)
+        jerk_limited = jerk_limited || (j > 0);
+    if (((cfg_.steps_generator != configuration::steps_generator_e::PROGRAM_TO_STEPS) &&
+            (cfg_.steps_generator != configuration::steps_generator_e::VARIABLE_INTERVAL)) ||
+        !jerk_limited)
+        return program_to_steps_factory(cfg_.steps_generator);
+    configuration::limits jerk_limits = cfg_;
+    if (cfg_.steps_generator == configuration::steps_generator_e::VARIABLE_INTERVAL) {
+        return [jerk_limits](const gcd::program_t& prog_,
+                   const configuration::actuators_organization& conf_,
+                   hardware::motor_layout& ml_,
+                   const gcd::block_t initial_state_,
+                   std::function<void(const gcd::block_t)> finish_callback_f_) {
+            return variable_interval_program_to_steps_with_jerk(prog_, conf_, ml_, initial_state_, finish_callback_f_, &jerk_limits);
+        };
+    }
+    return [jerk_limits](const gcd::program_t& prog_,
+               const configuration::actuators_organization& conf_,
+               hardware::motor_layout& ml_,
+               const gcd::block_t initial_state_,
+               std::function<void(const gcd::block_t)> finish_callback_f_) {
+        return program_to_steps_with_jerk(prog_, conf_, ml_, initial_state_, finish_callback_f_, &jerk_limits);
+    };
 }
 
 
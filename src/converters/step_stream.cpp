@@ -0,0 +1,214 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <converters/step_stream.hpp>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace raspigcd {
+namespace converters {
+
+static_assert(sizeof(step_stream_header_t) == 104, "the step stream header layout must not change");
+static_assert(sizeof(step_stream_record_t) == 40, "the step stream record layout must not change");
+static_assert((sizeof(hardware::multistep_command) % 8) == 0, "records must stay aligned after commands");
+
+step_stream_header_t step_stream_header(const configuration::global& cfg_)
+{
+    step_stream_header_t header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, STEP_STREAM_MAGIC, sizeof(header.magic));
+    header.version = STEP_STREAM_VERSION;
+    header.byte_order = STEP_STREAM_BYTE_ORDER;
+    header.command_size = sizeof(hardware::multistep_command);
+    header.tick_duration_us = cfg_.tick_duration_us;
+    header.motion_layout = cfg_.motion_layout;
+    header.laser = ((cfg_.spindles.size() > 0) && (cfg_.spindles.at(0).mode == configuration::spindle_modes::LASER)) ? 1 : 0;
+    header.steppers = cfg_.steppers.size();
+    for (unsigned i = 0; (i < 4) && (i < cfg_.steppers.size()); i++)
+        header.steps_per_mm[i] = cfg_.steppers[i].steps_per_mm;
+    for (unsigned i = 0; (i < 4) && (i < cfg_.scale.size()); i++)
+        header.scale[i] = cfg_.scale[i];
+    return header;
+}
+
+void step_stream_validate(const step_stream_header_t& header_, const configuration::global& cfg_)
+{
+    const step_stream_header_t expected = step_stream_header(cfg_);
+    std::stringstream differences;
+    if (header_.tick_duration_us != expected.tick_duration_us)
+        differences << " tick_duration_us " << header_.tick_duration_us << "!=" << expected.tick_duration_us << ";";
+    if (header_.motion_layout != expected.motion_layout)
+        differences << " motion_layout " << header_.motion_layout << "!=" << expected.motion_layout << ";";
+    if (header_.laser != expected.laser)
+        differences << " laser mode of spindle 0 " << header_.laser << "!=" << expected.laser << ";";
+    if (header_.steppers != expected.steppers)
+        differences << " steppers count " << header_.steppers << "!=" << expected.steppers << ";";
+    for (unsigned i = 0; i < 4; i++) {
+        if (header_.steps_per_mm[i] != expected.steps_per_mm[i])
+            differences << " steps_per_mm[" << i << "] " << header_.steps_per_mm[i] << "!=" << expected.steps_per_mm[i] << ";";
+        if (header_.scale[i] != expected.scale[i])
+            differences << " scale[" << i << "] " << header_.scale[i] << "!=" << expected.scale[i] << ";";
+    }
+    if (differences.str().size() > 0)
+        throw std::invalid_argument("step stream was calculated for different configuration:" + differences.str());
+}
+
+step_stream_writer::step_stream_writer(const std::string& filename_, const configuration::global& cfg_)
+{
+    _filename = filename_;
+    _out.open(filename_, std::ios::binary | std::ios::trunc);
+    if (!_out.is_open()) throw std::runtime_error("step_stream_writer: could not open file \"" + filename_ + "\"");
+    step_stream_header_t header = step_stream_header(cfg_);
+    _out.write((const char*)&header, sizeof(header));
+}
+
+void step_stream_writer::write_record(const step_stream_record_t& record_)
+{
+    _out.write((const char*)&record_, sizeof(record_));
+}
+
+void step_stream_writer::steps(const hardware::multistep_commands_t& commands_, const bool continues_motion_)
+{
+    step_stream_record_t record = {STEP_STREAM_STEPS, continues_motion_ ? 1 : 0, (std::int64_t)commands_.size(), {0.0, 0.0, 0.0}};
+    write_record(record);
+    _out.write((const char*)commands_.data(), commands_.size() * sizeof(hardware::multistep_command));
+}
+
+void step_stream_writer::m_code(const gcd::block_t& m_)
+{
+    int code = (int)(m_.at('M'));
+    if ((code != 3) && (code != 5) && (code != 17) && (code != 18)) return;
+    double p = -1.0;
+    if (m_.count('P')) {
+        p = m_.at('P');
+    } else if (m_.count('X')) {
+        p = 1000 * m_.at('X');
+    }
+    write_record({STEP_STREAM_M, code, 0, {p, 0.0, 0.0}});
+}
+
+void step_stream_writer::set_position(const gcd::block_t& g92_)
+{
+    step_stream_record_t record = {STEP_STREAM_G92, 0, 0, {0.0, 0.0, 0.0}};
+    const char axes[3] = {'X', 'Y', 'Z'};
+    for (int i = 0; i < 3; i++) {
+        if (g92_.count(axes[i])) {
+            record.code |= 1 << i;
+            record.values[i] = g92_.at(axes[i]);
+        }
+    }
+    write_record(record);
+}
+
+void step_stream_writer::finish()
+{
+    write_record({STEP_STREAM_END, 0, 0, {0.0, 0.0, 0.0}});
+    _out.close();
+    if (_out.fail()) throw std::runtime_error("step_stream_writer: could not write file \"" + _filename + "\"");
+}
+
+step_stream_reader::step_stream_reader(const std::string& filename_)
+{
+    _fd = open(filename_.c_str(), O_RDONLY);
+    if (_fd < 0) throw std::invalid_argument("step_stream_reader: open " + filename_ + ": " + std::strerror(errno));
+    struct stat st;
+    if ((fstat(_fd, &st) != 0) || ((std::size_t)st.st_size < sizeof(step_stream_header_t))) {
+        close(_fd);
+        throw std::invalid_argument("step_stream_reader: " + filename_ + " is not the step stream");
+    }
+    _size = st.st_size;
+    _data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (_data == MAP_FAILED) {
+        close(_fd);
+        throw std::invalid_argument("step_stream_reader: mmap " + filename_ + ": " + std::strerror(errno));
+    }
+    // the commands are read once from the beginning to the end
+    madvise(_data, _size, MADV_SEQUENTIAL);
+
+    auto fail = [this, &filename_](const std::string& reason) {
+        munmap(_data, _size);
+        close(_fd);
+        throw std::invalid_argument("step_stream_reader: " + filename_ + ": " + reason);
+    };
+    const step_stream_header_t& h = header();
+    if (std::memcmp(h.magic, STEP_STREAM_MAGIC, sizeof(h.magic)) != 0) fail("it is not the step stream");
+    if (h.version != STEP_STREAM_VERSION) fail("unsupported version " + std::to_string(h.version));
+    if (h.byte_order != STEP_STREAM_BYTE_ORDER) fail("the stream was created on the machine with different byte order");
+    if (h.command_size != sizeof(hardware::multistep_command)) fail("the stream was created for different multistep command size");
+
+    const char* p = (const char*)_data + sizeof(step_stream_header_t);
+    const char* end = (const char*)_data + _size;
+    while (true) {
+        if ((std::size_t)(end - p) < sizeof(step_stream_record_t)) fail("the stream is truncated");
+        const step_stream_record_t* record = (const step_stream_record_t*)p;
+        p += sizeof(step_stream_record_t);
+        if (record->type == STEP_STREAM_END) break;
+        switch (record->type) {
+        case STEP_STREAM_STEPS: {
+            if ((record->count < 0) || ((std::size_t)record->count > (std::size_t)(end - p) / sizeof(hardware::multistep_command)))
+                fail("the stream is truncated");
+            _events.push_back({record, (const hardware::multistep_command*)p});
+            p += record->count * sizeof(hardware::multistep_command);
+        } break;
+        case STEP_STREAM_M:
+        case STEP_STREAM_G92:
+            _events.push_back({record, nullptr});
+            break;
+        default:
+            fail("unknown record type " + std::to_string(record->type));
+        }
+    }
+}
+
+step_stream_reader::~step_stream_reader()
+{
+    munmap(_data, _size);
+    close(_fd);
+}
+
+gcd::block_t step_stream_record_to_m_block(const step_stream_record_t& record_)
+{
+    gcd::block_t m = {{'M', record_.code}};
+    if (record_.values[0] >= 0.0) m['P'] = record_.values[0];
+    return m;
+}
+
+gcd::block_t step_stream_record_to_g92_block(const step_stream_record_t& record_)
+{
+    gcd::block_t g92 = {{'G', 92}};
+    const char axes[3] = {'X', 'Y', 'Z'};
+    for (int i = 0; i < 3; i++)
+        if (record_.code & (1 << i)) g92[axes[i]] = record_.values[i];
+    return g92;
+}
+
+} // namespace converters
+} // namespace raspigcd
@@ -3,7 +3,9 @@
 #include <converters/gcd_program_to_steps.hpp>
 #include <gcd/remove_g92_from_gcode.hpp>
 #include <hardware/driver/inmem.hpp>
+#include <hardware/driver/button_events_gpio_chardev.hpp>
 #include <hardware/driver/low_buttons_fake.hpp>
+#include <hardware/driver/low_buttons_gpio_events.hpp>
 #include <hardware/driver/low_spindles_pwm_fake.hpp>
 #include <hardware/driver/low_timers_busy_wait.hpp>
 #include <hardware/driver/low_timers_fake.hpp>
@@ -27,10 +29,22 @@ using namespace raspigcd::gcd;
 /// Visualization part
 #ifdef HAVE_SDL2
 #include <SDL2/SDL.h>
+#include <ring_buffer.hpp>
 #include <video.hpp>
 class video_sdl
 {
 public:
+    /// decimated point of the tool track, published by the stepping thread
+    struct track_point_t {
+        distance_t p;
+    };
+    /// run of the track drawn with one color and one primitive
+    struct track_batch_t {
+        Uint8 r, g, b;
+        bool lines;                      ///< working moves are lines, moves above the work are sparse points
+        std::vector<distance_t> points;  ///< world coordinates, so the batch survives view changes
+    };
+
     std::shared_ptr<SDL_Window> window;
     std::shared_ptr<SDL_Renderer> renderer;
 
@@ -39,12 +53,18 @@ public:
 
     std::thread loop_thread;
 
-    distance_t current_position;
+    // producer (stepping thread) side
+    spsc_ring_c<track_point_t> track_ring;
+    distance_t last_published; ///< last position pushed to the ring
+    steps_t position_for_fake;
 
-    std::list<distance_t> movements_track;
-    steps_t steps_scale;
+    // consumer (render thread) side
+    std::vector<track_batch_t> batches;
+    distance_t current_position;
+    std::size_t drawn_batch;  ///< first batch not fully rendered into the texture
+    std::size_t drawn_points; ///< points of drawn_batch already rendered
+    std::vector<SDL_Point> screen_points;
 
-    std::mutex list_mutex;
     configuration::global* cfg;
     std::shared_ptr<motor_layout> ml;
     driver::low_buttons_fake* buttons_drv;
@@ -55,80 +75,117 @@ public:
     int view_y;
     int scale_view;
 
-    steps_t position_for_fake;
-
     bool dragging_view = false;
     bool scaling_view = false;
 
     std::vector<int> previous_button_state;
 
+    /**
+     * called from the stepping loop on every step. It must not wait for the renderer,
+     * so the position is published only when it moved by at least 0.1mm and when the
+     * ring is full the point is skipped (the next one will be connected with a line).
+     */
     void set_steps(const steps_t& st)
     {
-        if (!(position_for_fake == st)) {
-            current_position = ml->steps_to_cartesian(st);
-            steps_t reduced_a;
-            steps_t reduced_b;
-
-            std::lock_guard<std::mutex> guard(list_mutex);
-            for (std::size_t i = 0; i < current_position.size(); i++) {
-                reduced_a[i] = current_position[i] * 10.0;       ///(int)(cfg->steppers[i].steps_per_mm);
-                reduced_b[i] = movements_track.back()[i] * 10.0; ///(int)(cfg->steppers[i].steps_per_mm);
-            }
-            if (!(reduced_a == reduced_b)) {
-                movements_track.push_back(current_position);
-            }
+        if (position_for_fake == st) return;
+        position_for_fake = st;
+        distance_t p = ml->steps_to_cartesian(st);
 
-            if (current_position[0] < -1000) { // 1000mm left
-                if (previous_button_state[0] != 1) buttons_drv->trigger_button_down(0);
-                previous_button_state[0] = 1;
-            } else {
-                if (previous_button_state[0] != 0) buttons_drv->trigger_button_up(0);
-                previous_button_state[0] = 0;
-            }
-            if (current_position[1] > 1000) { // 10mm forward (y positive)
-                if (previous_button_state[1] != 1) buttons_drv->trigger_button_down(1);
-                previous_button_state[1] = 1;
-            } else {
-                if (previous_button_state[1] != 0) buttons_drv->trigger_button_up(1);
-                previous_button_state[1] = 0;
-            }
-            if (current_position[2] > 900) { // 90mm up
-                if (previous_button_state[2] != 1) buttons_drv->trigger_button_down(2);
-                previous_button_state[2] = 1;
-            } else {
-                if (previous_button_state[2] != 0) buttons_drv->trigger_button_up(2);
-                previous_button_state[2] = 0;
+        bool moved = false;
+        for (std::size_t i = 0; i < p.size(); i++) {
+            if ((long)(p[i] * 10.0) != (long)(last_published[i] * 10.0)) {
+                moved = true;
+                break;
             }
         }
+        if (moved && track_ring.try_push({p})) last_published = p;
+
+        if (p[0] < -1000) { // 1000mm left
+            if (previous_button_state[0] != 1) buttons_drv->trigger_button_down(0);
+            previous_button_state[0] = 1;
+        } else {
+            if (previous_button_state[0] != 0) buttons_drv->trigger_button_up(0);
+            previous_button_state[0] = 0;
+        }
+        if (p[1] > 1000) { // 10mm forward (y positive)
+            if (previous_button_state[1] != 1) buttons_drv->trigger_button_down(1);
+            previous_button_state[1] = 1;
+        } else {
+            if (previous_button_state[1] != 0) buttons_drv->trigger_button_up(1);
+            previous_button_state[1] = 0;
+        }
+        if (p[2] > 900) { // 90mm up
+            if (previous_button_state[2] != 1) buttons_drv->trigger_button_down(2);
+            previous_button_state[2] = 1;
+        } else {
+            if (previous_button_state[2] != 0) buttons_drv->trigger_button_up(2);
+            previous_button_state[2] = 0;
+        }
+    }
 
-        position_for_fake = st;
+    SDL_Point to_screen(const distance_t& e) const
+    {
+        return {(int)((e[0] * 1000 / scale_view + view_x) + e[2] * z_p_x / scale_view),
+            (int)((-e[1] * 1000 / scale_view + view_y) - e[2] * z_p_y / scale_view)};
     }
 
-    void draw_path(std::shared_ptr<SDL_Renderer> renderer, int width, int /*height*/, const std::list<distance_t>& t)
+    /**
+     * moves the points published by the stepping thread into the batches
+     */
+    void drain_track()
     {
-        static std::random_device dev;
-        static std::mt19937 rng(dev());
-        static std::uniform_int_distribution<std::mt19937::result_type> draw_upper(0, 100); // distribution in range [1, 6]
-
-
-        std::map<int, int> z_buffer;
-
-        for (auto& e : t) {
-            double x = e[0];
-            double y = e[1];
-            double z = e[2];
-            if ((e[2] <= 0) || (draw_upper(rng) == 0)) {
-                //                if ((z_buffer.count(y * width + x) == 0) || (z_buffer[y * width + x] >= z)) {
-                if (true) { //(z_buffer.count(y * width + x) == 0) || (z_buffer[y * width + x] >= z)) {
-                    SDL_SetRenderDrawColor(renderer.get(), 255 - (e[2] * 255 / 5), 255, 255, 255);
-                    SDL_RenderDrawPoint(renderer.get(), (x * 1000 / scale_view + view_x) + z * z_p_x / scale_view, (-y * 1000 / scale_view + view_y) - z * z_p_y / scale_view);
-                    z_buffer[y * width + x] = z;
-                }
+        track_ring.consume_all([this](const track_point_t& tp) {
+            const distance_t& e = tp.p;
+            bool lines = e[2] <= 0;
+            Uint8 r = (Uint8)std::max(0.0, std::min(255.0, 255 - (e[2] * 255 / 5)));
+            if (!lines) r = 96;
+            // colors are quantized, so the batches stay long
+            r &= 0xf0;
+            if (batches.size() == 0 || batches.back().lines != lines || batches.back().r != r) {
+                track_batch_t b{r, 255, 255, lines, {}};
+                // new batch starts where the previous one ended to keep the line continuous
+                if (lines) b.points.push_back(current_position);
+                batches.push_back(b);
             }
+            batches.back().points.push_back(e);
+            current_position = e;
+        });
+    }
+
+    /**
+     * renders batches starting from given batch and point. Lines are drawn from the
+     * point before the first one, so the continuation joins the already drawn part.
+     */
+    void draw_batches(SDL_Renderer* r, std::size_t from_batch, std::size_t from_point)
+    {
+        for (std::size_t bi = from_batch; bi < batches.size(); bi++) {
+            auto& b = batches[bi];
+            std::size_t start = (bi == from_batch) ? from_point : 0;
+            if (start >= b.points.size()) continue;
+            if (b.lines && start > 0) start--;
+            screen_points.clear();
+            if (b.lines) {
+                for (std::size_t i = start; i < b.points.size(); i++)
+                    screen_points.push_back(to_screen(b.points[i]));
+            } else {
+                // travel above the work area is only sketched
+                for (std::size_t i = start; i < b.points.size(); i++)
+                    if ((i % 16) == 0) screen_points.push_back(to_screen(b.points[i]));
+            }
+            if (screen_points.size() == 0) continue;
+            SDL_SetRenderDrawColor(r, b.r, b.g, b.b, 255);
+            if (b.lines && screen_points.size() > 1)
+                SDL_RenderDrawLines(r, screen_points.data(), (int)screen_points.size());
+            else
+                SDL_RenderDrawPoints(r, screen_points.data(), (int)screen_points.size());
+        }
+        if (batches.size()) {
+            drawn_batch = batches.size() - 1;
+            drawn_points = batches.back().points.size();
         }
     }
 
-    video_sdl(configuration::global* cfg_, driver::low_buttons_fake* buttons_drv_, int width = 640, int height = 480)
+    video_sdl(configuration::global* cfg_, driver::low_buttons_fake* buttons_drv_, int width = 640, int height = 480) : track_ring(1 << 16)
     {
         if (SDL_Init(SDL_INIT_VIDEO) != 0) throw std::invalid_argument("SDL_Init");
         previous_button_state.resize(100);
@@ -143,8 +200,10 @@ public:
         view_x = width / 2;
         view_y = height / 2;
 
+        drawn_batch = 0;
+        drawn_points = 0;
+
         ml = motor_layout::get_instance(*cfg);
-        movements_track.push_back(distance_t());
         loop_thread = std::thread([this, width, height]() {
             std::cout << "loop thread..." << std::endl;
 
@@ -156,11 +215,16 @@ public:
                 });
             if (window == nullptr) throw std::invalid_argument("SDL_CreateWindow - error");
 
-            renderer = std::shared_ptr<SDL_Renderer>(SDL_CreateRenderer(window.get(), -1, SDL_RENDERER_ACCELERATED), [](SDL_Renderer* ptr) {
+            renderer = std::shared_ptr<SDL_Renderer>(SDL_CreateRenderer(window.get(), -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE), [](SDL_Renderer* ptr) {
                 SDL_DestroyRenderer(ptr);
             });
             if (renderer == nullptr) throw std::invalid_argument("SDL_CreateRenderer");
 
+            // the track is accumulated in the texture, only the new part is drawn every frame
+            std::shared_ptr<SDL_Texture> track_texture;
+            int texture_w = 0, texture_h = 0;
+            std::array<int, 3> drawn_view = {view_x, view_y, scale_view};
+
             for (; active;) {
                 SDL_Event event;
                 while (SDL_PollEvent(&event)) {
@@ -214,20 +278,46 @@ public:
                         break;
                     }
                 }
-
-                SDL_SetRenderDrawColor(renderer.get(), 0, 0, 0, 255);
-                SDL_RenderClear(renderer.get());
-
-                SDL_SetRenderDrawColor(renderer.get(), 255, 255, 255, 255);
-                distance_t s;
-                std::list<distance_t> t;
-
-                {
-                    std::lock_guard<std::mutex> guard(list_mutex);
-                    s = current_position;
-                    t = movements_track;
+                if (scale_view == 0) scale_view = 1;
+
+                drain_track();
+
+                int out_w, out_h;
+                SDL_GetRendererOutputSize(renderer.get(), &out_w, &out_h);
+                bool full_redraw = false;
+                if (SDL_RenderTargetSupported(renderer.get()) && ((track_texture == nullptr) || (out_w != texture_w) || (out_h != texture_h))) {
+                    track_texture = std::shared_ptr<SDL_Texture>(
+                        SDL_CreateTexture(renderer.get(), SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, out_w, out_h),
+                        [](SDL_Texture* ptr) {
+                            if (ptr) SDL_DestroyTexture(ptr);
+                        });
+                    texture_w = out_w;
+                    texture_h = out_h;
+                    full_redraw = true;
+                }
+                std::array<int, 3> view = {view_x, view_y, scale_view};
+                if (view != drawn_view) full_redraw = true;
+                drawn_view = view;
+
+                if (track_texture) {
+                    SDL_SetRenderTarget(renderer.get(), track_texture.get());
+                    if (full_redraw) {
+                        SDL_SetRenderDrawColor(renderer.get(), 0, 0, 0, 255);
+                        SDL_RenderClear(renderer.get());
+                        draw_batches(renderer.get(), 0, 0);
+                    } else {
+                        draw_batches(renderer.get(), drawn_batch, drawn_points);
+                    }
+                    SDL_SetRenderTarget(renderer.get(), nullptr);
+                    SDL_RenderCopy(renderer.get(), track_texture.get(), nullptr, nullptr);
+                } else {
+                    // no render targets - draw everything, but still in batches
+                    SDL_SetRenderDrawColor(renderer.get(), 0, 0, 0, 255);
+                    SDL_RenderClear(renderer.get());
+                    draw_batches(renderer.get(), 0, 0);
                 }
-                draw_path(renderer, width, height, t);
+
+                distance_t s = current_position;
                 SDL_SetRenderDrawColor(renderer.get(), std::min(255.0, spindle_power * 255), 255 - (std::min(255.0, spindle_power * 255)), 0, 255);
                 for (double i = 0; i < 1.0; i += 0.05) {
                     SDL_RenderDrawPoint(renderer.get(),
@@ -241,6 +331,7 @@ public:
                     o << "" << s[0] << "\n"
                       << s[1] << "\n"
                       << s[2] << "\n view: " << view_x << "," << view_y << " s: " << scale_view;
+                    if (track_ring.dropped()) o << "\n skipped track points: " << track_ring.dropped();
                     sdl_draw_text(renderer.get(), 5, 5, o.str());
                 }
                 SDL_RenderPresent(renderer.get());
@@ -314,7 +405,13 @@ execution_objects_t stepping_simple_timer_factory(configuration::global cfg)
         auto rp = std::make_shared<driver::raspberry_pi_3>(cfg);
         steppers_drv = rp;
         spindles_drv = rp;
-        buttons_drv = rp;
+        if (cfg.buttons_driver == configuration::low_buttons_e::BUTTONS_GPIO_EVENTS) {
+            buttons_drv = std::make_shared<driver::low_buttons_gpio_events>(
+                std::make_shared<driver::button_events_gpio_chardev>(cfg.buttons),
+                std::chrono::microseconds(cfg.button_debounce_us));
+        } else {
+            buttons_drv = rp;
+        }
     } catch (const std::invalid_argument &e) {
         std::cerr << "verry bad runtime error. Please check configuration file: " << e.what() << std::endl;
 	throw e;
@@ -361,7 +458,24 @@ execution_objects_t stepping_simple_timer_factory(configuration::global cfg)
         timer_drv = std::make_shared<hardware::driver::low_timers_fake>();
         break;
     }
+    std::shared_ptr<telemetry_writer> telemetry;
+    if (cfg.telemetry_shm.size() > 0) {
+        try {
+            telemetry = std::make_shared<telemetry_writer>(cfg.telemetry_shm, cfg.telemetry_interval_us);
+            // spindle power is published when it is set
+            auto spindles_drv_inner = spindles_drv;
+            spindles_drv = std::make_shared<raspigcd::hardware::driver::low_spindles_pwm_fake>(
+                [spindles_drv_inner, telemetry](const int s_i, const double p_i) {
+                    spindles_drv_inner->spindle_pwm_power(s_i, p_i);
+                    telemetry->publish_spindle(s_i, p_i);
+                });
+        } catch (const std::runtime_error& e) {
+            std::cerr << "stepping_simple_timer_factory: telemetry is disabled: " << e.what() << std::endl;
+        }
+    }
     std::shared_ptr<stepping_simple_timer> stepping = std::make_shared<stepping_simple_timer>(cfg, steppers_drv, timer_drv);
+    stepping->set_telemetry(telemetry);
+    stepping->set_low_level_spindles_pwm(spindles_drv);
 #ifdef HAVE_SDL2
     if (enable_video)
         video = std::make_shared<video_sdl>(&cfg, (driver::low_buttons_fake*)buttons_drv.get());
@@ -372,7 +486,8 @@ execution_objects_t stepping_simple_timer_factory(configuration::global cfg)
         spindles_drv,
         buttons_drv,
         motor_layout_,
-        stepping
+        stepping,
+        std::make_shared<metrics_registry>()
     };
 }
 } // namespace raspigcd
@@ -0,0 +1,218 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <gcd/arcs.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace raspigcd {
+namespace gcd {
+
+static const double arc_angular_travel_epsilon = 5e-7;
+
+double arc_t::length() const
+{
+    double planar = std::abs(sweep) * (start_radius + end_radius) * 0.5;
+    double dz = end[2] - start[2];
+    return std::sqrt(planar * planar + dz * dz);
+}
+
+distance_t arc_t::point_at(double s) const
+{
+    double l = length();
+    if ((l <= 0) || (s >= l)) return end;
+    double t = std::max(0.0, s / l);
+    double angle = start_angle + sweep * t;
+    double r = start_radius + (end_radius - start_radius) * t;
+    distance_t p = start + (end - start) * t; // Z and A change linearly
+    p[0] = center[0] + r * std::cos(angle);
+    p[1] = center[1] + r * std::sin(angle);
+    return p;
+}
+
+distance_t arc_t::tangent_at(double s) const
+{
+    double l = length();
+    double t = (l > 0) ? std::max(0.0, std::min(1.0, s / l)) : 0.0;
+    double angle = start_angle + sweep * t;
+    double r = start_radius + (end_radius - start_radius) * t;
+    double dr = end_radius - start_radius;
+    distance_t d = end - start;
+    d[0] = dr * std::cos(angle) - r * std::sin(angle) * sweep;
+    d[1] = dr * std::sin(angle) + r * std::cos(angle) * sweep;
+    double dl = d.length();
+    return (dl > 0) ? d / dl : d;
+}
+
+arc_t block_to_arc(const block_t& state, const block_t& block)
+{
+    block_t next_state = merge_blocks(state, block);
+    if (!is_arc_block(next_state)) throw std::invalid_argument("block_to_arc: the move must be G2 or G3");
+    const bool clockwise = (int)next_state.at('G') == 2;
+    arc_t arc;
+    arc.start = block_to_distance_t(state);
+    arc.end = block_to_distance_t(next_state);
+    double x = arc.end[0] - arc.start[0];
+    double y = arc.end[1] - arc.start[1];
+    double i, j;
+    if (block.count('I') || block.count('J')) {
+        i = block.count('I') ? block.at('I') : 0.0;
+        j = block.count('J') ? block.at('J') : 0.0;
+    } else if (block.count('R')) {
+        double r = block.at('R');
+        double d = std::sqrt(x * x + y * y);
+        if (d == 0) throw std::invalid_argument("block_to_arc: the full circle cannot be given by R, use I and J");
+        double h_x2_div_d = 4.0 * r * r - x * x - y * y;
+        // small rounding errors in the gcode are accepted as a half circle
+        if (h_x2_div_d < -1e-6 * r * r) throw std::invalid_argument("block_to_arc: the radius R is too small for the given end point");
+        h_x2_div_d = -std::sqrt(std::max(0.0, h_x2_div_d)) / d;
+        if (!clockwise) h_x2_div_d = -h_x2_div_d;
+        if (r < 0) h_x2_div_d = -h_x2_div_d;
+        i = 0.5 * (x - y * h_x2_div_d);
+        j = 0.5 * (y + x * h_x2_div_d);
+    } else {
+        throw std::invalid_argument("block_to_arc: G2 and G3 need I and J or R");
+    }
+    arc.center = {arc.start[0] + i, arc.start[1] + j, 0, 0};
+    arc.start_radius = std::sqrt(i * i + j * j);
+    arc.end_radius = std::sqrt((arc.end[0] - arc.center[0]) * (arc.end[0] - arc.center[0]) +
+                               (arc.end[1] - arc.center[1]) * (arc.end[1] - arc.center[1]));
+    if (arc.start_radius <= 0) throw std::invalid_argument("block_to_arc: the radius cannot be 0");
+    if (std::abs(arc.end_radius - arc.start_radius) > std::max(0.005, 0.001 * arc.start_radius))
+        throw std::invalid_argument("block_to_arc: the end point is not on the arc");
+    // both angles are calculated the same way, so the full circle is not broken by -0.0
+    arc.start_angle = std::atan2(arc.start[1] - arc.center[1], arc.start[0] - arc.center[0]);
+    double end_angle = std::atan2(arc.end[1] - arc.center[1], arc.end[0] - arc.center[0]);
+    arc.sweep = end_angle - arc.start_angle;
+    if (clockwise) {
+        if (arc.sweep >= -arc_angular_travel_epsilon) arc.sweep -= 2.0 * M_PI;
+    } else {
+        if (arc.sweep <= arc_angular_travel_epsilon) arc.sweep += 2.0 * M_PI;
+    }
+    return arc;
+}
+
+std::vector<distance_t> arc_to_points(const arc_t& arc, double max_error_mm)
+{
+    double r = std::max(arc.start_radius, arc.end_radius);
+    std::size_t n = 1;
+    if (r > max_error_mm) {
+        double max_step_angle = 2.0 * std::acos(1.0 - max_error_mm / r);
+        n = std::max((std::size_t)1, (std::size_t)std::ceil(std::abs(arc.sweep) / max_step_angle));
+    } else {
+        n = 4;
+    }
+    std::vector<distance_t> ret;
+    ret.reserve(n);
+    double l = arc.length();
+    for (std::size_t k = 1; k < n; k++)
+        ret.push_back(arc.point_at(l * k / n));
+    ret.push_back(arc.end);
+    return ret;
+}
+
+/**
+ * the limits depend on direction, so the arc is checked in many points
+ */
+static configuration::proportional_limits::values_t arc_minimal_limits(const arc_t& arc, const configuration::limits& machine_limits)
+{
+    const configuration::proportional_limits plimits(machine_limits);
+    const int samples = std::max(8, (int)std::ceil(std::abs(arc.sweep) / (M_PI / 16.0)));
+    double l = arc.length();
+    auto ret = plimits.all(arc.tangent_at(0));
+    for (int k = 1; k <= samples; k++) {
+        auto values = plimits.all(arc.tangent_at(l * k / samples));
+        ret.max_accelerations_mm_s2 = std::min(ret.max_accelerations_mm_s2, values.max_accelerations_mm_s2);
+        ret.max_velocity_mm_s = std::min(ret.max_velocity_mm_s, values.max_velocity_mm_s);
+        ret.max_no_accel_velocity_mm_s = std::min(ret.max_no_accel_velocity_mm_s, values.max_no_accel_velocity_mm_s);
+        ret.max_jerk_mm_s3 = std::min(ret.max_jerk_mm_s3, values.max_jerk_mm_s3);
+    }
+    return ret;
+}
+
+double arc_max_velocity(const arc_t& arc, const configuration::limits& machine_limits)
+{
+    auto limits = arc_minimal_limits(arc, machine_limits);
+    double r = std::min(arc.start_radius, arc.end_radius);
+    return std::min(limits.max_velocity_mm_s, std::sqrt(limits.max_accelerations_mm_s2 * r));
+}
+
+double arc_max_acceleration(const arc_t& arc, const configuration::limits& machine_limits)
+{
+    return arc_minimal_limits(arc, machine_limits).max_accelerations_mm_s2;
+}
+
+double arc_max_jerk(const arc_t& arc, const configuration::limits& machine_limits)
+{
+    return arc_minimal_limits(arc, machine_limits).max_jerk_mm_s3;
+}
+
+std::pair<block_t, block_t> split_arc_block(const block_t& state, const block_t& block, double s)
+{
+    auto arc = block_to_arc(state, block);
+    auto p = arc.point_at(s);
+    block_t first = block;
+    block_t second = block;
+    first.erase('R');
+    second.erase('R');
+    first['X'] = p[0];
+    first['Y'] = p[1];
+    first['Z'] = p[2];
+    first['I'] = arc.center[0] - arc.start[0];
+    first['J'] = arc.center[1] - arc.start[1];
+    second['X'] = arc.end[0];
+    second['Y'] = arc.end[1];
+    second['Z'] = arc.end[2];
+    second['I'] = arc.center[0] - p[0];
+    second['J'] = arc.center[1] - p[1];
+    return {first, second};
+}
+
+program_t linearize_arcs(const program_t& program_, double max_error_mm, const block_t& initial_state)
+{
+    program_t ret;
+    ret.reserve(program_.size());
+    block_t state = merge_blocks({{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}}, initial_state);
+    for (const auto& block : program_) {
+        block_t next_state = merge_blocks(state, block);
+        if ((block.count('M') == 0) && is_arc_block(next_state)) {
+            for (const auto& p : arc_to_points(block_to_arc(state, block), max_error_mm)) {
+                block_t segment = distance_to_block(p);
+                segment['G'] = 1;
+                if (block.count('F')) segment['F'] = block.at('F');
+                ret.push_back(segment);
+            }
+            // the arc words are not modal
+            next_state.erase('I');
+            next_state.erase('J');
+            next_state.erase('R');
+        } else {
+            ret.push_back(block);
+        }
+        state = next_state;
+    }
+    return ret;
+}
+
+} // namespace gcd
+} // namespace raspigcd
@@ -19,6 +19,7 @@
 
 
 #include <gcd/gcode_interpreter.hpp>
+#include <gcd/parallel_for.hpp>
 
 //#include <memory>
 //#include <hardware/low_steppers.hpp>
@@ -29,10 +30,12 @@
 #include <cmath>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <map>
 #include <regex>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
 namespace raspigcd {
 namespace gcd {
@@ -110,7 +113,12 @@ block_t last_state_after_program_execution(const program_t& program_, const bloc
 
 program_t enrich_gcode_with_feedrate_commands(const program_t& program_, const configuration::global& cfg)
 {
-    auto program = program_;
+    return enrich_gcode_with_feedrate_commands(program_t(program_), cfg);
+}
+
+program_t enrich_gcode_with_feedrate_commands(program_t&& program_, const configuration::global& cfg)
+{
+    program_t program = std::move(program_);
     double previous_feedrate_g1 = 0.1;
 
     double g0_feedrate = *std::max_element(
@@ -125,7 +133,7 @@ program_t enrich_gcode_with_feedrate_commands(const program_t& program_, const c
                 } else {
                     g0_feedrate = p['F'];
                 }
-            } else if (p['G'] == 1) {
+            } else if ((p['G'] == 1) || (p['G'] == 2) || (p['G'] == 3)) { // arcs share the feedrate with G1
                 if (p.count('F')) {
                     previous_feedrate_g1 = p['F'];
                 } else {
@@ -138,84 +146,164 @@ program_t enrich_gcode_with_feedrate_commands(const program_t& program_, const c
 }
 
 
-partitioned_program_t insert_additional_nodes_inbetween(partitioned_program_t& partitioned_program_, const block_t& initial_state, const configuration::limits& machine_limits)
+namespace {
+/// inserts the additional nodes into one G part. The current_state is updated to the state after the part
+program_t insert_additional_nodes_into_part(const program_t& subprogram, block_t& current_state, const configuration::proportional_limits& plimits)
 {
     using namespace raspigcd::movement::physics;
-    partitioned_program_t ret;
-    auto current_state = merge_blocks({{'X', 0.0}, {'Y', 0.0}, {'Z', 0.0}, {'A', 0.0}, {'F', 0.1}}, initial_state);
-    for (const auto& subprogram : partitioned_program_) {
-        if (subprogram.size() > 0) {
-            if (subprogram[0].count('G')) {
-                program_t nsubprog;
-                nsubprog.reserve(subprogram.size() * 2);
-                for (const auto& block : subprogram) {
-                    //std::cout << "###############  G: " << block.at('G') << " ; state: "  << current_state['G'] << std::endl;
-                    if ((block.at('G') == 0) || (block.at('G') == 1)) {
-                        auto next_state = merge_blocks(current_state, block);
-                        distance_t move_vec = blocks_to_vector_move(current_state, next_state);
-                        if (move_vec.length() < 0.00000001) {
-                            nsubprog.push_back(block);
-                        } else {
-                            double max_accel = machine_limits.proportional_max_accelerations_mm_s2(move_vec);
-                            double max_no_acc_v = machine_limits.proportional_max_no_accel_velocity_mm_s(move_vec);
-                            path_node_t a = {block_to_distance_t(current_state), max_no_acc_v}; //current_state['F']};
-                            path_node_t b = {block_to_distance_t(next_state), next_state['F']};
-                            path_node_t transition_point = calculate_transition_point(
-                                a,
-                                b,
-                                max_accel);
-                            move_vec = move_vec * 0.5;
-                            if ((transition_point.p - a.p).length() < move_vec.length()) {
-                                //std::cout << "++ a.p " << a.p << "  transition_point.p " << transition_point.p << "   b.p " << b.p << std::endl;
-                                auto nmvect = (move_vec / move_vec.length()) * (transition_point.p - a.p).length();
-                                auto mid_state_a = merge_blocks(current_state, distance_to_block(a.p + nmvect));
-                                auto mid_state_b = merge_blocks(current_state, distance_to_block(b.p - nmvect));
-                                mid_state_a['F'] = mid_state_b['F'] = std::max(next_state['F'], current_state['F']);
-                                mid_state_a['G'] = mid_state_b['G'] = next_state['G'];
-                                nsubprog.push_back(mid_state_a);
-                                nsubprog.push_back(mid_state_b);
-                                nsubprog.push_back(next_state);
-                            } else {
-                                //std::cout << "-- a.p " << a.p << "  transition_point.p " << transition_point.p << "   b.p " << b.p << std::endl;
-                                auto mid_state = merge_blocks(current_state, distance_to_block(block_to_distance_t(current_state) + move_vec));
-                                mid_state['G'] = next_state['G'];
-                                mid_state['F'] = std::max(next_state['F'], current_state['F']);
-                                a = {block_to_distance_t(current_state), max_no_acc_v}; //current_state['F']};
-                                b = {block_to_distance_t(mid_state), mid_state['F']};
-                                while (acceleration_between(a, b) > max_accel) {
-                                    mid_state['F'] = mid_state['F']*0.75;
-                                    a = {block_to_distance_t(current_state), max_no_acc_v}; //current_state['F']};
-                                    b = {block_to_distance_t(mid_state), mid_state['F']};
-                                }
-                                nsubprog.push_back(mid_state);
-                                nsubprog.push_back(next_state);
-                            }
-                        }
-                        current_state = next_state;
-                    } else {
-                        if (block.at('G') == 92) {
-                            current_state = merge_blocks(current_state, block);
-                            nsubprog.push_back(current_state);
-                        } else {
-                            nsubprog.push_back(block);
-                        }
+    program_t nsubprog;
+    nsubprog.reserve(subprogram.size() * 2);
+    for (const auto& block : subprogram) {
+        //std::cout << "###############  G: " << block.at('G') << " ; state: "  << current_state['G'] << std::endl;
+        if ((block.at('G') == 0) || (block.at('G') == 1)) {
+            auto next_state = merge_blocks(current_state, block);
+            distance_t move_vec = blocks_to_vector_move(current_state, next_state);
+            if (move_vec.length() < 0.00000001) {
+                nsubprog.push_back(block);
+            } else {
+                const auto move_limits = plimits.all(move_vec);
+                double max_accel = move_limits.max_accelerations_mm_s2;
+                double max_no_acc_v = move_limits.max_no_accel_velocity_mm_s;
+                double max_jerk = move_limits.max_jerk_mm_s3;
+                path_node_t a = {block_to_distance_t(current_state), max_no_acc_v}; //current_state['F']};
+                path_node_t b = {block_to_distance_t(next_state), next_state['F']};
+                path_node_t transition_point = calculate_transition_point(
+                    a,
+                    b,
+                    max_accel,
+                    max_jerk);
+                move_vec = move_vec * 0.5;
+                if ((transition_point.p - a.p).length() < move_vec.length()) {
+                    //std::cout << "++ a.p " << a.p << "  transition_point.p " << transition_point.p << "   b.p " << b.p << std::endl;
+                    auto nmvect = (move_vec / move_vec.length()) * (transition_point.p - a.p).length();
+                    auto mid_state_a = merge_blocks(current_state, distance_to_block(a.p + nmvect));
+                    auto mid_state_b = merge_blocks(current_state, distance_to_block(b.p - nmvect));
+                    mid_state_a['F'] = mid_state_b['F'] = std::max(next_state['F'], current_state['F']);
+                    mid_state_a['G'] = mid_state_b['G'] = next_state['G'];
+                    nsubprog.push_back(mid_state_a);
+                    nsubprog.push_back(mid_state_b);
+                    nsubprog.push_back(next_state);
+                } else {
+                    //std::cout << "-- a.p " << a.p << "  transition_point.p " << transition_point.p << "   b.p " << b.p << std::endl;
+                    auto mid_state = merge_blocks(current_state, distance_to_block(block_to_distance_t(current_state) + move_vec));
+                    mid_state['G'] = next_state['G'];
+                    mid_state['F'] = std::max(next_state['F'], current_state['F']);
+                    a = {block_to_distance_t(current_state), max_no_acc_v}; //current_state['F']};
+                    b = {block_to_distance_t(mid_state), mid_state['F']};
+                    while (acceleration_between(a, b) > jerk_limited_acceleration(b.v - a.v, max_accel, max_jerk)) {
+                        mid_state['F'] = mid_state['F']*0.75;
+                        a = {block_to_distance_t(current_state), max_no_acc_v}; //current_state['F']};
+                        b = {block_to_distance_t(mid_state), mid_state['F']};
                     }
+                    nsubprog.push_back(mid_state);
+                    nsubprog.push_back(next_state);
                 }
-                nsubprog.shrink_to_fit();
-                ret.push_back(nsubprog);
+            }
+            current_state = next_state;
+        } else {
+            if (block.at('G') == 92) {
+                current_state = merge_blocks(current_state, block);
+                nsubprog.push_back(current_state);
+            } else if ((block.at('G') == 2) || (block.at('G') == 3)) {
+                current_state = merge_blocks(current_state, block);
+                nsubprog.push_back(block);
             } else {
-                ret.push_back(subprogram);
+                nsubprog.push_back(block);
             }
         }
     }
+    nsubprog.shrink_to_fit();
+    return nsubprog;
+}
+
+/// the changes of the machine state made by one part, so the states before parts can be found without inserting nodes
+block_t part_state_changes(const program_t& subprogram)
+{
+    block_t changes;
+    if ((subprogram.size() == 0) || (subprogram[0].count('G') == 0)) return changes;
+    for (const auto& block : subprogram) {
+        double g = block.at('G');
+        if ((g == 0) || (g == 1) || (g == 2) || (g == 3) || (g == 92)) {
+            for (const auto& e : block)
+                changes[e.first] = e.second;
+        }
+    }
+    return changes;
+}
+
+partitioned_program_t insert_additional_nodes_inbetween_impl(partitioned_program_t& partitioned_program_, const block_t& initial_state, const configuration::limits& machine_limits, const bool release_source, const int threads_)
+{
+    const configuration::proportional_limits plimits(machine_limits);
+    auto current_state = merge_blocks({{'X', 0.0}, {'Y', 0.0}, {'Z', 0.0}, {'A', 0.0}, {'F', 0.1}}, initial_state);
+    // the part is moved or copied, when it does not contain moves
+    auto process_part = [&](program_t& subprogram, block_t& state) -> program_t {
+        if (subprogram[0].count('G')) {
+            auto nsubprog = insert_additional_nodes_into_part(subprogram, state, plimits);
+            if (release_source) subprogram = program_t();
+            return nsubprog;
+        } else if (release_source) {
+            return std::move(subprogram);
+        } else {
+            return subprogram;
+        }
+    };
+    partitioned_program_t ret;
+    ret.reserve(partitioned_program_.size());
+    int threads = threads_to_use(threads_);
+    if ((threads == 1) || (partitioned_program_.size() < 2)) {
+        for (auto& subprogram : partitioned_program_) {
+            if (subprogram.size() > 0) ret.push_back(process_part(subprogram, current_state));
+        }
+        return ret;
+    }
+
+    // every part depends only on the state before it, and that state is the prefix scan of the part changes
+    std::vector<block_t> states(partitioned_program_.size());
+    parallel_for(partitioned_program_.size(), threads, [&](std::size_t i) {
+        states[i] = part_state_changes(partitioned_program_[i]);
+    });
+    for (auto& state : states) {
+        block_t changes = std::move(state);
+        state = current_state;
+        for (const auto& e : changes)
+            current_state[e.first] = e.second;
+    }
+    ret.resize(partitioned_program_.size());
+    parallel_for(partitioned_program_.size(), threads, [&](std::size_t i) {
+        if (partitioned_program_[i].size() > 0) ret[i] = process_part(partitioned_program_[i], states[i]);
+    });
+    ret.erase(std::remove_if(ret.begin(), ret.end(), [](const program_t& p) { return p.size() == 0; }), ret.end());
+    return ret;
+}
+} // namespace
+
+partitioned_program_t insert_additional_nodes_inbetween(partitioned_program_t& partitioned_program_, const block_t& initial_state, const configuration::limits& machine_limits, const int threads)
+{
+    return insert_additional_nodes_inbetween_impl(partitioned_program_, initial_state, machine_limits, false, threads);
+}
+
+partitioned_program_t insert_additional_nodes_inbetween_consume(partitioned_program_t&& partitioned_program_, const block_t& initial_state, const configuration::limits& machine_limits, const int threads)
+{
+    auto ret = insert_additional_nodes_inbetween_impl(partitioned_program_, initial_state, machine_limits, true, threads);
+    partitioned_program_ = partitioned_program_t();
     return ret;
 }
 
 
 program_t remove_duplicate_blocks(const program_t& program_states, const block_t& initial_state)
 {
-    program_t ret;
-    ret.reserve(program_states.size());
+    return remove_duplicate_blocks(program_t(program_states), initial_state);
+}
+
+program_t remove_duplicate_blocks(program_t&& program_states, const block_t& initial_state)
+{
+    // every block gives at most one block, so the result is written over the source
+    program_t ret = std::move(program_states);
+    std::size_t kept = 0;
+    auto push_back = [&](block_t&& b) {
+        if (&ret[kept] != &b) ret[kept] = std::move(b);
+        kept++;
+    };
     auto current_state = merge_blocks({
                                           {'X', 0.0},
                                           {'Y', 0.0},
@@ -224,15 +312,26 @@ program_t remove_duplicate_blocks(const program_t& program_states, const block_t
                                           {'F', 0.1},
                                       },
         initial_state);
-    for (auto s : program_states) {
+    for (std::size_t i = 0; i < ret.size(); i++) {
+        auto& s = ret[i];
         if (s.count('M') == 0) {
+            if (s.count('G') && ((s.at('G') == 2) || (s.at('G') == 3))) {
+                // the arc can end where it started (full circle), and I, J, R are not modal
+                auto new_state = merge_blocks(current_state, s);
+                auto nblock = diff_blocks(new_state, current_state);
+                for (char k : {'G', 'I', 'J', 'R'})
+                    if (s.count(k)) nblock[k] = s.at(k);
+                push_back(std::move(nblock));
+                current_state = new_state;
+                continue;
+            }
             if (s.count('G') && ((s.at('G') == 0) || (s.at('G') == 1))) {
                 auto new_state = merge_blocks(current_state, s);
                 if (!((blocks_to_vector_move(new_state, current_state).length() == 0) &&
                         (new_state['F'] == current_state['F']))) {
                     auto nblock = diff_blocks(new_state, current_state);
                     nblock['G'] = new_state['G'];
-                    ret.push_back(nblock);
+                    push_back(std::move(nblock));
                     //ret.push_back(new_state);
                     current_state = new_state;
                     //block_t diff_blocks(const block_t& destination, const block_t& source);
@@ -243,16 +342,35 @@ program_t remove_duplicate_blocks(const program_t& program_states, const block_t
                 continue;
             }
         }
-        ret.push_back(s);
+        push_back(std::move(s));
     }
+    ret.resize(kept);
     ret.shrink_to_fit();
     return ret;
 }
 
 
+double junction_deviation_velocity(const distance_t& A, const distance_t& B, const distance_t& C,
+    const configuration::proportional_limits& plimits, const double junction_deviation_mm)
+{
+    auto ab = B - A;
+    auto bc = C - B;
+    double v_min = std::min(plimits.max_no_accel_velocity_mm_s(ab), plimits.max_no_accel_velocity_mm_s(bc)) * 0.5;
+    double v_max = std::min(plimits.max_velocity_mm_s(ab), plimits.max_velocity_mm_s(bc));
+    // the direction of the velocity change - the centripetal acceleration on the turn
+    auto dv = bc / bc.length() - ab / ab.length();
+    if (dv.length() < 0.000000001) return v_max;
+    double sin_half = std::sin(B.angle(A, C) / 2.0);
+    if (sin_half >= 1.0) return v_max;
+    double r = junction_deviation_mm * sin_half / (1.0 - sin_half);
+    double v = std::sqrt(plimits.max_accelerations_mm_s2(dv) * r);
+    return std::max(v_min, std::min(v_max, v));
+}
+
 program_t apply_limits_for_turns(const program_t& program_states,
     const configuration::limits& machine_limits)
 {
+    const configuration::proportional_limits plimits(machine_limits);
     auto ret_states = remove_duplicate_blocks(program_states, {});
     auto current_state = merge_blocks({}, {});
     for (auto& e : ret_states) {
@@ -283,7 +401,7 @@ program_t apply_limits_for_turns(const program_t& program_states,
         auto orig_state_f = ret_states[0]['F'];
         if (first_diff.length() > 0) {
             ret_states[0]['F'] = std::min(
-                machine_limits.proportional_max_no_accel_velocity_mm_s(first_diff / first_diff.length()),
+                plimits.max_no_accel_velocity_mm_s(first_diff),
                 orig_state_f);
         }
         if (std::isnan(ret_states[0]['F'])) {
@@ -296,6 +414,20 @@ program_t apply_limits_for_turns(const program_t& program_states,
     }
     //block_t previous_block;
     if (ret_states.size() > 2) {
+        // limits for every segment of the path are calculated once, in one batch
+        std::vector<distance_t> segments;
+        segments.reserve(ret_states.size() - 1);
+        {
+            block_t st = ret_states[0];
+            distance_t prev = block_to_distance_t(st);
+            for (std::size_t k = 1; k < ret_states.size(); k++) {
+                st = merge_blocks(st, ret_states[k]);
+                distance_t p = block_to_distance_t(st);
+                segments.push_back(p - prev);
+                prev = p;
+            }
+        }
+        const auto segment_limits = plimits.all(segments);
         std::list<block_t> tristate;
         tristate.push_back(ret_states[0]);
         tristate.push_back(merge_blocks(tristate.back(), ret_states[1]));
@@ -311,22 +443,26 @@ program_t apply_limits_for_turns(const program_t& program_states,
 
             // get minimum of the values for first vector and second vector
             double angle = B.angle(A, C);
-            if (angle <= (M_PI / 2.0)) {
+            if (machine_limits.cornering_model == configuration::CORNERING_JUNCTION_DEVIATION) {
+                if (ret_states[i]['F'] == 0.0) {
+                    throw std::invalid_argument("feedrate cannot be 0:\n" + back_to_gcode({ret_states}));
+                }
+                double result_f = std::min(junction_deviation_velocity(A, B, C, plimits, machine_limits.junction_deviation_mm),
+                    ret_states[i]['F']);
+                if (std::isnan(result_f)) throw std::invalid_argument("C: result_f cannot be nan!!");
+                ret_states[i]['F'] = result_f;
+            } else if (angle <= (M_PI / 2.0)) {
                 auto y = linear_interpolation(angle, 0, 0.25, M_PI / 2.0, 1);
                 if (ret_states[i]['F'] == 0.0) {
                     throw std::invalid_argument("feedrate cannot be 0:\n" + back_to_gcode({ret_states}));
                 }
                 double result_f = std::min(y * std::min(
-                                                   machine_limits.proportional_max_no_accel_velocity_mm_s((B - A) / (B - A).length()),
-                                                   machine_limits.proportional_max_no_accel_velocity_mm_s((C - B) / (C - B).length())),
+                                                   segment_limits[i - 1].max_no_accel_velocity_mm_s,
+                                                   segment_limits[i].max_no_accel_velocity_mm_s),
                     ret_states[i]['F']);
                 if (std::isnan(result_f)) throw std::invalid_argument("A: result_f cannot be nan!!");
                 ret_states[i]['F'] = result_f;
             } else {
-                auto B_A = (B - A).length();
-                auto C_B = (C - B).length();
-                B_A = (B_A <= 0) ? 0.0000001 : B_A;
-                C_B = (C_B <= 0) ? 0.0000001 : C_B;
                 auto angle_transformed = ((angle - M_PI / 2.0) / (M_PI / 2.0));
                 angle_transformed *= angle_transformed;
                 angle_transformed = angle_transformed * (M_PI / 2.0) + M_PI / 2.0;
@@ -334,11 +470,11 @@ program_t apply_limits_for_turns(const program_t& program_states,
                     angle_transformed,
                     M_PI / 2.0,
                     std::min(
-                        machine_limits.proportional_max_no_accel_velocity_mm_s((B - A) / B_A),
-                        machine_limits.proportional_max_no_accel_velocity_mm_s((C - B) / C_B)),
+                        segment_limits[i - 1].max_no_accel_velocity_mm_s,
+                        segment_limits[i].max_no_accel_velocity_mm_s),
                     M_PI,
-                    std::min(machine_limits.proportional_max_velocity_mm_s((B - A) / B_A),
-                        machine_limits.proportional_max_velocity_mm_s((C - B) / C_B)));
+                    std::min(segment_limits[i - 1].max_velocity_mm_s,
+                        segment_limits[i].max_velocity_mm_s));
                 if (std::isnan(y)) y = ret_states[i]['F'];
                 if (ret_states[i]['F'] == 0.0) {
                     throw std::invalid_argument("feedrate cannot be 0:\n" + back_to_gcode({ret_states}));
@@ -349,10 +485,10 @@ program_t apply_limits_for_turns(const program_t& program_states,
                         ret_states[i]['F']);
                 if (std::isnan(result_f)) {
                     std::cout << y << std::endl;
-                    std::cout << machine_limits.proportional_max_no_accel_velocity_mm_s((B - A) / B_A) << std::endl;
-                    std::cout << machine_limits.proportional_max_no_accel_velocity_mm_s((C - B) / C_B) << std::endl;
-                    std::cout << machine_limits.proportional_max_velocity_mm_s((B - A) / B_A) << std::endl;
-                    std::cout << machine_limits.proportional_max_velocity_mm_s((C - B) / C_B) << std::endl;
+                    std::cout << segment_limits[i - 1].max_no_accel_velocity_mm_s << std::endl;
+                    std::cout << segment_limits[i].max_no_accel_velocity_mm_s << std::endl;
+                    std::cout << segment_limits[i - 1].max_velocity_mm_s << std::endl;
+                    std::cout << segment_limits[i].max_velocity_mm_s << std::endl;
                     throw std::invalid_argument("B: result_f cannot be nan!");
                 }
                 ret_states[i]['F'] = result_f;
@@ -362,7 +498,7 @@ program_t apply_limits_for_turns(const program_t& program_states,
     }
     {
         auto second_diff = blocks_to_vector_move(*(--(--ret_states.end())), *(--ret_states.end()));
-        auto A = machine_limits.proportional_max_no_accel_velocity_mm_s(second_diff / second_diff.length());
+        auto A = plimits.max_no_accel_velocity_mm_s(second_diff);
         auto B = (*(--ret_states.end()))['F'];
         auto ff = std::min(A, B);
         if (std::isnan(A)) ff = B;
@@ -377,6 +513,7 @@ program_t apply_limits_for_turns(const program_t& program_states,
 auto do_the_acceleration_limiting = [](auto program, const configuration::limits& machine_limits) {
     using namespace raspigcd::movement::physics;
 
+    const configuration::proportional_limits plimits(machine_limits);
     program_t result = program;
     //result.push_back(current_state);
     //int walk_direction = 1;
@@ -409,8 +546,10 @@ auto do_the_acceleration_limiting = [](auto program, const configuration::limits
             double s = ABvec.length();
             if (s != 0) {
                 if (result[i - 1]['F'] != result[i]['F']) {
-                    double max_a = machine_limits.proportional_max_accelerations_mm_s2(ABvec / s);
-                    double min_v = machine_limits.proportional_max_no_accel_velocity_mm_s(ABvec / s) / 2.0;
+                    const auto ab_limits = plimits.all(ABvec);
+                    double max_a = jerk_limited_acceleration(result[i]['F'] - result[i - 1]['F'],
+                        ab_limits.max_accelerations_mm_s2, ab_limits.max_jerk_mm_s3);
+                    double min_v = ab_limits.max_no_accel_velocity_mm_s / 2.0;
                     min_v = std::min(min_v, result[i]['F']);
                     max_a = std::max(max_a, min_v);
                     path_node_t pnA = {.p = A, .v = result[i - 1]['F']};
@@ -432,11 +571,129 @@ auto do_the_acceleration_limiting = [](auto program, const configuration::limits
     return result;
 };
 
+program_t time_optimal_feedrates(const program_t& program_states,
+    const configuration::limits& machine_limits,
+    const std::vector<double>& segment_feedrates)
+{
+    using namespace raspigcd::movement::physics;
+    if ((segment_feedrates.size() != 0) && (segment_feedrates.size() != program_states.size()))
+        throw std::invalid_argument("time_optimal_feedrates: segment_feedrates must be empty or of the size of the program");
+    const std::size_t n = program_states.size();
+    if (n < 2) return program_states;
+    const configuration::proportional_limits plimits(machine_limits);
+
+    struct segment_t {
+        double s;         ///< length
+        distance_t dir;   ///< unit direction
+        double a;         ///< maximal acceleration
+        double j;         ///< maximal jerk
+        double cap;       ///< maximal velocity inside the segment
+    };
+    std::vector<block_t> nodes(n);
+    std::vector<double> v(n);
+    std::vector<segment_t> segments(n - 1);
+    nodes[0] = program_states[0];
+    for (std::size_t i = 1; i < n; i++)
+        nodes[i] = merge_blocks(nodes[i - 1], program_states[i]);
+    for (std::size_t i = 0; i < n; i++)
+        v[i] = nodes[i].count('F') ? nodes[i].at('F') : 0.0;
+    for (std::size_t i = 0; i + 1 < n; i++) {
+        auto vec = blocks_to_vector_move(nodes[i], nodes[i + 1]);
+        auto& seg = segments[i];
+        seg.s = vec.length();
+        if (seg.s > 0) {
+            const auto l = plimits.all(vec);
+            seg.dir = vec / seg.s;
+            seg.a = l.max_accelerations_mm_s2;
+            seg.j = l.max_jerk_mm_s3;
+            seg.cap = l.max_velocity_mm_s;
+            if (segment_feedrates.size()) seg.cap = std::min(seg.cap, segment_feedrates[i + 1]);
+            v[i] = std::min(v[i], seg.cap);
+            v[i + 1] = std::min(v[i + 1], seg.cap);
+        } else {
+            seg.dir = vec;
+            seg.a = seg.j = 0.0;
+            seg.cap = std::numeric_limits<double>::max();
+        }
+    }
+
+    // the highest velocity not higher than v_limit that can be reached from v0 on the distance s
+    auto reachable = [](double v0, const segment_t& seg, double v_limit) {
+        if (v_limit <= v0) return v_limit;
+        if (seg.s <= 0) return v0;
+        if (seg.j <= 0) return std::min(v_limit, std::sqrt(v0 * v0 + 2.0 * seg.a * seg.s));
+        if (velocity_change_distance(v0, v_limit, seg.a, seg.j) <= seg.s) return v_limit;
+        double lo = v0, hi = v_limit;
+        for (int k = 0; k < 48; k++) {
+            double m = (lo + hi) / 2.0;
+            if (velocity_change_distance(v0, m, seg.a, seg.j) <= seg.s) lo = m;
+            else hi = m;
+        }
+        return lo;
+    };
+    // backward pass - every node must allow braking to the next one
+    for (std::size_t i = n - 1; i > 0; i--)
+        v[i - 1] = reachable(v[i], segments[i - 1], v[i - 1]);
+    // forward pass - every node must be reachable from the previous one
+    for (std::size_t i = 0; i + 1 < n; i++)
+        v[i + 1] = reachable(v[i], segments[i], v[i + 1]);
+
+    program_t result;
+    result.reserve(n + n / 2);
+    auto with_f = [](block_t b, double f) {
+        b['F'] = f;
+        return b;
+    };
+    result.push_back(with_f(nodes[0], v[0]));
+    for (std::size_t i = 0; i + 1 < n; i++) {
+        const auto& seg = segments[i];
+        if (seg.s > 0) {
+            // the fastest profile on the segment accelerates, optionally cruises, and brakes
+            double v_low = std::max(v[i], v[i + 1]);
+            auto ramps = [&](double vp) {
+                return velocity_change_distance(v[i], vp, seg.a, seg.j) + velocity_change_distance(vp, v[i + 1], seg.a, seg.j);
+            };
+            double v_peak = seg.cap;
+            bool cruise = ramps(seg.cap) <= seg.s;
+            if (!cruise) {
+                if (seg.j <= 0) {
+                    v_peak = std::sqrt((v[i] * v[i] + v[i + 1] * v[i + 1] + 2.0 * seg.a * seg.s) / 2.0);
+                } else {
+                    double lo = v_low, hi = seg.cap;
+                    for (int k = 0; k < 48; k++) {
+                        double m = (lo + hi) / 2.0;
+                        if (ramps(m) <= seg.s) lo = m;
+                        else hi = m;
+                    }
+                    v_peak = lo;
+                }
+                v_peak = std::min(v_peak, seg.cap);
+            }
+            if (v_peak > v_low * (1.0 + 0.000001)) {
+                auto p0 = block_to_distance_t(nodes[i]);
+                double s_acc = velocity_change_distance(v[i], v_peak, seg.a, seg.j);
+                double s_dec = velocity_change_distance(v_peak, v[i + 1], seg.a, seg.j);
+                block_t mid = nodes[i + 1];
+                if (s_acc > 0.000001) {
+                    result.push_back(with_f(merge_blocks(mid, distance_to_block(p0 + seg.dir * s_acc)), v_peak));
+                }
+                if (cruise && ((seg.s - s_dec - s_acc) > 0.000001) && (s_dec > 0.000001)) {
+                    result.push_back(with_f(merge_blocks(mid, distance_to_block(p0 + seg.dir * (seg.s - s_dec))), v_peak));
+                }
+            }
+        }
+        result.push_back(with_f(nodes[i + 1], v[i + 1]));
+    }
+    result.shrink_to_fit();
+    return result;
+}
 
 program_t g1_move_to_g1_with_machine_limits(const program_t& program_states,
     const configuration::limits& machine_limits,
     block_t current_state0,
-    bool do_the_accel_limit)
+    bool do_the_accel_limit,
+    const block_t& entry_from,
+    const block_t& exit_to)
 {
     using namespace raspigcd::movement::physics;
     if (program_states.size() == 0) throw std::invalid_argument("there must be at least one G0 or G1 code in the program!");
@@ -467,17 +724,80 @@ program_t g1_move_to_g1_with_machine_limits(const program_t& program_states,
         current_state = next_state;
     }
     result.shrink_to_fit();
+    // the moves before and after the program are used only to calculate junction velocities
+    bool with_entry = (entry_from.size() > 0) && (blocks_to_vector_move(merge_blocks(result.front(), entry_from), result.front()).length() > 0);
+    bool with_exit = (exit_to.size() > 0) && (blocks_to_vector_move(result.back(), merge_blocks(result.back(), exit_to)).length() > 0);
+    if (with_entry) result.insert(result.begin(), merge_blocks(result.front(), entry_from));
+    if (with_exit) result.push_back(merge_blocks(result.back(), exit_to));
     auto result_with_limits = apply_limits_for_turns(result, machine_limits);
     if (result_with_limits.size() != result.size()) throw std::invalid_argument("result_with_limits shoud have equal size to result");
+    if (with_entry) result_with_limits.erase(result_with_limits.begin());
+    if (with_exit) {
+        result_with_limits.pop_back();
+        result_with_limits.back()['F'] = std::min(result_with_limits.back()['F'], merge_blocks(result_with_limits.back(), exit_to)['F']);
+    }
 
     // std::reverse(result_with_limits.begin(), result_with_limits.end());
     // result_with_limits = do_the_acceleration_limiting(result_with_limits, machine_limits);
     // std::reverse(result_with_limits.begin(), result_with_limits.end());
-    if ( do_the_accel_limit ) result_with_limits = do_the_acceleration_limiting(result_with_limits, machine_limits);
+    if ( do_the_accel_limit ) {
+        if (machine_limits.time_optimal_planning) {
+            std::vector<double> segment_feedrates(result_with_limits.size());
+            for (std::size_t i = 0; i < segment_feedrates.size(); i++)
+                segment_feedrates[i] = result.at(i + (with_entry ? 1 : 0)).at('F');
+            result_with_limits = time_optimal_feedrates(result_with_limits, machine_limits, segment_feedrates);
+        } else {
+            result_with_limits = do_the_acceleration_limiting(result_with_limits, machine_limits);
+        }
+    }
     result_with_limits.erase(result_with_limits.begin());
     return result_with_limits;
 }
 
+partitioned_program_t blend_motion_parts(const partitioned_program_t& program_parts,
+    const configuration::limits& machine_limits,
+    block_t current_state)
+{
+    auto is_motion_part = [&program_parts](std::size_t i) {
+        if (i >= program_parts.size()) return false;
+        const auto& ppart = program_parts[i];
+        return (ppart.size() != 0) && (ppart[0].count('M') == 0) && ppart[0].count('G') &&
+               (((int)(ppart[0].at('G')) == 0) || ((int)(ppart[0].at('G')) == 1));
+    };
+    partitioned_program_t result;
+    result.reserve(program_parts.size());
+    block_t entry_from = {}; // the state before the last move of the previous motion part
+    for (std::size_t i = 0; i < program_parts.size(); i++) {
+        const auto& ppart = program_parts[i];
+        if (is_motion_part(i)) {
+            program_t planned = ppart;
+            if ((int)(ppart[0].at('G')) == 0) {
+                block_t exit_to = {};
+                if (is_motion_part(i + 1)) {
+                    exit_to = merge_blocks(last_state_after_program_execution(ppart, current_state), program_parts[i + 1].front());
+                }
+                planned = g1_move_to_g1_with_machine_limits(ppart, machine_limits, current_state, true, entry_from, exit_to);
+            }
+            if (planned.size() > 0) {
+                entry_from = last_state_after_program_execution(program_t(planned.begin(), planned.end() - 1), current_state);
+                current_state = last_state_after_program_execution(planned, current_state);
+                result.push_back(planned);
+            }
+        } else {
+            if ((ppart.size() != 0) && (ppart[0].count('M') == 0) && ppart[0].count('G') &&
+                (((int)(ppart[0].at('G')) == 2) || ((int)(ppart[0].at('G')) == 3))) {
+                current_state = last_state_after_program_execution(ppart, current_state);
+            } else if ((ppart.size() != 0) && (ppart[0].count('M') == 0) && ppart[0].count('G') &&
+                ((int)(ppart[0].at('G')) != 4)) {
+                current_state = merge_blocks(current_state, ppart.front());
+            }
+            entry_from = {};
+            result.push_back(ppart);
+        }
+    }
+    return result;
+}
+
 program_t g0_move_to_g1_sequence(const program_t& program_states,
     const configuration::limits& machine_limits,
     block_t current_state)
@@ -488,6 +808,7 @@ program_t g0_move_to_g1_sequence(const program_t& program_states,
     //for (const auto &e: program_states) {
     //    if (e.count('F')) minimal_feedrate_from_gcode = std::min(minimal_feedrate_from_gcode,e.at('F'));
     //}
+    const configuration::proportional_limits plimits(machine_limits);
     program_t result;
     for (const auto& ps_input : program_states) {
         auto next_state = merge_blocks(current_state, ps_input);
@@ -501,17 +822,19 @@ program_t g0_move_to_g1_sequence(const program_t& program_states,
             if (s == 0) {
                 result.push_back(next_state);
             } else {
-                double a = machine_limits.proportional_max_accelerations_mm_s2(ABvec / s);
-                double max_v = machine_limits.proportional_max_velocity_mm_s(ABvec / s);
-                double min_v = machine_limits.proportional_max_no_accel_velocity_mm_s(ABvec / s);
+                const auto ab_limits = plimits.all(ABvec);
+                double a = ab_limits.max_accelerations_mm_s2;
+                double max_v = ab_limits.max_velocity_mm_s;
+                double min_v = ab_limits.max_no_accel_velocity_mm_s;
+                double max_jerk = ab_limits.max_jerk_mm_s3;
                 path_node_t pnA = {.p = A, .v = min_v};
                 path_node_t pnMed = {.p = (A + B) * 0.5, .v = max_v};
                 path_node_t pnB = {.p = B, .v = min_v};
                 double a_real = acceleration_between(pnA, pnMed);
                 //std::cout <<"a_real:" << a_real << " a_max" << a << std::endl;
-                if (a_real >= a) {
+                if (a_real >= jerk_limited_acceleration(max_v - min_v, a, max_jerk)) {
                     auto block_A = current_state;
-                    pnMed = calculate_transition_point(pnA, pnMed, a);
+                    pnMed = calculate_transition_point(pnA, pnMed, a, max_jerk);
                     //std::cout << "pnMed.v " << pnMed.v << std::endl;
                     auto block_Med = merge_blocks(current_state, distance_to_block(pnMed.p));
                     auto block_B = next_state;
@@ -523,14 +846,14 @@ program_t g0_move_to_g1_sequence(const program_t& program_states,
                     result.push_back(block_B);
                 } else {
                     auto block_A = current_state;
-                    pnMed = calculate_transition_point(pnA, pnMed, a);
+                    pnMed = calculate_transition_point(pnA, pnMed, a, max_jerk);
                     //std::cout << "pnMed.v " << pnMed.v << std::endl;
                     auto block_Med = merge_blocks(current_state, distance_to_block(pnMed.p));
                     block_Med['F'] = pnMed.v;
                     block_Med['G'] = 1;
                     result.push_back(block_Med);
 
-                    pnMed = calculate_transition_point(pnB, pnMed, a);
+                    pnMed = calculate_transition_point(pnB, pnMed, a, max_jerk);
                     block_Med = merge_blocks(current_state, distance_to_block(pnMed.p));
                     block_Med['F'] = pnMed.v;
                     block_Med['G'] = 1;
@@ -595,46 +918,56 @@ block_t diff_blocks(const block_t& destination, const block_t& source)
 
 
 partitioned_program_t group_gcode_commands(const program_t& program_states, const block_t& initial_state)
+{
+    return group_gcode_commands(program_t(program_states), initial_state);
+}
+
+partitioned_program_t group_gcode_commands(program_t&& program_states, const block_t& initial_state)
 {
     partitioned_program_t generated_program;
     block_t current_state = merge_blocks({{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}}, initial_state);
-    for (const auto& e : program_states) {
+    auto new_group = [&generated_program](block_t&& e) {
+        generated_program.emplace_back();
+        generated_program.back().push_back(std::move(e));
+    };
+    for (auto& e : program_states) {
+        for (const auto& v : e)
+            current_state[v.first] = v.second;
         if (generated_program.size() == 0) {
             if ((e.count('G') > 0) || (e.count('M')))
-                generated_program.push_back({e});
+                new_group(std::move(e));
             else
                 throw std::invalid_argument("the first command must be G or M");
         } else {
             if (e.count('G')) {
                 if (generated_program.back().back().count('G')) {
-                    if ((generated_program.back().front().at('G') == e.at('G')) && (e.at('G') <= 2)) {
-                        generated_program.back().push_back(e);
+                    if ((generated_program.back().front().at('G') == e.at('G')) && (e.at('G') <= 3)) {
+                        generated_program.back().push_back(std::move(e));
                     } else {
-                        generated_program.push_back({e});
+                        new_group(std::move(e));
                     }
                 } else {
-                    generated_program.push_back({e});
+                    new_group(std::move(e));
                 }
             } else if (e.count('M')) {
-                generated_program.push_back({e});
+                new_group(std::move(e));
             } else {
                 if (generated_program.back().front().count('G'))
-                    generated_program.back().push_back(e);
+                    generated_program.back().push_back(std::move(e));
                 else
                     throw std::invalid_argument("It is not clear if the command is about G or M");
             }
         }
-        current_state = merge_blocks(current_state, e);
         /// check correctness of first command
         if ((generated_program.back().size() == 1) && (generated_program.back()[0].count('G') == 1)) {
             if ((((int)generated_program.back()[0].at('G')) == 1) &&
                 (((int)generated_program.back()[0].count('F')) == 0)) {
                 //        // we must provide feedrate for the first command
-                generated_program.back() = {{{'G', 1.0}, {'F', current_state.at('F')}}, e};
+                generated_program.back().insert(generated_program.back().begin(), {{'G', 1.0}, {'F', current_state.at('F')}});
             }
         }
     }
-
+    program_states = program_t();
 
     return generated_program;
 }
@@ -696,100 +1029,443 @@ std::map<char, double> command_to_map_of_arguments(const std::string& command__)
 }
 
 
-program_t optimize_path_douglas_peucker_g(const program_t& program_, const double epsilon, const block_t& p0_)
+namespace {
+/// ranges longer than this are searched for the farthest point on many threads
+const std::size_t dp_parallel_scan_size = 1 << 16;
+/// ranges shorter than this are simplified by one thread
+const std::size_t dp_min_task_size = 1 << 12;
+
+/**
+ * distance of the point i from the segment s-e. The calculations are done in the same order
+ * as in optimize_generic_path_dp, so the results are identical.
+ */
+inline double dp_point_segment_distance(const path_coordinates_t& path, const std::size_t i, const std::size_t s, const std::size_t e)
 {
-    std::vector<distance_with_velocity_t> path;
-    path.reserve(program_.size());
-    auto is_block_a_new_position = [](const block_t& e) {
-        if ((e.count('M') == 0) && (e.count('G') != 0)) {
-            switch ((int)(e.at('G'))) {
-            case 0:
-            case 1:
-                return true;
-            }
+    const double abx = path.x[e] - path.x[s], aby = path.y[e] - path.y[s], abz = path.z[e] - path.z[s];
+    const double l2 = abx * abx + aby * aby + abz * abz;
+    double t = 0;
+    if (l2 > 0) {
+        t = (path.x[i] - path.x[s]) * abx + (path.y[i] - path.y[s]) * aby + (path.z[i] - path.z[s]) * abz;
+        t /= l2;
+    }
+    t = std::max(0.0, std::min(1.0, t));
+    const double qx = path.x[s] + abx * t - path.x[i];
+    const double qy = path.y[s] + aby * t - path.y[i];
+    const double qz = path.z[s] + abz * t - path.z[i];
+    return std::sqrt(qx * qx + qy * qy + qz * qz);
+}
+
+/// the first point with the maximal distance from the segment s-e in the range [from, to)
+std::pair<std::size_t, double> dp_farthest_point(const path_coordinates_t& path, const std::size_t s, const std::size_t e, const std::size_t from, const std::size_t to)
+{
+    std::pair<std::size_t, double> ret = {s, 0.0};
+    for (std::size_t i = from; i < to; i++) {
+        double d = dp_point_segment_distance(path, i, s, e);
+        if (d > ret.second) ret = {i, d};
+    }
+    return ret;
+}
+
+std::pair<std::size_t, double> dp_farthest_point_parallel(const path_coordinates_t& path, const std::size_t s, const std::size_t e, const int threads)
+{
+    std::vector<std::pair<std::size_t, double>> found(threads, {s, 0.0});
+    std::vector<std::thread> workers;
+    const std::size_t n = e - s - 1;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            found[t] = dp_farthest_point(path, s, e, s + 1 + n * t / threads, s + 1 + n * (t + 1) / threads);
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+    std::pair<std::size_t, double> ret = {s, 0.0};
+    for (const auto& f : found)
+        if (f.second > ret.second) ret = f;
+    return ret;
+}
+
+/// simplifies the ranges from the stack. The ranges must not overlap
+void dp_simplify_ranges(const path_coordinates_t& path, const double epsilon, std::vector<char>& to_delete, std::vector<std::pair<std::size_t, std::size_t>> stack)
+{
+    while (stack.size()) {
+        auto r = stack.back();
+        stack.pop_back();
+        if (r.second <= r.first + 1) continue;
+        auto farthest = dp_farthest_point(path, r.first, r.second, r.first + 1, r.second);
+        if (farthest.second > epsilon) {
+            stack.push_back({farthest.first, r.second});
+            stack.push_back({r.first, farthest.first});
+        } else {
+            std::fill(to_delete.begin() + r.first + 1, to_delete.begin() + r.second, 1);
         }
-        return false;
+    }
+}
+} // namespace
+
+std::vector<char> douglas_peucker_mask(const path_coordinates_t& path, const double epsilon, const int threads_)
+{
+    std::vector<char> to_delete(path.size(), 0);
+    if (path.size() <= 2) return to_delete;
+    int threads = threads_to_use(threads_);
+    if ((threads == 1) || (path.size() < 2 * dp_min_task_size)) {
+        dp_simplify_ranges(path, epsilon, to_delete, {{0, path.size() - 1}});
+        return to_delete;
+    }
+
+    // split the path until there are enough ranges for all the threads
+    const std::size_t task_size = std::max(dp_min_task_size, path.size() / (8 * threads));
+    std::vector<std::pair<std::size_t, std::size_t>> large = {{0, path.size() - 1}};
+    std::vector<std::pair<std::size_t, std::size_t>> tasks;
+    while (large.size()) {
+        auto r = large.back();
+        large.pop_back();
+        if (r.second - r.first < task_size) {
+            tasks.push_back(r);
+            continue;
+        }
+        auto farthest = (r.second - r.first > dp_parallel_scan_size) ? dp_farthest_point_parallel(path, r.first, r.second, threads) : dp_farthest_point(path, r.first, r.second, r.first + 1, r.second);
+        if (farthest.second > epsilon) {
+            large.push_back({farthest.first, r.second});
+            large.push_back({r.first, farthest.first});
+        } else {
+            std::fill(to_delete.begin() + r.first + 1, to_delete.begin() + r.second, 1);
+        }
+    }
+
+    // ranges do not overlap, so every thread writes to different elements of the mask
+    parallel_for(tasks.size(), threads, [&](std::size_t i) {
+        dp_simplify_ranges(path, epsilon, to_delete, {tasks[i]});
+    });
+    return to_delete;
+}
+
+namespace {
+/// min-heap of point indexes that allows to change the key of any point
+class indexed_min_heap_t
+{
+    std::vector<std::size_t> heap;     ///< point indexes
+    std::vector<std::size_t> position; ///< position of the point in the heap
+    std::vector<double> keys;
+
+    void swap_nodes(std::size_t a, std::size_t b)
+    {
+        std::swap(heap[a], heap[b]);
+        position[heap[a]] = a;
+        position[heap[b]] = b;
+    }
+    void sift_up(std::size_t i)
+    {
+        while ((i > 0) && (keys[heap[i]] < keys[heap[(i - 1) / 2]])) {
+            swap_nodes(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    void sift_down(std::size_t i)
+    {
+        for (;;) {
+            std::size_t smallest = i;
+            for (std::size_t c = 2 * i + 1; (c < heap.size()) && (c <= 2 * i + 2); c++)
+                if (keys[heap[c]] < keys[heap[smallest]]) smallest = c;
+            if (smallest == i) return;
+            swap_nodes(i, smallest);
+            i = smallest;
+        }
+    }
+
+public:
+    indexed_min_heap_t(const std::vector<double>& keys_, const std::vector<std::size_t>& elements) : heap(elements), position(keys_.size(), 0), keys(keys_)
+    {
+        for (std::size_t i = 0; i < heap.size(); i++)
+            position[heap[i]] = i;
+        for (std::size_t i = heap.size() / 2 + 1; i-- > 0;)
+            sift_down(i);
+    }
+    bool empty() const { return heap.empty(); }
+    std::size_t top() const { return heap[0]; }
+    double top_key() const { return keys[heap[0]]; }
+    void pop()
+    {
+        swap_nodes(0, heap.size() - 1);
+        heap.pop_back();
+        if (heap.size()) sift_down(0);
+    }
+    void update(std::size_t element, double key)
+    {
+        double old_key = keys[element];
+        keys[element] = key;
+        if (key < old_key)
+            sift_up(position[element]);
+        else
+            sift_down(position[element]);
+    }
+};
+
+/// the longest segment that is checked point by point when the error bound is too big
+const std::size_t vw_exact_error_span = 64;
+
+inline double vw_triangle_area(const path_coordinates_t& path, const std::size_t a, const std::size_t b, const std::size_t c)
+{
+    const double ux = path.x[b] - path.x[a], uy = path.y[b] - path.y[a], uz = path.z[b] - path.z[a];
+    const double vx = path.x[c] - path.x[a], vy = path.y[c] - path.y[a], vz = path.z[c] - path.z[a];
+    const double cx = uy * vz - uz * vy, cy = uz * vx - ux * vz, cz = ux * vy - uy * vx;
+    return 0.5 * std::sqrt(cx * cx + cy * cy + cz * cz);
+}
+} // namespace
+
+std::vector<char> visvalingam_whyatt_mask(const path_coordinates_t& path, const double epsilon, const std::vector<char>& fixed)
+{
+    const std::size_t n = path.size();
+    std::vector<char> to_delete(n, 0);
+    if (n <= 2) return to_delete;
+    std::vector<std::size_t> prev(n), next(n);
+    // error[i] is the upper bound of the distance between the removed points and the segment from i to next[i]
+    std::vector<double> error(n, 0.0);
+    for (std::size_t i = 0; i < n; i++) {
+        prev[i] = (i > 0) ? i - 1 : 0;
+        next[i] = (i + 1 < n) ? i + 1 : n - 1;
+    }
+    const double never = std::numeric_limits<double>::infinity();
+    auto is_fixed = [&](std::size_t i) { return (i < fixed.size()) && fixed[i]; };
+    // the distance between the path and the segment prev[i]-next[i]. The bound is cheap, but if it is too
+    // big then the exact distance is calculated for short segments
+    auto removal_error = [&](std::size_t i) {
+        double bound = std::max(error[prev[i]], error[i]) + dp_point_segment_distance(path, i, prev[i], next[i]);
+        if ((bound > epsilon) && (next[i] - prev[i] <= vw_exact_error_span)) {
+            bound = 0.0;
+            for (std::size_t j = prev[i] + 1; j < next[i]; j++)
+                bound = std::max(bound, dp_point_segment_distance(path, j, prev[i], next[i]));
+        }
+        return bound;
+    };
+    // the effective area of the point, or infinity if removing it could move the path more than epsilon
+    auto key = [&](std::size_t i) {
+        if (removal_error(i) > epsilon) return never;
+        return vw_triangle_area(path, prev[i], i, next[i]);
     };
+    std::vector<double> keys(n, never);
+    std::vector<std::size_t> removable;
+    removable.reserve(n);
+    for (std::size_t i = 1; i + 1 < n; i++) {
+        if (is_fixed(i)) continue;
+        keys[i] = key(i);
+        removable.push_back(i);
+    }
+    indexed_min_heap_t heap(keys, removable);
+    while (!heap.empty() && (heap.top_key() < never)) {
+        std::size_t i = heap.top();
+        heap.pop();
+        error[prev[i]] = removal_error(i);
+        to_delete[i] = 1;
+        next[prev[i]] = next[i];
+        prev[next[i]] = prev[i];
+        for (std::size_t neighbour : {prev[i], next[i]})
+            if ((neighbour > 0) && (neighbour + 1 < n) && !is_fixed(neighbour)) heap.update(neighbour, key(neighbour));
+    }
+    return to_delete;
+}
+
+namespace {
+bool is_block_a_new_position(const block_t& e)
+{
+    if ((e.count('M') == 0) && (e.count('G') != 0)) {
+        switch ((int)(e.at('G'))) {
+        case 0:
+        case 1:
+            return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+/**
+ * marks the blocks from the range [begin, end) of the program that can be removed. The range is
+ * the G0 or G1 group, as it would be returned from group_gcode_commands.
+ */
+void simplify_path_g(const program_t& program_, const std::size_t begin, const std::size_t end, const double epsilon, const block_t& p0_, const int threads, const configuration::path_simplifier_e simplifier, std::vector<char>& to_remove)
+{
+    const std::size_t size = end - begin;
+    path_coordinates_t path;
+    std::vector<double> feedrates;
+    path.x.reserve(size + 1);
+    path.y.reserve(size + 1);
+    path.z.reserve(size + 1);
+    feedrates.reserve(size + 1);
     block_t machine_state = merge_blocks({{'X', 0}, {'Y', 0}, {'Z', 0}, {'F', 0.1}}, p0_);
-    path.push_back(block_to_distance_with_v_t(machine_state));
-    for (const auto& e : program_) {
+    double position[4] = {machine_state['X'], machine_state['Y'], machine_state['Z'], machine_state['F']};
+    auto push_position = [&]() {
+        path.x.push_back(position[0]);
+        path.y.push_back(position[1]);
+        path.z.push_back(position[2]);
+        feedrates.push_back(position[3]);
+    };
+    push_position();
+    for (std::size_t k = begin; k < end; k++) {
+        const auto& e = program_[k];
         if (is_block_a_new_position(e)) {
-            machine_state = merge_blocks(machine_state, e);
-            auto p = block_to_distance_with_v_t(machine_state);
-            path.push_back(p);
+            for (const auto& v : e) {
+                switch (v.first) {
+                case 'X': position[0] = v.second; break;
+                case 'Y': position[1] = v.second; break;
+                case 'Z': position[2] = v.second; break;
+                case 'F': position[3] = v.second; break;
+                }
+            }
+            push_position();
         }
     }
 
-    std::vector<char> toDelete = optimize_generic_path_dp(epsilon, path);
-    //std::cout << "PATH:" << std::endl;
+    // points where the feedrate changes or that are next to other commands must stay
+    std::vector<char> fixed(path.size(), 0);
     for (unsigned i = 0; i < path.size(); i++) {
-        //auto e = path[i];
-        //std::cout << e << " " << (toDelete[i]?"DELETE":"keep") << std::endl;
         if (i > 0) {
-            if (path[i].back() != path[i - 1].back()) toDelete[i] = false;
+            if (feedrates[i] != feedrates[i - 1]) fixed[i] = true;
             if (i > 1) {
-            if (!is_block_a_new_position(program_[i-2])) toDelete[i] = false;
+            if (!is_block_a_new_position(program_[begin + i - 2])) fixed[i] = true;
             }
         }
         if (i < path.size() - 1) {
-            if (path[i].back() != path[i + 1].back()) toDelete[i] = false;
+            if (feedrates[i] != feedrates[i + 1]) fixed[i] = true;
             if (i < path.size() - 2) {
-                if (!is_block_a_new_position(program_[i])) toDelete[i] = false;
+                if (!is_block_a_new_position(program_[begin + i])) fixed[i] = true;
             }
         }
     }
-    
-    program_t ret;
-    ret.reserve(program_.size());
-    unsigned int idx_in_program = 0;
-    auto qpsh = [&]() {
-        while ((idx_in_program < program_.size()) && !is_block_a_new_position(program_.at(idx_in_program))) {
-            //std::cout << "   i " << i << "  idx_in_program " << idx_in_program << std::endl;
-            ret.push_back(program_.at(idx_in_program));
+    std::vector<char> toDelete;
+    if (simplifier == configuration::path_simplifier_e::VISVALINGAM_WHYATT) {
+        toDelete = visvalingam_whyatt_mask(path, epsilon, fixed);
+    } else {
+        toDelete = douglas_peucker_mask(path, epsilon, threads);
+        for (unsigned i = 0; i < path.size(); i++)
+            if (fixed[i]) toDelete[i] = false;
+    }
+
+    // the i-th point of the path is the i-th position block, other blocks always stay
+    std::size_t idx_in_program = begin;
+    for (unsigned int i = 1; i < path.size(); i++) {
+        while ((idx_in_program < end) && !is_block_a_new_position(program_[idx_in_program]))
             idx_in_program++;
+        if (toDelete[i]) to_remove[idx_in_program] = 1;
+        idx_in_program++;
+    }
+}
+
+/**
+ * finds the G0 and G1 groups in the same way as group_gcode_commands does. If the G1 group starts
+ * without the feedrate, then group_gcode_commands adds the block with the feedrate, so it is added
+ * to the program as well.
+ */
+std::vector<std::pair<std::size_t, std::size_t>> find_motion_groups(program_t& program_)
+{
+    std::vector<std::pair<std::size_t, std::size_t>> groups;
+    std::vector<std::pair<std::size_t, double>> inserted_blocks;
+    for (int pass = 0; pass < 2; pass++) {
+        groups.clear();
+        inserted_blocks.clear();
+        double feedrate = 1; // default initial state of group_gcode_commands
+        std::size_t front = 0;
+        for (std::size_t i = 0; i < program_.size(); i++) {
+            const auto& e = program_[i];
+            if (e.count('F')) feedrate = e.at('F');
+            bool new_group = false;
+            if (i == 0) {
+                if ((e.count('G') == 0) && (e.count('M') == 0)) throw std::invalid_argument("the first command must be G or M");
+                new_group = true;
+            } else if (e.count('G')) {
+                new_group = !(program_[i - 1].count('G') && (program_[front].at('G') == e.at('G')) && (e.at('G') <= 3));
+            } else if (e.count('M')) {
+                new_group = true;
+            } else if (program_[front].count('G') == 0) {
+                throw std::invalid_argument("It is not clear if the command is about G or M");
+            }
+            if (new_group) {
+                if (i > 0) groups.push_back({front, i});
+                front = i;
+                if ((e.count('G') == 1) && (((int)e.at('G')) == 1) && (e.count('F') == 0)) inserted_blocks.push_back({i, feedrate});
+            }
         }
-    };
-    for (unsigned int i = 1; i < path.size(); i++) {
-        //        std::cout << "++ i " << i << "  idx_in_program " << idx_in_program << " ;;; toDelete: " <<
-        //        (toDelete[i]?"delete":"keep") << std::endl;
-        qpsh();
-        if (!toDelete[i]) {
-            //std::cout << "     push " << idx_in_program << std::endl;
-            //path.push_back(tmp[i]);
-            if (idx_in_program < program_.size())
-                ret.push_back(program_.at(idx_in_program));
-            else
-                std::cout << "     push failed[" << i << "]:: " << idx_in_program << std::endl;
+        if (program_.size()) groups.push_back({front, program_.size()});
+        if (inserted_blocks.empty()) break;
+        program_t with_feedrates;
+        with_feedrates.reserve(program_.size() + inserted_blocks.size());
+        std::size_t next_inserted = 0;
+        for (std::size_t i = 0; i < program_.size(); i++) {
+            if ((next_inserted < inserted_blocks.size()) && (inserted_blocks[next_inserted].first == i)) {
+                with_feedrates.push_back({{'G', 1.0}, {'F', inserted_blocks[next_inserted].second}});
+                next_inserted++;
+            }
+            with_feedrates.push_back(std::move(program_[i]));
         }
-        idx_in_program++;
+        program_ = std::move(with_feedrates);
     }
-    qpsh();
-    ret.shrink_to_fit();
-    //for (auto &p:ret) if (p.count('F')) p['F'] /= 100.0;
-    return ret;
+    std::vector<std::pair<std::size_t, std::size_t>> motion_groups;
+    for (const auto& g : groups) {
+        const auto& e = program_[g.first];
+        if (e.count('G') && ((e.at('G') == 0) || (e.at('G') == 1))) motion_groups.push_back(g);
+    }
+    return motion_groups;
 }
 
-program_t optimize_path_douglas_peucker(const program_t& program_, const double epsilon, const block_t& p0_)
+program_t simplify_path_groups(program_t&& program_, const double epsilon, const block_t& p0_, const int threads_, const configuration::path_simplifier_e simplifier)
 {
-    program_t ret;
-    block_t state = p0_;
-    for (auto e : group_gcode_commands(program_)) {
-        // std::cout << "e: " << e.size() << std::endl;
-        if (e.at(0).count('G') && e.at(0).at('G') == 0) {
-            auto pp = optimize_path_douglas_peucker_g(e, epsilon, p0_);
-            // std::cout << "pp: " << pp.size() << std::endl;
-            state = last_state_after_program_execution(e, state);
-            ret.insert(ret.end(), pp.begin(), pp.end());
-        } else if (e.at(0).count('G') && e.at(0).at('G') == 1) {
-            auto pp = optimize_path_douglas_peucker_g(e, epsilon, p0_);
-            // std::cout << "pp: " << pp.size() << std::endl;
-            state = last_state_after_program_execution(e, state);
-            ret.insert(ret.end(), pp.begin(), pp.end());
+    program_t program = std::move(program_);
+    auto groups = find_motion_groups(program);
+    int threads = threads_to_use(threads_);
+
+    // long groups are simplified one by one on all the threads, the short ones are divided between threads
+    std::vector<char> to_remove(program.size(), 0);
+    std::vector<std::size_t> short_groups;
+    std::size_t short_groups_size = 0;
+    for (std::size_t i = 0; i < groups.size(); i++) {
+        std::size_t size = groups[i].second - groups[i].first;
+        if (size >= dp_parallel_scan_size) {
+            simplify_path_g(program, groups[i].first, groups[i].second, epsilon, p0_, threads, simplifier, to_remove);
         } else {
-            ret.insert(ret.end(), e.begin(), e.end());
+            short_groups.push_back(i);
+            short_groups_size += size;
         }
     }
-    return ret;
+    auto simplify_short_group = [&](std::size_t i) {
+        simplify_path_g(program, groups[i].first, groups[i].second, epsilon, p0_, 1, simplifier, to_remove);
+    };
+    if ((threads == 1) || (short_groups.size() < 2) || (short_groups_size < dp_min_task_size)) {
+        for (auto i : short_groups)
+            simplify_short_group(i);
+    } else {
+        // groups do not overlap, so every thread writes to different elements of to_remove
+        parallel_for(short_groups.size(), threads, [&](std::size_t i) {
+            simplify_short_group(short_groups[i]);
+        });
+    }
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < program.size(); i++) {
+        if (to_remove[i]) continue;
+        if (kept != i) program[kept] = std::move(program[i]);
+        kept++;
+    }
+    program.resize(kept);
+    return program;
+}
+
+program_t optimize_path_douglas_peucker(const program_t& program_, const double epsilon, const block_t& p0_, const int threads)
+{
+    return simplify_path_groups(program_t(program_), epsilon, p0_, threads, configuration::path_simplifier_e::DOUGLAS_PEUCKER);
+}
+
+program_t optimize_path_douglas_peucker(program_t&& program_, const double epsilon, const block_t& p0_, const int threads)
+{
+    return simplify_path_groups(std::move(program_), epsilon, p0_, threads, configuration::path_simplifier_e::DOUGLAS_PEUCKER);
+}
+
+program_t optimize_path_visvalingam_whyatt(const program_t& program_, const double epsilon, const block_t& p0_, const int threads)
+{
+    return simplify_path_groups(program_t(program_), epsilon, p0_, threads, configuration::path_simplifier_e::VISVALINGAM_WHYATT);
+}
+
+program_t optimize_path_visvalingam_whyatt(program_t&& program_, const double epsilon, const block_t& p0_, const int threads)
+{
+    return simplify_path_groups(std::move(program_), epsilon, p0_, threads, configuration::path_simplifier_e::VISVALINGAM_WHYATT);
 }
 } // namespace gcd
 } // namespace raspigcd
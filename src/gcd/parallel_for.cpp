@@ -0,0 +1,70 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <gcd/parallel_for.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raspigcd {
+namespace gcd {
+
+int threads_to_use(const int threads)
+{
+    return (threads > 0) ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+void parallel_for(const std::size_t n, const int threads_, const std::function<void(std::size_t)>& f)
+{
+    int threads = (int)std::min((std::size_t)threads_to_use(threads_), n);
+    if (threads <= 1) {
+        for (std::size_t i = 0; i < n; i++)
+            f(i);
+        return;
+    }
+    std::atomic<std::size_t> next_index(0);
+    // the exception from the worker is passed to the calling thread, the first one wins
+    std::exception_ptr first_exception;
+    std::mutex first_exception_mutex;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            try {
+                for (std::size_t i = next_index++; i < n; i = next_index++)
+                    f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(first_exception_mutex);
+                if (!first_exception) first_exception = std::current_exception();
+                next_index = n; // the other threads do not take new indexes
+            }
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+    if (first_exception) std::rethrow_exception(first_exception);
+}
+
+} // namespace gcd
+} // namespace raspigcd
@@ -0,0 +1,312 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include <gcd/preprocess_program.hpp>
+
+#include <gcd/arcs.hpp>
+#include <gcd/parallel_for.hpp>
+#include <gcd/reorder_travel_moves.hpp>
+#include <movement/physics.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+namespace raspigcd {
+namespace gcd {
+
+namespace {
+/// the same as last_state_after_program_execution, but the state is updated in place
+void update_state_after_program_execution(block_t& state, const program_t& program_)
+{
+    state['X'];
+    state['Y'];
+    state['Z'];
+    for (const auto& e : program_) {
+        state.erase('M');
+        if (e.count('G') && ((int)(e.at('G')) == 4)) continue; // G4 means dwell, we don't need that
+        for (const auto& v : e)
+            state[v.first] = v.second;
+    }
+}
+
+bool is_g_part(const program_t& ppart, const int g)
+{
+    return (ppart.size() != 0) && (ppart[0].count('M') == 0) && ppart[0].count('G') && ((int)(ppart[0].at('G')) == g);
+}
+
+bool is_full_g1_block(const block_t& block)
+{
+    return block.count('G') && ((int)(block.at('G')) == 1) && block.count('F') && block.count('X') && block.count('Y') && block.count('Z');
+}
+
+/**
+ * the moves at the end of the prepared program are braked to the velocity v with the acceleration
+ * limits. The braking node is inserted on the last G1 move at the point where the braking starts.
+ * If that move is too short, the whole move is braking and the moves before it are braked as well.
+ * When the start of the move is not known, it is braked on its whole length.
+ */
+void brake_before_arc(program_t& prepared_program, double v, const configuration::proportional_limits& plimits)
+{
+    using namespace raspigcd::movement::physics;
+    for (std::size_t k = prepared_program.size(); k > 0; k--) {
+        auto& block = prepared_program[k - 1];
+        if (!block.count('G') || !block.count('F') || (block['G'] < 1) || (block['G'] > 3) || (block['F'] <= v)) return;
+        if (!is_full_g1_block(block) || (k < 2) || !is_full_g1_block(prepared_program[k - 2])) {
+            block['F'] = v;
+            return;
+        }
+        path_node_t end = {block_to_distance_t(block), v};
+        path_node_t start = {block_to_distance_t(prepared_program[k - 2]), block['F']};
+        distance_t move_vec = start.p - end.p;
+        if (move_vec.length() < 0.00000001) {
+            block['F'] = v;
+            continue;
+        }
+        const auto move_limits = plimits.all(move_vec);
+        path_node_t transition_point = calculate_transition_point(end, start, move_limits.max_accelerations_mm_s2, move_limits.max_jerk_mm_s3);
+        if ((transition_point.v >= start.v) && ((transition_point.p - start.p).length() > 0.00000001)) {
+            // keep the velocity till the braking node
+            block_t braking_node = merge_blocks(block, distance_to_block(transition_point.p));
+            block['F'] = v;
+            prepared_program.insert(prepared_program.begin() + (k - 1), braking_node);
+            return;
+        }
+        // the move before must end with the velocity from which this move can brake
+        block['F'] = v;
+        v = transition_point.v;
+    }
+}
+
+/**
+ * the states of the machine before the G0 parts. They are the same as in the sequential
+ * planning as long as the planned G0 parts and arcs end with the same feedrate as the
+ * source, so every one of them must be checked before it is used.
+ */
+std::vector<block_t> expected_states_before_g0_parts(const partitioned_program_t& program_parts, block_t machine_state, const int threads)
+{
+    // the changes made by every part
+    std::vector<block_t> changes(program_parts.size());
+    parallel_for(program_parts.size(), threads, [&](std::size_t i) {
+        const auto& ppart = program_parts[i];
+        if ((ppart.size() == 0) || ppart[0].count('M') || (ppart[0].count('G') == 0)) return;
+        switch ((int)(ppart[0].at('G'))) {
+        case 0:
+        case 1:
+            for (const auto& e : ppart) {
+                changes[i].erase('M');
+                if (e.count('G') && ((int)(e.at('G')) == 4)) continue;
+                for (const auto& v : e)
+                    changes[i][v.first] = v.second;
+            }
+            break;
+        case 2:
+        case 3:
+            for (const auto& block : ppart)
+                for (const auto& v : block)
+                    changes[i][v.first] = v.second;
+            break;
+        case 4:
+        case 28:
+        case 92:
+            changes[i] = ppart.front();
+            break;
+        }
+    });
+    std::vector<block_t> states(program_parts.size());
+    for (std::size_t i = 0; i < program_parts.size(); i++) {
+        if (is_g_part(program_parts[i], 0)) states[i] = machine_state;
+        if (is_g_part(program_parts[i], 0) || is_g_part(program_parts[i], 1)) {
+            // the same as update_state_after_program_execution
+            machine_state['X'];
+            machine_state['Y'];
+            machine_state['Z'];
+            machine_state.erase('M');
+        }
+        for (const auto& v : changes[i])
+            machine_state[v.first] = v.second;
+    }
+    return states;
+}
+} // namespace
+
+partitioned_program_t preprocess_program_parts(partitioned_program_t program_parts, const configuration::global& cfg, block_t machine_state)
+{
+    program_t prepared_program;
+    std::size_t program_size = 0;
+    for (const auto& ppart : program_parts)
+        program_size += ppart.size();
+    prepared_program.reserve(program_size);
+    // moves the part to the prepared program and releases it
+    auto move_part = [&prepared_program](program_t& ppart) {
+        prepared_program.insert(prepared_program.end(), std::make_move_iterator(ppart.begin()), std::make_move_iterator(ppart.end()));
+        ppart = program_t();
+    };
+
+    if (cfg.cross_group_blending) {
+        program_parts = blend_motion_parts(program_parts, cfg, machine_state);
+    }
+    // the G0 parts are planned in parallel from the expected states, and the parts that start
+    // from the different state are planned again in order
+    std::vector<block_t> planned_from;
+    std::vector<program_t> planned(program_parts.size());
+    const configuration::proportional_limits plimits(cfg);
+    const int threads = threads_to_use(cfg.planning_threads);
+    if (!cfg.cross_group_blending && (threads > 1)) {
+        planned_from = expected_states_before_g0_parts(program_parts, machine_state, threads);
+        parallel_for(program_parts.size(), threads, [&](std::size_t i) {
+            if (is_g_part(program_parts[i], 0)) planned[i] = g1_move_to_g1_with_machine_limits(program_parts[i], cfg, planned_from[i]);
+        });
+    }
+    for (std::size_t i = 0; i < program_parts.size(); i++) {
+        auto& ppart = program_parts[i];
+        if (ppart.size() != 0) {
+            if (ppart[0].count('M') == 0) {
+                //std::cout << "G PART: " << ppart.size() << std::endl;
+                switch ((int)(ppart[0]['G'])) {
+                case 0:
+                    if (!cfg.cross_group_blending) {
+                        if (planned[i].size() && (planned_from[i] == machine_state))
+                            ppart = std::move(planned[i]);
+                        else
+                            ppart = g1_move_to_g1_with_machine_limits(ppart, cfg, machine_state);
+                    }
+                    update_state_after_program_execution(machine_state, ppart);
+                    move_part(ppart);
+                    break;
+                case 1:
+                    //  (DO NOT INTERPRET G1) ppart = g1_move_to_g1_with_machine_limits(ppart, cfg, machine_state, false);
+                    update_state_after_program_execution(machine_state, ppart);
+                    move_part(ppart);
+                    break;
+                case 2:
+                case 3:
+                    // the feedrate on the arc is limited by the centripetal acceleration
+                    for (auto& ppart_block : ppart) {
+                        block_t block = std::move(ppart_block);
+                        auto arc = block_to_arc(machine_state, block);
+                        block['F'] = std::min(block.count('F') ? block['F'] : machine_state['F'], arc_max_velocity(arc, cfg));
+                        // the move before the arc must end with the velocity that is allowed on the arc
+                        if (prepared_program.size() && prepared_program.back().count('G') && prepared_program.back().count('F') &&
+                            (prepared_program.back()['G'] >= 1) && (prepared_program.back()['G'] <= 3) &&
+                            (prepared_program.back()['F'] > block['F'])) {
+                            brake_before_arc(prepared_program, block['F'], plimits);
+                            machine_state['F'] = block['F'];
+                        }
+                        // accelerate with the maximal acceleration and then keep the speed till the end of the arc
+                        double v0 = machine_state['F'];
+                        double arc_acceleration = movement::physics::jerk_limited_acceleration(block['F'] - v0,
+                            arc_max_acceleration(arc, cfg), arc_max_jerk(arc, cfg));
+                        double accel_distance = (block['F'] * block['F'] - v0 * v0) / (2.0 * arc_acceleration);
+                        if ((accel_distance > 0) && (accel_distance < arc.length() * 0.9)) {
+                            auto [accelerating, cruising] = split_arc_block(machine_state, block, accel_distance);
+                            prepared_program.push_back(accelerating);
+                            machine_state = merge_blocks(machine_state, accelerating);
+                            block = cruising;
+                        }
+                        machine_state = merge_blocks(machine_state, block);
+                        prepared_program.push_back(std::move(block));
+                    }
+                    ppart = program_t();
+                    break;
+                case 4:
+                case 28:
+                case 92:
+                    machine_state = merge_blocks(machine_state, ppart.front());
+                    move_part(ppart);
+                    break;
+                }
+            } else {
+                //std::cout << "M PART: " << ppart.size() << std::endl;
+                for (auto& m : ppart) {
+                    switch ((int)(m['M'])) {
+                    case 18:
+                    case 3:
+                    case 5:
+                    case 17:
+                        prepared_program.push_back(std::move(m));
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    program_parts = partitioned_program_t();
+
+    prepared_program = (cfg.path_simplifier == configuration::VISVALINGAM_WHYATT) ?
+        optimize_path_visvalingam_whyatt(std::move(prepared_program), cfg.douglas_peucker_marigin) :
+        optimize_path_douglas_peucker(std::move(prepared_program), cfg.douglas_peucker_marigin);
+    return group_gcode_commands(remove_duplicate_blocks(std::move(prepared_program), {}));
+}
+
+
+partitioned_program_t preprocess_program(program_t program_,
+    const configuration::global& cfg,
+    const block_t& initial_state,
+    const bool raw_gcode,
+    const std::shared_ptr<metrics_registry>& metrics)
+{
+    using stage_timer = metrics_registry::stage_timer;
+    program_t program = std::move(program_);
+    {
+        stage_timer t(metrics, "enrich");
+        program = enrich_gcode_with_feedrate_commands(std::move(program), cfg);
+    }
+    if (!raw_gcode && cfg.reorder_travel_moves) {
+        stage_timer t(metrics, "reorder_travel");
+        travel_statistics_t travel_statistics;
+        program = reorder_travel_moves(program, initial_state, travel_statistics);
+        std::cerr << "TRAVEL_REORDER: " << travel_statistics.travel_before_mm << " -> " << travel_statistics.travel_after_mm << " mm (" << travel_statistics.cuts << " cuts)" << std::endl;
+    }
+    if (!raw_gcode) {
+        if (cfg.path_simplifier == configuration::VISVALINGAM_WHYATT) {
+            stage_timer t(metrics, "visvalingam_whyatt");
+            program = optimize_path_visvalingam_whyatt(std::move(program), cfg.douglas_peucker_marigin, initial_state);
+        } else {
+            stage_timer t(metrics, "douglas_peucker");
+            program = optimize_path_douglas_peucker(std::move(program), cfg.douglas_peucker_marigin, initial_state);
+        }
+    }
+    partitioned_program_t program_parts;
+    {
+        stage_timer t(metrics, "group");
+        program_parts = group_gcode_commands(std::move(program));
+    }
+    if (raw_gcode) return program_parts;
+
+    std::cerr << "PREPROCESSING GCODE" << std::endl;
+    block_t machine_state = initial_state;
+    {
+        stage_timer t(metrics, "insert_nodes");
+        program_parts = insert_additional_nodes_inbetween_consume(std::move(program_parts), machine_state, cfg, cfg.planning_threads);
+    }
+    machine_state['F'] = *std::min_element(cfg.max_no_accel_velocity_mm_s.begin(), cfg.max_no_accel_velocity_mm_s.end());
+    {
+        stage_timer t(metrics, "preprocess");
+        program_parts = preprocess_program_parts(std::move(program_parts), cfg, machine_state);
+    }
+    return program_parts;
+}
+
+} // namespace gcd
+} // namespace raspigcd
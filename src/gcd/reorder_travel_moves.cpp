@@ -0,0 +1,448 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <gcd/reorder_travel_moves.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace raspigcd {
+namespace gcd {
+
+namespace {
+
+static const int two_opt_window = 48;
+static const int two_opt_max_passes = 10;
+
+enum class block_kind_e {
+    TRAVEL,
+    CUT,
+    BARRIER
+};
+
+struct point_t {
+    double x, y, z;
+};
+
+block_kind_e block_kind(const block_t& b)
+{
+    if (b.count('G') && b.count('M')) return block_kind_e::BARRIER;
+    if (b.count('G')) {
+        int g = (int)b.at('G');
+        if (((double)g) != b.at('G')) return block_kind_e::BARRIER;
+        if (g == 0) return block_kind_e::TRAVEL;
+        if ((g == 1) || (g == 2) || (g == 3) || (g == 4)) return block_kind_e::CUT;
+        return block_kind_e::BARRIER;
+    }
+    if (b.count('M')) {
+        if ((b.at('M') == 3) || (b.at('M') == 5)) return block_kind_e::CUT;
+    }
+    return block_kind_e::BARRIER;
+}
+
+bool is_motion(const block_t& b)
+{
+    return b.count('G') && (b.at('G') >= 1) && (b.at('G') <= 3);
+}
+
+/// position after the block, the same rules as in last_state_after_program_execution
+block_t position_after(const block_t& position, const block_t& b)
+{
+    if (b.count('G') && ((int)b.at('G') == 4)) return position;
+    block_t ret = position;
+    for (char axis : {'X', 'Y', 'Z', 'A'})
+        if (b.count(axis)) ret[axis] = b.at(axis);
+    return ret;
+}
+
+point_t to_point(const block_t& position)
+{
+    return {position.at('X'), position.at('Y'), position.at('Z')};
+}
+
+double distance_3d(const point_t& a, const point_t& b)
+{
+    return std::sqrt((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y) + (b.z - a.z) * (b.z - a.z));
+}
+
+double distance_xy(const point_t& a, const point_t& b)
+{
+    return std::sqrt((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y));
+}
+
+block_t with_position(const block_t& b, const block_t& position)
+{
+    block_t ret = b;
+    for (const auto& e : position)
+        ret[e.first] = e.second;
+    return ret;
+}
+
+/**
+ * the cut sequence that can be moved. Blocks are stored with the full position,
+ * so they do not depend on the moves before them.
+ */
+struct cut_t {
+    program_t blocks;
+    program_t reversed_blocks; ///< empty if the cut can not be reversed
+    block_t start;
+    block_t end;
+    bool reversible() const { return reversed_blocks.size() > 0; }
+    const block_t& entry(bool reversed) const { return reversed ? end : start; }
+    const block_t& exit(bool reversed) const { return reversed ? start : end; }
+};
+
+cut_t make_cut(const program_t& program_, std::size_t from, std::size_t to, const block_t& start_position)
+{
+    cut_t cut;
+    cut.start = start_position;
+    block_t position = start_position;
+    std::vector<block_t> positions = {position};
+    bool reversible = true;
+    std::size_t first_motion = to, last_motion = from;
+    for (std::size_t i = from; i < to; i++) {
+        const auto& b = program_[i];
+        position = position_after(position, b);
+        if (is_motion(b)) {
+            cut.blocks.push_back(with_position(b, position));
+            positions.push_back(position);
+            first_motion = std::min(first_motion, i);
+            last_motion = i;
+            if (((int)b.at('G') != 1) || (position.at('Z') != start_position.at('Z'))) reversible = false;
+        } else {
+            cut.blocks.push_back(b);
+            if (b.count('G')) reversible = false; // dwell
+        }
+    }
+    cut.end = position;
+    // M codes can only be at the beginning and at the end of the reversed cut
+    for (std::size_t i = first_motion; (i < last_motion) && (first_motion < to); i++)
+        if (!is_motion(program_[i])) reversible = false;
+    if (reversible && (first_motion < to)) {
+        for (std::size_t i = from; i < first_motion; i++)
+            cut.reversed_blocks.push_back(program_[i]);
+        std::size_t motions = positions.size() - 1;
+        std::size_t motion_idx = motions;
+        for (std::size_t i = last_motion + 1; i-- > first_motion;) {
+            const auto& b = program_[i];
+            block_t r = {{'G', 1}};
+            if (b.count('F')) r['F'] = b.at('F');
+            cut.reversed_blocks.push_back(with_position(r, positions[motion_idx - 1]));
+            motion_idx--;
+        }
+        for (std::size_t i = last_motion + 1; i < to; i++)
+            cut.reversed_blocks.push_back(program_[i]);
+    }
+    return cut;
+}
+
+/// uniform grid over the cut entries for the nearest neighbour search
+class entry_grid_t
+{
+    double min_x, min_y, cell;
+    int w, h;
+    std::vector<std::vector<std::pair<int, bool>>> cells;
+
+    int cell_x(double x) const { return std::min(w - 1, std::max(0, (int)((x - min_x) / cell))); }
+    int cell_y(double y) const { return std::min(h - 1, std::max(0, (int)((y - min_y) / cell))); }
+
+public:
+    entry_grid_t(const std::vector<cut_t>& cuts, const std::vector<point_t>& extra_points)
+    {
+        std::vector<point_t> pts = extra_points;
+        for (const auto& c : cuts) {
+            pts.push_back(to_point(c.start));
+            pts.push_back(to_point(c.end));
+        }
+        min_x = min_y = std::numeric_limits<double>::max();
+        double max_x = std::numeric_limits<double>::lowest(), max_y = max_x;
+        for (const auto& p : pts) {
+            min_x = std::min(min_x, p.x);
+            min_y = std::min(min_y, p.y);
+            max_x = std::max(max_x, p.x);
+            max_y = std::max(max_y, p.y);
+        }
+        double side = std::max(std::max(max_x - min_x, max_y - min_y), 1e-6);
+        int n = std::max(1, (int)std::sqrt((double)cuts.size()));
+        cell = side / n;
+        w = std::min(n, (int)((max_x - min_x) / cell) + 1);
+        h = std::min(n, (int)((max_y - min_y) / cell) + 1);
+        cells.resize(w * h);
+        for (int i = 0; i < (int)cuts.size(); i++) {
+            auto s = to_point(cuts[i].start);
+            cells[cell_y(s.y) * w + cell_x(s.x)].push_back({i, false});
+            if (cuts[i].reversible()) {
+                auto e = to_point(cuts[i].end);
+                cells[cell_y(e.y) * w + cell_x(e.x)].push_back({i, true});
+            }
+        }
+    }
+
+    /// finds the closest entry of the cut that was not used yet. Used entries are removed on the way
+    std::pair<int, bool> nearest(const point_t& p, const std::vector<cut_t>& cuts, const std::vector<bool>& used)
+    {
+        std::pair<int, bool> best = {-1, false};
+        double best_d = std::numeric_limits<double>::max();
+        int cx = cell_x(p.x), cy = cell_y(p.y);
+        for (int r = 0; r <= std::max(w, h); r++) {
+            for (int y = cy - r; y <= cy + r; y++) {
+                if ((y < 0) || (y >= h)) continue;
+                for (int x = cx - r; x <= cx + r; x++) {
+                    if ((x < 0) || (x >= w)) continue;
+                    if ((std::abs(x - cx) != r) && (std::abs(y - cy) != r)) continue;
+                    auto& c = cells[y * w + x];
+                    for (std::size_t k = 0; k < c.size();) {
+                        if (used[c[k].first]) {
+                            c[k] = c.back();
+                            c.pop_back();
+                            continue;
+                        }
+                        double d = distance_xy(p, to_point(cuts[c[k].first].entry(c[k].second)));
+                        if ((d < best_d) || ((d == best_d) && (c[k] < best))) {
+                            best_d = d;
+                            best = c[k];
+                        }
+                        k++;
+                    }
+                }
+            }
+            if ((best.first >= 0) && (best_d <= r * cell)) break;
+        }
+        return best;
+    }
+};
+
+/// travel moves from one position to another, never going lower than travel_z
+program_t travel_moves(const block_t& from, const block_t& to, double travel_z, double f)
+{
+    program_t ret;
+    double z = std::max(travel_z, std::max(from.at('Z'), to.at('Z')));
+    block_t p = from;
+    if (p.at('Z') < z) {
+        p['Z'] = z;
+        ret.push_back(with_position({{'G', 0}, {'F', f}}, p));
+    }
+    for (char axis : {'X', 'Y', 'A'})
+        if (to.count(axis)) p[axis] = to.at(axis);
+    if ((p.at('X') != from.at('X')) || (p.at('Y') != from.at('Y')) ||
+        (p.count('A') && (p.at('A') != (from.count('A') ? from.at('A') : 0.0))))
+        ret.push_back(with_position({{'G', 0}, {'F', f}}, p));
+    if (p.at('Z') != to.at('Z')) {
+        p['Z'] = to.at('Z');
+        ret.push_back(with_position({{'G', 0}, {'F', f}}, p));
+    }
+    return ret;
+}
+
+double travel_length(const program_t& travel, const block_t& from)
+{
+    double l = 0.0;
+    block_t p = from;
+    for (const auto& b : travel) {
+        auto n = position_after(p, b);
+        l += distance_3d(to_point(p), to_point(n));
+        p = n;
+    }
+    return l;
+}
+
+/**
+ * orders the cuts starting at start_point and finishing at end_point.
+ * Returns the order of cuts with the information if the cut is reversed.
+ */
+std::vector<std::pair<int, bool>> order_cuts(const std::vector<cut_t>& cuts, const point_t& start_point, const point_t& end_point)
+{
+    std::vector<std::pair<int, bool>> order;
+    order.reserve(cuts.size());
+    entry_grid_t grid(cuts, {start_point, end_point});
+    std::vector<bool> used(cuts.size(), false);
+    point_t p = start_point;
+    for (std::size_t i = 0; i < cuts.size(); i++) {
+        auto n = grid.nearest(p, cuts, used);
+        used[n.first] = true;
+        order.push_back(n);
+        p = to_point(cuts[n.first].exit(n.second));
+    }
+
+    // 2-opt: reverse the part of the tour if it is shorter. Only the reversible cuts can be in the reversed part
+    auto exit_point = [&](int i) { return (i < 0) ? start_point : to_point(cuts[order[i].first].exit(order[i].second)); };
+    auto entry_point = [&](int i) { return (i >= (int)order.size()) ? end_point : to_point(cuts[order[i].first].entry(order[i].second)); };
+    std::vector<int> not_reversible_count(cuts.size() + 1, 0);
+    for (std::size_t i = 0; i < order.size(); i++)
+        not_reversible_count[i + 1] = not_reversible_count[i] + (cuts[order[i].first].reversible() ? 0 : 1);
+    int n = order.size();
+    for (int pass = 0; pass < two_opt_max_passes; pass++) {
+        bool improved = false;
+        for (int i = 0; i < n; i++) {
+            for (int j = i; (j < n) && (j < i + two_opt_window); j++) {
+                if (not_reversible_count[j + 1] != not_reversible_count[i]) break;
+                double before = distance_xy(exit_point(i - 1), entry_point(i)) + distance_xy(exit_point(j), entry_point(j + 1));
+                double after = distance_xy(exit_point(i - 1), exit_point(j)) + distance_xy(entry_point(i), entry_point(j + 1));
+                if (after < before - 1e-9) {
+                    std::reverse(order.begin() + i, order.begin() + j + 1);
+                    for (int k = i; k <= j; k++)
+                        order[k].second = !order[k].second;
+                    improved = true;
+                }
+            }
+        }
+        if (!improved) break;
+    }
+    return order;
+}
+
+/**
+ * reorders the fragment of the program without barriers. Returns the original
+ * fragment if it can not be improved.
+ */
+program_t reorder_region(const program_t& program_, std::size_t from, std::size_t to, const block_t& start_position, bool spindle_on, travel_statistics_t& statistics)
+{
+    program_t original(program_.begin() + from, program_.begin() + to);
+
+    // leading part (before the first travel) stays in place
+    std::size_t i = from;
+    block_t position = start_position;
+    auto update_spindle = [&spindle_on](const block_t& b) {
+        if (b.count('M') && !b.count('G')) spindle_on = (b.at('M') == 3);
+    };
+    while ((i < to) && (block_kind(program_[i]) != block_kind_e::TRAVEL)) {
+        update_spindle(program_[i]);
+        position = position_after(position, program_[i]);
+        i++;
+    }
+    std::size_t leading_end = i;
+    block_t after_leading = position;
+
+    double travel_before = 0.0;
+    double travel_z = position.at('Z');
+    double travel_f = -1;
+    std::vector<cut_t> cuts;
+    bool ends_with_travel = false;
+    while (i < to) {
+        while ((i < to) && (block_kind(program_[i]) == block_kind_e::TRAVEL)) {
+            auto n = position_after(position, program_[i]);
+            travel_before += distance_3d(to_point(position), to_point(n));
+            position = n;
+            travel_z = std::max(travel_z, position.at('Z'));
+            if ((travel_f < 0) && program_[i].count('F')) travel_f = program_[i].at('F');
+            i++;
+        }
+        if (i >= to) {
+            ends_with_travel = true;
+            break;
+        }
+        std::size_t cut_begin = i;
+        bool spindle_on_start = spindle_on;
+        while ((i < to) && (block_kind(program_[i]) == block_kind_e::CUT)) {
+            update_spindle(program_[i]);
+            i++;
+        }
+        // moving the cut would change the state of the spindle during other cuts
+        if (spindle_on_start != spindle_on) return original;
+        cuts.push_back(make_cut(program_, cut_begin, i, position));
+        position = cuts.back().end;
+    }
+    block_t end_position = position;
+
+    if (cuts.size() == 0) return original;
+    if (travel_f < 0) return original;
+
+    cut_t last_cut;
+    bool pinned_last = !ends_with_travel;
+    if (pinned_last) {
+        last_cut = cuts.back();
+        cuts.pop_back();
+    }
+    const block_t& final_target = pinned_last ? last_cut.start : end_position;
+
+    auto order = order_cuts(cuts, to_point(after_leading), to_point(final_target));
+
+    program_t result(program_.begin() + from, program_.begin() + leading_end);
+    double travel_after = 0.0;
+    position = after_leading;
+    for (const auto& o : order) {
+        const auto& cut = cuts[o.first];
+        auto travel = travel_moves(position, cut.entry(o.second), travel_z, travel_f);
+        travel_after += travel_length(travel, position);
+        result.insert(result.end(), travel.begin(), travel.end());
+        const auto& blocks = o.second ? cut.reversed_blocks : cut.blocks;
+        result.insert(result.end(), blocks.begin(), blocks.end());
+        position = cut.exit(o.second);
+    }
+    auto travel = travel_moves(position, final_target, travel_z, travel_f);
+    travel_after += travel_length(travel, position);
+    result.insert(result.end(), travel.begin(), travel.end());
+    if (pinned_last) result.insert(result.end(), last_cut.blocks.begin(), last_cut.blocks.end());
+
+    statistics.travel_before_mm += travel_before;
+    if (travel_after >= travel_before) {
+        statistics.travel_after_mm += travel_before;
+        return original;
+    }
+    statistics.travel_after_mm += travel_after;
+    statistics.cuts += cuts.size();
+    return result;
+}
+
+} // namespace
+
+program_t reorder_travel_moves(const program_t& program_, const block_t& initial_state, travel_statistics_t& statistics)
+{
+    statistics = {0.0, 0.0, 0};
+    program_t result;
+    result.reserve(program_.size());
+    block_t position = {{'X', 0.0}, {'Y', 0.0}, {'Z', 0.0}};
+    position = position_after(position, initial_state);
+    bool spindle_on = false;
+    auto update_spindle = [&spindle_on](const block_t& b) {
+        if (b.count('M') && !b.count('G') && ((b.at('M') == 3) || (b.at('M') == 5))) spindle_on = (b.at('M') == 3);
+    };
+    std::size_t i = 0;
+    while (i < program_.size()) {
+        if (block_kind(program_[i]) == block_kind_e::BARRIER) {
+            result.push_back(program_[i]);
+            position = position_after(position, program_[i]);
+            i++;
+            continue;
+        }
+        std::size_t region_end = i;
+        while ((region_end < program_.size()) && (block_kind(program_[region_end]) != block_kind_e::BARRIER))
+            region_end++;
+        auto region = reorder_region(program_, i, region_end, position, spindle_on, statistics);
+        result.insert(result.end(), region.begin(), region.end());
+        for (; i < region_end; i++) {
+            update_spindle(program_[i]);
+            position = position_after(position, program_[i]);
+        }
+    }
+    return result;
+}
+
+program_t reorder_travel_moves(const program_t& program_, const block_t& initial_state)
+{
+    travel_statistics_t statistics;
+    return reorder_travel_moves(program_, initial_state, statistics);
+}
+
+} // namespace gcd
+} // namespace raspigcd
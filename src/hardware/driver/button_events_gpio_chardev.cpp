@@ -0,0 +1,117 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <hardware/driver/button_events_gpio_chardev.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace raspigcd {
+namespace hardware {
+namespace driver {
+
+button_events_gpio_chardev::button_events_gpio_chardev(const std::vector<configuration::button>& buttons, const std::string& chip_name)
+{
+    _buttons = buttons;
+    int chip_fd = open(chip_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (chip_fd < 0) throw std::runtime_error("button_events_gpio_chardev: cannot open " + chip_name + ": " + std::strerror(errno));
+    for (auto& b : _buttons) {
+        gpioevent_request req;
+        std::memset(&req, 0, sizeof(req));
+        req.lineoffset = b.pin;
+        req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+#ifdef GPIOHANDLE_REQUEST_BIAS_PULL_UP
+        if (b.pullup) req.handleflags |= GPIOHANDLE_REQUEST_BIAS_PULL_UP;
+#endif
+        req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+        std::strncpy(req.consumer_label, "raspigcd button", sizeof(req.consumer_label) - 1);
+        if (ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+            std::string err = std::strerror(errno);
+            for (auto fd : _fds)
+                close(fd);
+            close(chip_fd);
+            throw std::runtime_error("button_events_gpio_chardev: cannot request events for pin " + std::to_string(b.pin) + ": " + err);
+        }
+        _fds.push_back(req.fd);
+    }
+    close(chip_fd);
+}
+
+button_events_gpio_chardev::~button_events_gpio_chardev()
+{
+    for (auto fd : _fds)
+        close(fd);
+}
+
+int button_events_gpio_chardev::buttons_count() const
+{
+    return _buttons.size();
+}
+
+int button_events_gpio_chardev::to_button_value(const int btn, const int level) const
+{
+    // the same meaning as in raspberry_pi_3 - the button shorts the pin to ground
+    int v = 1 - level;
+    return (_buttons[btn].invert) ? (1 - v) : v;
+}
+
+bool button_events_gpio_chardev::wait_for_event(button_event_t& event, const std::chrono::microseconds timeout)
+{
+    using namespace std::chrono;
+    std::vector<pollfd> pfds;
+    for (auto fd : _fds)
+        pfds.push_back({fd, POLLIN | POLLPRI, 0});
+    timespec timeout_ts = {(time_t)(timeout.count() / 1000000), (long)((timeout.count() % 1000000) * 1000)};
+    if (ppoll(pfds.data(), pfds.size(), &timeout_ts, nullptr) <= 0) return false;
+    for (unsigned i = 0; i < pfds.size(); i++) {
+        if (!(pfds[i].revents & (POLLIN | POLLPRI))) continue;
+        gpioevent_data data;
+        if (read(pfds[i].fd, &data, sizeof(data)) != sizeof(data)) continue;
+        auto now = steady_clock::now();
+        // the kernel timestamp is CLOCK_MONOTONIC on recent kernels. Older kernels use
+        // CLOCK_REALTIME, then the time of reading the event is the best we have
+        steady_clock::time_point ts(duration_cast<steady_clock::duration>(nanoseconds(data.timestamp)));
+        if ((ts > now) || ((now - ts) > seconds(1))) ts = now;
+        event = {(int)i, to_button_value(i, (data.id == GPIOEVENT_EVENT_RISING_EDGE) ? 1 : 0), ts};
+        return true;
+    }
+    return false;
+}
+
+int button_events_gpio_chardev::read_value(const int btn)
+{
+    gpiohandle_data data;
+    std::memset(&data, 0, sizeof(data));
+    if (ioctl(_fds.at(btn), GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0)
+        throw std::runtime_error(std::string("button_events_gpio_chardev: cannot read the button: ") + std::strerror(errno));
+    return to_button_value(btn, data.values[0]);
+}
+
+} // namespace driver
+} // namespace hardware
+} // namespace raspigcd
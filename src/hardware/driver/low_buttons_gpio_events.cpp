@@ -0,0 +1,143 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <hardware/driver/low_buttons_gpio_events.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace raspigcd {
+namespace hardware {
+namespace driver {
+
+low_buttons_gpio_events::low_buttons_gpio_events(std::shared_ptr<button_events_source> source, const std::chrono::microseconds debounce)
+{
+    _source = source;
+    _debounce = debounce;
+    for (int i = 0; i < _source->buttons_count(); i++) {
+        _state.push_back(_source->read_value(i));
+        _last_events.push_back({i, _state.back(), std::chrono::steady_clock::now()});
+        _lockout_until.push_back(std::chrono::steady_clock::time_point::min());
+        _recheck.push_back(false);
+    }
+    while (_callbacks.size() < 100) {
+        _callbacks.push_back([](int, int) {});
+    }
+    _latency = {0, 0.0, 0.0};
+    _alive = true;
+    _worker = std::thread([this]() { worker_loop(); });
+}
+
+low_buttons_gpio_events::~low_buttons_gpio_events()
+{
+    _alive = false;
+    _worker.join();
+}
+
+void low_buttons_gpio_events::on_key(int btn, std::function<void(int, int)> callback_)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    _callbacks.at(btn) = callback_;
+}
+
+std::function<void(int, int)> low_buttons_gpio_events::on_key(int btn)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    return _callbacks.at(btn);
+}
+
+std::vector<int> low_buttons_gpio_events::keys_state()
+{
+    std::lock_guard<std::mutex> lock(_m);
+    return _state;
+}
+
+button_event_t low_buttons_gpio_events::last_event(int btn)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    return _last_events.at(btn);
+}
+
+low_buttons_gpio_events::latency_statistics_t low_buttons_gpio_events::latency_statistics()
+{
+    std::lock_guard<std::mutex> lock(_m);
+    return _latency;
+}
+
+void low_buttons_gpio_events::accept_event(const button_event_t& e)
+{
+    std::function<void(int, int)> f;
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        if ((e.button < 0) || (e.button >= (int)_state.size())) return;
+        if (e.timestamp < _lockout_until[e.button]) {
+            // bouncing. The state will be checked again after the lockout
+            _recheck[e.button] = true;
+            return;
+        }
+        if (e.value == _state[e.button]) return;
+        _state[e.button] = e.value;
+        _last_events[e.button] = e;
+        _lockout_until[e.button] = e.timestamp + _debounce;
+        _recheck[e.button] = true;
+
+        double latency_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - e.timestamp).count();
+        _latency.mean_us = (_latency.mean_us * _latency.events + latency_us) / (_latency.events + 1);
+        _latency.max_us = std::max(_latency.max_us, latency_us);
+        _latency.events++;
+        f = _callbacks.at(e.button);
+    }
+    f(e.button, e.value);
+}
+
+void low_buttons_gpio_events::worker_loop()
+{
+    using namespace std::chrono;
+    while (_alive) {
+        auto timeout = microseconds(20000);
+        auto now = steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(_m);
+            for (unsigned i = 0; i < _recheck.size(); i++)
+                if (_recheck[i]) timeout = std::min(timeout, duration_cast<microseconds>(_lockout_until[i] - now));
+        }
+        button_event_t e;
+        if (_source->wait_for_event(e, std::max(timeout, microseconds(0)))) accept_event(e);
+
+        // read the inputs that were locked, because the edges during lockout were ignored
+        now = steady_clock::now();
+        for (int i = 0; i < (int)_recheck.size(); i++) {
+            int value;
+            {
+                std::lock_guard<std::mutex> lock(_m);
+                if (!(_recheck[i] && (now >= _lockout_until[i]))) continue;
+                _recheck[i] = false;
+                value = _state[i];
+            }
+            int v = _source->read_value(i);
+            if (v != value) accept_event({i, v, now});
+        }
+    }
+}
+
+} // namespace driver
+} // namespace hardware
+} // namespace raspigcd
@@ -27,6 +27,21 @@ namespace hardware {
 namespace driver {
 
 
+/**
+ * @brief the long waits (dwell) sleep, and only the last part of the wait is busy,
+ * so the waiting thread does not keep the core busy
+ */
+static const auto busy_wait_sleep_margin = std::chrono::microseconds(250);
+
+static void busy_wait_until(const std::chrono::high_resolution_clock::time_point& nextT)
+{
+    if ((nextT - std::chrono::system_clock::now()) > 2 * busy_wait_sleep_margin)
+        std::this_thread::sleep_until(nextT - busy_wait_sleep_margin);
+    for (; std::chrono::system_clock::now() < nextT;){
+        std::this_thread::yield();
+    }
+}
+
 /**
  * @brief start the timer
  * 
@@ -46,9 +61,16 @@ std::chrono::high_resolution_clock::time_point low_timers_busy_wait::wait_for_ti
 {
     auto ttime = std::chrono::microseconds((unsigned long)(t));
     auto nextT = prev_timer + ttime;
-    for (; std::chrono::system_clock::now() < nextT;){
-        std::this_thread::yield();
-    }
+    busy_wait_until(nextT);
+    return nextT;
+};
+
+std::chrono::high_resolution_clock::time_point low_timers_busy_wait::wait_for_tick_ns(
+    const std::chrono::high_resolution_clock::time_point& prev_timer,
+    const int64_t t)
+{
+    auto nextT = prev_timer + std::chrono::nanoseconds(t);
+    busy_wait_until(nextT);
     return nextT;
 };
 
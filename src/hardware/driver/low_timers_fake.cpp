@@ -47,6 +47,16 @@ std::chrono::high_resolution_clock::time_point low_timers_fake::wait_for_tick_us
     on_wait_s(dt);
     return std::chrono::system_clock::now();
 };
+
+std::chrono::high_resolution_clock::time_point low_timers_fake::wait_for_tick_ns(
+    const std::chrono::high_resolution_clock::time_point&,
+    const int64_t dt)
+{
+    // the callback and last_delay are in microseconds, the same as for wait_for_tick_us
+    last_delay = dt * 0.001;
+    on_wait_s(dt * 0.001);
+    return std::chrono::system_clock::now();
+};
 } // namespace driver
 } // namespace hardware
 } // namespace raspigcd
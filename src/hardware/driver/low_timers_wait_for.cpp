@@ -53,6 +53,15 @@ std::chrono::high_resolution_clock::time_point low_timers_wait_for::wait_for_tic
     return nextT;
 };
 
+std::chrono::high_resolution_clock::time_point low_timers_wait_for::wait_for_tick_ns(
+    const std::chrono::high_resolution_clock::time_point& prev_timer,
+    const int64_t t)
+{
+    auto nextT = prev_timer + std::chrono::nanoseconds(t);
+    std::this_thread::sleep_until(nextT);
+    return nextT;
+};
+
 } // namespace driver
 } // namespace hardware
 } // namespace raspigcd
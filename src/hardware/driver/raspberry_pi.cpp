@@ -149,41 +149,21 @@ raspberry_pi_3::raspberry_pi_3(const configuration::global& configuration)
         pins_taken_check(sppwm.pin, "OUT pwm spindle");
         INP_GPIO(sppwm.pin);
         OUT_GPIO(sppwm.pin);
-
-        _spindle_duties.push_back(0.0);
-        spindle_pwm_power(i, 0.0);
-        _spindle_threads.push_back(std::thread([this, sppwm, i]() {
-            std::cout << "starting spindle " << i << " thread" << std::endl;
-//            double& _duty = _spindle_duties[i];
-            set_thread_realtime();
-            //auto prevTime = std::chrono::steady_clock::now();
-            while (_threads_alive) {
-                const double _duty = _spindle_duties[i];
-                if ((_duty >= 0.0 ) && (_duty <= sppwm.cycle_time_seconds)) {
-                // 1
-                if (_duty >= 0.0) {
-                    if (sppwm.pin_negate)
-                        GPIO_CLR = 1 << sppwm.pin;
-                    else
-                        GPIO_SET = 1 << sppwm.pin;
-//                    std::this_thread::sleep_until(prevTime + std::chrono::microseconds((int)(_duty * 1000000.0)));
-                    std::this_thread::sleep_for(std::chrono::microseconds((int)(_duty * 1000000.0)));
-                }
-                if (_duty < sppwm.cycle_time_seconds) {
-                    // 0
-                    if (sppwm.pin_negate)
-                        GPIO_SET = 1 << sppwm.pin;
-                    else
-                        GPIO_CLR = 1 << sppwm.pin;
-                }
-//                prevTime = prevTime + std::chrono::microseconds((int)(sppwm.cycle_time_seconds * 1000000.0));
-                std::this_thread::sleep_for(std::chrono::microseconds((int)((sppwm.cycle_time_seconds-_duty) * 1000000.0)));
-//                std::this_thread::sleep_until(prevTime);
-                }
-            }
-            std::cout << "finished spindle " << i << " thread" << std::endl;
-        }));
     }
+    std::vector<double> cycle_times;
+    for (auto& sppwm : spindles)
+        cycle_times.push_back(sppwm.cycle_time_seconds);
+    // one thread serves all the pwm outputs
+    _spindles_pwm = std::make_unique<pwm_scheduler>(cycle_times, [this](int i, bool high) {
+        if (spindles[i].pin_negate) high = !high;
+        if (high)
+            GPIO_SET = 1 << spindles[i].pin;
+        else
+            GPIO_CLR = 1 << spindles[i].pin;
+    });
+    // the spindles are stopped, but the ESC needs the duty_min pulse from the start
+    for (unsigned i = 0; i < spindles.size(); i++)
+        spindle_pwm_power(i, 0.0);
 
     //    std::this_thread::sleep_until(std::chrono::steady_clock::now() + std::chrono::seconds(3));
 
@@ -214,6 +194,9 @@ raspberry_pi_3::raspberry_pi_3(const configuration::global& configuration)
     GPIO_PULL = 0;
     GPIO_PULLCLK0 = 0;
 
+    // the buttons are served by low_buttons_gpio_events, only the pull-ups are set here
+    if (configuration.buttons_driver == configuration::low_buttons_e::BUTTONS_GPIO_EVENTS) return;
+
     _btn_thread = std::async(std::launch::async, [this]() {
         static int anti_bounce_n = 100;
         std::vector<int> button_anti_bounce(buttons.size());
@@ -261,9 +244,8 @@ std::vector<int> raspberry_pi_3::keys_state()
 raspberry_pi_3::~raspberry_pi_3()
 {
     _threads_alive = false;
-    _btn_thread.get();
-    for (auto& t : _spindle_threads)
-        t.join(); //get();
+    if (_btn_thread.valid()) _btn_thread.get();
+    _spindles_pwm.reset();
     munmap((void*)gpio.addr, BLOCK_SIZE);
     close(gpio.mem_fd);
 }
@@ -369,14 +351,18 @@ void raspberry_pi_3::set_steps(const steps_t steps_count__)
         steps_counter[i] = lsteps_counter[i];
 }
 
-void raspberry_pi_3::spindle_pwm_power(const int i, const double pwr0)
+double spindle_pwm_duty(const configuration::spindle_pwm& spindle, const double pwr0)
 {
     auto pwr = pwr0;
     if (pwr < 0) throw std::invalid_argument("spindle power should be 0 or more");
     if (pwr > 1.1) throw std::invalid_argument("spindle power should be less or equal 1");
     if (pwr > 1.0) pwr = 1.0;
-    _spindle_duties[i] = (spindles.at(i).duty_max - spindles.at(i).duty_min) * pwr + spindles.at(i).duty_min;
-    std::cout << "sett duty to " << _spindle_duties[i] << std::endl;
+    return (spindle.duty_max - spindle.duty_min) * pwr + spindle.duty_min;
+}
+
+void raspberry_pi_3::spindle_pwm_power(const int i, const double pwr0)
+{
+    _spindles_pwm->set_duty(i, spindle_pwm_duty(spindles.at(i), pwr0));
 }
 
 } // namespace driver
@@ -0,0 +1,109 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <hardware/pwm_scheduler.hpp>
+#include <hardware/thread_helper.hpp>
+
+#include <algorithm>
+#include <queue>
+#include <stdexcept>
+
+namespace raspigcd {
+namespace hardware {
+
+pwm_scheduler::pwm_scheduler(const std::vector<double>& cycle_times_seconds, set_output_f set_output)
+{
+    for (auto ct : cycle_times_seconds)
+        if (ct <= 0.0) throw std::invalid_argument("pwm_scheduler: the cycle time must be greater than 0");
+    _cycle_times = cycle_times_seconds;
+    _duties.reset(new std::atomic<double>[_cycle_times.size()]);
+    for (std::size_t i = 0; i < _cycle_times.size(); i++)
+        _duties[i] = 0.0;
+    _set_output = set_output;
+    for (std::size_t i = 0; i < _cycle_times.size(); i++)
+        _set_output(i, false);
+    _alive = true;
+    _worker = std::thread([this]() { worker_loop(); });
+}
+
+pwm_scheduler::~pwm_scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        _alive = false;
+    }
+    _cv.notify_all();
+    _worker.join();
+    for (std::size_t i = 0; i < _cycle_times.size(); i++)
+        _set_output(i, false);
+}
+
+void pwm_scheduler::set_duty(const int channel, const double duty_seconds)
+{
+    if ((channel < 0) || (channel >= (int)_cycle_times.size()))
+        throw std::invalid_argument("pwm_scheduler: there is no such channel");
+    _duties[channel].store(std::max(0.0, std::min(duty_seconds, _cycle_times[channel])), std::memory_order_relaxed);
+}
+
+double pwm_scheduler::get_duty(const int channel) const
+{
+    if ((channel < 0) || (channel >= (int)_cycle_times.size()))
+        throw std::invalid_argument("pwm_scheduler: there is no such channel");
+    return _duties[channel].load(std::memory_order_relaxed);
+}
+
+void pwm_scheduler::worker_loop()
+{
+    using namespace std::chrono;
+    set_thread_realtime();
+    auto later = [](const edge_t& a, const edge_t& b) {
+        // on the same time the falling edge goes first
+        if (a.deadline == b.deadline) return a.rising && !b.rising;
+        return a.deadline > b.deadline;
+    };
+    std::priority_queue<edge_t, std::vector<edge_t>, decltype(later)> edges(later);
+    auto start = steady_clock::now();
+    for (std::size_t i = 0; i < _cycle_times.size(); i++)
+        edges.push({start, (int)i, true});
+
+    std::unique_lock<std::mutex> lock(_m);
+    while (_alive && !edges.empty()) {
+        auto e = edges.top();
+        if (_cv.wait_until(lock, e.deadline, [this]() { return !_alive; })) break;
+        edges.pop();
+        auto cycle = duration_cast<steady_clock::duration>(duration<double>(_cycle_times[e.channel]));
+        if (e.rising) {
+            const double duty = _duties[e.channel].load(std::memory_order_relaxed);
+            _set_output(e.channel, duty > 0.0);
+            if ((duty > 0.0) && (duty < _cycle_times[e.channel]))
+                edges.push({e.deadline + duration_cast<steady_clock::duration>(duration<double>(duty)), e.channel, false});
+            auto next_deadline = e.deadline + cycle;
+            // the thread was not woken up for the whole cycle, so we start again from now
+            if (next_deadline < steady_clock::now()) next_deadline = steady_clock::now();
+            edges.push({next_deadline, e.channel, true});
+        } else {
+            _set_output(e.channel, false);
+        }
+    }
+}
+
+} // namespace hardware
+} // namespace raspigcd
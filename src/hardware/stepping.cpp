@@ -30,8 +30,12 @@
 #include <steps_t.hpp>
 
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <stdexcept>
+#include <string>
+#include <thread>
 
 namespace raspigcd {
 namespace hardware {
@@ -43,13 +47,13 @@ std::list<steps_t> hardware_commands_to_steps(const std::vector<multistep_comman
 {
     std::list<steps_t> ret;
     steps_t _steps = {0, 0, 0, 0};
-    for (const auto& s : commands_to_do) {
+    multistep_commands_for_each(commands_to_do, [&](const multistep_command& s) {
         for (int i = 0; i < s.count; i++) {
             for (std::size_t j = 0; j < _steps.size(); j++)
                 _steps[j] = _steps[j] + (int)((signed char)s.b[j].step * ((signed char)s.b[j].dir * 2 - 1));
             ret.push_back(_steps);
         }
-    }
+    });
     return ret;
 }
 
@@ -57,28 +61,52 @@ steps_t hardware_commands_to_last_position_after_given_steps(const std::vector<m
 {
     steps_t _steps = {0, 0, 0, 0};
     int itt = 0;
-    for (const auto& s : commands_to_do) {
+    multistep_commands_for_each(commands_to_do, [&](const multistep_command& s) {
         for (int i = 0; i < s.count; i++) {
-            if ((last_step_ >= 0) && (itt >= last_step_)) return _steps;
+            if ((last_step_ >= 0) && (itt >= last_step_)) return;
             for (std::size_t j = 0; j < _steps.size(); j++) {
                 _steps[j] = _steps[j] + (int)((signed char)s.b[j].step * ((signed char)s.b[j].dir * 2 - 1));
             }
             itt++;
         }
-    }
+    });
     return _steps;
 }
 
+double hardware_commands_duration(const std::vector<multistep_command>& commands_to_do, const double tick_duration_s)
+{
+    auto duration = [tick_duration_s](const multistep_command& s) {
+        return (s.delay_ns > 0) ? ((double)s.count * s.delay_ns * 0.000000001) : (s.count * tick_duration_s);
+    };
+    double ret = 0.0;
+    for (std::size_t i = 0; i < commands_to_do.size(); i++) {
+        const int pattern_length = multistep_command_pattern_length(commands_to_do[i]);
+        if (pattern_length == 0) {
+            ret += duration(commands_to_do[i]);
+            continue;
+        }
+        // the pattern is counted once and multiplied
+        double pattern_duration = 0.0;
+        const std::size_t end = std::min(commands_to_do.size(), i + 1 + pattern_length);
+        for (std::size_t k = i + 1; k < end; k++)
+            pattern_duration += duration(commands_to_do[k]);
+        ret += pattern_duration * commands_to_do[i].count;
+        i = end - 1;
+    }
+    return ret;
+}
+
 int hardware_commands_to_steps_count(const std::vector<multistep_command>& commands_to_do, int last_step_)
 {
     int itt = 0;
-    for (const auto& s : commands_to_do) {
-        for (int i = 0; i < s.count; i++) {
-            if ((last_step_ >= 0) && (itt >= last_step_)) return i;
+    int ret = -1;
+    multistep_commands_for_each(commands_to_do, [&](const multistep_command& s) {
+        for (int i = 0; (i < s.count) && (ret < 0); i++) {
+            if ((last_step_ >= 0) && (itt >= last_step_)) ret = i;
             itt++;
         }
-    }
-    return itt;
+    });
+    return (ret < 0) ? itt : ret;
 }
 
 
@@ -112,6 +140,19 @@ void stepping_simple_timer::set_delay_microseconds(int delay_ms)
     _delay_microseconds = delay_ms;
 }
 
+void stepping_simple_timer::set_feed_override(const double factor)
+{
+    if (!((factor >= feed_override_min) && (factor <= feed_override_max)))
+        throw std::invalid_argument("feed override must be between " + std::to_string(feed_override_min) + " and " + std::to_string(feed_override_max));
+    _feed_override = factor;
+}
+
+void stepping_simple_timer::set_feed_override_rate(const double rate_per_s)
+{
+    if (!(rate_per_s > 0.0)) throw std::invalid_argument("feed override rate must be greater than 0");
+    _feed_override_rate = rate_per_s;
+}
+
 void stepping_simple_timer::set_low_level_steppers_driver(std::shared_ptr<low_steppers> steppers_driver)
 {
     _steppers_driver_shr = steppers_driver;
@@ -125,51 +166,213 @@ void stepping_simple_timer::set_low_level_timers(std::shared_ptr<low_timers> tim
 }
 
 
+void stepping_simple_timer::set_low_level_spindles_pwm(std::shared_ptr<low_spindles_pwm> spindles_driver)
+{
+    _spindles_driver_shr = spindles_driver;
+    _spindles_driver = _spindles_driver_shr.get();
+}
+
+
+void stepping_simple_timer::set_telemetry(std::shared_ptr<telemetry_writer> telemetry)
+{
+    _telemetry_shr = telemetry;
+    _telemetry = _telemetry_shr.get();
+}
+
+
 void stepping_simple_timer::exec(const std::vector<multistep_command>& commands_to_do,
     std::function<int (const steps_t steps_from_start, const int command_index) > on_execution_break)
+{
+    exec(commands_to_do.data(), commands_to_do.size(), on_execution_break);
+}
+
+void stepping_simple_timer::exec(const multistep_command* commands_to_do, const std::size_t commands_count,
+    std::function<int (const steps_t steps_from_start, const int command_index) > on_execution_break)
 {
     set_thread_realtime();
-    _tick_index = 0;
     std::chrono::high_resolution_clock::time_point prev_timer = _low_timer->start_timing();
     _terminate_execution = 0;
     int counter_delay = 1000;
     int start_counter_delay = 0;
     int termination_procedure_ddt = 0;
-    for (const auto& s : commands_to_do) {
-        for (int i = 0; i < s.count; i++) {
-            if (_terminate_execution > 0) {
-                if (termination_procedure_ddt == 0) {
-                    start_counter_delay = _terminate_execution;
-                    termination_procedure_ddt = -1;
-                } else if (termination_procedure_ddt > 0) {
-                    if (counter_delay == 1000) {
-                        _terminate_execution = 0;
-                        start_counter_delay = 0;
-                        termination_procedure_ddt = 0;
-                    }
+    int spindle_sync = SPINDLE_SYNC_NONE; // the last state of synchronized spindle set by this method
+
+    // the counters are kept locally and published every executor_counters_interval ticks,
+    // so the ticks do not need atomic read-modify-write operations
+    int tick_index = 0;
+    int steps_counter = _steps_counter.load(std::memory_order_relaxed);
+    auto publish_counters = [&]() {
+        _tick_index.store(tick_index, std::memory_order_relaxed);
+        _steps_counter.store(steps_counter, std::memory_order_relaxed);
+    };
+    publish_counters();
+
+    // the feed override divides the tick period. It is changed between the batches of ticks, and
+    // the change is limited by the feed override rate, so the velocity changes smoothly
+    double feed = _current_feed_override.load(std::memory_order_relaxed);
+    const double feed_rate = _feed_override_rate.load(std::memory_order_relaxed);
+    auto ramp_feed = [&](const int64_t elapsed_ns) {
+        const double target = _feed_override.load(std::memory_order_relaxed);
+        if (feed == target) return;
+        const double max_change = feed_rate * elapsed_ns * 0.000000001;
+        feed = (target > feed) ? std::min(target, feed + max_change) : std::max(target, feed - max_change);
+        _current_feed_override.store(feed, std::memory_order_relaxed);
+    };
+    auto feed_tick_ns = [&](const int64_t tick_ns) {
+        return (feed == 1.0) ? tick_ns : (int64_t)std::llround(tick_ns / feed);
+    };
+
+    // telemetry - the position is counted here, so the driver is not asked for it on every publication.
+    // The time is counted in nanoseconds, because the timed commands are not the multiples of the tick
+    const int64_t telemetry_interval_ns = (_telemetry != nullptr) ? (int64_t)_telemetry->interval_us() * 1000 : 0;
+    int64_t telemetry_countdown_ns = telemetry_interval_ns;
+    int64_t machine_time_ns = 0;
+    int command_index = 0;
+    steps_t telemetry_steps = (_telemetry != nullptr) ? _steppers_driver->get_steps() : steps_t{0, 0, 0, 0};
+    steps_t telemetry_prev_steps = telemetry_steps;
+    int64_t telemetry_prev_time_ns = 0;
+    auto publish_telemetry = [&](int cmd_i) {
+        std::array<double, 4> velocity = {0.0, 0.0, 0.0, 0.0};
+        if ((cmd_i >= 0) && (machine_time_ns > telemetry_prev_time_ns)) {
+            double dt = (machine_time_ns - telemetry_prev_time_ns) * 0.000000001;
+            for (unsigned j = 0; j < 4; j++)
+                velocity[j] = (telemetry_steps[j] - telemetry_prev_steps[j]) / dt;
+        }
+        if (!_telemetry->publish(tick_index, telemetry_steps, cmd_i, velocity)) return false;
+        telemetry_prev_steps = telemetry_steps;
+        telemetry_prev_time_ns = machine_time_ns;
+        return true;
+    };
+    // the publication that was skipped because the spindle power was written is repeated on the next tick
+    auto telemetry_countdown = [&](const int64_t elapsed_ns) {
+        if ((telemetry_countdown_ns -= elapsed_ns) <= 0) {
+            if (publish_telemetry(command_index)) telemetry_countdown_ns = telemetry_interval_ns;
+        }
+    };
+    // after the movement the executor can sleep, so the other writer can finish
+    auto publish_final_telemetry = [&]() {
+        while (!publish_telemetry(-1))
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    };
+    auto telemetry_tick = [&](const multistep_command& s, const int64_t tick_ns) {
+        machine_time_ns += tick_ns;
+        for (unsigned j = 0; j < 4; j++)
+            telemetry_steps[j] += (int)s.b[j].step * ((int)s.b[j].dir * 2 - 1);
+        telemetry_countdown(tick_ns);
+    };
+
+    // one tick of the termination procedure. The ticks are slowed down until the break handler is called
+    auto termination_tick = [&](const multistep_command& s, const int delay_ns) {
+        if (termination_procedure_ddt == 0) {
+            start_counter_delay = _terminate_execution;
+            termination_procedure_ddt = -1;
+        } else if (termination_procedure_ddt > 0) {
+            if (counter_delay == 1000) {
+                _terminate_execution = 0;
+                start_counter_delay = 0;
+                termination_procedure_ddt = 0;
+            }
+        }
+        if ((_terminate_execution == 1) && (termination_procedure_ddt < 0)) {
+            publish_counters();
+            if (on_execution_break(_steppers_driver->get_steps(), tick_index)) {
+                // the break handler could switch the spindle, so restore the synchronized state
+                if ((spindle_sync != SPINDLE_SYNC_NONE) && (_spindles_driver != nullptr)) {
+                    _spindles_driver->spindle_pwm_power(0, (spindle_sync == SPINDLE_SYNC_ON) ? 1.0 : 0.0);
                 }
-                if ((_terminate_execution == 1) && (termination_procedure_ddt < 0)) {
-                    //if (on_execution_break(hardware_commands_to_last_position_after_given_steps(commands_to_do, _tick_index),_tick_index)) {
-                    if (on_execution_break(_steppers_driver->get_steps(),_tick_index)) {
-                        termination_procedure_ddt = 1;
-                        _terminate_execution = 1;
-                        prev_timer = _low_timer->start_timing();
-                    } else {
-                    throw execution_terminated(
-                        //hardware_commands_to_last_position_after_given_steps(commands_to_do, _tick_index)
-                        _steppers_driver->get_steps()
-                    );}
-                } else {
-                    _terminate_execution += termination_procedure_ddt;
-                    counter_delay = 1000+(start_counter_delay - _terminate_execution);
+                termination_procedure_ddt = 1;
+                _terminate_execution = 1;
+                prev_timer = _low_timer->start_timing();
+            } else {
+                if (_telemetry != nullptr) publish_final_telemetry();
+                throw execution_terminated(_steppers_driver->get_steps());
+            }
+        } else if (_terminate_execution > 0) {
+            _terminate_execution += termination_procedure_ddt;
+            counter_delay = 1000 + (start_counter_delay - _terminate_execution);
+        }
+        const int64_t tick_ns = feed_tick_ns((delay_ns > 0) ? (int64_t)delay_ns : (int64_t)_delay_microseconds * 1000);
+        _steppers_driver->do_step(s.b);
+        steps_counter += s.b[0].step + s.b[1].step + s.b[2].step;
+        tick_index++;
+        if (_telemetry != nullptr) telemetry_tick(s, tick_ns);
+        if ((delay_ns > 0) || (feed != 1.0))
+            prev_timer = _low_timer->wait_for_tick_ns(prev_timer, tick_ns * counter_delay / 1000);
+        else
+            prev_timer = _low_timer->wait_for_tick_us(prev_timer, _delay_microseconds * counter_delay / 1000);
+        ramp_feed(tick_ns);
+    };
+
+    auto execute_command = [&](const multistep_command& s) {
+        if ((s.flags.bits.g != SPINDLE_SYNC_NONE) && (s.flags.bits.g != spindle_sync) && (_spindles_driver != nullptr)) {
+            spindle_sync = s.flags.bits.g;
+            _spindles_driver->spindle_pwm_power(0, (spindle_sync == SPINDLE_SYNC_ON) ? 1.0 : 0.0);
+        }
+        // the timed command waits its own delay instead of the tick
+        const int delay_ns = s.delay_ns;
+        const int step_count = s.b[0].step + s.b[1].step + s.b[2].step;
+        const bool idle = (s.b[0].step | s.b[1].step | s.b[2].step | s.b[3].step) == 0;
+        int i = 0;
+        while (i < s.count) {
+            if (_terminate_execution.load(std::memory_order_relaxed) != 0) {
+                termination_tick(s, delay_ns);
+                i++;
+                continue;
+            }
+            // the inner loop only steps and waits. It stops on the next tick after the termination request
+            const int delay_us = _delay_microseconds.load(std::memory_order_relaxed);
+            const int64_t tick_ns = feed_tick_ns((delay_ns > 0) ? (int64_t)delay_ns : (int64_t)delay_us * 1000);
+            // the tick that is not changed by the timed command nor the feed override waits in microseconds
+            const bool nominal_tick = (delay_ns == 0) && (feed == 1.0);
+            int n = 0;
+            if (idle) {
+                // nothing moves (empty ticks, dwell), so the steppers are not touched and the command is
+                // one wait until the absolute deadline. It is split into slices, so the termination is noticed
+                n = (int)std::min((int64_t)(s.count - i), std::max((int64_t)1, idle_wait_slice_ns / tick_ns));
+                prev_timer = _low_timer->wait_for_tick_ns(prev_timer, n * tick_ns);
+                tick_index += n;
+                if (_telemetry != nullptr) {
+                    machine_time_ns += n * tick_ns;
+                    telemetry_countdown(n * tick_ns);
                 }
+            } else {
+                const int batch = std::min(s.count - i, executor_counters_interval);
+                for (; (n < batch) && (_terminate_execution.load(std::memory_order_relaxed) == 0); n++) {
+                    _steppers_driver->do_step(s.b);
+                    tick_index++;
+                    if (_telemetry != nullptr) telemetry_tick(s, tick_ns);
+                    if (nominal_tick)
+                        prev_timer = _low_timer->wait_for_tick_us(prev_timer, delay_us);
+                    else
+                        prev_timer = _low_timer->wait_for_tick_ns(prev_timer, tick_ns);
+                }
+                steps_counter += n * step_count;
+            }
+            i += n;
+            publish_counters();
+            ramp_feed(n * tick_ns);
+        }
+    };
+
+    for (std::size_t ci = 0; ci < commands_count; ci++) {
+        const int pattern_length = multistep_command_pattern_length(commands_to_do[ci]);
+        if (pattern_length == 0) {
+            command_index = ci;
+            execute_command(commands_to_do[ci]);
+            continue;
+        }
+        // the pattern header - the next pattern_length commands are repeated
+        const std::size_t end = std::min(commands_count, ci + 1 + pattern_length);
+        for (int r = 0; r < commands_to_do[ci].count; r++) {
+            for (std::size_t k = ci + 1; k < end; k++) {
+                command_index = k;
+                execute_command(commands_to_do[k]);
             }
-            _steppers_driver->do_step(s.b);
-            _steps_counter += s.b[0].step + s.b[1].step + s.b[2].step;
-            _tick_index++;
-            prev_timer = _low_timer->wait_for_tick_us(prev_timer, _delay_microseconds*counter_delay/1000);
         }
+        ci = end - 1;
     }
+    publish_counters();
+    if (_telemetry != nullptr) publish_final_telemetry();
 }
 
 } // namespace hardware
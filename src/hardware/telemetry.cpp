@@ -0,0 +1,177 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <hardware/telemetry.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace raspigcd {
+namespace hardware {
+
+static_assert(sizeof(telemetry_block_t) == 112, "the telemetry block layout must not change");
+static_assert(std::atomic<std::int64_t>::is_always_lock_free, "the telemetry block must be lock free");
+static_assert(std::atomic<double>::is_always_lock_free, "the telemetry block must be lock free");
+
+telemetry_writer::telemetry_writer(const std::string& name, const int interval_us)
+{
+    _name = name;
+    _interval_us = interval_us;
+    for (auto& p : _spindle_power)
+        p = 0.0;
+    _spindle_changed = false;
+    _fd = shm_open(_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (_fd < 0) throw std::runtime_error("telemetry_writer: shm_open " + _name + ": " + std::strerror(errno));
+    if (ftruncate(_fd, sizeof(telemetry_block_t)) != 0) {
+        close(_fd);
+        throw std::runtime_error("telemetry_writer: ftruncate " + _name + ": " + std::strerror(errno));
+    }
+    void* m = mmap(NULL, sizeof(telemetry_block_t), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (m == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("telemetry_writer: mmap " + _name + ": " + std::strerror(errno));
+    }
+    std::memset(m, 0, sizeof(telemetry_block_t));
+    _block = new (m) telemetry_block_t();
+    _block->command_index = -1;
+    _block->version = TELEMETRY_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    _block->magic = TELEMETRY_MAGIC;
+}
+
+telemetry_writer::~telemetry_writer()
+{
+    munmap((void*)_block, sizeof(telemetry_block_t));
+    close(_fd);
+    shm_unlink(_name.c_str());
+}
+
+bool telemetry_writer::try_write_begin()
+{
+    // the writers are the executor and the spindle control. None of them waits for the other, because
+    // the executor runs with the realtime priority and could spin forever on the single core
+    if (_writer_lock.test_and_set(std::memory_order_acquire)) return false;
+    _block->sequence.store(_block->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+}
+
+void telemetry_writer::write_end()
+{
+    using namespace std::chrono;
+    _block->timestamp_ns.store(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+    _block->sequence.store(_block->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    _writer_lock.clear(std::memory_order_seq_cst);
+}
+
+void telemetry_writer::copy_spindle_power()
+{
+    _spindle_changed = false;
+    for (unsigned i = 0; i < _spindle_power.size(); i++)
+        _block->spindle_power[i].store(_spindle_power[i].load(), std::memory_order_relaxed);
+}
+
+void telemetry_writer::flush_spindle_power()
+{
+    // the flag is checked after the lock is released, so the power that was changed while
+    // the block was written is not lost
+    while (_spindle_changed && try_write_begin()) {
+        copy_spindle_power();
+        write_end();
+    }
+}
+
+bool telemetry_writer::publish(const std::int64_t tick_index, const steps_t& steps, const int command_index, const std::array<double, 4>& velocity)
+{
+    if (!try_write_begin()) return false;
+    _block->tick_index.store(tick_index, std::memory_order_relaxed);
+    _block->command_index.store(command_index, std::memory_order_relaxed);
+    for (unsigned i = 0; i < 4; i++) {
+        _block->steps[i].store(steps[i], std::memory_order_relaxed);
+        _block->velocity[i].store(velocity[i], std::memory_order_relaxed);
+    }
+    if (_spindle_changed) copy_spindle_power();
+    write_end();
+    flush_spindle_power();
+    return true;
+}
+
+void telemetry_writer::publish_spindle(const int i, const double power)
+{
+    if ((i < 0) || (i >= (int)_spindle_power.size())) return;
+    _spindle_power[i] = power;
+    _spindle_changed = true;
+    flush_spindle_power();
+}
+
+telemetry_reader::telemetry_reader(const std::string& name)
+{
+    _fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (_fd < 0) throw std::runtime_error("telemetry_reader: shm_open " + name + ": " + std::strerror(errno));
+    void* m = mmap(NULL, sizeof(telemetry_block_t), PROT_READ, MAP_SHARED, _fd, 0);
+    if (m == MAP_FAILED) {
+        close(_fd);
+        throw std::runtime_error("telemetry_reader: mmap " + name + ": " + std::strerror(errno));
+    }
+    _block = (const telemetry_block_t*)m;
+    if ((_block->magic != TELEMETRY_MAGIC) || (_block->version != TELEMETRY_VERSION)) {
+        munmap(m, sizeof(telemetry_block_t));
+        close(_fd);
+        throw std::runtime_error("telemetry_reader: " + name + " is not the telemetry block");
+    }
+}
+
+telemetry_reader::~telemetry_reader()
+{
+    munmap((void*)_block, sizeof(telemetry_block_t));
+    close(_fd);
+}
+
+telemetry_snapshot_t telemetry_reader::read() const
+{
+    telemetry_snapshot_t ret;
+    std::uint32_t seq_after;
+    do {
+        ret.sequence = _block->sequence.load(std::memory_order_acquire);
+        ret.command_index = _block->command_index.load(std::memory_order_relaxed);
+        ret.tick_index = _block->tick_index.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < 4; i++) {
+            ret.steps[i] = _block->steps[i].load(std::memory_order_relaxed);
+            ret.velocity[i] = _block->velocity[i].load(std::memory_order_relaxed);
+            ret.spindle_power[i] = _block->spindle_power[i].load(std::memory_order_relaxed);
+        }
+        ret.timestamp_ns = _block->timestamp_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_after = _block->sequence.load(std::memory_order_relaxed);
+    } while ((ret.sequence != seq_after) || (ret.sequence & 1));
+    return ret;
+}
+
+} // namespace hardware
+} // namespace raspigcd
@@ -0,0 +1,149 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <metrics.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+#include <sys/resource.h>
+
+namespace raspigcd {
+
+metrics_registry::stage_timer::stage_timer(const std::shared_ptr<metrics_registry>& metrics, const std::string& stage)
+{
+    _metrics = metrics.get();
+    _stage = stage;
+    _start = std::chrono::steady_clock::now();
+}
+
+metrics_registry::stage_timer::~stage_timer()
+{
+    if (_metrics != nullptr)
+        _metrics->add_stage_time(_stage, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count());
+}
+
+void metrics_registry::add_stage_time(const std::string& stage, const double ms)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    auto& s = _stages[stage];
+    s.count++;
+    s.total_ms += ms;
+    s.max_ms = std::max(s.max_ms, ms);
+    s.last_ms = ms;
+}
+
+void metrics_registry::queue_depth(const int depth)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    _queue_samples++;
+    _queue_depth_sum += depth;
+    _queue_depth_max = std::max(_queue_depth_max, depth);
+}
+
+void metrics_registry::executor_wait(const double ms, const bool in_motion)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    if (in_motion) {
+        _underruns++;
+        _underrun_ms += ms;
+    } else {
+        _startup_wait_ms += ms;
+    }
+}
+
+void metrics_registry::generated_commands(const long n, const double seconds)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    _generated_commands += n;
+    _generation_seconds += seconds;
+}
+
+void metrics_registry::executed_commands(const long n, const double seconds)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    _executed_commands += n;
+    _execution_seconds += seconds;
+}
+
+long metrics_registry::peak_memory_kb()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return usage.ru_maxrss;
+}
+
+void metrics_registry::reset()
+{
+    std::lock_guard<std::mutex> lock(_m);
+    _stages.clear();
+    _queue_samples = 0;
+    _queue_depth_sum = 0.0;
+    _queue_depth_max = 0;
+    _underruns = 0;
+    _underrun_ms = 0.0;
+    _startup_wait_ms = 0.0;
+    _generated_commands = 0;
+    _generation_seconds = 0.0;
+    _executed_commands = 0;
+    _execution_seconds = 0.0;
+}
+
+nlohmann::json metrics_registry::to_json() const
+{
+    std::lock_guard<std::mutex> lock(_m);
+    nlohmann::json stages = nlohmann::json::object();
+    for (const auto& [name, s] : _stages) {
+        stages[name] = {
+            {"count", s.count},
+            {"total_ms", s.total_ms},
+            {"max_ms", s.max_ms},
+            {"last_ms", s.last_ms}};
+    }
+    return {
+        {"stages", stages},
+        {"queue", {{"samples", _queue_samples}, {"mean_depth", (_queue_samples > 0) ? (_queue_depth_sum / _queue_samples) : 0.0}, {"max_depth", _queue_depth_max}}},
+        {"generation", {{"commands", _generated_commands}, {"seconds", _generation_seconds}, {"commands_per_second", (_generation_seconds > 0.0) ? (_generated_commands / _generation_seconds) : 0.0}}},
+        {"executor", {{"commands", _executed_commands}, {"seconds", _execution_seconds}, {"commands_per_second", (_execution_seconds > 0.0) ? (_executed_commands / _execution_seconds) : 0.0}, {"underruns", _underruns}, {"underrun_ms", _underrun_ms}, {"startup_wait_ms", _startup_wait_ms}}},
+        {"peak_memory_kb", peak_memory_kb()}};
+}
+
+void metrics_registry::set_dump_file(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(_m);
+    _dump_file = filename;
+}
+
+void metrics_registry::job_finished(const std::string& job) const
+{
+    std::string filename;
+    {
+        std::lock_guard<std::mutex> lock(_m);
+        filename = _dump_file;
+    }
+    if (filename.size() == 0) return;
+    auto j = to_json();
+    j["job"] = job;
+    std::ofstream file(filename, std::ios_base::app);
+    file << j.dump() << std::endl;
+}
+
+} // namespace raspigcd
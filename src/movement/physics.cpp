@@ -150,6 +150,85 @@ path_node_t calculate_transition_point(const path_node_t &a, const path_node_t &
     return ret;
 }
 
+path_node_t calculate_transition_point(const path_node_t &a, const path_node_t &b, const double max_acceleration, const double max_jerk) {
+    if ((max_jerk <= 0) || (max_acceleration <= 0) || (b.v <= a.v)) return calculate_transition_point(a, b, max_acceleration);
+    double s_target = (b.p-a.p).length();
+    auto distance_needed = [&](double v) {
+        return velocity_change_distance(a.v, v, max_acceleration, max_jerk);
+    };
+    if (distance_needed(b.v) <= s_target)
+        return calculate_transition_point(a, b, jerk_limited_acceleration(b.v - a.v, max_acceleration, max_jerk));
+    double v_min = a.v, v_max = b.v;
+    for (int n = 0; n < 64; n++) {
+        double v = (v_min + v_max) / 2.0;
+        if (distance_needed(v) > s_target) v_max = v;
+        else v_min = v;
+    }
+    path_node_t ret = b;
+    ret.v = v_min;
+    return ret;
+}
+
+double velocity_change_distance(const double v0, const double v1, const double max_acceleration, const double max_jerk) {
+    if (v0 == v1) return 0.0;
+    return std::abs(v1 * v1 - v0 * v0) / (2.0 * jerk_limited_acceleration(v1 - v0, max_acceleration, max_jerk));
+}
+
+double jerk_limited_acceleration(const double dv, const double max_acceleration, const double max_jerk) {
+    double v = std::abs(dv);
+    if ((max_jerk <= 0) || (v == 0)) return max_acceleration;
+    double t; // time of the fastest change of velocity
+    if (v * max_jerk >= max_acceleration * max_acceleration) {
+        t = v / max_acceleration + max_acceleration / max_jerk;
+    } else {
+        t = 2.0 * std::sqrt(v / max_jerk);
+    }
+    return v / t;
+}
+
+s_curve_t s_curve_between(const double v0, const double v1, const double T, const double max_jerk) {
+    double dv = v1 - v0;
+    double sign = (dv < 0) ? -1.0 : 1.0;
+    if ((max_jerk <= 0) || (dv == 0) || (T <= 0)) return {v0, T, 0.0, 0.0, (T > 0) ? (dv / T) : 0.0, v1};
+    double j = max_jerk;
+    double a, tj;
+    // dv = a*(T - tj) and a = j*tj
+    double delta = j * j * T * T - 4.0 * j * std::abs(dv);
+    if (delta < 0) {
+        // the time is too short - the jerk must be bigger
+        tj = T / 2.0;
+        a = 2.0 * std::abs(dv) / T;
+        j = a / tj;
+    } else {
+        a = (j * T - std::sqrt(delta)) / 2.0;
+        tj = a / j;
+    }
+    return {v0, T, sign * j, tj, sign * a, v1};
+}
+
+double s_curve_t::distance(double t) const {
+    // the end is exact, so the following segment starts where this one ends
+    if (t >= T) return (v0 + v1) * T / 2.0;
+    t = std::max(0.0, t);
+    if (t <= tj) return v0 * t + j * t * t * t / 6.0;
+    if (t <= (T - tj)) {
+        double s1 = v0 * tj + j * tj * tj * tj / 6.0;
+        double vj = v0 + j * tj * tj / 2.0;
+        double tau = t - tj;
+        return s1 + vj * tau + a * tau * tau / 2.0;
+    }
+    double u = T - t; // time left
+    return (v0 + v1) * T / 2.0 - v1 * u + j * u * u * u / 6.0;
+}
+
+double s_curve_t::velocity(double t) const {
+    if (t >= T) return v1;
+    t = std::max(0.0, t);
+    if (t <= tj) return v0 + j * t * t / 2.0;
+    if (t <= (T - tj)) return v0 + j * tj * tj / 2.0 + a * (t - tj);
+    double u = T - t;
+    return v1 - j * u * u / 2.0;
+}
 
 bool operator==(const path_node_t &lhs,const path_node_t &rhs) {
     if ((lhs.p == rhs.p) && (lhs.v == rhs.v)) return true;
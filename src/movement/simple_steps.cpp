@@ -23,7 +23,9 @@
 
 #include <distance_t.hpp>
 #include <hardware/stepping_commands.hpp>
+#include <array>
 #include <list>
+#include <vector>
 #include <movement/simple_steps.hpp>
 #include <steps_t.hpp>
 
@@ -69,6 +71,93 @@ hardware::multistep_commands_t collapse_repeated_steps(
 }
 
 
+hardware::multistep_commands_t compress_periodic_patterns(const hardware::multistep_commands_t& commands,
+    const int max_pattern_length)
+{
+    using namespace hardware;
+    const std::size_t max_length = std::max(0, std::min(max_pattern_length, multistep_command_max_pattern_length));
+    const std::size_t n = commands.size();
+    // the steps, flags and count packed into one number, so the search compares numbers, not commands.
+    // The headers of the already compressed patterns get unique keys, so they do not match anything
+    std::vector<uint64_t> keys(n);
+    std::vector<int> delays(n);
+    for (std::size_t i = 0; i < n; i++) {
+        const auto& c = commands[i];
+        uint64_t key = (uint32_t)c.count;
+        key = (key << 8) | c.flags.all;
+        for (const auto& b : c.b)
+            key = (key << 2) | (b.step << 1) | b.dir;
+        keys[i] = multistep_command_pattern_length(c) ? (((uint64_t)1 << 63) | i) : key;
+        delays[i] = c.delay_ns;
+    }
+    // the sequence from i is periodic with the period l as long as commands[k] == commands[k+l]. The
+    // length of this run is counted backward for every period at once, and the period that saves
+    // the most commands is remembered for every i
+    std::vector<unsigned char> best_length(n, 0);
+    std::vector<uint32_t> best_repeats(n, 0);
+    // for every period l: the run is repeats * l + phase commands long. The loops are written
+    // without branches, so they are vectorized
+    std::array<uint32_t, multistep_command_max_pattern_length + 1> repeats = {};
+    std::array<uint32_t, multistep_command_max_pattern_length + 1> phase = {};
+    std::array<uint32_t, multistep_command_max_pattern_length + 1> periods = {};
+    for (std::size_t l = 0; l < periods.size(); l++)
+        periods[l] = l;
+    for (std::size_t i = n; i-- > 0;) {
+        const std::size_t last_l = std::min(max_length, n - 1 - i);
+        const uint64_t key = keys[i];
+        const int delay = delays[i];
+        for (std::size_t l = 2; l <= last_l; l++) {
+            const uint32_t same = (keys[i + l] == key) & (delays[i + l] == delay);
+            const uint32_t next_phase = phase[l] + 1;
+            const uint32_t next_repeat = same & (next_phase == periods[l]);
+            repeats[l] = (repeats[l] + next_repeat) * same;
+            phase[l] = next_phase * (same & !next_repeat);
+        }
+        // the pattern of l commands that is executed repeats+1 times saves repeats * l - 1 commands
+        uint32_t best_saved = 1;
+        for (std::size_t l = 2; l <= last_l; l++)
+            best_saved = std::max(best_saved, repeats[l] * periods[l]);
+        if (best_saved == 1) continue;
+        for (std::size_t l = 2; l <= last_l; l++) {
+            if (repeats[l] * periods[l] == best_saved) {
+                best_length[i] = l;
+                best_repeats[i] = repeats[l] + 1;
+                break;
+            }
+        }
+    }
+
+    multistep_commands_t ret;
+    ret.reserve(commands.size());
+    for (std::size_t i = 0; i < n;) {
+        if (const int l = multistep_command_pattern_length(commands[i])) {
+            // already compressed
+            std::size_t end = std::min(n, i + 1 + l);
+            ret.insert(ret.end(), commands.begin() + i, commands.begin() + end);
+            i = end;
+        } else if (best_length[i] == 0) {
+            ret.push_back(commands[i]);
+            i++;
+        } else {
+            multistep_command header = {};
+            header.flags.bits.p = best_length[i];
+            header.count = best_repeats[i];
+            ret.push_back(header);
+            ret.insert(ret.end(), commands.begin() + i, commands.begin() + i + best_length[i]);
+            i += best_length[i] * best_repeats[i];
+        }
+    }
+    ret.shrink_to_fit();
+    return ret;
+}
+
+hardware::multistep_commands_t expand_periodic_patterns(const hardware::multistep_commands_t& commands)
+{
+    hardware::multistep_commands_t ret;
+    ret.reserve(commands.size());
+    hardware::multistep_commands_for_each(commands, [&ret](const hardware::multistep_command& c) { ret.push_back(c); });
+    return ret;
+}
 
 
 void chase_steps(hardware::multistep_commands_t &ret, const steps_t& start_pos_, const steps_t &destination_pos_)
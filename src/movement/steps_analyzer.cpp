@@ -30,25 +30,57 @@
 namespace raspigcd {
 namespace movement {
 
+namespace {
+/// adds the steps of n executions of the command
+void add_command_steps(steps_t& steps_, const hardware::multistep_command& s, const int n)
+{
+    for (int j = 0; j < 4; j++)
+        steps_[j] = steps_[j] + n * ((int)((signed char)s.b[j].step * ((signed char)s.b[j].dir * 2 - 1)));
+}
+} // namespace
+
 steps_t steps_analyzer::steps_from_tick(const hardware::multistep_commands_t& commands_to_do, const int tick_number) const
 {
     auto tick_number_ = tick_number;
     steps_t _steps = {0, 0, 0, 0};
-    int cmnd_i = 0;
     int i = 0;
-    for (const auto& s : commands_to_do) {
-        //std::cout << " i " << i << " cmnd_i " << cmnd_i << std::endl;
-        if ((tick_number_ >= i) && (tick_number_ < (i + s.count))) {
-            //std::cout << " i " << i << " cmnd_i " << cmnd_i << "  >> " << (tick_number_ - i) << std::endl;
+    for (std::size_t ci = 0; ci < commands_to_do.size(); ci++) {
+        const auto& s = commands_to_do[ci];
+        if (const int pattern_length = hardware::multistep_command_pattern_length(s)) {
+            // the pattern is skipped as a whole, unless the tick is inside it
+            const std::size_t end = std::min(commands_to_do.size(), ci + 1 + pattern_length);
+            int pattern_ticks = 0;
+            steps_t pattern_steps = {0, 0, 0, 0};
+            for (std::size_t k = ci + 1; k < end; k++) {
+                pattern_ticks += commands_to_do[k].count;
+                add_command_steps(pattern_steps, commands_to_do[k], commands_to_do[k].count);
+            }
+            if ((pattern_ticks > 0) && (tick_number_ >= i) && (tick_number_ < (i + s.count * pattern_ticks))) {
+                int r = (tick_number_ - i) / pattern_ticks;
+                for (int j = 0; j < 4; j++)
+                    _steps[j] = _steps[j] + r * pattern_steps[j];
+                i += r * pattern_ticks;
+                for (std::size_t k = ci + 1; k < end; k++) {
+                    const auto& c = commands_to_do[k];
+                    if (tick_number_ < (i + c.count)) {
+                        add_command_steps(_steps, c, tick_number_ - i);
+                        return _steps;
+                    }
+                    add_command_steps(_steps, c, c.count);
+                    i += c.count;
+                }
+            }
             for (int j = 0; j < 4; j++)
-                _steps[j] = _steps[j] + (tick_number_ - i) * ((int)((signed char)s.b[j].step * ((signed char)s.b[j].dir * 2 - 1)));
+                _steps[j] = _steps[j] + s.count * pattern_steps[j];
+            i += pattern_ticks * s.count;
+            ci = end - 1;
+        } else if ((tick_number_ >= i) && (tick_number_ < (i + s.count))) {
+            add_command_steps(_steps, s, tick_number_ - i);
             return _steps;
         } else {
-            for (int j = 0; j < 4; j++)
-                _steps[j] = _steps[j] + s.count * ((int)((signed char)s.b[j].step * ((signed char)s.b[j].dir * 2 - 1)));
+            add_command_steps(_steps, s, s.count);
+            i += s.count;
         }
-        cmnd_i++;
-        i += s.count;
     }
     if (i == tick_number_)
         return _steps;
@@ -57,12 +89,8 @@ steps_t steps_analyzer::steps_from_tick(const hardware::multistep_commands_t& co
 
 int steps_analyzer::get_last_tick_index(const hardware::multistep_commands_t& commands_to_do) const
 {
-    int cmnd_i = 0;
     int i = 0;
-    for (const auto& s : commands_to_do) {
-        cmnd_i++;
-        i += s.count;
-    }
+    hardware::multistep_commands_for_each(commands_to_do, [&i](const hardware::multistep_command& s) { i += s.count; });
     return i;
 };
 
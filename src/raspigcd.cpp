@@ -25,8 +25,11 @@ This is simple program that uses the library. It will execute given GCode.
 */
 
 #include <configuration.hpp>
+#include <converters/gcd_program_to_png.hpp>
 #include <converters/gcd_program_to_steps.hpp>
+#include <converters/step_stream.hpp>
 #include <factories.hpp>
+#include <gcd/preprocess_program.hpp>
 #include <gcd/remove_g92_from_gcode.hpp>
 #include <hardware/driver/inmem.hpp>
 #include <hardware/driver/low_buttons_fake.hpp>
@@ -37,6 +40,8 @@ This is simple program that uses the library. It will execute given GCode.
 #include <hardware/driver/raspberry_pi.hpp>
 #include <hardware/motor_layout.hpp>
 #include <hardware/stepping.hpp>
+#include <movement/physics.hpp>
+#include <movement/simple_steps.hpp>
 
 #include <configuration_json.hpp>
 
@@ -81,6 +86,18 @@ void help_text(const std::vector<std::string>& args)
     std::cout << "\t--raw" << std::endl;
     std::cout << "\t\tTreat the file as raw - no additional processing. No machine limits check (speed, acceleration, ...)." << std::endl;
     std::cout << std::endl;
+    std::cout << "\t--metrics <filename>" << std::endl;
+    std::cout << "\t\tappend metrics of every job (stage durations, queue depth, underruns, memory) as one line of JSON to the file" << std::endl;
+    std::cout << std::endl;
+    std::cout << "\t--preview <filename> <pngfile>" << std::endl;
+    std::cout << "\t\tdraw the toolpath of the gcode file to PNG picture (no machine is needed)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "\t--compile <filename> <stepsfile>" << std::endl;
+    std::cout << "\t\tcalculate steps for the gcode file and save them as the step stream for --play (no machine is needed)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "\t--play <stepsfile>" << std::endl;
+    std::cout << "\t\texecute the step stream created by --compile. The configuration must match the one used for compilation" << std::endl;
+    std::cout << std::endl;
     std::cout << "\t--configtest" << std::endl;
     std::cout << "\t\tEnables the debug mode for testing configuration" << std::endl;
     std::cout << std::endl;
@@ -111,61 +128,13 @@ void help_text(const std::vector<std::string>& args)
 }
 
 
-partitioned_program_t preprocess_program_parts(partitioned_program_t program_parts, const configuration::global& cfg, block_t machine_state)
-{
-    program_t prepared_program;
-
-    for (auto& ppart : program_parts) {
-        if (ppart.size() != 0) {
-            if (ppart[0].count('M') == 0) {
-                //std::cout << "G PART: " << ppart.size() << std::endl;
-                switch ((int)(ppart[0]['G'])) {
-                case 0:
-                    ppart = g1_move_to_g1_with_machine_limits(ppart, cfg, machine_state);
-                    prepared_program.insert(prepared_program.end(), ppart.begin(), ppart.end());
-                    machine_state = last_state_after_program_execution(ppart, machine_state);
-                    break;
-                case 1:
-                    //  (DO NOT INTERPRET G1) ppart = g1_move_to_g1_with_machine_limits(ppart, cfg, machine_state, false);
-                    prepared_program.insert(prepared_program.end(), ppart.begin(), ppart.end());
-                    machine_state = last_state_after_program_execution(ppart, machine_state);
-                    break;
-                case 4:
-                case 28:
-                case 92:
-                    prepared_program.insert(prepared_program.end(), ppart.begin(), ppart.end());
-                    machine_state = merge_blocks(machine_state, ppart.front());
-                    break;
-                }
-            } else {
-                //std::cout << "M PART: " << ppart.size() << std::endl;
-                for (auto& m : ppart) {
-                    switch ((int)(m['M'])) {
-                    case 18:
-                    case 3:
-                    case 5:
-                    case 17:
-                        prepared_program.push_back(m);
-                        break;
-                    }
-                }
-            }
-        }
-    }
-
-    prepared_program = optimize_path_douglas_peucker(prepared_program, cfg.douglas_peucker_marigin);
-    program_parts = group_gcode_commands(remove_duplicate_blocks(prepared_program, {}));
-    return program_parts;
-}
-
-
-void execute_calculated_multistep(raspigcd::hardware::multistep_commands_t m_commands, execution_objects_t machine, std::function<void(int, int)> on_stop_execution, std::atomic<bool>& cancel_execution, std::atomic<bool>& paused, long int last_spindle_on_delay, std::map<int, double>& spindles_status)
+void execute_calculated_multistep(const raspigcd::hardware::multistep_command* m_commands, const std::size_t m_commands_count, execution_objects_t machine, std::function<void(int, int)> on_stop_execution, std::atomic<bool>& cancel_execution, std::atomic<bool>& paused, long int last_spindle_on_delay, std::map<int, double>& spindles_status, const configuration::global& cfg)
 {
     machine.buttons_drv->on_key(low_buttons_default_meaning_t::ENDSTOP_X, on_stop_execution);
     machine.buttons_drv->on_key(low_buttons_default_meaning_t::ENDSTOP_Y, on_stop_execution);
     machine.buttons_drv->on_key(low_buttons_default_meaning_t::ENDSTOP_Z, on_stop_execution);
 
-    machine.stepping->exec(m_commands, [machine, &cancel_execution, &paused, last_spindle_on_delay, &spindles_status](auto, auto tick_n) -> int {
+    machine.stepping->exec(m_commands, m_commands_count, [machine, &cancel_execution, &paused, last_spindle_on_delay, &spindles_status, &cfg](auto, auto tick_n) -> int {
         std::cout << "break at " << tick_n << " tick" << std::endl;
         for (auto e : spindles_status) {
             // stop spindles and lasers ASAP!
@@ -178,6 +147,8 @@ void execute_calculated_multistep(raspigcd::hardware::multistep_commands_t m_com
         if (cancel_execution) return 0; // stop execution
 
         for (auto e : spindles_status) {
+            // laser is restored by the stepping according to the commands stream
+            if ((e.first < (int)cfg.spindles.size()) && (cfg.spindles.at(e.first).mode == configuration::spindle_modes::LASER)) continue;
             machine.spindles_drv->spindle_pwm_power(e.first, e.second);
             machine.timer_drv->wait_us(1000 * last_spindle_on_delay);
         }
@@ -185,6 +156,74 @@ void execute_calculated_multistep(raspigcd::hardware::multistep_commands_t m_com
     });
 }
 
+/**
+ * @brief waits for the component (spindle, steppers) to start. The time t in milliseconds
+ * can be changed by P (milliseconds) or X (seconds) in the block. Returns the time.
+ */
+int wait_for_component_to_start(const block_t& m, int t)
+{
+    if (m.count('P') == 1) {
+        t = m.at('P');
+    } else if (m.count('X') == 1) {
+        t = 1000 * m.at('X');
+    }
+    if (t > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds((int)t));
+    return t;
+}
+
+/**
+ * @brief executes M17, M18, M3 or M5. Other M codes are ignored.
+ */
+void execute_m_code(const block_t& m, execution_objects_t machine, const configuration::global& cfg, std::map<int, double>& spindles_status, long int& last_spindle_on_delay)
+{
+    switch ((int)(m.at('M'))) {
+    case 17:
+        machine.steppers_drv->enable_steppers({true, true, true, true});
+        wait_for_component_to_start(m, 200);
+        break;
+    case 18:
+        machine.steppers_drv->enable_steppers({false, false, false, false});
+        wait_for_component_to_start(m, 200);
+        break;
+    case 3:
+        spindles_status[0] = 1.0;
+        if (cfg.spindles.at(0).mode != configuration::spindle_modes::LASER) {
+            machine.spindles_drv->spindle_pwm_power(0, spindles_status[0]);
+        }
+        last_spindle_on_delay = wait_for_component_to_start(m, 3000);
+        break;
+    case 5:
+        spindles_status[0] = 0.0;
+        if (cfg.spindles.at(0).mode != configuration::spindle_modes::LASER) {
+            machine.spindles_drv->spindle_pwm_power(0, spindles_status[0]);
+        }
+        wait_for_component_to_start(m, 3000);
+        break;
+    }
+}
+
+/**
+ * @brief sets the steps counters according to the G92 blocks. Returns the new position.
+ */
+distance_t set_position_g92(const program_t& ppart, execution_objects_t machine)
+{
+    auto position_from_steps = machine.motor_layout_->steps_to_cartesian(machine.steppers_drv->get_steps());
+    for (auto pelem : ppart) {
+        if ((int)(pelem.count('X'))) {
+            position_from_steps[0] = pelem['X'];
+        }
+        if ((int)(pelem.count('Y'))) {
+            position_from_steps[1] = pelem['Y'];
+        }
+        if ((int)(pelem.count('Z'))) {
+            position_from_steps[2] = pelem['Z'];
+        }
+    }
+    machine.steppers_drv->set_steps(machine.motor_layout_->cartesian_to_steps(position_from_steps));
+    return position_from_steps;
+}
+
 void home_position_find(char axis_id, 
     double direction_value,
     converters::program_to_steps_f_t program_to_steps, 
@@ -326,12 +365,113 @@ public:
 
         throw std::invalid_argument("fifo_c: the put method broken.");
     }
+
+    /**
+     * @brief puts the value when can_put returns true for the current content of the queue
+     */
+    void put_when(std::atomic<bool>& cancel_execution, T value, std::function<bool(const std::list<T>&)> can_put)
+    {
+        while (!cancel_execution) {
+            while (lock.test_and_set(std::memory_order_acquire))
+                ;
+            if (can_put(data)) {
+                data.push_back(value);
+                lock.clear(std::memory_order_release);
+                return;
+            } else {
+                lock.clear(std::memory_order_release);
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+
+        throw std::invalid_argument("fifo_c: the put method broken.");
+    }
+
+    std::size_t size()
+    {
+        while (lock.test_and_set(std::memory_order_acquire))
+            ;
+        auto ret = data.size();
+        lock.clear(std::memory_order_release);
+        return ret;
+    }
 };
+/**
+ * @brief the element of the queue between the steps generator and the executor
+ */
+struct calculated_part_t {
+    hardware::multistep_commands_t commands; ///< steps to execute
+    block_t machine_state;                   ///< machine state after execution of commands
+    std::size_t next_part;                   ///< index of the first program part that is not completely covered by commands
+    double execution_seconds;                ///< the time of execution of commands
+    bool continues_motion;                   ///< the next element continues the motion, so the executor must not wait for it
+};
+
+/**
+ * @brief the maximal number of multistep commands that are joined into one continuous stream
+ * from consecutive G0 and G1 parts.
+ */
+const std::size_t max_continuous_stream_commands = 200000;
+
+/**
+ * @brief the size of the first element of the continuous stream. Next elements are
+ * twice as big up to max_continuous_stream_commands, so the execution starts early.
+ */
+const std::size_t first_continuous_stream_commands = 4096;
+
+/**
+ * @brief the number of blocks that are converted to steps at once when the long part is split
+ */
+const std::size_t stream_split_blocks = 32;
+
+/**
+ * @brief the maximal number of multistep commands waiting for execution. It limits the memory usage
+ */
+const std::size_t max_queued_commands = 4000000;
+
+/**
+ * @brief decides how many elements the producer can calculate ahead of the executor.
+ *
+ * The producer measures how long it takes to calculate one element. The queue
+ * is allowed to grow beyond the default depth until the queued elements take
+ * at least twice as long to execute as the slowest recent calculation. The
+ * execution time is divided by the feed override, because the executor runs
+ * the commands faster or slower than planned.
+ */
+class producer_lookahead_t
+{
+    std::size_t _min_depth;
+    double _generation_seconds; ///< slowly decaying maximum of the time of calculation of one element
+public:
+    producer_lookahead_t(const bool sequential) : _min_depth(sequential ? 1 : 5), _generation_seconds(0.0) {}
+
+    void generated(const double seconds)
+    {
+        _generation_seconds = std::max(seconds, _generation_seconds * 0.9);
+    }
+
+    bool can_put(const std::list<calculated_part_t>& queue, const double feed_override = 1.0) const
+    {
+        if (queue.size() < _min_depth) return true;
+        if (_min_depth == 1) return false; // sequential execution
+        double buffered_seconds = 0.0;
+        std::size_t buffered_commands = 0;
+        for (const auto& e : queue) {
+            buffered_seconds += e.execution_seconds;
+            buffered_commands += e.commands.size();
+        }
+        return (buffered_commands < max_queued_commands) && (buffered_seconds / feed_override < 2.0 * _generation_seconds);
+    }
+};
+
 /**
  * @brief produces series of multistep steps series filling the buffer that is a list of multistep commands. It can be canceled by setting cancel_execution to true.
  * 
+ * Consecutive G0, G1, G2 and G3 parts are joined into one stream of commands. In laser mode
+ * every command carries the laser state in flags.bits.g, so the laser is switched exactly on
+ * the tick where the working move starts and ends.
  */
-auto multistep_producer_for_execution = [](fifo_c<std::pair<hardware::multistep_commands_t, block_t>>& calculated_multisteps,
+auto multistep_producer_for_execution = [](fifo_c<calculated_part_t>& calculated_multisteps,
                                             partitioned_program_t& program_parts,
                                             execution_objects_t machine,
                                             converters::program_to_steps_f_t program_to_steps,
@@ -339,6 +479,21 @@ auto multistep_producer_for_execution = [](fifo_c<std::pair<hardware::multistep_
                                             configuration::global cfg,
                                             block_t machine_state) -> int { // calculate multisteps
     std::map<int, double> spindles_status;
+    const bool laser_mode = (cfg.spindles.size() > 0) && (cfg.spindles.at(0).mode == configuration::spindle_modes::LASER);
+    // the program_to_steps generator works block by block, so the part can be split without changing the steps
+    const bool can_split_parts = (cfg.steps_generator == configuration::steps_generator_e::PROGRAM_TO_STEPS) ||
+                                 (cfg.steps_generator == configuration::steps_generator_e::VARIABLE_INTERVAL);
+    producer_lookahead_t lookahead(cfg.sequential_gcode_execution);
+    auto can_put = [&lookahead, &machine](const std::list<calculated_part_t>& queue) {
+        // during the change of the feed override the faster one is taken
+        return lookahead.can_put(queue, std::max(machine.stepping->get_feed_override(), machine.stepping->get_current_feed_override()));
+    };
+    std::size_t stream_commands_target = first_continuous_stream_commands;
+    std::size_t first_block = 0; // the first not calculated block of the part that was split
+    auto is_motion_part = [](const program_t& ppart) {
+        return (ppart.size() != 0) && (ppart[0].count('M') == 0) &&
+               (((int)(ppart[0].at('G')) >= 0) && ((int)(ppart[0].at('G')) <= 3));
+    };
 
     for (std::size_t command_block_index = 0; (command_block_index < program_parts.size()) && (!cancel_execution); command_block_index++) {
         auto& ppart = program_parts[command_block_index];
@@ -346,26 +501,68 @@ auto multistep_producer_for_execution = [](fifo_c<std::pair<hardware::multistep_
             if (ppart[0].count('M') == 0) {
                 switch ((int)(ppart[0].at('G'))) {
                 case 0:
-                case 1: {
-                    auto machine_state_prev = machine_state;
-
+                case 1:
+                case 2:
+                case 3: {
                     auto time0 = std::chrono::high_resolution_clock::now();
-                    block_t st = last_state_after_program_execution(ppart, machine_state);
-                    //// std::cout << "program_to_steps ... " << back_to_gcode({ppart}) << std::endl;
-                    auto m_commands = program_to_steps(ppart, cfg, *(machine.motor_layout_.get()),
-                        machine_state, [&machine_state](const gcd::block_t result) {
-                            machine_state = result;
-                        });
-
-                    if (!(block_to_distance_with_v_t(st) == block_to_distance_with_v_t(machine_state))) {
-                        std::cout << "states differs: " << block_to_distance_with_v_t(st) << "!=" << block_to_distance_with_v_t(machine_state) << std::endl;
-                        throw std::invalid_argument("states differ");
+                    hardware::multistep_commands_t m_commands;
+                    std::size_t blocks_count = 0;
+                    std::size_t next_part = command_block_index;
+                    while ((next_part < program_parts.size()) && is_motion_part(program_parts[next_part]) &&
+                           (m_commands.size() < stream_commands_target)) {
+                        auto& whole_part = program_parts[next_part];
+                        std::size_t last_block = whole_part.size();
+                        if (can_split_parts) last_block = std::min(last_block, first_block + stream_split_blocks);
+                        program_t split_part;
+                        if ((first_block > 0) || (last_block < whole_part.size()))
+                            split_part = program_t(whole_part.begin() + first_block, whole_part.begin() + last_block);
+                        auto& mpart = ((first_block > 0) || (last_block < whole_part.size())) ? split_part : whole_part;
+
+                        block_t st = last_state_after_program_execution(mpart, machine_state);
+                        //// std::cout << "program_to_steps ... " << back_to_gcode({mpart}) << std::endl;
+                        auto part_commands = program_to_steps(mpart, cfg, *(machine.motor_layout_.get()),
+                            machine_state, [&machine_state](const gcd::block_t result) {
+                                machine_state = result;
+                            });
+
+                        if (!(block_to_distance_with_v_t(st) == block_to_distance_with_v_t(machine_state))) {
+                            std::cout << "states differs: " << block_to_distance_with_v_t(st) << "!=" << block_to_distance_with_v_t(machine_state) << std::endl;
+                            throw std::invalid_argument("states differ");
+                        }
+                        if (laser_mode) {
+                            unsigned char sync = (((int)(whole_part[0].at('G')) != 0) && (spindles_status[0] > 0.0)) ? SPINDLE_SYNC_ON : SPINDLE_SYNC_OFF;
+                            for (auto& c : part_commands)
+                                c.flags.bits.g = sync;
+                        }
+                        m_commands.insert(m_commands.end(), part_commands.begin(), part_commands.end());
+                        blocks_count += mpart.size();
+                        if (last_block < whole_part.size()) {
+                            first_block = last_block;
+                        } else {
+                            first_block = 0;
+                            next_part++;
+                        }
                     }
+                    const bool continues_motion = (first_block > 0) ||
+                                                  ((next_part < program_parts.size()) && is_motion_part(program_parts[next_part]));
+                    stream_commands_target = continues_motion ? std::min(stream_commands_target * 2, max_continuous_stream_commands) : first_continuous_stream_commands;
+
+                    // the constant velocity moves are periodic, so they are sent to the executor as patterns
+                    m_commands = movement::simple_steps::compress_periodic_patterns(m_commands);
+                    double execution_seconds = hardware::hardware_commands_duration(m_commands, cfg.tick_duration());
 
                     auto time1 = std::chrono::high_resolution_clock::now();
                     double dt = std::chrono::duration<double, std::milli>(time1 - time0).count();
-                    std::cout << "calculations of " << ppart.size() << " commands took " << dt << " milliseconds; have " << m_commands.size() << " steps to execute" << std::endl;
-                    calculated_multisteps.put(cancel_execution, {m_commands, machine_state}, cfg.sequential_gcode_execution ? 1 : 5);
+                    std::cout << "calculations of " << blocks_count << " commands took " << dt << " milliseconds; have " << m_commands.size() << " steps to execute" << std::endl;
+                    if (machine.metrics) {
+                        machine.metrics->add_stage_time("step_generation", dt);
+                        machine.metrics->generated_commands(m_commands.size(), dt / 1000.0);
+                    }
+                    lookahead.generated(dt / 1000.0);
+                    calculated_multisteps.put_when(cancel_execution, {m_commands, machine_state, next_part, execution_seconds, continues_motion}, can_put);
+                    if (machine.metrics) machine.metrics->queue_depth(calculated_multisteps.size());
+                    // the part that was split is visited again
+                    command_block_index = next_part - 1;
 
                     if (cancel_execution) return -100;
                 } break;
@@ -373,7 +570,7 @@ auto multistep_producer_for_execution = [](fifo_c<std::pair<hardware::multistep_
                     if (ppart[0].count('X')) machine_state['X'] = 0.0;
                     if (ppart[0].count('Y')) machine_state['Y'] = 0.0;
                     if (ppart[0].count('Z')) machine_state['Z'] = 0.0;
-                    calculated_multisteps.put(cancel_execution, {{}, machine_state}, cfg.sequential_gcode_execution ? 1 : 5);
+                    calculated_multisteps.put_when(cancel_execution, {{}, machine_state, command_block_index + 1, 0.0, false}, can_put);
                     if (cancel_execution) return -100;
                 } break;
                 case 92: {
@@ -382,7 +579,7 @@ auto multistep_producer_for_execution = [](fifo_c<std::pair<hardware::multistep_
                         if (pelem.count('Y')) machine_state['Y'] = pelem['Y'];
                         if (pelem.count('Z')) machine_state['Z'] = pelem['Z'];
                     }
-                    calculated_multisteps.put(cancel_execution, {{}, machine_state}, cfg.sequential_gcode_execution ? 1 : 5);
+                    calculated_multisteps.put_when(cancel_execution, {{}, machine_state, command_block_index + 1, 0.0, false}, can_put);
                     if (cancel_execution) return -100;
                 } break;
                 }
@@ -417,7 +614,7 @@ std::pair<int, block_t> execute_command_parts(partitioned_program_t program_part
 {
     machine.steppers_drv->set_steps(machine.motor_layout_->cartesian_to_steps(block_to_distance_t(machine_state_0)));
     std::cout << "execute_command_parts: starting with steps counters: " << machine.steppers_drv->get_steps() << std::endl;
-    fifo_c<std::pair<hardware::multistep_commands_t, block_t>> calculated_multisteps;
+    fifo_c<calculated_part_t> calculated_multisteps;
 
     std::atomic<bool> paused{false};
     std::function<void(int, int)> on_pause_execution = [machine, &paused](int, int s) {
@@ -468,17 +665,10 @@ std::pair<int, block_t> execute_command_parts(partitioned_program_t program_part
 
         std::map<int, double> spindles_status;
         long int last_spindle_on_delay = 7000;
-
-        auto wait_for_component_to_start = [](auto m, int t = 3000) {
-            if (m.count('P') == 1) {
-                t = m.at('P');
-            } else if (m.count('X') == 1) {
-                t = 1000 * m.at('X');
-            }
-            if (t > 0)
-                std::this_thread::sleep_for(std::chrono::milliseconds((int)t));
-            return t;
-        };
+        bool in_motion = false; // the last executed commands ended in the middle of the motion
+        int underruns = 0;      // number of times when the executor waited for steps in the middle of the motion
+        // the simulated executor does not wait for the real time, so it is always faster than the producer
+        const bool real_time_execution = std::dynamic_pointer_cast<hardware::driver::low_timers_fake>(machine.timer_drv) == nullptr;
         for (std::size_t command_block_index = 0; (command_block_index < program_parts.size()) && (!cancel_execution); command_block_index++) {
             auto& ppart = program_parts[command_block_index];
 
@@ -487,14 +677,32 @@ std::pair<int, block_t> execute_command_parts(partitioned_program_t program_part
                 if (ppart[0].count('M') == 0) {
                     switch ((int)(ppart[0].at('G'))) {
                     case 0:
-                    case 1: {
-                        auto [m_commands, machine_state] = calculated_multisteps.get(cancel_execution);
-                        try {
-                            if (((int)(ppart[0].at('G')) == 1) && cfg.spindles.at(0).mode == configuration::spindle_modes::LASER) {
-                                machine.spindles_drv->spindle_pwm_power(0, spindles_status[0]);
+                    case 1:
+                    case 2:
+                    case 3: {
+                        // the stream covers all consecutive G0, G1, G2 and G3 parts, the laser is switched by the stepping itself
+                        const bool queue_was_empty = calculated_multisteps.size() == 0;
+                        auto wait_start = std::chrono::steady_clock::now();
+                        auto [m_commands, machine_state, next_part, execution_seconds, continues_motion] = calculated_multisteps.get(cancel_execution);
+                        auto exec_start = std::chrono::steady_clock::now();
+                        double wait_ms = std::chrono::duration<double, std::milli>(exec_start - wait_start).count();
+                        if (queue_was_empty && (wait_ms * 1000.0 > cfg.tick_duration_us)) {
+                            if (machine.metrics) machine.metrics->executor_wait(wait_ms, in_motion && real_time_execution);
+                            if (in_motion && real_time_execution) {
+                                underruns++;
+                                std::cerr << "UNDERRUN: the executor waited " << wait_ms << " ms for steps in the middle of the motion" << std::endl;
                             }
-                            execute_calculated_multistep(m_commands, machine, on_stop_execution, cancel_execution, paused, last_spindle_on_delay, spindles_status);
-                            if (((int)(ppart[0].at('G')) == 1) && cfg.spindles.at(0).mode == configuration::spindle_modes::LASER) {
+                        }
+                        if (machine.metrics) machine.metrics->queue_depth(calculated_multisteps.size());
+                        // if the part was split, the same part index is visited again
+                        command_block_index = next_part - 1;
+                        try {
+                            execute_calculated_multistep(m_commands.data(), m_commands.size(), machine, on_stop_execution, cancel_execution, paused, last_spindle_on_delay, spindles_status, cfg);
+                            in_motion = continues_motion;
+                            if (machine.metrics) machine.metrics->executed_commands(m_commands.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - exec_start).count());
+                            // the laser stays on between elements of the same motion, unless the machine has to wait
+                            if (cfg.spindles.size() && (cfg.spindles.at(0).mode == configuration::spindle_modes::LASER) &&
+                                ((!continues_motion) || (calculated_multisteps.size() == 0))) {
                                 machine.spindles_drv->spindle_pwm_power(0, 0.0);
                             }
                             machine_state_ret = machine_state;
@@ -510,7 +718,7 @@ std::pair<int, block_t> execute_command_parts(partitioned_program_t program_part
                         }
                     } break;
                     case 28: {
-                        auto [m_commands, machine_state] = calculated_multisteps.get(cancel_execution);
+                        auto [m_commands, machine_state, next_part, execution_seconds, continues_motion] = calculated_multisteps.get(cancel_execution);
                         for (auto pelem : ppart) {
                             if ((int)(pelem.count('X'))) {
                                 home_position_find('X',
@@ -534,20 +742,8 @@ std::pair<int, block_t> execute_command_parts(partitioned_program_t program_part
                         machine_state_ret = machine_state;
                     } break;
                     case 92: {
-                        auto [m_commands, machine_state] = calculated_multisteps.get(cancel_execution);
-                        auto position_from_steps = machine.motor_layout_->steps_to_cartesian(machine.steppers_drv->get_steps());
-                        for (auto pelem : ppart) {
-                            if ((int)(pelem.count('X'))) {
-                                position_from_steps[0] = pelem['X'];
-                            }
-                            if ((int)(pelem.count('Y'))) {
-                                position_from_steps[1] = pelem['Y'];
-                            }
-                            if ((int)(pelem.count('Z'))) {
-                                position_from_steps[2] = pelem['Z'];
-                            }
-                        }
-                        machine.steppers_drv->set_steps(machine.motor_layout_->cartesian_to_steps(position_from_steps));
+                        auto [m_commands, machine_state, next_part, execution_seconds, continues_motion] = calculated_multisteps.get(cancel_execution);
+                        auto position_from_steps = set_position_g92(ppart, machine);
                         machine_state['X'] = position_from_steps[0];
                         machine_state['Y'] = position_from_steps[1];
                         machine_state['Z'] = position_from_steps[2];
@@ -556,65 +752,35 @@ std::pair<int, block_t> execute_command_parts(partitioned_program_t program_part
                     }
                 } else {
                     for (auto& m : ppart) {
-                        switch ((int)(m.at('M'))) {
-                        case 17:
-                            machine.steppers_drv->enable_steppers({true, true, true, true});
-                            wait_for_component_to_start(m, 200);
-                            break;
-                        case 18:
-                            machine.steppers_drv->enable_steppers({false, false, false, false});
-                            wait_for_component_to_start(m, 200);
-                            break;
-                        case 3:
-                            spindles_status[0] = 1.0;
-                            if (cfg.spindles.at(0).mode != configuration::spindle_modes::LASER) {
-                                machine.spindles_drv->spindle_pwm_power(0, spindles_status[0]);
-                            }
-                            last_spindle_on_delay = wait_for_component_to_start(m, 3000);
-                            break;
-                        case 5:
-                            spindles_status[0] = 0.0;
-                            if (cfg.spindles.at(0).mode != configuration::spindle_modes::LASER) {
-                                machine.spindles_drv->spindle_pwm_power(0, spindles_status[0]);
-                            }
-                            wait_for_component_to_start(m, 3000);
-                            break;
-                        }
+                        execute_m_code(m, machine, cfg, spindles_status, last_spindle_on_delay);
                     }
                 }
             }
         }
-        return {multistep_calculation_promise.get(), machine_state_ret};
+        int ret = multistep_calculation_promise.get();
+        if ((ret == 0) && (underruns > 0)) ret = -3;
+        return {ret, machine_state_ret};
     }
 };
 
 
-auto execute_gcode_text = [](const configuration::global cfg, const bool raw_gcode, const auto gcode_text, const auto& machine, std::atomic<bool>& cancel_execution, block_t machine_state_0 = {{'F', 0.5}}) {
-    converters::program_to_steps_f_t program_to_steps = converters::program_to_steps_factory(cfg.steps_generator);
+auto execute_gcode_text = [](const configuration::global cfg, const bool raw_gcode, const auto gcode_text, const auto& machine, std::atomic<bool>& cancel_execution, block_t machine_state_0 = {{'F', 0.5}}, const std::string job = "go") {
+    using stage_timer = metrics_registry::stage_timer;
+    converters::program_to_steps_f_t program_to_steps = converters::program_to_steps_factory(cfg);
+    if (machine.metrics) machine.metrics->reset();
 
-    auto program = gcode_to_maps_of_arguments(gcode_text);
-    //            std::cout << "PRORGRAM RAW: \n" << back_to_gcode({program}) << std::endl;
-    program = enrich_gcode_with_feedrate_commands(std::move(program), cfg);
-    //            std::cout << back_to_gcode({program}) << std::endl;
-    // program = remove_g92_from_gcode(program);
-    if (!raw_gcode) {
-        program = optimize_path_douglas_peucker(program, cfg.douglas_peucker_marigin, machine_state_0);
+    program_t program;
+    {
+        stage_timer t(machine.metrics, "parse");
+        program = gcode_to_maps_of_arguments(gcode_text);
     }
-    auto program_parts = group_gcode_commands(std::move(program));
-
-    block_t machine_state = machine_state_0; //{{'F', 0.5}};
-    if (!raw_gcode) {
-        std::cerr << "PREPROCESSING GCODE" << std::endl;
-        program_parts = insert_additional_nodes_inbetween(program_parts, machine_state, cfg);
-        //std::cerr << back_to_gcode(program_parts) << std::endl;
-        machine_state['F'] = *std::min_element(cfg.max_no_accel_velocity_mm_s.begin(), cfg.max_no_accel_velocity_mm_s.end());
-        program_parts = preprocess_program_parts(program_parts, cfg, machine_state);
-        //std::cerr << back_to_gcode(program_parts) << std::endl;
-    } // if prepare paths
+    partitioned_program_t program_parts = preprocess_program(std::move(program), cfg, machine_state_0, raw_gcode, machine.metrics);
 
     //std::cerr << "STARTING...." << std::endl;
 
-    return execute_command_parts(std::move(program_parts), machine, program_to_steps, cfg, cancel_execution, machine_state_0);
+    auto ret = execute_command_parts(std::move(program_parts), machine, program_to_steps, cfg, cancel_execution, machine_state_0);
+    if (machine.metrics) machine.metrics->job_finished(job);
+    return ret;
 };
 
 /**
@@ -629,11 +795,11 @@ auto execute_gcode_file = [](const configuration::global cfg, const bool raw_gco
     if (!gcd_file.is_open()) throw std::invalid_argument("could not open file \"" + filename + "\"");
     std::string gcode_text((std::istreambuf_iterator<char>(gcd_file)),
         std::istreambuf_iterator<char>());
-    return execute_gcode_text(cfg, raw_gcode, gcode_text, machine, cancel_execution, machine_state_0);
+    return execute_gcode_text(cfg, raw_gcode, gcode_text, machine, cancel_execution, machine_state_0, filename);
 };
 
 
-double fake_execution_and_statistics_collect(configuration::global cfg, std::function<void(execution_objects_t& machine)> work_on_machine_f)
+double fake_execution_and_statistics_collect(configuration::global cfg, std::function<void(execution_objects_t& machine)> work_on_machine_f, std::shared_ptr<metrics_registry> metrics = std::make_shared<metrics_registry>())
 {
     double execution_seconds = 0;
 
@@ -651,6 +817,7 @@ double fake_execution_and_statistics_collect(configuration::global cfg, std::fun
         execution_seconds += (double)0.000001 * (double)dt;
     };
     std::shared_ptr<stepping_simple_timer> stepping = std::make_shared<stepping_simple_timer>(cfg, steppers_drv, timer_drv);
+    stepping->set_low_level_spindles_pwm(spindles_drv);
 
     execution_objects_t machine = {
         timer_drv,
@@ -658,7 +825,8 @@ double fake_execution_and_statistics_collect(configuration::global cfg, std::fun
         spindles_drv,
         buttons_drv,
         motor_layout_,
-        stepping};
+        stepping,
+        metrics};
 
     timer_drv->start_timing();
     work_on_machine_f(machine);
@@ -667,14 +835,135 @@ double fake_execution_and_statistics_collect(configuration::global cfg, std::fun
 }
 
 
-auto interactive_mode_execution = [](const auto cfg, const auto raw_gcode) {
+/**
+ * @brief calculates steps for the gcode file and saves them as the step stream, so the machine
+ * does not have to calculate them. The steps are calculated the same way as for the execution
+ * of the file, starting from the position 0. G28 cannot be compiled, because it depends on endstops.
+ */
+void compile_gcode_file(const configuration::global cfg, const bool raw_gcode, const std::string filename, const std::string stream_filename)
+{
+    std::ifstream gcd_file(filename);
+    if (!gcd_file.is_open()) throw std::invalid_argument("could not open file \"" + filename + "\"");
+    std::string gcode_text((std::istreambuf_iterator<char>(gcd_file)),
+        std::istreambuf_iterator<char>());
+
+    fake_execution_and_statistics_collect(cfg, [&](execution_objects_t& machine) {
+        block_t machine_state_0 = {{'F', 0.5}};
+        partitioned_program_t program_parts = preprocess_program(gcode_to_maps_of_arguments(gcode_text), cfg, machine_state_0, raw_gcode, machine.metrics);
+        for (auto& ppart : program_parts) {
+            if ((ppart.size() != 0) && (ppart[0].count('M') == 0) && ((int)(ppart[0].at('G')) == 28))
+                throw std::invalid_argument("G28 depends on endstops, so it can not be compiled");
+        }
+        converters::step_stream_writer stream(stream_filename, cfg);
+        fifo_c<calculated_part_t> calculated_multisteps;
+        std::atomic<bool> cancel_execution = false;
+        auto multistep_calculation_promise = std::async(std::launch::async, [&]() {
+            return multistep_producer_for_execution(calculated_multisteps, program_parts, machine,
+                converters::program_to_steps_factory(cfg), cancel_execution, cfg, machine_state_0);
+        });
+        // the same order of parts as in execute_command_parts
+        for (std::size_t command_block_index = 0; command_block_index < program_parts.size(); command_block_index++) {
+            auto& ppart = program_parts[command_block_index];
+            if (ppart.size() == 0) continue;
+            if (ppart[0].count('M')) {
+                for (auto& m : ppart)
+                    stream.m_code(m);
+                continue;
+            }
+            switch ((int)(ppart[0].at('G'))) {
+            case 0:
+            case 1:
+            case 2:
+            case 3: {
+                auto calculated = calculated_multisteps.get(cancel_execution);
+                stream.steps(calculated.commands, calculated.continues_motion);
+                command_block_index = calculated.next_part - 1;
+            } break;
+            case 92: {
+                calculated_multisteps.get(cancel_execution);
+                for (auto& pelem : ppart)
+                    stream.set_position(pelem);
+            } break;
+            }
+        }
+        multistep_calculation_promise.get();
+        stream.finish();
+    });
+}
+
+/**
+ * @brief executes the step stream created by compile_gcode_file. Nothing is calculated, the memory
+ * mapped commands are given directly to the stepping. Throws std::invalid_argument if the stream
+ * was calculated for the different configuration. Returns 0 on success, -2 if the execution was terminated.
+ */
+int play_step_stream_file(const configuration::global cfg, const std::string stream_filename, execution_objects_t machine, std::atomic<bool>& cancel_execution)
+{
+    converters::step_stream_reader stream(stream_filename);
+    converters::step_stream_validate(stream.header(), cfg);
+    if (machine.metrics) machine.metrics->reset();
+
+    machine.steppers_drv->set_steps({0, 0, 0, 0});
+    std::atomic<bool> paused{false};
+    std::function<void(int, int)> on_pause_execution = [machine, &paused](int, int s) {
+        if (s == 1) {
+            if (paused) {
+                paused = false;
+            } else {
+                paused = true;
+                machine.stepping->terminate(1000);
+            }
+        }
+    };
+    auto on_stop_execution = [machine, &cancel_execution](int k, int s) {
+        if (s == 1) {
+            std::cout << "on_stop_execution " << k << "  " << s << std::endl;
+            cancel_execution = true;
+            machine.stepping->terminate(1000);
+        }
+    };
+    machine.buttons_drv->on_key(low_buttons_default_meaning_t::PAUSE, on_pause_execution);
+    machine.buttons_drv->on_key(low_buttons_default_meaning_t::TERMINATE, on_stop_execution);
+
+    std::map<int, double> spindles_status;
+    long int last_spindle_on_delay = 7000;
+    for (const auto& e : stream.events()) {
+        if (cancel_execution) break;
+        switch (e.record->type) {
+        case converters::STEP_STREAM_STEPS: {
+            auto exec_start = std::chrono::steady_clock::now();
+            try {
+                execute_calculated_multistep(e.commands, e.record->count, machine, on_stop_execution, cancel_execution, paused, last_spindle_on_delay, spindles_status, cfg);
+            } catch (const raspigcd::hardware::execution_terminated&) {
+                machine.spindles_drv->spindle_pwm_power(0, 0.0);
+                return -2;
+            }
+            if (machine.metrics) machine.metrics->executed_commands(e.record->count, std::chrono::duration<double>(std::chrono::steady_clock::now() - exec_start).count());
+            if (stream.header().laser && (e.record->code == 0)) {
+                machine.spindles_drv->spindle_pwm_power(0, 0.0);
+            }
+        } break;
+        case converters::STEP_STREAM_M:
+            execute_m_code(converters::step_stream_record_to_m_block(*e.record), machine, cfg, spindles_status, last_spindle_on_delay);
+            break;
+        case converters::STEP_STREAM_G92:
+            set_position_g92({converters::step_stream_record_to_g92_block(*e.record)}, machine);
+            break;
+        }
+    }
+    if (machine.metrics) machine.metrics->job_finished(stream_filename);
+    return cancel_execution ? -2 : 0;
+}
+
+
+auto interactive_mode_execution = [](const auto cfg, const auto raw_gcode, const std::string metrics_file) {
     using namespace raspigcd;
     using namespace raspigcd::hardware;
 
     auto machine = stepping_simple_timer_factory(cfg);
+    machine.metrics->set_dump_file(metrics_file);
 
     converters::program_to_steps_f_t program_to_steps;
-    program_to_steps = converters::program_to_steps_factory(cfg.steps_generator);
+    program_to_steps = converters::program_to_steps_factory(cfg);
 
 
     machine.buttons_drv->on_key(low_buttons_default_meaning_t::PAUSE, [](int k, int v) { std::cout << "PAUSE     " << k << "  value=" << v << std::endl; });
@@ -713,6 +1002,7 @@ auto interactive_mode_execution = [](const auto cfg, const auto raw_gcode) {
                     std::cout << "EXECUTE: \"" << filename << "\"" << std::endl;
                     auto [err_code, machine_state] = execute_gcode_file(cfg, raw_gcode, filename, machine, cancel_execution, machine_status_after_exec);
                     std::cout << "EXECUTE_FINISHED: \"" << filename << "\"" << std::endl;
+                    if (err_code != 0) std::cerr << "ERROR_AFTER_EXECUTION: " << err_code << std::endl;
                     auto end_pos = machine.motor_layout_->steps_to_cartesian(machine.steppers_drv->get_steps());
                     machine_state['X'] = end_pos[0];
                     machine_state['Y'] = end_pos[1];
@@ -733,7 +1023,7 @@ auto interactive_mode_execution = [](const auto cfg, const auto raw_gcode) {
                     double executio_time = fake_execution_and_statistics_collect(cfg, [&](execution_objects_t& machine) {
                         auto [err_code, machine_state] = execute_gcode_file(cfg, raw_gcode, filename, machine, cancel_execution, machine_status_after_exec);
                         if (err_code != 0) std::cerr << "ERROR_AFTER_EXECUTION: " << err_code << std::endl;
-                    });
+                    }, machine.metrics);
                     std::cout << "SIM_EXEC_TIME: " << executio_time << std::endl;
                 } catch (std::exception& e) {
                     std::cout << "SIM_EXEC_TIME: "
@@ -754,7 +1044,7 @@ auto interactive_mode_execution = [](const auto cfg, const auto raw_gcode) {
                     double executio_time = fake_execution_and_statistics_collect(cfg, [&](execution_objects_t& machine) {
                         auto [err_code, machine_state] = execute_gcode_text(cfg, raw_gcode, gcdcommand + "\n", machine, cancel_execution, machine_status_after_exec);
                         if (err_code != 0) std::cerr << "ERROR_AFTER_EXECUTION: " << err_code << std::endl;
-                    });
+                    }, machine.metrics);
                     std::cout << "SIM_GO_TIME: " << executio_time << std::endl;
                 } catch (std::exception& e) {
                     std::cout << "SIM_GO_TIME: "
@@ -821,6 +1111,19 @@ auto interactive_mode_execution = [](const auto cfg, const auto raw_gcode) {
             auto end_pos = machine.motor_layout_->steps_to_cartesian(machine.steppers_drv->get_steps());
             std::cout << "TERMINATED: " << end_pos << std::endl;
         } else if (command == "q") {
+        } else if (command == "feed") {
+            std::string feed_value;
+            std::getline(std::cin, feed_value);
+            feed_value = std::regex_replace(feed_value, std::regex("[ %]"), "");
+            try {
+                if (feed_value.size() > 0) machine.stepping->set_feed_override(std::stod(feed_value) / 100.0);
+                std::cout << "FEED: " << (machine.stepping->get_feed_override() * 100.0) << "% current "
+                          << (machine.stepping->get_current_feed_override() * 100.0) << "%" << std::endl;
+            } catch (const std::exception& e) {
+                std::cout << "FEED_ERROR: " << e.what() << std::endl;
+            }
+        } else if (command == "metrics") {
+            std::cout << "METRICS: " << machine.metrics->to_json().dump() << std::endl;
         } else if (command == "status") {
             auto end_steps = machine.steppers_drv->get_steps();
             auto end_pos = machine.motor_layout_->steps_to_cartesian(end_steps);
@@ -845,6 +1148,8 @@ auto interactive_mode_execution = [](const auto cfg, const auto raw_gcode) {
             std::cout << "INFO:  sim_go [g-code]       -> simulate execution of gcode command" << std::endl;
             std::cout << "INFO:  sim_exec [filename]   -> simulate execution of gcode file" << std::endl;
             std::cout << "INFO:  status                -> get status and last position" << std::endl;
+            std::cout << "INFO:  metrics               -> get metrics of the last job as JSON" << std::endl;
+            std::cout << "INFO:  feed [50..200]%       -> set the feed override or show it, it works during execution" << std::endl;
             std::cout << "INFO:  stop                  -> stop and go to origin" << std::endl;
             std::cout << "INFO:  terminate             -> terminate current execution" << std::endl;
         }
@@ -859,6 +1164,7 @@ int main(int argc, char** argv)
     cfg.load_defaults();
 
     bool raw_gcode = false; // should I push G commands directly, without adaptation to machine
+    std::string metrics_file;   // where to append metrics after each job
     for (unsigned i = 1; i < args.size(); i++) {
         if ((args.at(i) == "-h") || (args.at(i) == "--help")) {
             help_text(args);
@@ -869,13 +1175,39 @@ int main(int argc, char** argv)
             std::cout << cfg << std::endl;
         } else if (args.at(i) == "--raw") {
             raw_gcode = true;
+        } else if (args.at(i) == "--metrics") {
+            i++;
+            metrics_file = args.at(i);
         } else if (args.at(i) == "-f") {
             i++;
             auto machine = stepping_simple_timer_factory(cfg);
+            machine.metrics->set_dump_file(metrics_file);
             std::atomic<bool> cancel_execution = false;
             execute_gcode_file(cfg, raw_gcode, args.at(i), machine, cancel_execution);
+        } else if (args.at(i) == "--preview") {
+            std::string filename = args.at(i + 1);
+            std::string png_filename = args.at(i + 2);
+            i += 2;
+            std::ifstream gcd_file(filename);
+            if (!gcd_file.is_open()) throw std::invalid_argument("could not open file \"" + filename + "\"");
+            std::string gcode_text((std::istreambuf_iterator<char>(gcd_file)),
+                std::istreambuf_iterator<char>());
+            auto program_parts = group_gcode_commands(gcode_to_maps_of_arguments(gcode_text));
+            converters::save_preview_png(converters::render_preview(converters::program_to_preview_segments(program_parts)), png_filename);
+        } else if (args.at(i) == "--compile") {
+            std::string filename = args.at(i + 1);
+            std::string stream_filename = args.at(i + 2);
+            i += 2;
+            compile_gcode_file(cfg, raw_gcode, filename, stream_filename);
+        } else if (args.at(i) == "--play") {
+            i++;
+            auto machine = stepping_simple_timer_factory(cfg);
+            machine.metrics->set_dump_file(metrics_file);
+            std::atomic<bool> cancel_execution = false;
+            if (play_step_stream_file(cfg, args.at(i), machine, cancel_execution) != 0) std::cerr << "ERROR_AFTER_EXECUTION: terminated" << std::endl;
+            std::cout << "EXECUTE_DONE: " << machine.motor_layout_->steps_to_cartesian(machine.steppers_drv->get_steps()) << std::endl;
         } else if (args.at(i) == "--configtest") {
-            interactive_mode_execution(cfg, raw_gcode);
+            interactive_mode_execution(cfg, raw_gcode, metrics_file);
             i++;
         }
     }
@@ -106,6 +106,17 @@ TEST_CASE( "Configuration handling", "[configuration]" ) {
         REQUIRE(cfg1 == cfg2);
     }
 
+    SECTION( "variable interval steps generator is saved and loaded" ) {
+        raspigcd::configuration::global cfg1;
+        cfg1.load_defaults();
+        cfg1.steps_generator = raspigcd::configuration::steps_generator_e::VARIABLE_INTERVAL;
+        nlohmann::json j1 = cfg1;
+        REQUIRE(j1["steps_generator"] == "variable_interval");
+        raspigcd::configuration::global cfg2;
+        cfg2 = j1;
+        REQUIRE(cfg1 == cfg2);
+    }
+
 
     //     conf &load(const std::string &filename);
 //     conf &save(const std::string &filename);
@@ -119,6 +130,22 @@ TEST_CASE( "Configuration handling", "[configuration]" ) {
         REQUIRE(!(cfg2 == cfg));
         cfg2.load_defaults();
         REQUIRE(cfg2 == cfg);
+        cfg2.max_jerk_mm_s3.at(1) = 5000;
+        REQUIRE(!(cfg2 == cfg));
+        cfg2.load_defaults();
+        REQUIRE(cfg2 == cfg);
+        cfg2.path_simplifier = raspigcd::configuration::VISVALINGAM_WHYATT;
+        REQUIRE(!(cfg2 == cfg));
+        cfg2.load_defaults();
+        REQUIRE(cfg2 == cfg);
+        cfg2.planning_threads = 4;
+        REQUIRE(!(cfg2 == cfg));
+        cfg2.load_defaults();
+        REQUIRE(cfg2 == cfg);
+        cfg2.feed_override_rate = 2.0;
+        REQUIRE(!(cfg2 == cfg));
+        cfg2.load_defaults();
+        REQUIRE(cfg2 == cfg);
     }
 
     SECTION( "configuration method save and load works as expected returns the same object" ) {
@@ -163,4 +190,49 @@ TEST_CASE( "Configuration handling", "[configuration]" ) {
         REQUIRE(cfg.motion_layout == raspigcd::configuration::motion_layouts::CARTESIAN);
     }
   
+
+    SECTION( "precomputed proportional limits give the same values as limits" ) {
+        raspigcd::configuration::global cfg;
+        cfg.load_defaults();
+        cfg.max_accelerations_mm_s2 = {100, 200, 50, 10};
+        cfg.max_velocity_mm_s = {220, 120, 20, 5};
+        cfg.max_no_accel_velocity_mm_s = {2, 3, 1, 0.5};
+        cfg.max_jerk_mm_s3 = {1000, 2000, 500, 100};
+        raspigcd::configuration::proportional_limits plimits(cfg);
+        std::vector<distance_t> directions = {{1, 0, 0, 0}, {0, -1, 0, 0}, {3, 4, 0, 0}, {-1, 2, -3, 1}, {0.1, 0, 0.2, 0}};
+        auto batch = plimits.all(directions);
+        REQUIRE(batch.size() == directions.size());
+        for (std::size_t i = 0; i < directions.size(); i++) {
+            auto n = directions[i] / directions[i].length();
+            REQUIRE(plimits.max_accelerations_mm_s2(directions[i]) == Approx(cfg.proportional_max_accelerations_mm_s2(n)));
+            REQUIRE(plimits.max_velocity_mm_s(directions[i]) == Approx(cfg.proportional_max_velocity_mm_s(n)));
+            REQUIRE(plimits.max_no_accel_velocity_mm_s(directions[i]) == Approx(cfg.proportional_max_no_accel_velocity_mm_s(n)));
+            REQUIRE(batch[i].max_accelerations_mm_s2 == Approx(cfg.proportional_max_accelerations_mm_s2(n)));
+            REQUIRE(batch[i].max_velocity_mm_s == Approx(cfg.proportional_max_velocity_mm_s(n)));
+            REQUIRE(batch[i].max_no_accel_velocity_mm_s == Approx(cfg.proportional_max_no_accel_velocity_mm_s(n)));
+            REQUIRE(batch[i].max_jerk_mm_s3 == Approx(cfg.proportional_max_jerk_mm_s3(n)));
+        }
+        REQUIRE(plimits.max_velocity_mm_s({1, 0, 0, 0}) == Approx(220));
+        REQUIRE(plimits.max_velocity_mm_s({3, 4, 0, 0}) == Approx((220 * 3 + 120 * 4) / 7.0));
+    }
+
+    SECTION( "proportional limits for the zero direction are 0, the same as for limits" ) {
+        raspigcd::configuration::global cfg;
+        cfg.load_defaults();
+        raspigcd::configuration::proportional_limits plimits(cfg);
+        const distance_t zero = {0, 0, 0, 0};
+        REQUIRE(cfg.proportional_max_accelerations_mm_s2(zero) == 0);
+        REQUIRE(cfg.proportional_max_velocity_mm_s(zero) == 0);
+        REQUIRE(cfg.proportional_max_no_accel_velocity_mm_s(zero) == 0);
+        REQUIRE(cfg.proportional_max_jerk_mm_s3(zero) == 0);
+        REQUIRE(plimits.max_accelerations_mm_s2(zero) == 0);
+        REQUIRE(plimits.max_velocity_mm_s(zero) == 0);
+        REQUIRE(plimits.max_no_accel_velocity_mm_s(zero) == 0);
+        REQUIRE(plimits.max_jerk_mm_s3(zero) == 0);
+        auto v = plimits.all(zero);
+        REQUIRE(v.max_accelerations_mm_s2 == 0);
+        REQUIRE(v.max_velocity_mm_s == 0);
+        REQUIRE(v.max_no_accel_velocity_mm_s == 0);
+        REQUIRE(v.max_jerk_mm_s3 == 0);
+    }
 }
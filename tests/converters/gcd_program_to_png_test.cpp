@@ -0,0 +1,129 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <configuration.hpp>
+#include <converters/gcd_program_to_png.hpp>
+#include <gcd/gcode_interpreter.hpp>
+#include <hardware/motor_layout.hpp>
+#include <lodepng/lodepng.h>
+
+#include <cstdio>
+#include <unistd.h>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::gcd;
+using namespace raspigcd::converters;
+
+TEST_CASE("converters - program preview", "[converters][preview]")
+{
+    auto program = group_gcode_commands(gcode_to_maps_of_arguments(R"(
+        G0X10
+        M3
+        G1Y10
+        M5
+        G0X0Y0
+    )"));
+
+    SECTION("program is converted into travel and work segments")
+    {
+        auto segments = program_to_preview_segments(program);
+        REQUIRE(segments.size() == 3);
+        REQUIRE(segments[0].travel);
+        REQUIRE(segments[0].b == distance_t{10, 0, 0, 0});
+        REQUIRE_FALSE(segments[1].travel);
+        REQUIRE(segments[1].power == 1.0);
+        REQUIRE(segments[1].b == distance_t{10, 10, 0, 0});
+        REQUIRE(segments[2].travel);
+        REQUIRE(segments[2].power == 0.0);
+    }
+
+    SECTION("picture does not depend on the number of rasterizer threads")
+    {
+        auto segments = program_to_preview_segments(program);
+        preview_options_t options;
+        options.width = 103;
+        options.height = 200;
+        options.threads = 1;
+        auto single = render_preview(segments, options);
+        options.threads = 7;
+        auto parallel = render_preview(segments, options);
+        REQUIRE(single.width == 103);
+        REQUIRE(single.height == 103);
+        REQUIRE(single.pixels_per_mm == Approx(10.0));
+        REQUIRE(single.rgba == parallel.rgba);
+
+        auto pixel = [&](int x, int y) {
+            auto* p = &single.rgba[(y * single.width + x) * 4];
+            return std::array<unsigned char, 3>{p[0], p[1], p[2]};
+        };
+        // the work move goes along the right edge, travel along the bottom
+        REQUIRE(pixel(101, 50) == options.work);
+        REQUIRE(pixel(50, 101) == options.travel);
+        REQUIRE(pixel(50, 20) == options.background);
+    }
+
+    SECTION("steps stream is converted using spindle synchronization flags")
+    {
+        configuration::global cfg;
+        cfg.load_defaults();
+        cfg.motion_layout = configuration::motion_layouts::CARTESIAN;
+        auto ml = hardware::motor_layout::get_instance(cfg);
+        ml->set_configuration(cfg);
+        steps_t to_x = ml->cartesian_to_steps({2, 0, 0, 0});
+        hardware::multistep_commands_t commands;
+        hardware::multistep_command c = {};
+        c.b[0].step = 1;
+        c.b[0].dir = 1;
+        c.flags.bits.g = hardware::SPINDLE_SYNC_OFF;
+        c.count = to_x[0];
+        commands.push_back(c);
+        c.flags.bits.g = hardware::SPINDLE_SYNC_ON;
+        c.b[0].dir = 0;
+        commands.push_back(c);
+
+        auto segments = steps_to_preview_segments(commands, *ml);
+        REQUIRE(segments.size() == 2);
+        REQUIRE(segments[0].travel);
+        REQUIRE(segments[0].b[0] == Approx(2.0));
+        REQUIRE_FALSE(segments[1].travel);
+        REQUIRE(segments[1].power == 1.0);
+        REQUIRE(segments[1].b[0] == Approx(0.0));
+    }
+
+    SECTION("picture is saved as png")
+    {
+        auto image = render_preview(program_to_preview_segments(program));
+        std::string fname = "preview_test_" + std::to_string(getpid()) + ".png";
+        save_preview_png(image, fname);
+        std::vector<unsigned char> decoded;
+        unsigned w, h;
+        REQUIRE(lodepng::decode(decoded, w, h, fname) == 0);
+        std::remove(fname.c_str());
+        REQUIRE((int)w == image.width);
+        REQUIRE((int)h == image.height);
+        REQUIRE(decoded == image.rgba);
+        REQUIRE_THROWS_AS(save_preview_png(image, "/nonexistent_dir/x.png"), std::runtime_error);
+    }
+}
@@ -177,6 +177,35 @@ TEST_CASE("converters - program_to_steps", "[gcd][converters][program_to_steps]"
         REQUIRE(commands_count == (int)(t/dt));
 //        REQUIRE(result.size() == (1000000/test_config.tick_duration_us));
     }
+    SECTION("jerk limited acceleration from F0 to F1 keeps the distance and the time, but starts smoothly")
+    {
+        configuration::global jerk_config;
+        jerk_config.motion_layout = test_config.motion_layout;
+        jerk_config.scale = test_config.scale;
+        jerk_config.tick_duration_us = test_config.tick_duration_us;
+        jerk_config.steppers = test_config.steppers;
+        jerk_config.steps_generator = configuration::steps_generator_e::PROGRAM_TO_STEPS;
+        jerk_config.max_jerk_mm_s3 = {1000, 1000, 1000, 1000};
+        auto jerk_program_to_steps = converters::program_to_steps_factory(jerk_config);
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F0
+           G1X50F100
+        )");
+        auto result = jerk_program_to_steps(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        auto trapezoid = program_to_steps(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) == steps_t{5000,0,0,0});
+        REQUIRE(hardware_commands_to_steps_count(result) == Approx(hardware_commands_to_steps_count(trapezoid)).epsilon(0.001));
+        // the acceleration starts from 0, so at the beginning the machine moves slower than with constant acceleration
+        auto steps_after = [](auto commands, int ticks) {
+            int x = 0;
+            for (auto &e : commands) {
+                for (int i = 0; (i < e.count) && (ticks > 0); i++, ticks--)
+                    if (e.b[0].step) x += ((int)(e.b[0].dir)*2)-1;
+            }
+            return x;
+        };
+        REQUIRE(steps_after(result, 1000) < steps_after(trapezoid, 1000));
+    }
     SECTION("break from F1 to F0 should result in correct time")
     {
         double t = 1;
@@ -388,4 +417,169 @@ TEST_CASE("converters - program_to_steps", "[gcd][converters][program_to_steps]"
         REQUIRE(steps_done_count == (int)(2.0/dt));
     }
 
+
+    SECTION("arc G3 is followed in the steps space and takes the time of the arc length") {
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F10
+           G3X0Y10I-10J0F10
+        )");
+        auto result = program_to_steps(program,test_config, *(motor_layot_p.get()),
+            {{'X',10},{'Y',0},{'Z',0},{'F',10}}, [](const block_t &){} );
+        steps_t start = motor_layot_p->cartesian_to_steps({10,0,0,0});
+        double max_radius_error = 0;
+        for (auto &s : hardware_commands_to_steps(result)) {
+            auto p = motor_layot_p->steps_to_cartesian(s + start);
+            max_radius_error = std::max(max_radius_error, std::abs(std::sqrt(p[0]*p[0]+p[1]*p[1]) - 10.0));
+        }
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) + start == steps_t{0,1000,0,0});
+        // one step is 0.01mm
+        REQUIRE(max_radius_error <= 0.015);
+        double dt = ((double) test_config.tick_duration_us)/1000000.0;
+        REQUIRE(hardware_commands_to_steps_count(result) == Approx((M_PI * 5.0 / 10.0)/dt).epsilon(0.001));
+    }
+
+    SECTION("full circle G2 returns to the start position") {
+        auto program = gcode_to_maps_of_arguments(R"(
+           G2X0Y0I5J0F20
+        )");
+        auto result = program_to_steps(program,test_config, *(motor_layot_p.get()),
+            {{'X',0},{'Y',0},{'Z',0},{'F',20}}, [](const block_t &){} );
+        REQUIRE(result.size() > 0);
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) == steps_t{0,0,0,0});
+    }
+}
+
+TEST_CASE("converters - variable_interval program_to_steps", "[gcd][converters][program_to_steps][variable_interval]")
+{
+    configuration::actuators_organization test_config;
+
+    test_config.motion_layout = configuration::motion_layouts::CARTESIAN;
+    test_config.scale = {1,1,1,1};
+    test_config.tick_duration_us = 100; // 0.0001 s
+    for (size_t i = 0; i <COORDINATES_COUNT;i++){
+        configuration::stepper stepper;
+        stepper.dir = 1;
+        stepper.en = 2;
+        stepper.step = 3;
+        stepper.steps_per_mm = 100;
+        test_config.steppers.push_back(stepper);
+    }
+    auto motor_layot_p = hardware::motor_layout::get_instance(test_config);
+    motor_layot_p->set_configuration(test_config);
+    auto program_to_steps = converters::program_to_steps_factory(configuration::steps_generator_e::PROGRAM_TO_STEPS);
+    auto variable_interval = converters::program_to_steps_factory(configuration::steps_generator_e::VARIABLE_INTERVAL);
+    double dt = ((double) test_config.tick_duration_us)/1000000.0;
+
+    SECTION("empty program should result in empty steps list")
+    {
+        REQUIRE(variable_interval({},test_config, *(motor_layot_p.get()),{{'F',0}},[](const gcd::block_t &){}).size() == 0);
+    }
+    SECTION("constant speed move has one timed command for every step and takes the time of the move")
+    {
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F1
+           G1X1F1
+        )");
+        auto result = variable_interval(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) == steps_t{100,0,0,0});
+        // the first step is after 0.01s, then every step waits 0.01s, so they are merged into one command
+        REQUIRE(hardware_commands_to_steps_count(result) == 101);
+        REQUIRE(result.size() == 3);
+        REQUIRE(result.at(0).delay_ns == 10000000);
+        REQUIRE(result.at(1).delay_ns == 10000000);
+        REQUIRE(result.at(1).count == 99);
+        REQUIRE(hardware_commands_duration(result, dt) == Approx(1.0));
+    }
+    SECTION("if the speed is 0 and the distance is not 0, then the exception should be throwned")
+    {
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F0
+           G1X1F0
+        )");
+        REQUIRE_THROWS(variable_interval(program,test_config, *(motor_layot_p.get()),{{'F',0}},[](const gcd::block_t &){}));
+    }
+    SECTION("acceleration gives the same distance and time as program_to_steps, with less commands")
+    {
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F0
+           G1X50F100
+           G1X0Y20F10
+           G4P500
+           G1X10Y20Z1F10
+        )");
+        auto result = variable_interval(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        auto ticks = program_to_steps(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) == hardware_commands_to_last_position_after_given_steps(ticks));
+        REQUIRE(hardware_commands_duration(result, dt) == Approx(hardware_commands_duration(ticks, dt)).epsilon(0.001));
+        REQUIRE(result.size() < ticks.size());
+        for (auto& c : result) REQUIRE(c.delay_ns > 0);
+    }
+    SECTION("the step times follow the constant acceleration")
+    {
+        // s = a*t*t/2 for a=100, so the step at 1mm is at the time sqrt(2*1/100)
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F0
+           G1X50F100
+        )");
+        auto result = variable_interval(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        double t = 0;
+        int x = 0;
+        for (auto& c : result) {
+            for (int i = 0; (i < c.count) && (x < 100); i++) {
+                if (c.b[0].step) x++;
+                if (x < 100) t += c.delay_ns * 0.000000001;
+            }
+        }
+        REQUIRE(t == Approx(std::sqrt(2.0 / 100.0)).epsilon(0.0001));
+    }
+    SECTION("jerk limited generator keeps the distance and the time")
+    {
+        configuration::global jerk_config;
+        jerk_config.motion_layout = test_config.motion_layout;
+        jerk_config.scale = test_config.scale;
+        jerk_config.tick_duration_us = test_config.tick_duration_us;
+        jerk_config.steppers = test_config.steppers;
+        jerk_config.steps_generator = configuration::steps_generator_e::VARIABLE_INTERVAL;
+        jerk_config.max_jerk_mm_s3 = {1000, 1000, 1000, 1000};
+        auto jerk_variable_interval = converters::program_to_steps_factory(jerk_config);
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F0
+           G1X50F100
+        )");
+        auto result = jerk_variable_interval(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        auto trapezoid = variable_interval(program,test_config, *(motor_layot_p.get()) ,{{'F',0}},[](const gcd::block_t &){});
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) == steps_t{5000,0,0,0});
+        REQUIRE(hardware_commands_duration(result, dt) == Approx(hardware_commands_duration(trapezoid, dt)).epsilon(0.001));
+        // the acceleration starts from 0, so the first step is later than with constant acceleration
+        REQUIRE(result.front().delay_ns > trapezoid.front().delay_ns);
+    }
+    SECTION("long dwell is split into many timed commands")
+    {
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F10
+           G4X5
+           G1X1
+        )");
+        auto result = variable_interval(program,test_config, *(motor_layot_p.get()) ,{{'F',10}},[](const gcd::block_t &){});
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) == steps_t{100,0,0,0});
+        REQUIRE(hardware_commands_duration(result, dt) == Approx(5.1));
+        REQUIRE(hardware_commands_to_steps_count(result) == 100 + 3);
+    }
+    SECTION("arc G3 is followed in the steps space and takes the time of the arc length") {
+        auto program = gcode_to_maps_of_arguments(R"(
+           G1F10
+           G3X0Y10I-10J0F10
+        )");
+        auto result = variable_interval(program,test_config, *(motor_layot_p.get()),
+            {{'X',10},{'Y',0},{'Z',0},{'F',10}}, [](const block_t &){} );
+        steps_t start = motor_layot_p->cartesian_to_steps({10,0,0,0});
+        double max_radius_error = 0;
+        for (auto &s : hardware_commands_to_steps(result)) {
+            auto p = motor_layot_p->steps_to_cartesian(s + start);
+            max_radius_error = std::max(max_radius_error, std::abs(std::sqrt(p[0]*p[0]+p[1]*p[1]) - 10.0));
+        }
+        REQUIRE(hardware_commands_to_last_position_after_given_steps(result) + start == steps_t{0,1000,0,0});
+        REQUIRE(max_radius_error <= 0.015);
+        REQUIRE(hardware_commands_duration(result, dt) == Approx(M_PI * 5.0 / 10.0).epsilon(0.001));
+    }
 }
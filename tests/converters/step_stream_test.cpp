@@ -0,0 +1,138 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <configuration.hpp>
+#include <converters/step_stream.hpp>
+#include <hardware/driver/inmem.hpp>
+#include <hardware/driver/low_timers_fake.hpp>
+#include <hardware/stepping.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::gcd;
+using namespace raspigcd::hardware;
+using namespace raspigcd::converters;
+
+TEST_CASE("converters - step stream", "[converters][step_stream]")
+{
+    const std::string stream_file = "__test_tmp.steps";
+    configuration::global cfg;
+    cfg.load_defaults();
+
+    single_step_command x = {1, 1}, n = {0, 0};
+    multistep_commands_t commands = {
+        {.b = {x, n, n, n}, .flags = {.all = 0}, .count = 3},
+        {.b = {n, n, n, n}, .flags = {.all = 0}, .count = 2}, // pattern header
+        {.b = {n, x, n, n}, .flags = {.all = 0}, .count = 1},
+        {.b = {n, n, n, n}, .flags = {.all = 0}, .count = 2, .delay_ns = 1500}};
+    commands[1].flags.bits.p = 2;
+
+    {
+        step_stream_writer writer(stream_file, cfg);
+        writer.m_code({{'M', 17}});
+        writer.m_code({{'M', 3}, {'X', 1.5}});
+        writer.m_code({{'M', 114}}); // not executed, so it is not stored
+        writer.steps(commands, true);
+        writer.steps({}, false);
+        writer.set_position({{'G', 92}, {'X', 1.0}, {'Z', -2.0}});
+        writer.finish();
+    }
+
+    SECTION("the stream is read back")
+    {
+        step_stream_reader reader(stream_file);
+        REQUIRE(reader.header().tick_duration_us == cfg.tick_duration_us);
+        REQUIRE(reader.header().motion_layout == cfg.motion_layout);
+        REQUIRE_NOTHROW(step_stream_validate(reader.header(), cfg));
+
+        auto& events = reader.events();
+        REQUIRE(events.size() == 5);
+        REQUIRE(events[0].record->type == STEP_STREAM_M);
+        REQUIRE(step_stream_record_to_m_block(*events[0].record) == block_t{{'M', 17}});
+        REQUIRE(step_stream_record_to_m_block(*events[1].record) == block_t{{'M', 3}, {'P', 1500}});
+        REQUIRE(events[2].record->type == STEP_STREAM_STEPS);
+        REQUIRE(events[2].record->code == 1);
+        REQUIRE(events[2].record->count == (int)commands.size());
+        for (unsigned i = 0; i < commands.size(); i++) {
+            REQUIRE(multistep_command_same_command(events[2].commands[i], commands[i]));
+            REQUIRE(events[2].commands[i].count == commands[i].count);
+        }
+        REQUIRE(events[3].record->type == STEP_STREAM_STEPS);
+        REQUIRE(events[3].record->count == 0);
+        REQUIRE(events[3].record->code == 0);
+        REQUIRE(step_stream_record_to_g92_block(*events[4].record) == block_t{{'G', 92}, {'X', 1.0}, {'Z', -2.0}});
+    }
+
+    SECTION("the memory mapped commands are executed the same way as the vector")
+    {
+        step_stream_reader reader(stream_file);
+        auto steppers = std::make_shared<driver::inmem>();
+        stepping_simple_timer worker(cfg, steppers, std::make_shared<driver::low_timers_fake>());
+        steppers->current_steps = {0, 0, 0, 0};
+        worker.exec(reader.events()[2].commands, reader.events()[2].record->count);
+        steps_t mapped_result = steppers->current_steps;
+        steppers->current_steps = {0, 0, 0, 0};
+        worker.exec(commands);
+        REQUIRE(mapped_result == steppers->current_steps);
+        REQUIRE(mapped_result == steps_t{3, 2, 0, 0});
+    }
+
+    SECTION("the stream calculated for different machine is rejected")
+    {
+        step_stream_reader reader(stream_file);
+        configuration::global other_tick = cfg;
+        other_tick.tick_duration_us = cfg.tick_duration_us + 10;
+        REQUIRE_THROWS_AS(step_stream_validate(reader.header(), other_tick), std::invalid_argument);
+        configuration::global other_steppers = cfg;
+        other_steppers.steppers[1].steps_per_mm *= 2.0;
+        REQUIRE_THROWS_AS(step_stream_validate(reader.header(), other_steppers), std::invalid_argument);
+        configuration::global other_layout = cfg;
+        other_layout.motion_layout = (cfg.motion_layout == configuration::motion_layouts::COREXY) ? configuration::motion_layouts::CARTESIAN : configuration::motion_layouts::COREXY;
+        REQUIRE_THROWS_AS(step_stream_validate(reader.header(), other_layout), std::invalid_argument);
+    }
+
+    SECTION("incomplete or foreign file is rejected")
+    {
+        {
+            std::ifstream in(stream_file, std::ios::binary);
+            std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            std::ofstream out(stream_file, std::ios::binary | std::ios::trunc);
+            out.write(data.data(), data.size() - sizeof(step_stream_record_t)); // without the end record
+        }
+        REQUIRE_THROWS_AS(step_stream_reader(stream_file), std::invalid_argument);
+        {
+            std::ofstream out(stream_file, std::ios::binary | std::ios::trunc);
+            out << "G0X10\nG1Y10\n";
+        }
+        REQUIRE_THROWS_AS(step_stream_reader(stream_file), std::invalid_argument);
+        REQUIRE_THROWS_AS(step_stream_reader("__not_existing_file.steps"), std::invalid_argument);
+    }
+
+    unlink(stream_file.c_str());
+}
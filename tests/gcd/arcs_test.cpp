@@ -0,0 +1,151 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <gcd/arcs.hpp>
+#include <gcd/gcode_interpreter.hpp>
+
+#include <cmath>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::configuration;
+using namespace raspigcd::gcd;
+
+TEST_CASE("gcode_interpreter_test - arcs", "[gcd][gcode_interpreter][arcs]")
+{
+    block_t start = {{'X', 10}, {'Y', 0}, {'Z', 0}, {'F', 10}};
+
+    SECTION("G3 with I and J is counterclockwise")
+    {
+        auto arc = block_to_arc(start, {{'G', 3}, {'X', 0}, {'Y', 10}, {'I', -10}, {'J', 0}});
+        REQUIRE(arc.center[0] == Approx(0));
+        REQUIRE(arc.center[1] == Approx(0));
+        REQUIRE(arc.start_radius == Approx(10));
+        REQUIRE(arc.sweep == Approx(M_PI / 2));
+        REQUIRE(arc.length() == Approx(5 * M_PI));
+        auto mid = arc.point_at(arc.length() / 2);
+        REQUIRE(mid[0] == Approx(10 / std::sqrt(2)));
+        REQUIRE(mid[1] == Approx(10 / std::sqrt(2)));
+        REQUIRE(arc.point_at(arc.length()) == distance_t{0, 10, 0, 0});
+        auto t = arc.tangent_at(0);
+        REQUIRE(t[0] == Approx(0).margin(1e-9));
+        REQUIRE(t[1] == Approx(1));
+    }
+
+    SECTION("G2 with the same points goes the long way")
+    {
+        auto arc = block_to_arc(start, {{'G', 2}, {'X', 0}, {'Y', 10}, {'I', -10}, {'J', 0}});
+        REQUIRE(arc.sweep == Approx(-3 * M_PI / 2));
+        auto mid = arc.point_at(arc.length() / 2);
+        REQUIRE(mid[0] == Approx(-10 / std::sqrt(2)));
+        REQUIRE(mid[1] == Approx(-10 / std::sqrt(2)));
+    }
+
+    SECTION("R form selects the center on the correct side")
+    {
+        block_t origin = {{'X', 0}, {'Y', 0}, {'Z', 0}};
+        auto half = block_to_arc(origin, {{'G', 2}, {'X', 10}, {'Y', 0}, {'R', 5}});
+        REQUIRE(half.center[0] == Approx(5));
+        REQUIRE(half.center[1] == Approx(0).margin(1e-9));
+        REQUIRE(half.sweep == Approx(-M_PI));
+
+        auto small = block_to_arc(origin, {{'G', 2}, {'X', 10}, {'Y', 10}, {'R', 10}});
+        REQUIRE(small.sweep == Approx(-M_PI / 2));
+        REQUIRE(small.center[0] == Approx(10));
+        REQUIRE(small.center[1] == Approx(0).margin(1e-9));
+        auto large = block_to_arc(origin, {{'G', 2}, {'X', 10}, {'Y', 10}, {'R', -10}});
+        REQUIRE(large.sweep == Approx(-3 * M_PI / 2));
+        REQUIRE(large.center[0] == Approx(0).margin(1e-9));
+        REQUIRE(large.center[1] == Approx(10));
+        auto ccw = block_to_arc(origin, {{'G', 3}, {'X', 10}, {'Y', 10}, {'R', 10}});
+        REQUIRE(ccw.sweep == Approx(M_PI / 2));
+        REQUIRE(ccw.center[0] == Approx(0).margin(1e-9));
+        REQUIRE(ccw.center[1] == Approx(10));
+    }
+
+    SECTION("the same start and end is the full circle, helix changes Z linearly")
+    {
+        auto arc = block_to_arc(start, {{'G', 2}, {'Z', -2}, {'I', -10}, {'J', 0}});
+        REQUIRE(arc.sweep == Approx(-2 * M_PI));
+        REQUIRE(arc.length() == Approx(std::sqrt(20 * M_PI * 20 * M_PI + 4)));
+        REQUIRE(arc.point_at(arc.length() / 2)[2] == Approx(-1));
+    }
+
+    SECTION("incorrect arcs are rejected")
+    {
+        REQUIRE_THROWS_AS(block_to_arc(start, {{'G', 2}, {'X', 0}, {'Y', 10}}), std::invalid_argument);
+        REQUIRE_THROWS_AS(block_to_arc(start, {{'G', 2}, {'X', 0}, {'Y', 12}, {'I', -10}}), std::invalid_argument);
+        REQUIRE_THROWS_AS(block_to_arc(start, {{'G', 2}, {'X', 30}, {'Y', 0}, {'R', 5}}), std::invalid_argument);
+        REQUIRE_THROWS_AS(block_to_arc(start, {{'G', 2}, {'R', 5}}), std::invalid_argument);
+        REQUIRE_THROWS_AS(block_to_arc(start, {{'G', 1}, {'X', 5}, {'I', 5}}), std::invalid_argument);
+    }
+
+    SECTION("arc split into points keeps the error bound")
+    {
+        auto arc = block_to_arc(start, {{'G', 3}, {'X', -10}, {'Y', 0}, {'I', -10}, {'J', 0}});
+        auto points = arc_to_points(arc, 0.01);
+        REQUIRE(points.size() > 10);
+        REQUIRE(points.back() == distance_t{-10, 0, 0, 0});
+        distance_t prev = arc.start;
+        for (auto& p : points) {
+            auto m = (prev + p) * 0.5;
+            REQUIRE((10.0 - std::sqrt(m[0] * m[0] + m[1] * m[1])) <= 0.01);
+            prev = p;
+        }
+    }
+
+    SECTION("velocity on the arc is limited by the centripetal acceleration")
+    {
+        configuration::limits machine_limits({100, 100, 100, 100}, {1000, 1000, 1000, 1000}, {2, 2, 2, 2});
+        auto arc = block_to_arc({{'X', 1}, {'Y', 0}}, {{'G', 3}, {'X', -1}, {'Y', 0}, {'I', -1}, {'J', 0}});
+        REQUIRE(arc_max_velocity(arc, machine_limits) == Approx(10));
+        configuration::limits slow_limits({100, 100, 100, 100}, {5, 5, 5, 5}, {2, 2, 2, 2});
+        REQUIRE(arc_max_velocity(arc, slow_limits) == Approx(5));
+    }
+
+    SECTION("linearize_arcs replaces arcs with G1")
+    {
+        program_t program = {{{'G', 1}, {'X', 10}, {'F', 5}}, {{'G', 3}, {'X', 0}, {'Y', 10}, {'I', -10}, {'J', 0}}, {{'X', -10}, {'Y', 0}, {'I', 0}, {'J', -10}}, {{'G', 1}, {'X', 0}}};
+        auto result = linearize_arcs(program, 0.01);
+        REQUIRE(result.size() > 4);
+        for (auto& b : result) {
+            REQUIRE(b.at('G') == 1);
+            REQUIRE(b.count('I') == 0);
+        }
+        REQUIRE(last_state_after_program_execution(result, {})['X'] == Approx(0));
+        REQUIRE(block_to_distance_t(result[result.size() - 2]) == distance_t{-10, 0, 0, 0});
+    }
+
+    SECTION("arcs are grouped and kept by remove_duplicate_blocks")
+    {
+        auto program = gcode_to_maps_of_arguments("G1X10F5\nG3X0Y10I-10J0\nG3X-10Y0I0J-10\nG2X-10Y0I10J0\nG1X0");
+        auto grouped = group_gcode_commands(program);
+        REQUIRE(grouped.size() == 4);
+        REQUIRE(grouped[1].size() == 2);
+        auto cleaned = remove_duplicate_blocks(program, {});
+        REQUIRE(cleaned.size() == program.size());
+        REQUIRE(cleaned[3].at('I') == 10);
+        REQUIRE(cleaned[3].at('J') == 0);
+    }
+}
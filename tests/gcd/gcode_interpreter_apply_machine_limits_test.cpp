@@ -359,6 +359,71 @@ TEST_CASE("gcode_interpreter_test - apply_limits_for_turns for longer program wi
 }
 
 
+TEST_CASE("gcode_interpreter_test - apply_limits_for_turns with junction deviation", "[gcd][gcode_interpreter][apply_limits_for_turns][junction_deviation]")
+{
+    configuration::limits machine_limits(
+        {100, 101, 102, 103}, // acceleration
+        {50, 51, 52, 53},     // max velocity
+        {2, 3, 4, 5});        // no accel velocity
+    machine_limits.cornering_model = configuration::CORNERING_JUNCTION_DEVIATION;
+    machine_limits.junction_deviation_mm = 0.05;
+
+    auto turn_0_program = gcode_to_maps_of_arguments(R"(
+        G1X0Y0Z0A0F100
+        G1X10Y0Z0A0F100
+        G1X0Y0Z0A0F100
+        )");
+    auto turn_90_program = gcode_to_maps_of_arguments(R"(
+        G1X0Y0Z0A0F100
+        G1X10Y0Z0A0F100
+        G1X10Y10Z0A0F100
+        )");
+    auto turn_180_program = gcode_to_maps_of_arguments(R"(
+        G1X0Y0Z0A0F200
+        G1X10Y0Z0A0F300
+        G1X20Y00Z0A0F400
+        )");
+    auto turn_135_program = gcode_to_maps_of_arguments(R"(
+        G1X0Y0Z0A0F200
+        G1X10Y0Z0A0F300
+        G1X20Y-10Z0A0F400
+        )");
+
+    SECTION("turn of 90 deg - the velocity comes from the centripetal acceleration")
+    {
+        auto ret = apply_limits_for_turns(turn_90_program, machine_limits);
+        double sin_half = std::sin(M_PI / 4.0);
+        double r = 0.05 * sin_half / (1.0 - sin_half);
+        REQUIRE(ret[1].at('F') == Approx(std::sqrt((100.0 + 101.0) / 2.0 * r)));
+    }
+    SECTION("going back results in the half of no accel velocity")
+    {
+        auto ret = apply_limits_for_turns(turn_0_program, machine_limits);
+        REQUIRE(ret[1].at('F') == Approx(1.0));
+    }
+    SECTION("straight line results in the maximal velocity")
+    {
+        auto ret = apply_limits_for_turns(turn_180_program, machine_limits);
+        REQUIRE(ret[1].at('F') == Approx(50.0));
+    }
+    SECTION("the right angle turn is faster than with the angle model")
+    {
+        auto ret = apply_limits_for_turns(turn_90_program, machine_limits);
+        auto limits_angle = machine_limits;
+        limits_angle.cornering_model = configuration::CORNERING_ANGLE;
+        auto ret_angle = apply_limits_for_turns(turn_90_program, limits_angle);
+        REQUIRE(ret[1].at('F') > ret_angle[1].at('F'));
+    }
+    SECTION("larger deviation allows faster turns")
+    {
+        auto ret = apply_limits_for_turns(turn_135_program, machine_limits);
+        auto limits_wide = machine_limits;
+        limits_wide.junction_deviation_mm = 0.2;
+        auto ret_wide = apply_limits_for_turns(turn_135_program, limits_wide);
+        REQUIRE(ret_wide[1].at('F') > ret[1].at('F'));
+    }
+}
+
 TEST_CASE("Found bugs - apply_limits_for_turns","[gcd][gcode_interpreter][apply_limits_for_turns][bugs]") {
     configuration::limits machine_limits(
         {100, 101, 102, 103}, // acceleration
@@ -0,0 +1,83 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <gcd/gcode_interpreter.hpp>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::configuration;
+using namespace raspigcd::gcd;
+
+TEST_CASE("gcode_interpreter_test - blend_motion_parts", "[gcd][gcode_interpreter][blend_motion_parts]")
+{
+    configuration::limits machine_limits(
+        {100, 100, 100, 100}, // acceleration
+        {50, 50, 50, 50},     // max velocity
+        {2, 2, 2, 2});        // no accel velocity
+    block_t initial_state = {{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}, {'F', 2}};
+
+    // returns the feedrate at the point where the part with given index starts
+    auto feedrate_at_part_boundary = [](const partitioned_program_t& parts, std::size_t part_index) {
+        return parts.at(part_index - 1).back().at('F');
+    };
+
+    SECTION("empty program gives empty result")
+    {
+        REQUIRE(blend_motion_parts({}, machine_limits, initial_state).size() == 0);
+    }
+
+    SECTION("straight travel followed by straight cut does not stop on the boundary")
+    {
+        auto parts = group_gcode_commands(gcode_to_maps_of_arguments("G0X20F50\nG1X40F40\nG0X50F50\nG0X60"));
+        auto blended = blend_motion_parts(parts, machine_limits, initial_state);
+        INFO(back_to_gcode(blended));
+        REQUIRE(blended.size() == 3);
+        REQUIRE(blended[0][0].at('G') == 0);
+        REQUIRE(blended[1][0].at('G') == 1);
+        REQUIRE(blended[2][0].at('G') == 0);
+        REQUIRE(feedrate_at_part_boundary(blended, 1) > 2.0);
+        REQUIRE(feedrate_at_part_boundary(blended, 1) <= 40.0);
+        REQUIRE(blended[2].front().at('F') > 2.0);
+        REQUIRE(blended.back().back().at('F') <= 2.0);
+        REQUIRE(blended.back().back().at('X') == Approx(60));
+    }
+
+    SECTION("parts separated by M code are planned separately")
+    {
+        auto parts = group_gcode_commands(gcode_to_maps_of_arguments("G0X20F50\nM3\nG1X40F40"));
+        auto blended = blend_motion_parts(parts, machine_limits, initial_state);
+        INFO(back_to_gcode(blended));
+        REQUIRE(blended.size() == 3);
+        REQUIRE(blended[1][0].count('M') == 1);
+        REQUIRE(blended[0].back().at('F') <= 2.0);
+        REQUIRE(blended[2] == parts[2]);
+    }
+
+    SECTION("sharp turn on the boundary is still limited")
+    {
+        auto parts = group_gcode_commands(gcode_to_maps_of_arguments("G0X20F50\nG1X0F40"));
+        auto blended = blend_motion_parts(parts, machine_limits, initial_state);
+        INFO(back_to_gcode(blended));
+        REQUIRE(feedrate_at_part_boundary(blended, 1) <= 2.0);
+    }
+}
@@ -176,6 +176,83 @@ TEST_CASE("gcode_interpreter_test - g1_move_to_g1_with_machine_limits - check if
     }
 }
 
+TEST_CASE("gcode_interpreter_test - time_optimal_feedrates", "[gcd][gcode_interpreter][time_optimal_feedrates]")
+{
+    using namespace raspigcd::movement::physics;
+    configuration::limits machine_limits(
+        {100, 100, 100, 100}, // acceleration
+        {20, 20, 20, 20},     // max velocity
+        {2, 2, 2, 2});        // no accel velocity
+    machine_limits.time_optimal_planning = true;
+
+    auto execution_time = [](const program_t& p) {
+        double t = 0;
+        for (unsigned i = 1; i < p.size(); i++)
+            t += blocks_to_vector_move(p[i - 1], p[i]).length() * 2.0 / (p[i - 1].at('F') + p[i].at('F'));
+        return t;
+    };
+    auto require_in_limits = [](const program_t& p, double max_a, double max_v) {
+        for (unsigned i = 1; i < p.size(); i++) {
+            path_node_t p0n = {.p = block_to_distance_t(p[i - 1]), .v = p[i - 1].at('F')};
+            path_node_t p1n = {.p = block_to_distance_t(p[i]), .v = p[i].at('F')};
+            REQUIRE(std::abs(acceleration_between(p0n, p1n)) <= max_a * 1.0001);
+            REQUIRE(p[i].at('F') <= max_v * 1.0001);
+        }
+    };
+
+    SECTION("long line accelerates, cruises and brakes with the maximal acceleration")
+    {
+        program_t program = {{{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}, {'F', 2}},
+            {{'X', 100}, {'Y', 0}, {'Z', 0}, {'A', 0}, {'F', 2}}};
+        auto result = time_optimal_feedrates(program, machine_limits, {20, 20});
+        REQUIRE(result.size() == 4);
+        double s_acc = (20.0 * 20.0 - 2.0 * 2.0) / (2.0 * 100.0);
+        REQUIRE(result[1].at('X') == Approx(s_acc));
+        REQUIRE(result[1].at('F') == Approx(20));
+        REQUIRE(result[2].at('X') == Approx(100.0 - s_acc));
+        REQUIRE(result[2].at('F') == Approx(20));
+        REQUIRE(result[3].at('F') == Approx(2));
+        require_in_limits(result, 100, 20);
+    }
+    SECTION("short line has the triangular profile")
+    {
+        program_t program = {{{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}, {'F', 2}},
+            {{'X', 1}, {'Y', 0}, {'Z', 0}, {'A', 0}, {'F', 2}}};
+        auto result = time_optimal_feedrates(program, machine_limits);
+        REQUIRE(result.size() == 3);
+        REQUIRE(result[1].at('X') == Approx(0.5));
+        REQUIRE(result[1].at('F') == Approx(std::sqrt(4.0 + 100.0)));
+        require_in_limits(result, 100, 20);
+    }
+    SECTION("velocities in nodes are lowered so the machine can brake")
+    {
+        program_t program = {{{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}, {'F', 2}},
+            {{'X', 10}, {'F', 20}},
+            {{'X', 10.1}, {'F', 20}},
+            {{'X', 10.2}, {'F', 2}}};
+        auto result = time_optimal_feedrates(program, machine_limits);
+        require_in_limits(result, 100, 20);
+        REQUIRE(result.back().at('F') == Approx(2));
+        REQUIRE(result.back().at('X') == Approx(10.2));
+    }
+    SECTION("the plan is not slower than the iterative acceleration limiting")
+    {
+        program_t program = gcode_to_maps_of_arguments("G0X1F20\nG0X15Y3F20\nG0X16Y3F20\nG0X16Y30F20\nG0X0Y0F20\nG0X0.5Y0.2F20");
+        auto limits_iterative = machine_limits;
+        limits_iterative.time_optimal_planning = false;
+        auto optimal = g1_move_to_g1_with_machine_limits(program, machine_limits);
+        auto iterative = g1_move_to_g1_with_machine_limits(program, limits_iterative);
+        INFO(back_to_gcode({optimal}));
+        INFO(back_to_gcode({iterative}));
+        require_in_limits(optimal, 100, 20);
+        block_t start = {{'X', 0}, {'Y', 0}, {'Z', 0}, {'A', 0}, {'F', 2}};
+        optimal.insert(optimal.begin(), start);
+        iterative.insert(iterative.begin(), start);
+        REQUIRE(execution_time(optimal) < execution_time(iterative));
+        REQUIRE(block_to_distance_t(optimal.back()) == block_to_distance_t(iterative.back()));
+    }
+}
+
 //TEST_CASE("gcode_interpreter_test - g1_move_to_g1_with_machine_limits - check if resulting gcode is within machine limits", "[gcd][gcode_interpreter][g1_move_to_g1_with_machine_limits][in_limits]")
 //{
 //
@@ -162,3 +162,53 @@ TEST_CASE("gcode_interpreter_test - optimize_path_douglas_peucker", "[gcd][gcode
     }
     
     }
+
+TEST_CASE("gcode_interpreter_test - douglas_peucker_mask", "[gcd][gcode_interpreter][optimize_path_douglas_peucker][douglas_peucker_mask]")
+{
+    // raster like path with the noise, so there are many kept and many removed points
+    auto make_path = [](std::size_t n) {
+        std::vector<distance_with_velocity_t> path;
+        path_coordinates_t soa;
+        unsigned int seed = 7;
+        for (std::size_t i = 0; i < n; i++) {
+            seed = seed * 1103515245 + 12345;
+            double noise = ((seed >> 8) % 1000) / 1000.0 * 0.03;
+            double x = (double)(i % 500) * (((i / 500) % 2) ? -0.1 : 0.1) + noise;
+            double y = (double)(i / 500) * 0.1;
+            double z = ((i % 97) == 0) ? 0.5 : 0.0;
+            path.push_back({x, y, z, 0.0, 10.0});
+            soa.x.push_back(x);
+            soa.y.push_back(y);
+            soa.z.push_back(z);
+        }
+        return std::make_pair(path, soa);
+    };
+
+    SECTION("short paths")
+    {
+        for (std::size_t n : {0, 1, 2, 3, 10, 1000}) {
+            auto p = make_path(n);
+            REQUIRE(douglas_peucker_mask(p.second, 0.0125) == optimize_generic_path_dp(0.0125, p.first));
+        }
+    }
+    SECTION("long path gives the same mask on one and on many threads")
+    {
+        auto p = make_path(300000);
+        auto expected = optimize_generic_path_dp(0.0125, p.first);
+        REQUIRE(douglas_peucker_mask(p.second, 0.0125, 1) == expected);
+        REQUIRE(douglas_peucker_mask(p.second, 0.0125, 4) == expected);
+        REQUIRE(douglas_peucker_mask(p.second, 0.5, 3) == optimize_generic_path_dp(0.5, p.first));
+    }
+    SECTION("many groups give the same program on one and on many threads")
+    {
+        program_t input;
+        for (int g = 0; g < 40; g++) {
+            input.push_back({{'M', 17}});
+            for (int i = 0; i < 400; i++)
+                input.push_back({{'G', (double)(g % 2)}, {'X', (double)(i % 7) * 0.001 + i}, {'Y', (double)g}, {'F', (i < 200) ? 10.0 : 20.0}});
+        }
+        auto expected = optimize_path_douglas_peucker(input, 0.0125, {{'X', 0}, {'Y', 0}, {'Z', 0}, {'F', 0.1}}, 1);
+        REQUIRE(expected.size() < input.size());
+        REQUIRE(optimize_path_douglas_peucker(input, 0.0125, {{'X', 0}, {'Y', 0}, {'Z', 0}, {'F', 0.1}}, 4) == expected);
+    }
+}
@@ -0,0 +1,113 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <gcd/gcode_interpreter.hpp>
+
+#include <cmath>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::gcd;
+
+namespace {
+double point_segment_distance(const distance_t& p, const distance_t& a, const distance_t& b)
+{
+    auto ab = b - a;
+    double l2 = ab.length2();
+    double t = (l2 > 0) ? std::max(0.0, std::min(1.0, ((p - a) * ab).sumv() / l2)) : 0.0;
+    return (a + ab * t - p).length();
+}
+} // namespace
+
+TEST_CASE("gcode_interpreter_test - optimize_path_visvalingam_whyatt", "[gcd][gcode_interpreter][optimize_path_visvalingam_whyatt]")
+{
+    SECTION("empty gives empty")
+    {
+        REQUIRE(optimize_path_visvalingam_whyatt({}, 0.0125).size() == 0);
+    }
+    SECTION("only m-codes gives the same result")
+    {
+        program_t input = {{{'M', 3}}, {{'M', 17}}};
+        REQUIRE(optimize_path_visvalingam_whyatt(input, 0.0125) == input);
+    }
+    SECTION("points on the line are removed")
+    {
+        program_t input;
+        for (int i = 1; i <= 100; i++)
+            input.push_back({{'G', 1}, {'X', i * 0.5}, {'Y', i * 0.25}, {'F', 10}});
+        program_t expected = {{{'G', 1}, {'X', 50}, {'Y', 25}, {'F', 10}}};
+        REQUIRE(optimize_path_visvalingam_whyatt(input, 0.0125, {{'X', 0}, {'Y', 0}, {'Z', 0}, {'F', 10}}) == expected);
+    }
+    SECTION("changes of the feedrate and other commands are kept")
+    {
+        program_t input = {
+            {{'G', 1}, {'X', 1}, {'F', 10}},
+            {{'G', 1}, {'X', 2}, {'F', 10}},
+            {{'G', 1}, {'X', 3}, {'F', 20}},
+            {{'G', 1}, {'X', 4}, {'F', 20}},
+            {{'G', 1}, {'X', 5}, {'F', 20}},
+            {{'M', 5}},
+            {{'G', 1}, {'X', 6}, {'F', 20}},
+            {{'G', 1}, {'X', 7}, {'F', 20}}};
+        auto result = optimize_path_visvalingam_whyatt(input, 0.0125, {{'X', 0}, {'Y', 0}, {'Z', 0}, {'F', 10}});
+        REQUIRE(result == optimize_path_douglas_peucker(input, 0.0125, {{'X', 0}, {'Y', 0}, {'Z', 0}, {'F', 10}}));
+        REQUIRE(result.size() < input.size());
+        REQUIRE(std::count(result.begin(), result.end(), block_t{{'M', 5}}) == 1);
+    }
+    SECTION("no point is further than epsilon from the simplified path")
+    {
+        for (double epsilon : {0.01, 0.1, 1.0}) {
+            path_coordinates_t path;
+            unsigned int seed = 3;
+            for (int i = 0; i < 20000; i++) {
+                seed = seed * 1103515245 + 12345;
+                double r = 10 + i * 0.002 + ((seed >> 8) % 1000) * 0.00004;
+                path.x.push_back(r * std::cos(i * 0.01));
+                path.y.push_back(r * std::sin(i * 0.01));
+                path.z.push_back((i % 1000) * 0.0001);
+            }
+            std::vector<char> fixed(path.size(), 0);
+            fixed[5000] = 1;
+            auto mask = visvalingam_whyatt_mask(path, epsilon, fixed);
+            REQUIRE(mask.front() == 0);
+            REQUIRE(mask.back() == 0);
+            REQUIRE(mask[5000] == 0);
+            auto point = [&](std::size_t i) { return distance_t{path.x[i], path.y[i], path.z[i], 0}; };
+            std::size_t kept = 0, previous = 0;
+            double max_distance = 0;
+            for (std::size_t i = 1; i < path.size(); i++) {
+                if (mask[i]) continue;
+                kept++;
+                for (std::size_t j = previous + 1; j < i; j++)
+                    max_distance = std::max(max_distance, point_segment_distance(point(j), point(previous), point(i)));
+                previous = i;
+            }
+            REQUIRE(max_distance <= epsilon);
+            // the result is similar to the Douglas-Peucker one
+            auto dp_mask = douglas_peucker_mask(path, epsilon);
+            REQUIRE(kept < 1.1 * std::count(dp_mask.begin() + 1, dp_mask.end(), 0));
+        }
+    }
+}
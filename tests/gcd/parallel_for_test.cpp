@@ -0,0 +1,69 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <configuration.hpp>
+#include <gcd/gcode_interpreter.hpp>
+#include <gcd/parallel_for.hpp>
+#include <gcd/preprocess_program.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::gcd;
+
+TEST_CASE("parallel_for", "[gcd][parallel_for]")
+{
+    SECTION("every index is visited once")
+    {
+        std::vector<std::atomic<int>> visited(1000);
+        parallel_for(visited.size(), 4, [&](std::size_t i) { visited[i]++; });
+        for (auto& v : visited)
+            REQUIRE(v == 1);
+    }
+    SECTION("the exception from the worker thread is rethrown on the calling thread")
+    {
+        for (int threads : {1, 2, 4, 8}) {
+            std::atomic<std::size_t> calls(0);
+            REQUIRE_THROWS_AS(parallel_for(1000, threads, [&](std::size_t i) {
+                calls++;
+                if (i == 10) throw std::invalid_argument("index 10");
+            }),
+                std::invalid_argument);
+            // the threads stop taking new indexes after the exception
+            REQUIRE(calls < 1000);
+        }
+    }
+    SECTION("the invalid program gives an exception when planned on many threads")
+    {
+        configuration::global cfg;
+        cfg.load_defaults();
+        cfg.planning_threads = 4;
+        program_t program = gcode_to_maps_of_arguments("G0X5F0\nM17\nG0X10\nM17\nG1X20F5\nM17\nG0X0\n");
+        REQUIRE_THROWS_AS(preprocess_program(program, cfg, {{'F', 0.5}}), std::invalid_argument);
+    }
+}
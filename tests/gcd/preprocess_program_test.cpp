@@ -0,0 +1,178 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <configuration.hpp>
+#include <gcd/gcode_interpreter.hpp>
+#include <gcd/preprocess_program.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::gcd;
+
+TEST_CASE("preprocess_program", "[gcd][preprocess_program]")
+{
+    configuration::global cfg;
+    cfg.load_defaults();
+    block_t initial_state = {{'F', 0.5}};
+
+    program_t program = {{{'G', 1}, {'X', 1}}, {{'M', 17}}, {{'G', 0}, {'Z', 5}}};
+    unsigned int seed = 11;
+    for (int row = 0; row < 20; row++) {
+        program.push_back({{'G', 0}, {'X', 0}, {'Y', row * 2.0}});
+        program.push_back({{'M', 3}});
+        for (int i = 1; i < 200; i++) {
+            seed = seed * 1103515245 + 12345;
+            block_t b = {{'G', 1}, {'X', i * 0.25}, {'Y', row * 2.0 + ((seed >> 8) % 100) * 0.0002}};
+            if (i == 1) b['F'] = 10;
+            if (i == 150) b['F'] = 20;
+            program.push_back(b);
+        }
+        program.push_back({{'G', 1}, {'X', 49.75}, {'Y', row * 2.0}});
+        program.push_back({{'G', 2}, {'X', 49.75}, {'Y', row * 2.0 + 1}, {'I', 0}, {'J', 0.5}});
+        program.push_back({{'G', 4}, {'P', 0.1}});
+        program.push_back({{'M', 5}});
+    }
+    program.push_back({{'G', 92}, {'X', 0}, {'Y', 0}});
+    program.push_back({{'G', 0}, {'X', 10}, {'Y', 10}});
+    program.push_back({{'M', 18}});
+
+    // the result of the separate passes, as they were executed before
+    auto separate_passes = [&](const program_t& program_) {
+        auto p = enrich_gcode_with_feedrate_commands(program_, cfg);
+        p = (cfg.path_simplifier == configuration::VISVALINGAM_WHYATT) ?
+            optimize_path_visvalingam_whyatt(p, cfg.douglas_peucker_marigin, initial_state) :
+            optimize_path_douglas_peucker(p, cfg.douglas_peucker_marigin, initial_state);
+        auto parts = group_gcode_commands(p);
+        block_t machine_state = initial_state;
+        parts = insert_additional_nodes_inbetween(parts, machine_state, cfg);
+        machine_state['F'] = *std::min_element(cfg.max_no_accel_velocity_mm_s.begin(), cfg.max_no_accel_velocity_mm_s.end());
+        return preprocess_program_parts(parts, cfg, machine_state);
+    };
+
+    SECTION("the result is the same as from separate passes")
+    {
+        auto expected = separate_passes(program);
+        REQUIRE(expected.size() > 10);
+        REQUIRE(preprocess_program(program, cfg, initial_state) == expected);
+    }
+    SECTION("the result is the same for other planners and simplifiers")
+    {
+        cfg.time_optimal_planning = true;
+        cfg.cross_group_blending = true;
+        cfg.path_simplifier = configuration::VISVALINGAM_WHYATT;
+        REQUIRE(preprocess_program(program, cfg, initial_state) == separate_passes(program));
+    }
+    SECTION("the result does not depend on the number of planning threads")
+    {
+        cfg.planning_threads = 1;
+        auto expected = preprocess_program(program, cfg, initial_state);
+        cfg.planning_threads = 4;
+        REQUIRE(preprocess_program(program, cfg, initial_state) == expected);
+        auto parts = group_gcode_commands(enrich_gcode_with_feedrate_commands(program, cfg));
+        REQUIRE(insert_additional_nodes_inbetween(parts, initial_state, cfg, 4) == insert_additional_nodes_inbetween(parts, initial_state, cfg, 1));
+    }
+    SECTION("raw gcode is only enriched and grouped")
+    {
+        REQUIRE(preprocess_program(program, cfg, initial_state, true) == group_gcode_commands(enrich_gcode_with_feedrate_commands(program, cfg)));
+    }
+    SECTION("passes that work in place give the same results as the copying ones")
+    {
+        auto enriched = enrich_gcode_with_feedrate_commands(program, cfg);
+        REQUIRE(enrich_gcode_with_feedrate_commands(program_t(program), cfg) == enriched);
+        REQUIRE(optimize_path_douglas_peucker(program_t(program), 0.01) == optimize_path_douglas_peucker(program, 0.01));
+        REQUIRE(optimize_path_visvalingam_whyatt(program_t(program), 0.01) == optimize_path_visvalingam_whyatt(program, 0.01));
+        REQUIRE(group_gcode_commands(program_t(program)) == group_gcode_commands(program));
+        REQUIRE(remove_duplicate_blocks(program_t(enriched), {}) == remove_duplicate_blocks(enriched, {}));
+        auto parts = group_gcode_commands(enriched);
+        auto expected = insert_additional_nodes_inbetween(parts, initial_state, cfg);
+        REQUIRE(insert_additional_nodes_inbetween_consume(std::move(parts), initial_state, cfg) == expected);
+    }
+}
+
+TEST_CASE("preprocess_program brakes before the arc", "[gcd][preprocess_program][arcs]")
+{
+    configuration::global cfg;
+    cfg.load_defaults();
+    block_t initial_state = {{'X', 0}, {'Y', 0}, {'Z', 0}, {'F', 0.5}};
+    const double max_acceleration = cfg.max_accelerations_mm_s2[0];
+    // the arc with the radius 0.5 allows sqrt(200*0.5) = 10mm/s
+    const double arc_velocity = std::sqrt(max_acceleration * 0.5);
+
+    // the program with the fast G1 of the given length followed by the small arc
+    auto fast_g1_and_arc = [](double length) -> program_t {
+        return {{{'G', 1}, {'X', length}, {'Y', 0}, {'F', 50}},
+            {{'G', 2}, {'X', length + 1}, {'Y', 0}, {'I', 0.5}, {'J', 0}}};
+    };
+    // the states after every block of the preprocessed program
+    auto states_of = [&](const partitioned_program_t& parts) {
+        std::vector<block_t> states = {initial_state};
+        for (const auto& part : parts)
+            for (const auto& block : part)
+                states.push_back(merge_blocks(states.back(), block));
+        return states;
+    };
+    // the largest deceleration on the straight moves
+    auto max_deceleration = [&](const std::vector<block_t>& states) {
+        double ret = 0;
+        for (std::size_t i = 1; i < states.size(); i++) {
+            double l = blocks_to_vector_move(states[i - 1], states[i]).length();
+            if (states[i].count('G') && (states[i].at('G') == 1) && (l > 0)) {
+                double v0 = states[i - 1].at('F'), v1 = states[i].at('F');
+                ret = std::max(ret, (v0 * v0 - v1 * v1) / (2.0 * l));
+            }
+        }
+        return ret;
+    };
+    // the state just before the arc
+    auto before_arc = [](const std::vector<block_t>& states) {
+        auto arc = std::find_if(states.begin(), states.end(), [](const block_t& b) { return b.count('G') && (b.at('G') == 2); });
+        REQUIRE(arc != states.begin());
+        REQUIRE(arc != states.end());
+        return *(arc - 1);
+    };
+
+    SECTION("the braking node is inserted where the braking must start")
+    {
+        auto states = states_of(preprocess_program(fast_g1_and_arc(30), cfg, initial_state));
+        REQUIRE(before_arc(states).at('F') == Approx(arc_velocity));
+        const double braking_distance = (50.0 * 50.0 - arc_velocity * arc_velocity) / (2.0 * max_acceleration);
+        auto braking_node = std::find_if(states.begin(), states.end(), [&](const block_t& b) {
+            return (b.at('F') == Approx(50)) && (b.at('X') == Approx(30 - braking_distance));
+        });
+        REQUIRE(braking_node != states.end());
+        REQUIRE(max_deceleration(states) <= Approx(max_acceleration));
+    }
+    SECTION("the short fast move is braked within the acceleration limit")
+    {
+        for (double length : {2.0, 3.0, 5.0, 8.0}) {
+            auto states = states_of(preprocess_program(fast_g1_and_arc(length), cfg, initial_state));
+            REQUIRE(before_arc(states).at('F') == Approx(arc_velocity));
+            REQUIRE(max_deceleration(states) <= Approx(max_acceleration));
+        }
+    }
+}
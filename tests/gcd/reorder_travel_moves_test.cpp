@@ -0,0 +1,182 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <gcd/gcode_interpreter.hpp>
+#include <gcd/reorder_travel_moves.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::gcd;
+
+namespace {
+using segment_t = std::array<double, 6>;
+
+/// G0 length and the cut segments (as not directed segments) of the program
+std::pair<double, std::vector<segment_t>> travel_and_cuts(const program_t& program)
+{
+    double travel = 0;
+    std::vector<segment_t> cuts;
+    block_t p = {{'X', 0}, {'Y', 0}, {'Z', 0}};
+    for (const auto& b : program) {
+        auto n = merge_blocks(p, b);
+        double l = std::sqrt((n['X'] - p['X']) * (n['X'] - p['X']) + (n['Y'] - p['Y']) * (n['Y'] - p['Y']) + (n['Z'] - p['Z']) * (n['Z'] - p['Z']));
+        if (b.count('G') && (b.at('G') == 0)) travel += l;
+        if (b.count('G') && (b.at('G') == 1) && (l > 0)) {
+            segment_t s = {p['X'], p['Y'], p['Z'], n['X'], n['Y'], n['Z']};
+            segment_t r = {n['X'], n['Y'], n['Z'], p['X'], p['Y'], p['Z']};
+            cuts.push_back(std::min(s, r));
+        }
+        p = n;
+    }
+    std::sort(cuts.begin(), cuts.end());
+    return {travel, cuts};
+}
+} // namespace
+
+TEST_CASE("reorder_travel_moves", "[gcd][reorder_travel_moves]")
+{
+    SECTION("laser squares are reordered and the travel is shorter")
+    {
+        program_t program;
+        // squares on the line visited in the order 0, 4, 1, 3, 2
+        for (int i : {0, 4, 1, 3, 2}) {
+            double x = i * 20;
+            program.push_back({{'G', 0}, {'X', x}, {'Y', 0}, {'F', 100}});
+            program.push_back({{'M', 3}});
+            program.push_back({{'G', 1}, {'X', x + 5}, {'F', 10}});
+            program.push_back({{'G', 1}, {'Y', 5}, {'F', 10}});
+            program.push_back({{'G', 1}, {'X', x}, {'F', 10}});
+            program.push_back({{'G', 1}, {'Y', 0}, {'F', 10}});
+            program.push_back({{'M', 5}});
+        }
+        program.push_back({{'G', 0}, {'X', 0}, {'Y', 0}, {'F', 100}});
+
+        travel_statistics_t stats;
+        auto result = reorder_travel_moves(program, {}, stats);
+        auto before = travel_and_cuts(program);
+        auto after = travel_and_cuts(result);
+
+        REQUIRE(stats.travel_before_mm == Approx(before.first));
+        REQUIRE(stats.travel_after_mm == Approx(after.first));
+        REQUIRE(after.first < before.first);
+        REQUIRE(after.first == Approx(2 * 80).margin(0.001));
+        REQUIRE(stats.cuts == 5);
+        REQUIRE(after.second == before.second);
+
+        // every cut is still between M3 and M5
+        bool on = false;
+        int m3 = 0;
+        for (const auto& b : result) {
+            if (b.count('M')) {
+                REQUIRE(on == (b.at('M') == 5));
+                on = (b.at('M') == 3);
+                m3 += on;
+            }
+            if (b.count('G') && (b.at('G') == 0)) REQUIRE_FALSE(on);
+            if (b.count('G') && (b.at('G') == 1)) REQUIRE(on);
+        }
+        REQUIRE(m3 == 5);
+        auto end_state = last_state_after_program_execution(result, {});
+        REQUIRE(end_state['X'] == 0);
+        REQUIRE(end_state['Y'] == 0);
+    }
+
+    SECTION("the cut that goes down is not reversed and the travel is on the safe height")
+    {
+        program_t program;
+        for (int i : {3, 0, 2, 1}) {
+            double x = i * 10;
+            program.push_back({{'G', 0}, {'Z', 5}, {'F', 100}});
+            program.push_back({{'G', 0}, {'X', x}, {'Y', 0}, {'F', 100}});
+            program.push_back({{'G', 0}, {'Z', 0}, {'F', 100}});
+            program.push_back({{'G', 1}, {'Z', -1}, {'F', 5}});
+            program.push_back({{'G', 1}, {'X', x + 3}, {'F', 5}});
+        }
+        program.push_back({{'G', 0}, {'Z', 5}, {'F', 100}});
+
+        travel_statistics_t stats;
+        auto result = reorder_travel_moves(program, {}, stats);
+        REQUIRE(stats.travel_after_mm < stats.travel_before_mm);
+        REQUIRE(travel_and_cuts(result).second == travel_and_cuts(program).second);
+
+        block_t p = {{'X', 0}, {'Y', 0}, {'Z', 0}};
+        for (const auto& b : result) {
+            auto n = merge_blocks(p, b);
+            if (b.count('G') && (b.at('G') == 0) && ((n['X'] != p['X']) || (n['Y'] != p['Y']))) {
+                REQUIRE(p['Z'] == 5);
+                REQUIRE(n['Z'] == 5);
+            }
+            // the plunge is always the first move of the cut
+            if (b.count('G') && (b.at('G') == 1) && (n['X'] != p['X'])) REQUIRE(p['Z'] == -1);
+            p = n;
+        }
+        REQUIRE(p['Z'] == 5);
+    }
+
+    SECTION("cuts are not moved over other commands")
+    {
+        program_t program = {
+            {{'G', 0}, {'X', 30}, {'F', 100}},
+            {{'G', 1}, {'X', 31}, {'F', 10}},
+            {{'G', 0}, {'X', 0}, {'F', 100}},
+            {{'G', 1}, {'X', 1}, {'F', 10}},
+            {{'M', 18}},
+            {{'G', 0}, {'X', 20}, {'F', 100}},
+            {{'G', 1}, {'X', 21}, {'F', 10}},
+            {{'G', 0}, {'X', 10}, {'F', 100}},
+            {{'G', 1}, {'X', 11}, {'F', 10}},
+            {{'G', 0}, {'X', 0}, {'F', 100}}};
+        auto result = reorder_travel_moves(program);
+        auto m18 = std::find(result.begin(), result.end(), block_t{{'M', 18}});
+        REQUIRE(m18 != result.end());
+        auto before_m18 = last_state_after_program_execution(program_t(result.begin(), m18), {});
+        // the last cut before M18 stays the last one
+        REQUIRE(before_m18['X'] == 1);
+        REQUIRE(travel_and_cuts(result).second == travel_and_cuts(program).second);
+        REQUIRE(travel_and_cuts(result).first < travel_and_cuts(program).first);
+    }
+
+    SECTION("the cut that changes the spindle state keeps the program unchanged")
+    {
+        program_t program = {
+            {{'G', 0}, {'X', 30}, {'F', 100}},
+            {{'M', 3}},
+            {{'G', 1}, {'X', 31}, {'F', 10}},
+            {{'G', 0}, {'X', 0}, {'F', 100}},
+            {{'G', 1}, {'X', 1}, {'F', 10}},
+            {{'M', 5}},
+            {{'G', 0}, {'X', 20}, {'F', 100}},
+            {{'G', 1}, {'X', 21}, {'F', 10}},
+            {{'G', 0}, {'X', 0}, {'F', 100}}};
+        travel_statistics_t stats;
+        auto result = reorder_travel_moves(program, {}, stats);
+        REQUIRE(result == program);
+        REQUIRE(stats.travel_after_mm == stats.travel_before_mm);
+    }
+}
@@ -0,0 +1,120 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+// #define CATCH_CONFIG_DISABLE_MATCHERS
+// #define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <hardware/driver/button_events_fake.hpp>
+#include <hardware/driver/low_buttons_gpio_events.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::hardware;
+using namespace raspigcd::hardware::driver;
+
+TEST_CASE("Hardware low_buttons_gpio_events", "[hardware][low_buttons_gpio_events]")
+{
+    using namespace std::chrono_literals;
+    auto source = std::make_shared<button_events_fake>(4);
+    low_buttons_gpio_events buttons(source, 5ms);
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<std::pair<int, int>> received;
+    for (int i = 0; i < 4; i++) {
+        buttons.on_key(i, [&](int k, int v) {
+            std::lock_guard<std::mutex> lock(m);
+            received.push_back({k, v});
+            cv.notify_all();
+        });
+    }
+    auto wait_for_received = [&](unsigned n) {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait_for(lock, 1s, [&]() { return received.size() >= n; });
+        return received;
+    };
+
+    SECTION("the handler is called on the edge")
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        source->push_event(ENDSTOP_Y, 1, t0);
+        auto r = wait_for_received(1);
+        REQUIRE(r.size() == 1);
+        REQUIRE(r[0] == std::pair<int, int>(ENDSTOP_Y, 1));
+        REQUIRE(buttons.keys_state() == std::vector<int>{0, 1, 0, 0});
+        REQUIRE(buttons.last_event(ENDSTOP_Y).timestamp == t0);
+    }
+
+    SECTION("handlers can be read and replaced also for not configured buttons")
+    {
+        low_buttons_handlers_guard guard(std::shared_ptr<low_buttons>(&buttons, [](auto) {}));
+        buttons.on_key(TERMINATE, [](int, int) {});
+        REQUIRE_THROWS(buttons.on_key(1000, [](int, int) {}));
+    }
+
+    SECTION("bouncing press is reported once")
+    {
+        source->push_event(ENDSTOP_X, 1);
+        source->push_event(ENDSTOP_X, 0);
+        source->push_event(ENDSTOP_X, 1);
+        source->push_event(ENDSTOP_X, 0);
+        source->push_event(ENDSTOP_X, 1);
+        std::this_thread::sleep_for(20ms);
+        auto r = wait_for_received(1);
+        REQUIRE(r.size() == 1);
+        REQUIRE(r[0] == std::pair<int, int>(ENDSTOP_X, 1));
+        REQUIRE(buttons.keys_state()[ENDSTOP_X] == 1);
+    }
+
+    SECTION("release during the debounce time is detected after the lockout")
+    {
+        source->push_event(ENDSTOP_X, 1);
+        source->push_event(ENDSTOP_X, 0);
+        source->push_event(ENDSTOP_X, 1);
+        source->push_event(ENDSTOP_X, 0);
+        auto t0 = std::chrono::steady_clock::now();
+        auto r = wait_for_received(2);
+        REQUIRE(r.size() == 2);
+        REQUIRE(r[0] == std::pair<int, int>(ENDSTOP_X, 1));
+        REQUIRE(r[1] == std::pair<int, int>(ENDSTOP_X, 0));
+        REQUIRE(buttons.last_event(ENDSTOP_X).timestamp >= t0);
+        REQUIRE(buttons.keys_state()[ENDSTOP_X] == 0);
+    }
+
+    SECTION("the latency of events is measured")
+    {
+        source->push_event(ENDSTOP_X, 1);
+        source->push_event(ENDSTOP_Z, 1);
+        wait_for_received(2);
+        auto stats = buttons.latency_statistics();
+        REQUIRE(stats.events == 2);
+        REQUIRE(stats.max_us >= stats.mean_us);
+        REQUIRE(stats.mean_us >= 0.0);
+        // much less than the polling driver with the 100 iterations anti bounce
+        REQUIRE(stats.max_us < 20000.0);
+    }
+}
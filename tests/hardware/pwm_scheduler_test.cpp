@@ -0,0 +1,151 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+// #define CATCH_CONFIG_DISABLE_MATCHERS
+// #define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <configuration.hpp>
+#include <hardware/driver/raspberry_pi.hpp>
+#include <hardware/pwm_scheduler.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace raspigcd;
+using namespace raspigcd::hardware;
+
+namespace {
+struct edge_record_t {
+    std::chrono::steady_clock::time_point t;
+    int channel;
+    bool high;
+};
+} // namespace
+
+TEST_CASE("Hardware pwm_scheduler", "[hardware][pwm_scheduler]")
+{
+    std::mutex m;
+    std::vector<edge_record_t> edges;
+    auto set_output = [&](int channel, bool high) {
+        std::lock_guard<std::mutex> lock(m);
+        edges.push_back({std::chrono::steady_clock::now(), channel, high});
+    };
+    // returns the fraction of time when the channel was high
+    auto high_ratio = [&](int channel) {
+        std::lock_guard<std::mutex> lock(m);
+        std::chrono::duration<double> high_time(0), total_time(0);
+        edge_record_t prev = {{}, -1, false};
+        for (auto& e : edges) {
+            if (e.channel != channel) continue;
+            if (prev.channel >= 0) {
+                total_time += e.t - prev.t;
+                if (prev.high) high_time += e.t - prev.t;
+            }
+            prev = e;
+        }
+        return high_time.count() / total_time.count();
+    };
+
+    SECTION("invalid cycle time is rejected")
+    {
+        REQUIRE_THROWS_AS(pwm_scheduler({0.01, 0.0}, set_output), std::invalid_argument);
+    }
+
+    SECTION("duty is limited to the cycle time and the channel must exist")
+    {
+        pwm_scheduler pwm({0.01}, set_output);
+        pwm.set_duty(0, 0.5);
+        REQUIRE(pwm.get_duty(0) == Approx(0.01));
+        pwm.set_duty(0, -1.0);
+        REQUIRE(pwm.get_duty(0) == Approx(0.0));
+        REQUIRE_THROWS_AS(pwm.set_duty(1, 0.001), std::invalid_argument);
+        REQUIRE_THROWS_AS(pwm.get_duty(-1), std::invalid_argument);
+    }
+
+    SECTION("zero duty never sets the output")
+    {
+        {
+            pwm_scheduler pwm({0.002, 0.003}, set_output);
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        }
+        for (auto& e : edges)
+            REQUIRE(e.high == false);
+    }
+
+    SECTION("two channels are served by one thread with their own duty")
+    {
+        {
+            pwm_scheduler pwm({0.004, 0.006}, set_output);
+            pwm.set_duty(0, 0.001);
+            pwm.set_duty(1, 0.0045);
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        }
+        REQUIRE(high_ratio(0) == Approx(0.25).margin(0.1));
+        REQUIRE(high_ratio(1) == Approx(0.75).margin(0.1));
+        int rising_edges = 0;
+        for (auto& e : edges)
+            if ((e.channel == 0) && e.high) rising_edges++;
+        // the period does not drift, so the number of cycles is close to the expected
+        REQUIRE(rising_edges == Approx(300 / 4).margin(8));
+        // the outputs are low after the scheduler is destroyed
+        REQUIRE(edges.back().high == false);
+    }
+}
+
+TEST_CASE("Hardware spindle_pwm_duty", "[hardware][pwm_scheduler][spindle_pwm_duty]")
+{
+    // the ESC spindle, like in v1.json
+    configuration::spindle_pwm esc = {.pin = 18,
+        .cycle_time_seconds = 0.02,
+        .duty_min = 0.001,
+        .duty_max = 0.002,
+        .pin_negate = false,
+        .mode = configuration::spindle_modes::SPINDLE};
+
+    SECTION("the power is mapped between duty_min and duty_max")
+    {
+        REQUIRE(driver::spindle_pwm_duty(esc, 0.0) == Approx(0.001));
+        REQUIRE(driver::spindle_pwm_duty(esc, 0.5) == Approx(0.0015));
+        REQUIRE(driver::spindle_pwm_duty(esc, 1.05) == Approx(0.002));
+        REQUIRE_THROWS_AS(driver::spindle_pwm_duty(esc, -0.1), std::invalid_argument);
+        REQUIRE_THROWS_AS(driver::spindle_pwm_duty(esc, 1.2), std::invalid_argument);
+    }
+
+    SECTION("the stopped spindle starts with the duty_min pulse")
+    {
+        std::mutex m;
+        int rising_edges = 0;
+        {
+            // the same initialization as in the raspberry_pi_3 constructor
+            pwm_scheduler pwm({esc.cycle_time_seconds}, [&](int, bool high) {
+                std::lock_guard<std::mutex> lock(m);
+                if (high) rising_edges++;
+            });
+            pwm.set_duty(0, driver::spindle_pwm_duty(esc, 0.0));
+            REQUIRE(pwm.get_duty(0) == Approx(esc.duty_min));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        REQUIRE(rising_edges > 0);
+    }
+}
@@ -21,6 +21,7 @@
 #include <configuration.hpp>
 #include <configuration_json.hpp>
 #include <hardware/driver/inmem.hpp>
+#include <hardware/driver/low_spindles_pwm_fake.hpp>
 #include <hardware/driver/low_timers_fake.hpp>
 #include <hardware/stepping.hpp>
 
@@ -57,10 +58,130 @@ TEST_CASE("Hardware stepping_simple_timer", "[hardware_stepping][stepping_simple
         int n = 0;
         ((driver::inmem*)lsfake.get())->current_steps = {0, 0, 0, 0};
         ((driver::inmem*)lsfake.get())->set_step_callback([&](const auto&) { n++; });
-        single_step_command sc = {0,0};
+        single_step_command sc = {1,0};
         worker.exec({{.b = {sc, sc, sc, sc}, .flags = {.all=0} ,.count = 1}});
         REQUIRE(n == 1);
     }
+    SECTION("Command without steps is one wait that does not touch the steppers")
+    {
+        int n = 0;
+        std::vector<double> delays;
+        std::shared_ptr<low_timers> ltdelays = std::make_shared<driver::low_timers_fake>([&](const double d) { delays.push_back(d); });
+        stepping_simple_timer dwell_worker(60, lsfake, ltdelays);
+        ((driver::inmem*)lsfake.get())->current_steps = {0, 0, 0, 0};
+        ((driver::inmem*)lsfake.get())->set_step_callback([&](const auto&) { n++; });
+        single_step_command sc = {0, 1};
+        dwell_worker.exec({{.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 100}});
+        REQUIRE(n == 0);
+        REQUIRE(dwell_worker.get_tick_index() == 100);
+        REQUIRE(delays == std::vector<double>{6000});
+    }
+    SECTION("Long dwell is interrupted by the termination")
+    {
+        int n = 0;
+        std::vector<double> delays;
+        stepping_simple_timer* dwell_worker_p = nullptr;
+        std::shared_ptr<low_timers> ltdelays = std::make_shared<driver::low_timers_fake>([&](const double d) {
+            delays.push_back(d);
+            dwell_worker_p->terminate();
+        });
+        stepping_simple_timer dwell_worker(60, lsfake, ltdelays);
+        dwell_worker_p = &dwell_worker;
+        ((driver::inmem*)lsfake.get())->set_step_callback([&](const auto&) { n++; });
+        single_step_command sc = {0, 0};
+        // one minute of waiting
+        REQUIRE_THROWS_AS(dwell_worker.exec({{.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 1000000}}), hardware::execution_terminated);
+        REQUIRE(n == 0);
+        REQUIRE(delays.size() == 1);
+        REQUIRE(delays[0] <= idle_wait_slice_ns / 1000);
+        REQUIRE(dwell_worker.get_tick_index() == (int)(idle_wait_slice_ns / 60000));
+    }
+    SECTION("Timed command waits its own delay instead of the tick")
+    {
+        std::vector<double> delays;
+        std::shared_ptr<low_timers> ltdelays = std::make_shared<driver::low_timers_fake>([&](const double d) { delays.push_back(d); });
+        stepping_simple_timer timed_worker(60, lsfake, ltdelays);
+        single_step_command sc = {1, 1};
+        multistep_commands_t commands = {
+            {.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 2, .delay_ns = 2500},
+            {.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 1}};
+        timed_worker.exec(commands);
+        // the fake timer gets microseconds
+        REQUIRE(delays == std::vector<double>{2.5, 2.5, 60});
+        REQUIRE(hardware_commands_duration(commands, 0.00006) == Approx(0.000065));
+    }
+
+    SECTION("Feed override divides the tick period")
+    {
+        std::vector<double> delays;
+        std::shared_ptr<low_timers> ltdelays = std::make_shared<driver::low_timers_fake>([&](const double d) { delays.push_back(d); });
+        stepping_simple_timer feed_worker(60, lsfake, ltdelays);
+        feed_worker.set_feed_override_rate(1000000.0);
+        feed_worker.set_feed_override(2.0);
+        single_step_command sc = {1, 1};
+        feed_worker.exec({{.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 200}});
+        // the override is applied after the first batch of ticks
+        REQUIRE(delays.size() == 200);
+        REQUIRE(delays.front() == 60);
+        REQUIRE(delays.back() == 30);
+        REQUIRE(feed_worker.get_current_feed_override() == 2.0);
+    }
+
+    SECTION("Feed override changes not faster than the feed override rate")
+    {
+        std::vector<double> delays;
+        std::shared_ptr<low_timers> ltdelays = std::make_shared<driver::low_timers_fake>([&](const double d) { delays.push_back(d); });
+        stepping_simple_timer feed_worker(60, lsfake, ltdelays);
+        feed_worker.set_feed_override_rate(20.0);
+        feed_worker.set_feed_override(0.5);
+        single_step_command sc = {1, 1};
+        feed_worker.exec({{.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 2000}});
+        double elapsed_s = 0.0;
+        for (unsigned i = 1; i < delays.size(); i++) {
+            elapsed_s += delays[i - 1] * 0.000001;
+            REQUIRE(delays[i] >= delays[i - 1]);
+            // the factor on the tick i is at least the initial factor minus rate times the elapsed time
+            REQUIRE(60.0 / delays[i] >= 1.0 - 20.0 * elapsed_s - 0.0001); // the delays are rounded to nanoseconds
+        }
+        REQUIRE(delays.back() == 120);
+        REQUIRE(feed_worker.get_current_feed_override() == 0.5);
+        // the next exec continues with the current feed override
+        delays.clear();
+        feed_worker.exec({{.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 1}});
+        REQUIRE(delays == std::vector<double>{120});
+    }
+
+    SECTION("Feed override outside of the range is rejected")
+    {
+        REQUIRE_THROWS_AS(worker.set_feed_override(feed_override_min * 0.9), std::invalid_argument);
+        REQUIRE_THROWS_AS(worker.set_feed_override(feed_override_max * 1.1), std::invalid_argument);
+        REQUIRE_NOTHROW(worker.set_feed_override(feed_override_min));
+        REQUIRE_NOTHROW(worker.set_feed_override(feed_override_max));
+        REQUIRE(worker.get_feed_override() == feed_override_max);
+    }
+
+    SECTION("Pattern of commands is executed as many times as the header says")
+    {
+        std::vector<double> delays;
+        std::shared_ptr<low_timers> ltdelays = std::make_shared<driver::low_timers_fake>([&](const double d) { delays.push_back(d); });
+        stepping_simple_timer pattern_worker(60, lsfake, ltdelays);
+        ((driver::inmem*)lsfake.get())->current_steps = {0, 0, 0, 0};
+        single_step_command sc = {1, 1};
+        single_step_command zc = {0, 0};
+        multistep_command header = {.b = {zc, zc, zc, zc}, .flags = {.all = 0}, .count = 3};
+        header.flags.bits.p = 2;
+        multistep_commands_t commands = {
+            header,
+            {.b = {sc, zc, zc, zc}, .flags = {.all = 0}, .count = 1},
+            {.b = {zc, zc, zc, zc}, .flags = {.all = 0}, .count = 2, .delay_ns = 1000},
+            {.b = {zc, sc, zc, zc}, .flags = {.all = 0}, .count = 1}};
+        pattern_worker.exec(commands);
+        REQUIRE(pattern_worker.get_tick_index() == 3 * 3 + 1);
+        REQUIRE(((driver::inmem*)lsfake.get())->current_steps == steps_t{3, 1, 0, 0});
+        // the command without steps is one wait
+        REQUIRE(delays == std::vector<double>{60, 2, 60, 2, 60, 2, 60});
+    }
+
     SECTION("Run one step in each positive  direction")
     {
         for (int i = 0; i < 4; i++) {
@@ -336,3 +457,69 @@ TEST_CASE("Hardware stepping_simple_timer", "[hardware_stepping][stepping_simple
     }
 
 }
+
+TEST_CASE("Hardware stepping_simple_timer spindle synchronization", "[hardware_stepping][stepping_simple_timer]")
+{
+    std::shared_ptr<low_steppers> lsfake(new driver::inmem());
+    std::shared_ptr<low_timers> ltfake = std::make_shared<driver::low_timers_fake>();
+    stepping_simple_timer worker(60, lsfake, ltfake);
+
+    std::vector<std::pair<int, double>> spindle_switches; // tick index and power
+    auto spindles_fake = std::make_shared<driver::low_spindles_pwm_fake>([&](const int, const double v) {
+        spindle_switches.push_back({worker.get_tick_index(), v});
+    });
+    single_step_command sc = {1, 1};
+    multistep_commands_t commands = {
+        {.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 2},
+        {.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 3},
+        {.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 4},
+        {.b = {sc, sc, sc, sc}, .flags = {.all = 0}, .count = 1}};
+    commands[0].flags.bits.g = SPINDLE_SYNC_OFF;
+    commands[1].flags.bits.g = SPINDLE_SYNC_ON;
+    commands[2].flags.bits.g = SPINDLE_SYNC_ON;
+    commands[3].flags.bits.g = SPINDLE_SYNC_OFF;
+
+    SECTION("without spindles driver the synchronization flags are ignored")
+    {
+        worker.exec(commands);
+        REQUIRE(spindle_switches.size() == 0);
+        REQUIRE(worker.get_tick_index() == 10);
+    }
+
+    SECTION("spindle is switched exactly on the tick of the first command with the new state")
+    {
+        worker.set_low_level_spindles_pwm(spindles_fake);
+        worker.exec(commands);
+        std::vector<std::pair<int, double>> expected = {{0, 0.0}, {2, 1.0}, {9, 0.0}};
+        REQUIRE(spindle_switches == expected);
+    }
+
+    SECTION("commands without synchronization flag do not touch the spindle")
+    {
+        worker.set_low_level_spindles_pwm(spindles_fake);
+        for (auto& c : commands)
+            c.flags.bits.g = SPINDLE_SYNC_NONE;
+        commands[2].flags.bits.g = SPINDLE_SYNC_ON;
+        worker.exec(commands);
+        std::vector<std::pair<int, double>> expected = {{5, 1.0}};
+        REQUIRE(spindle_switches == expected);
+    }
+
+    SECTION("synchronized spindle state is restored after the break")
+    {
+        worker.set_low_level_spindles_pwm(spindles_fake);
+        // the tick index is published in batches, so the ticks are counted here
+        int tick = 0;
+        ((driver::inmem*)lsfake.get())->set_step_callback([&](const auto&) {
+            if (tick++ == 3) worker.terminate(1);
+        });
+        worker.exec(commands, [&](auto, auto) {
+            spindles_fake->spindle_pwm_power(0, 0.0);
+            return 1;
+        });
+        REQUIRE(spindle_switches.size() == 5);
+        REQUIRE(spindle_switches.at(2).second == 0.0);
+        REQUIRE(spindle_switches.at(3) == std::pair<int, double>(spindle_switches.at(2).first, 1.0));
+        REQUIRE(spindle_switches.at(4).second == 0.0);
+    }
+}
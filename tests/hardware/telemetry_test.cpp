@@ -0,0 +1,151 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+// #define CATCH_CONFIG_DISABLE_MATCHERS
+// #define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+#include <hardware/driver/inmem.hpp>
+#include <hardware/driver/low_timers_fake.hpp>
+#include <hardware/stepping.hpp>
+#include <hardware/telemetry.hpp>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace raspigcd;
+using namespace raspigcd::hardware;
+
+TEST_CASE("Hardware telemetry", "[hardware][telemetry]")
+{
+    const std::string shm_name = "/raspigcd_telemetry_test_" + std::to_string(getpid());
+
+    SECTION("reader fails when there is no telemetry block")
+    {
+        REQUIRE_THROWS_AS(telemetry_reader(shm_name), std::runtime_error);
+    }
+
+    SECTION("published values can be read")
+    {
+        auto writer = std::make_shared<telemetry_writer>(shm_name);
+        telemetry_reader reader(shm_name);
+        auto s0 = reader.read();
+        REQUIRE(s0.command_index == -1);
+        REQUIRE(s0.tick_index == 0);
+
+        writer->publish(123, {1, 2, 3, 4}, 7, {10.0, 20.0, 0.0, -5.0});
+        writer->publish_spindle(0, 0.5);
+        auto s = reader.read();
+        REQUIRE(s.tick_index == 123);
+        REQUIRE(s.steps == steps_t{1, 2, 3, 4});
+        REQUIRE(s.command_index == 7);
+        REQUIRE(s.velocity[0] == Approx(10.0));
+        REQUIRE(s.velocity[3] == Approx(-5.0));
+        REQUIRE(s.spindle_power[0] == Approx(0.5));
+        REQUIRE(s.sequence == s0.sequence + 4);
+        REQUIRE(s.timestamp_ns > 0);
+    }
+
+    SECTION("reader always gets consistent block")
+    {
+        telemetry_writer writer(shm_name);
+        telemetry_reader reader(shm_name);
+        std::atomic<bool> done(false);
+        std::thread t([&]() {
+            for (int i = 1; i <= 200000; i++)
+                writer.publish(i, {i, i, i, i}, i, {(double)i, (double)i, (double)i, (double)i});
+            done = true;
+        });
+        int inconsistent = 0;
+        while (!done) {
+            auto s = reader.read();
+            if (s.tick_index == 0) continue; // nothing published yet
+            if ((s.steps != steps_t{(int)s.tick_index, (int)s.tick_index, (int)s.tick_index, (int)s.tick_index}) ||
+                (s.command_index != s.tick_index) ||
+                (s.velocity[2] != (double)s.tick_index))
+                inconsistent++;
+        }
+        t.join();
+        REQUIRE(inconsistent == 0);
+        REQUIRE(reader.read().tick_index == 200000);
+    }
+
+    SECTION("the spindle power is not lost when it is written together with the position")
+    {
+        telemetry_writer writer(shm_name);
+        telemetry_reader reader(shm_name);
+        const int n = 20000;
+        std::thread spindle([&]() {
+            for (int i = 1; i <= n; i++)
+                writer.publish_spindle(0, (double)i / n);
+        });
+        // the executor does not wait for the spindle, it only repeats the skipped publication
+        int published = 0;
+        for (int i = 1; i <= n; i++)
+            if (writer.publish(i, {i, i, i, i}, i, {0.0, 0.0, 0.0, 0.0})) published++;
+        spindle.join();
+        while (!writer.publish(n + 1, {0, 0, 0, 0}, -1, {0.0, 0.0, 0.0, 0.0}))
+            std::this_thread::yield();
+        REQUIRE(published > 0);
+        auto s = reader.read();
+        REQUIRE(s.spindle_power[0] == Approx(1.0));
+        REQUIRE(s.tick_index == n + 1);
+        REQUIRE(s.command_index == -1);
+    }
+
+    SECTION("stepping_simple_timer publishes the position during exec")
+    {
+        auto lsfake = std::make_shared<driver::inmem>();
+        lsfake->set_steps({10, 0, 0, 0});
+        stepping_simple_timer worker(100, lsfake, std::make_shared<driver::low_timers_fake>());
+        // every 10 ticks
+        worker.set_telemetry(std::make_shared<telemetry_writer>(shm_name, 1000));
+        telemetry_reader reader(shm_name);
+
+        multistep_command forward{};
+        forward.b[0].step = 1;
+        forward.b[0].dir = 1;
+        forward.count = 25;
+        multistep_command wait{};
+        wait.count = 5;
+        std::vector<telemetry_snapshot_t> snapshots;
+        lsfake->set_step_callback([&](const auto&) { snapshots.push_back(reader.read()); });
+        worker.exec({forward, wait});
+
+        // the snapshot is taken before the publication of the current tick
+        REQUIRE(snapshots.at(10).tick_index == 10);
+        REQUIRE(snapshots.at(10).steps == steps_t{20, 0, 0, 0});
+        REQUIRE(snapshots.at(10).command_index == 0);
+        REQUIRE(snapshots.at(10).velocity[0] == Approx(10000.0));
+        // the wait command does not touch the steppers
+        REQUIRE(snapshots.size() == 25);
+        REQUIRE(snapshots.at(24).tick_index == 20);
+        auto last = reader.read();
+        REQUIRE(last.tick_index == 30);
+        REQUIRE(last.steps == steps_t{35, 0, 0, 0});
+        REQUIRE(last.command_index == -1);
+        REQUIRE(last.velocity[0] == Approx(0.0));
+    }
+}
@@ -0,0 +1,116 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <metrics.hpp>
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace raspigcd;
+
+TEST_CASE("Metrics registry", "[metrics]")
+{
+    auto metrics = std::make_shared<metrics_registry>();
+
+    SECTION("empty registry produces zeros")
+    {
+        auto j = metrics->to_json();
+        REQUIRE(j["stages"].size() == 0);
+        REQUIRE(j["queue"]["max_depth"] == 0);
+        REQUIRE(j["executor"]["underruns"] == 0);
+        REQUIRE(j["executor"]["commands_per_second"] == 0.0);
+        REQUIRE(j["peak_memory_kb"].get<long>() > 0);
+    }
+
+    SECTION("stage durations are accumulated")
+    {
+        metrics->add_stage_time("parse", 2.0);
+        metrics->add_stage_time("parse", 4.0);
+        {
+            metrics_registry::stage_timer t(metrics, "enrich");
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        auto j = metrics->to_json();
+        REQUIRE(j["stages"]["parse"]["count"] == 2);
+        REQUIRE(j["stages"]["parse"]["total_ms"].get<double>() == Approx(6.0));
+        REQUIRE(j["stages"]["parse"]["max_ms"].get<double>() == Approx(4.0));
+        REQUIRE(j["stages"]["parse"]["last_ms"].get<double>() == Approx(4.0));
+        REQUIRE(j["stages"]["enrich"]["count"] == 1);
+        REQUIRE(j["stages"]["enrich"]["total_ms"].get<double>() >= 2.0);
+    }
+
+    SECTION("stage timer accepts empty registry")
+    {
+        metrics_registry::stage_timer t(nullptr, "parse");
+    }
+
+    SECTION("queue, underruns and rates")
+    {
+        metrics->queue_depth(1);
+        metrics->queue_depth(3);
+        metrics->executor_wait(10.0, false);
+        metrics->executor_wait(5.0, true);
+        metrics->executor_wait(7.0, true);
+        metrics->generated_commands(1000, 0.5);
+        metrics->executed_commands(1000, 2.0);
+        auto j = metrics->to_json();
+        REQUIRE(j["queue"]["samples"] == 2);
+        REQUIRE(j["queue"]["mean_depth"].get<double>() == Approx(2.0));
+        REQUIRE(j["queue"]["max_depth"] == 3);
+        REQUIRE(j["executor"]["startup_wait_ms"].get<double>() == Approx(10.0));
+        REQUIRE(j["executor"]["underruns"] == 2);
+        REQUIRE(j["executor"]["underrun_ms"].get<double>() == Approx(12.0));
+        REQUIRE(j["generation"]["commands_per_second"].get<double>() == Approx(2000.0));
+        REQUIRE(j["executor"]["commands_per_second"].get<double>() == Approx(500.0));
+
+        metrics->reset();
+        REQUIRE(metrics->to_json()["executor"]["underruns"] == 0);
+    }
+
+    SECTION("every finished job is appended to the dump file")
+    {
+        std::string fname = "/tmp/raspigcd_metrics_test_" + std::to_string(getpid()) + ".json";
+        std::remove(fname.c_str());
+        metrics->job_finished("nothing is saved");
+        metrics->set_dump_file(fname);
+        metrics->add_stage_time("parse", 1.0);
+        metrics->job_finished("first");
+        metrics->job_finished("second");
+        std::ifstream f(fname);
+        std::string line;
+        std::vector<nlohmann::json> jobs;
+        while (std::getline(f, line))
+            jobs.push_back(nlohmann::json::parse(line));
+        std::remove(fname.c_str());
+        REQUIRE(jobs.size() == 2);
+        REQUIRE(jobs[0]["job"] == "first");
+        REQUIRE(jobs[1]["job"] == "second");
+        REQUIRE(jobs[1]["stages"]["parse"]["count"] == 1);
+    }
+}
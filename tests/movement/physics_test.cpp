@@ -493,4 +493,78 @@ TEST_CASE("Get final velocity for limits", "[movement][physics][calculate_transi
        REQUIRE_THROWS(calculate_transition_point(a,b,acceleration));
    }
 
-}
\ No newline at end of file
+}
+TEST_CASE("Jerk limited velocity profile", "[movement][physics][s_curve]")
+{
+    SECTION("without jerk limit the average acceleration is the maximal acceleration")
+    {
+        REQUIRE(jerk_limited_acceleration(100.0, 200.0, 0.0) == Approx(200.0));
+        REQUIRE(jerk_limited_acceleration(0.0, 200.0, 5000.0) == Approx(200.0));
+    }
+    SECTION("with jerk limit the average acceleration is lower")
+    {
+        // dv = 100, a = 200, j = 4000: 0.5s of constant acceleration plus 0.05s of jerk
+        REQUIRE(jerk_limited_acceleration(100.0, 200.0, 4000.0) == Approx(100.0 / 0.55));
+        REQUIRE(jerk_limited_acceleration(-100.0, 200.0, 4000.0) == Approx(100.0 / 0.55));
+        // small change of velocity does not reach the maximal acceleration
+        REQUIRE(jerk_limited_acceleration(1.0, 200.0, 4000.0) == Approx(1.0 / (2.0 * std::sqrt(1.0 / 4000.0))));
+    }
+    SECTION("s curve without jerk is the constant acceleration")
+    {
+        auto curve = s_curve_between(10.0, 30.0, 2.0, 0.0);
+        for (double t = 0; t <= 2.0; t += 0.125) {
+            REQUIRE(curve.distance(t) == Approx(10.0 * t + 5.0 * t * t));
+            REQUIRE(curve.velocity(t) == Approx(10.0 + 10.0 * t));
+        }
+    }
+    SECTION("s curve keeps the distance, velocities, jerk and continuity")
+    {
+        for (auto [v0, v1] : std::vector<std::pair<double, double>>{{2.0, 100.0}, {100.0, 2.0}, {0.0, 50.0}, {50.0, 0.0}}) {
+            double T = 0.6;
+            double j = 2000.0;
+            auto curve = s_curve_between(v0, v1, T, j);
+            REQUIRE(curve.distance(0) == Approx(0.0));
+            REQUIRE(curve.distance(T) == Approx((v0 + v1) * T / 2.0));
+            REQUIRE(curve.velocity(0) == Approx(v0));
+            REQUIRE(curve.velocity(T) == Approx(v1));
+            REQUIRE(std::abs(curve.j) == Approx(j));
+            REQUIRE(std::abs(curve.a) <= Approx(std::abs(v1 - v0) / T * 2.0));
+            const double dt = 0.0001;
+            double prev_v = curve.velocity(0);
+            double prev_a = 0;
+            for (double t = dt; t <= T; t += dt) {
+                double a = (curve.velocity(t) - prev_v) / dt;
+                // velocity is monotonic and acceleration changes no faster than jerk
+                REQUIRE((curve.velocity(t) - prev_v) * (v1 - v0) >= 0);
+                REQUIRE(std::abs(a - prev_a) <= j * dt * 1.01 + 0.000001);
+                REQUIRE((curve.distance(t) - curve.distance(t - dt)) / dt == Approx(curve.velocity(t - dt / 2)).epsilon(0.001).margin(0.001));
+                prev_v = curve.velocity(t);
+                prev_a = a;
+            }
+        }
+    }
+    SECTION("too short time increases the jerk and keeps the velocities")
+    {
+        auto curve = s_curve_between(0.0, 100.0, 0.1, 1000.0);
+        REQUIRE(curve.tj == Approx(0.05));
+        REQUIRE(curve.j > 1000.0);
+        REQUIRE(curve.velocity(0.1) == Approx(100.0));
+        REQUIRE(curve.distance(0.1) == Approx(5.0));
+    }
+    SECTION("jerk limited transition point is reached later than without jerk")
+    {
+        const path_node_t a = {.p = {0, 0, 0}, .v = 2.0};
+        const path_node_t b = {.p = {100, 0, 0}, .v = 100.0};
+        auto no_jerk = calculate_transition_point(a, b, 200.0);
+        auto with_jerk = calculate_transition_point(a, b, 200.0, 2000.0);
+        REQUIRE(no_jerk.v == Approx(100.0));
+        REQUIRE(with_jerk.v == Approx(100.0));
+        REQUIRE(with_jerk.p[0] > no_jerk.p[0]);
+        REQUIRE(with_jerk.p[0] == Approx((100.0 * 100.0 - 4.0) / (2.0 * jerk_limited_acceleration(98.0, 200.0, 2000.0))));
+        const path_node_t c = {.p = {1, 0, 0}, .v = 100.0};
+        auto short_move = calculate_transition_point(a, c, 200.0, 2000.0);
+        REQUIRE(short_move.p[0] == Approx(1.0));
+        REQUIRE(short_move.v < calculate_transition_point(a, c, 200.0).v);
+        REQUIRE((short_move.v * short_move.v - 4.0) / (2.0 * jerk_limited_acceleration(short_move.v - 2.0, 200.0, 2000.0)) == Approx(1.0));
+    }
+}
@@ -22,6 +22,9 @@
 #include <configuration_json.hpp>
 #include <hardware/stepping.hpp>
 #include <movement/simple_steps.hpp>
+#include <movement/steps_analyzer.hpp>
+#include <converters/gcd_program_to_steps.hpp>
+#include <gcd/gcode_interpreter.hpp>
 
 #define CATCH_CONFIG_DISABLE_MATCHERS
 #define CATCH_CONFIG_FAST_COMPILE
@@ -82,3 +85,77 @@ TEST_CASE("Movement constant speed in steps generator", "[movement][steps_genera
         REQUIRE(result[1].count == 2);
     }
 }
+
+TEST_CASE("Movement periodic patterns of steps", "[movement][steps_generator][compress_periodic_patterns]")
+{
+    hardware::single_step_command zero_move{.step = 0, .dir = 0};
+    hardware::single_step_command x_move{.step = 1, .dir = 1};
+    hardware::multistep_command step = {.b = {x_move, zero_move, zero_move, zero_move}, .flags = {.all = 0}, .count = 1};
+    hardware::multistep_command wait2 = {.b = {zero_move, zero_move, zero_move, zero_move}, .flags = {.all = 0}, .count = 2};
+    hardware::multistep_command wait3 = {.b = {zero_move, zero_move, zero_move, zero_move}, .flags = {.all = 0}, .count = 3};
+    auto same_commands = [](const hardware::multistep_commands_t& a, const hardware::multistep_commands_t& b) {
+        if (a.size() != b.size()) return false;
+        for (std::size_t i = 0; i < a.size(); i++)
+            if ((a[i].count != b[i].count) || !hardware::multistep_command_same_command(a[i], b[i])) return false;
+        return true;
+    };
+
+    SECTION("empty and not periodic commands are not changed")
+    {
+        REQUIRE(compress_periodic_patterns({}).size() == 0);
+        hardware::multistep_commands_t commands = {step, wait2, step, wait3};
+        REQUIRE(same_commands(compress_periodic_patterns(commands), commands));
+    }
+    SECTION("the periodic commands are stored once with the pattern header")
+    {
+        hardware::multistep_commands_t commands;
+        for (int i = 0; i < 100; i++) {
+            commands.push_back(step);
+            commands.push_back(wait2);
+            commands.push_back(step);
+            commands.push_back(wait3);
+        }
+        commands.push_back(step);
+        auto result = compress_periodic_patterns(commands);
+        REQUIRE(result.size() == 6);
+        REQUIRE(hardware::multistep_command_pattern_length(result[0]) == 4);
+        REQUIRE(result[0].count == 100);
+        REQUIRE(same_commands(expand_periodic_patterns(result), commands));
+        REQUIRE(hardware::hardware_commands_to_last_position_after_given_steps(result) == steps_t{201, 0, 0, 0});
+        REQUIRE(hardware::hardware_commands_duration(result, 0.001) == Approx(hardware::hardware_commands_duration(commands, 0.001)));
+        // the compressed commands are not compressed again
+        REQUIRE(same_commands(compress_periodic_patterns(result), result));
+    }
+    SECTION("the pattern is not longer than the limit")
+    {
+        hardware::multistep_commands_t commands;
+        for (int i = 0; i < 10; i++) {
+            commands.push_back(step);
+            commands.push_back(wait2);
+            commands.push_back(step);
+            commands.push_back(wait3);
+        }
+        REQUIRE(same_commands(compress_periodic_patterns(commands, 3), commands));
+    }
+    SECTION("constant velocity move along the axis is compressed at least 10 times and gives the same steps")
+    {
+        configuration::global cfg;
+        cfg.load_defaults();
+        auto motor_layout = hardware::motor_layout::get_instance(cfg);
+        auto program_to_steps = converters::program_to_steps_factory(cfg);
+        auto commands = program_to_steps(gcd::gcode_to_maps_of_arguments("G1X20F7\nG1X20Y-5F7\n"), cfg, *(motor_layout.get()),
+            {{'X', 0.0}, {'Y', 0.0}, {'Z', 0.0}, {'A', 0.0}, {'F', 7.0}}, [](const gcd::block_t) {});
+        auto result = compress_periodic_patterns(commands);
+        INFO(commands.size() << " -> " << result.size());
+        REQUIRE(result.size() * 10 < commands.size());
+        REQUIRE(same_commands(expand_periodic_patterns(result), commands));
+
+        steps_analyzer analyzer(motor_layout);
+        int last_tick = analyzer.get_last_tick_index(commands);
+        REQUIRE(analyzer.get_last_tick_index(result) == last_tick);
+        for (int tick = 0; tick <= last_tick; tick += 97)
+            REQUIRE(analyzer.steps_from_tick(result, tick) == analyzer.steps_from_tick(commands, tick));
+        REQUIRE(analyzer.steps_from_tick(result, last_tick) == analyzer.steps_from_tick(commands, last_tick));
+        REQUIRE_THROWS_AS(analyzer.steps_from_tick(result, last_tick + 1), std::out_of_range);
+    }
+}
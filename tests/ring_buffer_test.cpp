@@ -0,0 +1,87 @@
+/*
+    Raspberry Pi G-CODE interpreter
+
+    Copyright (C) 2019  Tadeusz Puźniakowski puzniakowski.pl
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <ring_buffer.hpp>
+
+#define CATCH_CONFIG_DISABLE_MATCHERS
+#define CATCH_CONFIG_FAST_COMPILE
+#include <catch2/catch.hpp>
+
+#include <thread>
+#include <vector>
+
+using namespace raspigcd;
+
+TEST_CASE("Single producer single consumer ring buffer", "[ring_buffer]")
+{
+    SECTION("capacity is rounded up to power of 2")
+    {
+        spsc_ring_c<int> r(100);
+        REQUIRE(r.capacity() == 128);
+        REQUIRE_THROWS_AS(spsc_ring_c<int>(0), std::invalid_argument);
+    }
+
+    SECTION("elements are read in order and full buffer rejects new ones")
+    {
+        spsc_ring_c<int> r(4);
+        for (int i = 0; i < 4; i++)
+            REQUIRE(r.try_push(i));
+        REQUIRE_FALSE(r.try_push(10));
+        REQUIRE(r.dropped() == 1);
+        REQUIRE(r.size() == 4);
+        int v = -1;
+        REQUIRE(r.try_pop(v));
+        REQUIRE(v == 0);
+        REQUIRE(r.try_push(4));
+        std::vector<int> got;
+        REQUIRE(r.consume_all([&](const int& e) { got.push_back(e); }) == 4);
+        REQUIRE(got == std::vector<int>({1, 2, 3, 4}));
+        REQUIRE_FALSE(r.try_pop(v));
+        REQUIRE(r.size() == 0);
+    }
+
+    SECTION("concurrent producer and consumer see every element exactly once")
+    {
+        spsc_ring_c<long> r(64);
+        const long n = 20000;
+        // both sides yield when they wait, so the test is fast also on the single core
+        std::thread producer([&]() {
+            for (long i = 0; i < n;) {
+                if (r.try_push(i))
+                    i++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+        long expected = 0;
+        bool in_order = true;
+        while (expected < n) {
+            if (r.consume_all([&](const long& e) {
+                    if (e != expected) in_order = false;
+                    expected++;
+                }) == 0)
+                std::this_thread::yield();
+        }
+        producer.join();
+        REQUIRE(in_order);
+        REQUIRE(expected == n);
+    }
+}